@@ -20,6 +20,8 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 
 #include "bqreg.hpp"
 #include "bqreg_py_module_class.hpp"
@@ -33,10 +35,21 @@ PYBIND11_MODULE(bqreg_wrapper, m)
 
         .def( "get_omp_n_threads", &bqreg_module_Py::get_omp_n_threads )
         .def( "set_omp_n_threads", &bqreg_module_Py::set_omp_n_threads )
+        .def( "set_autotune", &bqreg_module_Py::set_autotune )
+        .def( "get_sampler_tuning", &bqreg_module_Py::get_sampler_tuning )
+        .def( "set_sampler_scheme", &bqreg_module_Py::set_sampler_scheme )
+        .def( "get_sampler_scheme", &bqreg_module_Py::get_sampler_scheme )
+        .def( "set_outer_cache_budget", &bqreg_module_Py::set_outer_cache_budget )
+        .def( "get_outer_cache_budget", &bqreg_module_Py::get_outer_cache_budget )
 
         .def( "set_seed_value", &bqreg_module_Py::set_seed_value )
 
-        .def( "load_data", &bqreg_module_Py::load_data )
+        // float32 arrays select the single-precision storage overload; float64 and float32 arrays,
+        // in either C or Fortran order, are used without a copy
+
+        .def( "load_data", static_cast<void (bqreg_module_Py::*)(const numpy_data_t<fp_t>&, const numpy_data_t<fp_t>&)>(&bqreg_module_Py::load_data) )
+        .def( "load_data", static_cast<void (bqreg_module_Py::*)(const numpy_data_t<float>&, const numpy_data_t<float>&)>(&bqreg_module_Py::load_data) )
+        .def( "load_data_sparse", &bqreg_module_Py::load_data_sparse )
         .def( "set_quantile_target", &bqreg_module_Py::set_quantile_target )
         .def( "set_prior_params", &bqreg_module_Py::set_prior_params )
 
@@ -44,5 +57,34 @@ PYBIND11_MODULE(bqreg_wrapper, m)
         .def( "set_initial_beta_draw", &bqreg_module_Py::set_initial_beta_draw )
 
         .def( "gibbs", &bqreg_module_Py::gibbs )
+        .def( "gibbs_adaptive", &bqreg_module_Py::gibbs_adaptive )
+        .def( "gibbs_to_file", &bqreg_module_Py::gibbs_to_file )
+        .def( "gibbs_multi_tau", &bqreg_module_Py::gibbs_multi_tau )
+        .def( "gibbs_multi_chain", &bqreg_module_Py::gibbs_multi_chain )
+        .def( "gibbs_consensus", &bqreg_module_Py::gibbs_consensus )
+
+        .def( "get_sampler_stats", &bqreg_module_Py::get_sampler_stats )
+
+        .def( "set_checkpoint", &bqreg_module_Py::set_checkpoint )
+        .def( "save_sampler_state", &bqreg_module_Py::save_sampler_state )
+        .def( "gibbs_resume", &bqreg_module_Py::gibbs_resume )
+
+        .def( "append_rows", &bqreg_module_Py::append_rows )
+        .def( "append_rows_sparse", &bqreg_module_Py::append_rows_sparse )
+        .def( "retire_rows", &bqreg_module_Py::retire_rows )
+        .def( "get_window_slots", &bqreg_module_Py::get_window_slots )
+        .def( "gibbs_warm", &bqreg_module_Py::gibbs_warm )
+
+        .def( "predict", &bqreg_module_Py::predict )
+        .def( "predict_sparse", &bqreg_module_Py::predict_sparse )
+        .def( "predict_from_file", &bqreg_module_Py::predict_from_file )
     ;
+
+    // a batch of independent fits, one per object, scheduled across the C++ threads
+
+    m.def( "gibbs_many", &bqreg_module_Py::gibbs_many );
+
+    // a batch of small problems given as arrays, with the draws in one shared buffer
+
+    m.def( "gibbs_batch", &bqreg_module_Py::gibbs_batch );
 }
@@ -23,7 +23,31 @@
 
 using namespace bqreg;
 
-using gibbs_output_t = std::tuple<Mat_t, Mat_t, ColVec_t>;
+// draws are returned as numpy arrays that take over the buffers of the C++ matrices
+
+using numpy_arr_t = pybind11::array_t<fp_t>;
+
+// data arrays are converted only if the dtype differs; any strides are used in place
+
+template<typename T>
+using numpy_data_t = pybind11::array_t<T, pybind11::array::forcecast>;
+
+using gibbs_output_t = std::tuple<numpy_arr_t, numpy_arr_t, numpy_arr_t>;
+using gibbs_adaptive_output_t = std::tuple<numpy_arr_t, numpy_arr_t, numpy_arr_t, pybind11::dict>;
+using gibbs_multi_tau_output_t = std::tuple<numpy_arr_t, numpy_arr_t, numpy_arr_t>;
+using gibbs_consensus_output_t = std::tuple<numpy_arr_t, numpy_arr_t>;
+using gibbs_multi_chain_output_t = std::tuple<numpy_arr_t, numpy_arr_t, numpy_arr_t, pybind11::dict>;
+using window_slots_t = Eigen::Matrix<Eigen::Index, Eigen::Dynamic, 1>;
+using predict_output_t = std::tuple<numpy_arr_t, numpy_arr_t>;
+
+// (target, features, tau, prior mean of beta, prior variance of beta, prior shape of sigma, prior scale of sigma)
+using gibbs_batch_problem_t = std::tuple<numpy_data_t<fp_t>, numpy_data_t<fp_t>, fp_t, ColVec_t, Mat_t, fp_t, fp_t>;
+using gibbs_batch_output_t = std::vector<std::tuple<numpy_arr_t, numpy_arr_t>>;
+
+/*
+ * The methods that sample release the GIL, so that separate objects can be used from separate
+ * Python threads at the same time; an object holds no state that is shared with other objects.
+ */
 
 class bqreg_module_Py
 {
@@ -43,9 +67,20 @@ class bqreg_module_Py
         int get_omp_n_threads();
         void set_omp_n_threads(const int omp_n_threads_inp);
 
+        void set_autotune(const bool autotune_inp, const std::string& cache_path_inp);
+        pybind11::dict get_sampler_tuning() const;
+
+        void set_sampler_scheme(const std::string& scheme_inp);
+        std::string get_sampler_scheme() const;
+
+        void set_outer_cache_budget(const size_t outer_cache_max_bytes_inp);
+        size_t get_outer_cache_budget() const;
+
         void set_seed_value(const size_t seed_val_inp);
 
-        void load_data(const ColVec_t& Y_inp, const Mat_t& X_inp);
+        void load_data(const numpy_data_t<fp_t>& Y_inp, const numpy_data_t<fp_t>& X_inp);
+        void load_data(const numpy_data_t<float>& Y_inp, const numpy_data_t<float>& X_inp);
+        void load_data_sparse(const ColVec_t& Y_inp, const SpMat_t& X_inp);
         void set_quantile_target(const fp_t tau_inp);
         void set_prior_params(const ColVec_t& prior_beta_mean_inp, const Mat_t& prior_beta_var_inp, const fp_t prior_sigma_shape_inp, const fp_t prior_sigma_scale_inp);
 
@@ -53,13 +88,73 @@ class bqreg_module_Py
         void set_initial_beta_draw(const ColVec_t& beta_initial_draw_inp);
 
         gibbs_output_t gibbs(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor);
+        void gibbs_to_file(const std::string& file_path, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, const bool z_as_float);
+        gibbs_adaptive_output_t gibbs_adaptive(const fp_t target_ess, const fp_t target_mcse, const fp_t rhat_max, const size_t check_interval, const size_t max_burnin_draws, const size_t max_draws, const size_t thinning_factor, const bool keep_z);
+        gibbs_multi_tau_output_t gibbs_multi_tau(const ColVec_t& tau_vec, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor);
+        gibbs_multi_chain_output_t gibbs_multi_chain(const size_t n_chains, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor);
+        gibbs_consensus_output_t gibbs_consensus(const size_t n_shards, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, const bool use_kernel_combiner);
+
+        pybind11::dict get_sampler_stats() const;
+
+        void set_checkpoint(const std::string& file_path, const size_t checkpoint_interval);
+        void save_sampler_state(const std::string& file_path) const;
+        gibbs_output_t gibbs_resume(const std::string& file_path, const size_t n_extra_keep_draws);
+
+        void append_rows(const ColVec_t& Y_new, const Mat_t& X_new);
+        void append_rows_sparse(const ColVec_t& Y_new, const SpMat_t& X_new);
+        void retire_rows(const size_t n_rows);
+        window_slots_t get_window_slots() const;
+        gibbs_output_t gibbs_warm(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor);
+
+        static std::vector<gibbs_output_t> gibbs_many(const std::vector<bqreg_module_Py*>& bqreg_objs, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, int omp_n_threads);
+        static gibbs_batch_output_t gibbs_batch(const std::vector<gibbs_batch_problem_t>& problems, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, const int omp_n_threads, const size_t seed_value);
+
+        predict_output_t predict(const numpy_data_t<fp_t>& X_new, const Eigen::Ref<const Mat_t>& beta_draws, const ColVec_t& probs) const;
+        predict_output_t predict_sparse(const SpMat_t& X_new, const Eigen::Ref<const Mat_t>& beta_draws, const ColVec_t& probs) const;
+        predict_output_t predict_from_file(const numpy_data_t<fp_t>& X_new, const std::string& file_path, const ColVec_t& probs) const;
     
     private:
         bool keep_sigma_fixed = false;
         int omp_n_threads = -1;
-        rand_engine_t rand_engine = rand_engine_t(std::random_device{}());
+        bool autotune = false;
+        std::string tuning_cache_path;
+        sampler_tuning_t sampler_tuning;
+        sampler_scheme_t sampler_scheme = SAMPLER_SCHEME_STANDARD;
+        size_t outer_cache_max_bytes = BQREG_OUTER_CACHE_MAX_BYTES;
+        size_t seed_val = std::random_device{}();
+        rand_engine_t rand_engine = rand_engine_t(seed_val);
 
         ColVec_t beta_initial_draw;
+
+        // dense data are viewed in the numpy arrays passed to load_data (which are kept alive here);
+        // Y and X (or Y_f and X_f) hold a copy only once the window of rows moves
+
+        bool use_external_storage = false;
+        pybind11::array Y_arr;
+        pybind11::array X_arr;
+
+        bool use_float_storage = false;
+        ColVecF_t Y_f;
+        MatF_t X_f;
+
+        bool use_sparse_storage = false;
+        SpMat_t X_sp;
+
+        sampler_stats_t sampler_stats;
+        sampler_checkpoint_t checkpoint;
+        row_window_t window;
+
+        size_t get_n_rows() const;
+        size_t get_n_features() const;
+
+        ColVecView_t get_Y_view() const;
+        MatView_t get_X_view() const;
+        ColVecFView_t get_Y_f_view() const;
+        MatFView_t get_X_f_view() const;
+        void copy_external_data();
+
+        void compact_window();
+        void run_gibbs(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, draw_sink_t& draw_sink, const int n_threads, const bool resume = false, const bool warm_start = false, const bool allow_autotune = true);
 };
 
 #include "bqreg_py_module_fns.hpp"
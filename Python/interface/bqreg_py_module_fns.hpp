@@ -35,21 +35,235 @@ bqreg_module_Py::set_omp_n_threads(const int omp_n_threads_inp)
     this->omp_n_threads = omp_n_threads_inp;
 }
 
+void
+inline
+bqreg_module_Py::set_autotune(const bool autotune_inp, const std::string& cache_path_inp)
+{
+    this->autotune = autotune_inp;
+    this->tuning_cache_path = cache_path_inp;
+}
+
+// thread counts used by the last autotuned fit
+
+pybind11::dict
+inline
+bqreg_module_Py::get_sampler_tuning()
+const
+{
+    pybind11::dict tuning_dict;
+
+    tuning_dict["setup_n_threads"] = sampler_tuning.setup_n_threads;
+    tuning_dict["data_pass_n_threads"] = sampler_tuning.data_pass_n_threads;
+    tuning_dict["data_pass_seconds"] = sampler_tuning.data_pass_seconds;
+    tuning_dict["calibration_seconds"] = sampler_tuning.calibration_seconds;
+    tuning_dict["from_cache"] = sampler_tuning.from_cache;
+
+    return tuning_dict;
+}
+
+// 'standard', 'collapsed', or 'interweaved'; see bqreg_schemes.hpp
+
+void
+inline
+bqreg_module_Py::set_sampler_scheme(const std::string& scheme_inp)
+{
+    this->sampler_scheme = sampler_scheme_from_string(scheme_inp);
+}
+
+std::string
+inline
+bqreg_module_Py::get_sampler_scheme()
+const
+{
+    return sampler_scheme_to_string(sampler_scheme);
+}
+
+// bytes; 0 turns the packed outer-product cache off (see outer_prod_cache_t)
+
+void
+inline
+bqreg_module_Py::set_outer_cache_budget(const size_t outer_cache_max_bytes_inp)
+{
+    this->outer_cache_max_bytes = outer_cache_max_bytes_inp;
+}
+
+size_t
+inline
+bqreg_module_Py::get_outer_cache_budget()
+const
+{
+    return outer_cache_max_bytes;
+}
+
 void
 inline
 bqreg_module_Py::set_seed_value(const size_t seed_val_inp)
 {
+    this->seed_val = seed_val_inp;
     this->rand_engine = rand_engine_t(seed_val_inp);
 }
 
+/*
+ * numpy interop: data arrays are viewed in place, with their strides, and matrices of draws
+ * are handed to numpy together with their buffers
+ */
+
+// an array that can be viewed by Eigen: positive strides that are a multiple of the element size
+// (the stride of a dimension of length one is never used); otherwise a Fortran-ordered copy
+
+template<typename T>
+inline
+pybind11::array
+viewable_array_Py(const numpy_data_t<T>& arr)
+{
+    for (pybind11::ssize_t j = 0; j < arr.ndim(); ++j) {
+        if (arr.shape(j) > 1 && (arr.strides(j) <= 0 || arr.strides(j) % pybind11::ssize_t(sizeof(T)) != 0)) {
+            return pybind11::array_t<T, pybind11::array::f_style | pybind11::array::forcecast>::ensure(arr);
+        }
+    }
+
+    return arr;
+}
+
+// a vector may be passed as an n-vector, an n x 1 matrix, or a 1 x n matrix
+
+template<typename T>
+inline
+Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>, 0, Eigen::InnerStride<>>
+vector_view_Py(const pybind11::array& arr)
+{
+    const pybind11::ssize_t stride_ind = (arr.ndim() == 2 && arr.shape(0) == 1) ? 1 : 0;
+    const pybind11::ssize_t stride_val = (arr.ndim() > 0) ? arr.strides(stride_ind) / pybind11::ssize_t(sizeof(T)) : 1;
+
+    return Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>, 0, Eigen::InnerStride<>>(static_cast<const T*>(arr.data()), arr.size(), Eigen::InnerStride<>(stride_val));
+}
+
+template<typename T>
+inline
+Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>, 0, DataStride_t>
+matrix_view_Py(const pybind11::array& arr)
+{
+    return Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>, 0, DataStride_t>(static_cast<const T*>(arr.data()), arr.shape(0), arr.shape(1), 
+                DataStride_t(arr.strides(1) / pybind11::ssize_t(sizeof(T)), arr.strides(0) / pybind11::ssize_t(sizeof(T))));
+}
+
+inline
 void
+check_data_arrays_Py(const pybind11::array& Y_arr, const pybind11::array& X_arr)
+{
+    if (X_arr.ndim() != 2) {
+        throw std::invalid_argument("bqreg: the features must be a two-dimensional array");
+    }
+
+    if (Y_arr.ndim() == 0 || Y_arr.ndim() > 2 || (Y_arr.ndim() == 2 && Y_arr.shape(0) != 1 && Y_arr.shape(1) != 1)) {
+        throw std::invalid_argument("bqreg: the target must be a vector");
+    }
+
+    if (Y_arr.size() != X_arr.shape(0)) {
+        throw std::invalid_argument("bqreg: the number of rows of the target and the features do not match");
+    }
+}
+
+// the capsule frees the matrix when numpy is done with the array
+
+inline
+numpy_arr_t
+to_numpy_Py(Mat_t&& mat)
+{
+    Mat_t* mat_ptr = new Mat_t(std::move(mat));
+    pybind11::capsule mat_owner(mat_ptr, [](void* ptr) { delete static_cast<Mat_t*>(ptr); });
+
+    return numpy_arr_t({ mat_ptr->rows(), mat_ptr->cols() }, 
+                       { pybind11::ssize_t(sizeof(fp_t)), pybind11::ssize_t(sizeof(fp_t) * mat_ptr->rows()) }, 
+                       mat_ptr->data(), mat_owner);
+}
+
 inline
-bqreg_module_Py::load_data(const ColVec_t& Y_inp, const Mat_t& X_inp)
+numpy_arr_t
+to_numpy_Py(ColVec_t&& vec)
+{
+    ColVec_t* vec_ptr = new ColVec_t(std::move(vec));
+    pybind11::capsule vec_owner(vec_ptr, [](void* ptr) { delete static_cast<ColVec_t*>(ptr); });
+
+    return numpy_arr_t({ vec_ptr->size() }, { pybind11::ssize_t(sizeof(fp_t)) }, vec_ptr->data(), vec_owner);
+}
+
+// the arrays are viewed, not copied; they must not be modified while the object uses them
+
+void
+inline
+bqreg_module_Py::load_data(const numpy_data_t<fp_t>& Y_inp, const numpy_data_t<fp_t>& X_inp)
+{
+    check_data_arrays_Py(Y_inp, X_inp);
+
+    this->Y_arr = viewable_array_Py<fp_t>(Y_inp);
+    this->X_arr = viewable_array_Py<fp_t>(X_inp);
+
+    this->use_external_storage = true;
+    this->Y.resize(0);
+    this->X.resize(0,0);
+
+    this->use_float_storage = false;
+    this->Y_f.resize(0);
+    this->X_f.resize(0,0);
+
+    this->use_sparse_storage = false;
+    this->X_sp.resize(0,0);
+
+    this->beta_initial_draw.setZero(get_n_features());
+
+    this->window.reset();
+}
+
+void
+inline
+bqreg_module_Py::load_data(const numpy_data_t<float>& Y_inp, const numpy_data_t<float>& X_inp)
+{
+    check_data_arrays_Py(Y_inp, X_inp);
+
+    this->Y_arr = viewable_array_Py<float>(Y_inp);
+    this->X_arr = viewable_array_Py<float>(X_inp);
+
+    this->use_external_storage = true;
+    this->Y_f.resize(0);
+    this->X_f.resize(0,0);
+
+    this->use_float_storage = true;
+    this->Y.resize(0);
+    this->X.resize(0,0);
+
+    this->use_sparse_storage = false;
+    this->X_sp.resize(0,0);
+
+    this->beta_initial_draw.setZero(get_n_features());
+
+    this->window.reset();
+}
+
+// scipy.sparse features (converted to CSR by the caster)
+
+void
+inline
+bqreg_module_Py::load_data_sparse(const ColVec_t& Y_inp, const SpMat_t& X_inp)
 {
     this->Y = Y_inp;
-    this->X = X_inp;
+    this->X_sp = X_inp;
+    this->X_sp.makeCompressed();
+
+    this->use_sparse_storage = true;
+    this->X.resize(0,0);
+
+    this->use_external_storage = false;
+    this->Y_arr = pybind11::array();
+    this->X_arr = pybind11::array();
+
+    this->use_float_storage = false;
+    this->Y_f.resize(0);
+    this->X_f.resize(0,0);
 
-    this->beta_initial_draw.setZero(X.cols());
+    this->beta_initial_draw.setZero(X_sp.cols());
+
+    this->window.reset();
 }
 
 void
@@ -102,29 +316,1030 @@ bqreg_module_Py::gibbs(
     Mat_t z_draws;
     ColVec_t sigma_draws;
 
-    if (beta_initial_draw.size() != X.cols()) {
-        beta_initial_draw.setZero(X.cols());
-    }
-
-    qr_gibbs(Y,
-             X,
-             tau,
-             beta_initial_draw,
-             prior_beta_mean,
-             prior_beta_var,
-             prior_sigma_shape,
-             prior_sigma_scale,
-             n_burnin_draws,
-             n_keep_draws,
-             thinning_factor,
-             keep_sigma_fixed,
-             omp_n_threads,
-             beta_draws,
-             z_draws,
-             sigma_draws,
-             rand_engine);
-
-    return std::make_tuple(beta_draws, z_draws, sigma_draws);
+    memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        run_gibbs(n_burnin_draws, n_keep_draws, thinning_factor, draw_sink, omp_n_threads);
+    }
+
+    return std::make_tuple(to_numpy_Py(std::move(beta_draws)), to_numpy_Py(std::move(z_draws)), to_numpy_Py(std::move(sigma_draws)));
+}
+
+gibbs_adaptive_output_t
+inline
+bqreg_module_Py::gibbs_adaptive(
+    const fp_t target_ess,
+    const fp_t target_mcse,
+    const fp_t rhat_max,
+    const size_t check_interval,
+    const size_t max_burnin_draws,
+    const size_t max_draws,
+    const size_t thinning_factor,
+    const bool keep_z
+)
+{
+    Mat_t beta_draws;
+    Mat_t z_draws;
+    ColVec_t sigma_draws;
+
+    adaptive_settings_t settings;
+
+    settings.target_ess = target_ess;
+    settings.target_mcse = target_mcse;
+    settings.rhat_max = rhat_max;
+    settings.check_interval = check_interval;
+    settings.min_burnin_draws = std::min(settings.min_burnin_draws, max_burnin_draws);
+    settings.max_burnin_draws = max_burnin_draws;
+    settings.max_draws = max_draws;
+    settings.thinning_factor = thinning_factor;
+
+    adaptive_sink_t draw_sink(settings, beta_draws, z_draws, sigma_draws, keep_z);
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        run_gibbs(0, settings.max_draws, settings.thinning_factor, draw_sink, omp_n_threads);
+    }
+
+    const adaptive_result_t& result = draw_sink.get_result();
+
+    pybind11::dict result_dict;
+    result_dict["n_burnin_draws"] = result.n_burnin_draws;
+    result_dict["n_keep_draws"] = result.n_keep_draws;
+    result_dict["burnin_converged"] = result.burnin_converged;
+    result_dict["targets_met"] = result.targets_met;
+    result_dict["ess"] = result.ess;
+    result_dict["mcse"] = result.mcse;
+    result_dict["rhat"] = result.rhat;
+
+    return std::make_tuple(to_numpy_Py(std::move(beta_draws)), to_numpy_Py(std::move(z_draws)), to_numpy_Py(std::move(sigma_draws)), result_dict);
+}
+
+void
+inline
+bqreg_module_Py::gibbs_to_file(
+    const std::string& file_path,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool z_as_float
+)
+{
+    mmap_draw_sink_t draw_sink(file_path, make_draw_store_meta(tau, n_burnin_draws, thinning_factor, rand_engine), true, z_as_float);
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        run_gibbs(n_burnin_draws, n_keep_draws, thinning_factor, draw_sink, omp_n_threads);
+    }
+}
+
+void
+inline
+bqreg_module_Py::set_checkpoint(
+    const std::string& file_path,
+    const size_t checkpoint_interval
+)
+{
+    checkpoint.file_path = file_path;
+    checkpoint.interval = checkpoint_interval;
+}
+
+void
+inline
+bqreg_module_Py::save_sampler_state(
+    const std::string& file_path
+)
+const
+{
+    bqreg::save_sampler_state(file_path, checkpoint.state);
+}
+
+// resume from a checkpoint file, or, with an empty path, extend the last run
+
+gibbs_output_t
+inline
+bqreg_module_Py::gibbs_resume(
+    const std::string& file_path,
+    const size_t n_extra_keep_draws
+)
+{
+    Mat_t beta_draws;
+    Mat_t z_draws;
+    ColVec_t sigma_draws;
+
+    if (!file_path.empty()) {
+        checkpoint.state = load_sampler_state(file_path);
+    } else if (checkpoint.state.beta_draw.size() == 0) {
+        throw std::invalid_argument("bqreg: there is no previous run to extend");
+    }
+
+    tau = checkpoint.state.tau;
+    keep_sigma_fixed = checkpoint.state.keep_sigma_fixed;
+
+    memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        run_gibbs(checkpoint.state.n_burnin_draws, checkpoint.state.n_keep_draws + n_extra_keep_draws, checkpoint.state.thinning_factor, draw_sink, omp_n_threads, true);
+    }
+
+    return std::make_tuple(to_numpy_Py(std::move(beta_draws)), to_numpy_Py(std::move(z_draws)), to_numpy_Py(std::move(sigma_draws)));
+}
+
+void
+inline
+bqreg_module_Py::append_rows(
+    const ColVec_t& Y_new,
+    const Mat_t& X_new
+)
+{
+    copy_external_data();
+
+    if (use_sparse_storage) {
+        window.append(Y, X_sp, Y_new, SpMat_t(X_new.sparseView()), checkpoint.state);
+    } else if (use_float_storage) {
+        window.append(Y_f, X_f, ColVecF_t(Y_new.cast<float>()), MatF_t(X_new.cast<float>()), checkpoint.state);
+    } else {
+        window.append(Y, X, Y_new, X_new, checkpoint.state);
+    }
+}
+
+void
+inline
+bqreg_module_Py::append_rows_sparse(
+    const ColVec_t& Y_new,
+    const SpMat_t& X_new
+)
+{
+    if (use_sparse_storage) {
+        window.append(Y, X_sp, Y_new, X_new, checkpoint.state);
+    } else {
+        append_rows(Y_new, Mat_t(X_new));
+    }
+}
+
+void
+inline
+bqreg_module_Py::retire_rows(const size_t n_rows)
+{
+    copy_external_data();
+
+    if (use_sparse_storage) {
+        window.retire(n_rows, Y, X_sp, checkpoint.state);
+    } else if (use_float_storage) {
+        window.retire(n_rows, Y_f, X_f, checkpoint.state);
+    } else {
+        window.retire(n_rows, Y, X, checkpoint.state);
+    }
+}
+
+// the row of the data (and the column of the z draws) of each row of the window, oldest first
+
+window_slots_t
+inline
+bqreg_module_Py::get_window_slots()
+const
+{
+    const std::vector<size_t> slots = window.get_slots(get_n_rows());
+
+    window_slots_t slots_vec(slots.size());
+
+    for (size_t j = 0; j < slots.size(); ++j) {
+        slots_vec(j) = static_cast<Eigen::Index>(slots[j]);
+    }
+
+    return slots_vec;
+}
+
+// start from the state of the last fit, after the window moved
+
+gibbs_output_t
+inline
+bqreg_module_Py::gibbs_warm(
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor
+)
+{
+    Mat_t beta_draws;
+    Mat_t z_draws;
+    ColVec_t sigma_draws;
+
+    memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        run_gibbs(n_burnin_draws, n_keep_draws, thinning_factor, draw_sink, omp_n_threads, false, true);
+    }
+
+    return std::make_tuple(to_numpy_Py(std::move(beta_draws)), to_numpy_Py(std::move(z_draws)), to_numpy_Py(std::move(sigma_draws)));
+}
+
+/*
+ * Independent fits of several objects, each with its own data, settings, and seed. The fits are
+ * spread across the threads, one object per thread, when there are at least as many objects as
+ * threads or the problems are small; otherwise they run one after another on all of the threads.
+ * The draws of each fit are those of its gibbs method with the same seed.
+ */
+
+std::vector<gibbs_output_t>
+inline
+bqreg_module_Py::gibbs_many(
+    const std::vector<bqreg_module_Py*>& bqreg_objs,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    int omp_n_threads
+)
+{
+    const size_t n_objs = bqreg_objs.size();
+
+    std::vector<bqreg_module_Py*> sorted_objs = bqreg_objs;
+    std::sort(sorted_objs.begin(), sorted_objs.end());
+
+    if (std::adjacent_find(sorted_objs.begin(), sorted_objs.end()) != sorted_objs.end()) {
+        throw std::invalid_argument("bqreg: an object appears more than once in the batch");
+    }
+
+#ifdef BQREG_USE_OPENMP
+    if (omp_n_threads < 0) {
+        omp_n_threads = std::max(1, static_cast<int>(omp_get_max_threads()) / 2);
+    }
+
+    if (omp_n_threads == 0) {
+        omp_n_threads = 1;
+    }
+#else
+    omp_n_threads = 1;
+#endif
+
+    size_t n_max = 0;
+
+    for (const bqreg_module_Py* bqreg_obj : bqreg_objs) {
+        n_max = std::max(n_max, bqreg_obj->get_n_rows());
+    }
+
+    int n_outer_threads = 1;
+    int n_inner_threads = 1;
+
+    set_chain_threading(n_max, n_objs, omp_n_threads, n_outer_threads, n_inner_threads);
+
+    (void)(n_outer_threads); // for !BQREG_USE_OPENMP case
+
+    std::vector<Mat_t> beta_draws(n_objs);
+    std::vector<Mat_t> z_draws(n_objs);
+    std::vector<ColVec_t> sigma_draws(n_objs);
+
+    // exceptions cannot leave an OpenMP region, so they are passed out by hand
+
+    std::vector<std::exception_ptr> obj_exceptions(n_objs);
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+#ifdef BQREG_USE_OPENMP
+        #pragma omp parallel for num_threads(n_outer_threads) schedule(dynamic)
+#endif
+        for (size_t m = 0; m < n_objs; ++m) {
+            try {
+                memory_sink_t draw_sink(beta_draws[m], z_draws[m], sigma_draws[m]);
+
+                // the batch splits the threads itself, so the objects are not autotuned here
+
+                bqreg_objs[m]->run_gibbs(n_burnin_draws, n_keep_draws, thinning_factor, draw_sink, n_inner_threads, false, false, false);
+            } catch (...) {
+                obj_exceptions[m] = std::current_exception();
+            }
+        }
+    }
+
+    for (size_t m = 0; m < n_objs; ++m) {
+        if (obj_exceptions[m]) {
+            std::rethrow_exception(obj_exceptions[m]);
+        }
+    }
+
+    std::vector<gibbs_output_t> draws_out;
+    draws_out.reserve(n_objs);
+
+    for (size_t m = 0; m < n_objs; ++m) {
+        draws_out.push_back(std::make_tuple(to_numpy_Py(std::move(beta_draws[m])), to_numpy_Py(std::move(z_draws[m])), to_numpy_Py(std::move(sigma_draws[m]))));
+    }
+
+    return draws_out;
+}
+
+/*
+ * A batch of small problems given directly as arrays, without an object per problem (see
+ * qr_gibbs_batch). The draws of all problems share one buffer; each problem gets a (beta, sigma)
+ * pair of views into it, which keep the buffer alive.
+ */
+
+gibbs_batch_output_t
+inline
+bqreg_module_Py::gibbs_batch(
+    const std::vector<gibbs_batch_problem_t>& problems,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const int omp_n_threads,
+    const size_t seed_value
+)
+{
+    const size_t n_problems = problems.size();
+
+    // the arrays are viewed in place, so they are kept here until the sampler is done
+
+    std::vector<pybind11::array> Y_arrs;
+    std::vector<pybind11::array> X_arrs;
+    std::vector<ColVecView_t> Y_views;
+    std::vector<MatView_t> X_views;
+
+    Y_arrs.reserve(n_problems);
+    X_arrs.reserve(n_problems);
+    Y_views.reserve(n_problems);
+    X_views.reserve(n_problems);
+
+    std::vector<batch_problem_t<ColVecView_t,MatView_t>> batch_problems(n_problems);
+
+    for (size_t p = 0; p < n_problems; ++p) {
+        check_data_arrays_Py(std::get<0>(problems[p]), std::get<1>(problems[p]));
+
+        Y_arrs.push_back(viewable_array_Py<fp_t>(std::get<0>(problems[p])));
+        X_arrs.push_back(viewable_array_Py<fp_t>(std::get<1>(problems[p])));
+
+        Y_views.push_back(vector_view_Py<fp_t>(Y_arrs[p]));
+        X_views.push_back(matrix_view_Py<fp_t>(X_arrs[p]));
+
+        batch_problems[p].Y = &Y_views[p];
+        batch_problems[p].X = &X_views[p];
+        batch_problems[p].tau = std::get<2>(problems[p]);
+        batch_problems[p].prior_beta_mean = std::get<3>(problems[p]);
+        batch_problems[p].prior_beta_var = std::get<4>(problems[p]);
+        batch_problems[p].prior_sigma_shape = std::get<5>(problems[p]);
+        batch_problems[p].prior_sigma_scale = std::get<6>(problems[p]);
+    }
+
+    batch_result_t* result_ptr = new batch_result_t();
+    pybind11::capsule result_owner(result_ptr, [](void* ptr) { delete static_cast<batch_result_t*>(ptr); });
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        qr_gibbs_batch(batch_problems, n_burnin_draws, n_keep_draws, thinning_factor, omp_n_threads, static_cast<uint64_t>(seed_value), *result_ptr);
+    }
+
+    gibbs_batch_output_t draws_out;
+    draws_out.reserve(n_problems);
+
+    for (size_t p = 0; p < n_problems; ++p) {
+        const pybind11::ssize_t K = result_ptr->n_features[p];
+        fp_t* const draws_ptr = result_ptr->arena.data() + result_ptr->offsets[p];
+
+        numpy_arr_t beta_draws({ K, pybind11::ssize_t(n_keep_draws) }, 
+                               { pybind11::ssize_t(sizeof(fp_t)), pybind11::ssize_t(sizeof(fp_t)) * K }, 
+                               draws_ptr, result_owner);
+        numpy_arr_t sigma_draws({ pybind11::ssize_t(n_keep_draws) }, { pybind11::ssize_t(sizeof(fp_t)) }, draws_ptr + K * n_keep_draws, result_owner);
+
+        draws_out.push_back(std::make_tuple(beta_draws, sigma_draws));
+    }
+
+    return draws_out;
+}
+
+// posterior mean and quantiles of x' beta for new rows, in blocks of rows
+
+predict_output_t
+inline
+bqreg_module_Py::predict(
+    const numpy_data_t<fp_t>& X_new,
+    const Eigen::Ref<const Mat_t>& beta_draws,
+    const ColVec_t& probs
+)
+const
+{
+    ColVec_t pred_mean;
+    Mat_t pred_quantiles;
+
+    const pybind11::array X_new_arr = viewable_array_Py<fp_t>(X_new);
+
+    if (X_new_arr.ndim() != 2) {
+        throw std::invalid_argument("bqreg: the features must be a two-dimensional array");
+    }
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        qr_predict(matrix_view_Py<fp_t>(X_new_arr), beta_draws, probs, omp_n_threads, pred_mean, pred_quantiles);
+    }
+
+    return std::make_tuple(to_numpy_Py(std::move(pred_mean)), to_numpy_Py(std::move(pred_quantiles)));
+}
+
+predict_output_t
+inline
+bqreg_module_Py::predict_sparse(
+    const SpMat_t& X_new,
+    const Eigen::Ref<const Mat_t>& beta_draws,
+    const ColVec_t& probs
+)
+const
+{
+    ColVec_t pred_mean;
+    Mat_t pred_quantiles;
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        qr_predict(X_new, beta_draws, probs, omp_n_threads, pred_mean, pred_quantiles);
+    }
+
+    return std::make_tuple(to_numpy_Py(std::move(pred_mean)), to_numpy_Py(std::move(pred_quantiles)));
+}
+
+// the draws of beta are read through the memory map of the draw store
+
+predict_output_t
+inline
+bqreg_module_Py::predict_from_file(
+    const numpy_data_t<fp_t>& X_new,
+    const std::string& file_path,
+    const ColVec_t& probs
+)
+const
+{
+    ColVec_t pred_mean;
+    Mat_t pred_quantiles;
+
+    const pybind11::array X_new_arr = viewable_array_Py<fp_t>(X_new);
+
+    if (X_new_arr.ndim() != 2) {
+        throw std::invalid_argument("bqreg: the features must be a two-dimensional array");
+    }
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        draw_store_reader_t draw_store(file_path);
+
+        const size_t n_draws = draw_store.header().n_draws_written;
+
+        qr_predict(matrix_view_Py<fp_t>(X_new_arr), draw_store.beta_draws().leftCols(n_draws), probs, omp_n_threads, pred_mean, pred_quantiles);
+    }
+
+    return std::make_tuple(to_numpy_Py(std::move(pred_mean)), to_numpy_Py(std::move(pred_quantiles)));
+}
+
+// the window of rows of data passed from Python has not moved (see copy_external_data)
+
+void
+inline
+bqreg_module_Py::compact_window()
+{
+    if (use_external_storage) {
+        return;
+    }
+
+    if (use_sparse_storage) {
+        window.compact(Y, X_sp, checkpoint.state);
+    } else if (use_float_storage) {
+        window.compact(Y_f, X_f, checkpoint.state);
+    } else {
+        window.compact(Y, X, checkpoint.state);
+    }
+}
+
+// single-tau sampler on whichever copy of the data was loaded
+
+void
+inline
+bqreg_module_Py::run_gibbs(
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    draw_sink_t& draw_sink,
+    const int n_threads,
+    const bool resume,
+    const bool warm_start,
+    const bool allow_autotune
+)
+{
+    compact_window();
+
+    checkpoint.resume = resume;
+    checkpoint.warm_start = warm_start && window_has_state(checkpoint.state, get_n_rows(), get_n_features());
+
+    if (size_t(beta_initial_draw.size()) != get_n_features()) {
+        beta_initial_draw.setZero(get_n_features());
+    }
+
+    int run_n_threads = n_threads;
+    int setup_n_threads = 0;
+
+    if (autotune && allow_autotune) {
+        if (use_sparse_storage) {
+            sampler_tuning = tune_sampler_threads(Y, X_sp, n_threads, tuning_cache_path, tau, keep_sigma_fixed, outer_cache_max_bytes);
+        } else if (use_float_storage) {
+            sampler_tuning = tune_sampler_threads(get_Y_f_view(), get_X_f_view(), n_threads, tuning_cache_path, tau, keep_sigma_fixed, outer_cache_max_bytes);
+        } else {
+            sampler_tuning = tune_sampler_threads(get_Y_view(), get_X_view(), n_threads, tuning_cache_path, tau, keep_sigma_fixed, outer_cache_max_bytes);
+        }
+
+        run_n_threads = sampler_tuning.data_pass_n_threads;
+        setup_n_threads = sampler_tuning.setup_n_threads;
+    }
+
+    if (use_sparse_storage) {
+        qr_gibbs(Y,
+                 X_sp,
+                 tau,
+                 beta_initial_draw,
+                 prior_beta_mean,
+                 prior_beta_var,
+                 prior_sigma_shape,
+                 prior_sigma_scale,
+                 n_burnin_draws,
+                 n_keep_draws,
+                 thinning_factor,
+                 keep_sigma_fixed,
+                 run_n_threads,
+                 draw_sink,
+                 rand_engine,
+                 &sampler_stats,
+                 &checkpoint,
+                 setup_n_threads,
+                 sampler_scheme,
+                 outer_cache_max_bytes);
+    } else if (use_float_storage) {
+        qr_gibbs(get_Y_f_view(),
+                 get_X_f_view(),
+                 tau,
+                 beta_initial_draw,
+                 prior_beta_mean,
+                 prior_beta_var,
+                 prior_sigma_shape,
+                 prior_sigma_scale,
+                 n_burnin_draws,
+                 n_keep_draws,
+                 thinning_factor,
+                 keep_sigma_fixed,
+                 run_n_threads,
+                 draw_sink,
+                 rand_engine,
+                 &sampler_stats,
+                 &checkpoint,
+                 setup_n_threads,
+                 sampler_scheme,
+                 outer_cache_max_bytes);
+    } else {
+        qr_gibbs(get_Y_view(),
+                 get_X_view(),
+                 tau,
+                 beta_initial_draw,
+                 prior_beta_mean,
+                 prior_beta_var,
+                 prior_sigma_shape,
+                 prior_sigma_scale,
+                 n_burnin_draws,
+                 n_keep_draws,
+                 thinning_factor,
+                 keep_sigma_fixed,
+                 run_n_threads,
+                 draw_sink,
+                 rand_engine,
+                 &sampler_stats,
+                 &checkpoint,
+                 setup_n_threads,
+                 sampler_scheme,
+                 outer_cache_max_bytes);
+    }
+}
+
+// statistics of the last call of gibbs or gibbs_to_file; all zero unless built with BQREG_ENABLE_SAMPLER_STATS
+
+pybind11::dict
+inline
+bqreg_module_Py::get_sampler_stats()
+const
+{
+    pybind11::dict stats_dict;
+
+    stats_dict["enabled"] = sampler_stats.enabled;
+    stats_dict["n_iterations"] = sampler_stats.n_iterations;
+    stats_dict["n_threads"] = sampler_stats.n_threads;
+
+    stats_dict["total_seconds"] = sampler_stats.total_seconds;
+    stats_dict["setup_seconds"] = sampler_stats.setup_seconds;
+    stats_dict["beta_draw_seconds"] = sampler_stats.beta_draw_seconds;
+    stats_dict["data_pass_seconds"] = sampler_stats.data_pass_seconds;
+    stats_dict["reduce_seconds"] = sampler_stats.reduce_seconds;
+    stats_dict["sigma_draw_seconds"] = sampler_stats.sigma_draw_seconds;
+    stats_dict["store_seconds"] = sampler_stats.store_seconds;
+
+    stats_dict["nu_draw_thread_seconds"] = sampler_stats.nu_draw_thread_seconds;
+    stats_dict["gram_thread_seconds"] = sampler_stats.gram_thread_seconds;
+    stats_dict["thread_busy_seconds"] = Eigen::VectorXd( Eigen::Map<const Eigen::VectorXd>(sampler_stats.thread_busy_seconds.data(), sampler_stats.thread_busy_seconds.size()) );
+    stats_dict["load_imbalance"] = sampler_stats.load_imbalance();
+
+    stats_dict["n_workspace_allocs"] = sampler_stats.n_workspace_allocs;
+    stats_dict["workspace_alloc_bytes"] = sampler_stats.workspace_alloc_bytes;
+    stats_dict["outer_cache_bytes"] = sampler_stats.outer_cache_bytes;
+
+    return stats_dict;
+}
+
+size_t
+inline
+bqreg_module_Py::get_n_rows()
+const
+{
+    if (use_external_storage) {
+        return X_arr.shape(0);
+    }
+
+    if (use_sparse_storage) {
+        return X_sp.rows();
+    }
+
+    return use_float_storage ? X_f.rows() : X.rows();
+}
+
+size_t
+inline
+bqreg_module_Py::get_n_features()
+const
+{
+    if (use_external_storage) {
+        return X_arr.shape(1);
+    }
+
+    if (use_sparse_storage) {
+        return X_sp.cols();
+    }
+
+    return use_float_storage ? X_f.cols() : X.cols();
+}
+
+// views of the arrays passed to load_data, or of the copies held by the object
+
+ColVecView_t
+inline
+bqreg_module_Py::get_Y_view()
+const
+{
+    if (use_external_storage) {
+        return vector_view_Py<fp_t>(Y_arr);
+    }
+
+    return ColVecView_t(Y.data(), Y.size(), Eigen::InnerStride<>(1));
+}
+
+MatView_t
+inline
+bqreg_module_Py::get_X_view()
+const
+{
+    if (use_external_storage) {
+        return matrix_view_Py<fp_t>(X_arr);
+    }
+
+    return MatView_t(X.data(), X.rows(), X.cols(), DataStride_t(X.rows(), 1));
+}
+
+ColVecFView_t
+inline
+bqreg_module_Py::get_Y_f_view()
+const
+{
+    if (use_external_storage) {
+        return vector_view_Py<float>(Y_arr);
+    }
+
+    return ColVecFView_t(Y_f.data(), Y_f.size(), Eigen::InnerStride<>(1));
+}
+
+MatFView_t
+inline
+bqreg_module_Py::get_X_f_view()
+const
+{
+    if (use_external_storage) {
+        return matrix_view_Py<float>(X_arr);
+    }
+
+    return MatFView_t(X_f.data(), X_f.rows(), X_f.cols(), DataStride_t(X_f.rows(), 1));
+}
+
+// rows are appended and retired in place, so the window works on a copy of the arrays passed to load_data
+
+void
+inline
+bqreg_module_Py::copy_external_data()
+{
+    if (!use_external_storage) {
+        return;
+    }
+
+    if (use_float_storage) {
+        Y_f = get_Y_f_view();
+        X_f = get_X_f_view();
+    } else {
+        Y = get_Y_view();
+        X = get_X_view();
+    }
+
+    use_external_storage = false;
+    Y_arr = pybind11::array();
+    X_arr = pybind11::array();
+}
+
+// stack a vector of T (rows x cols) matrices into a T x rows x cols array
+
+inline
+pybind11::array_t<fp_t>
+stack_draws_Py(const std::vector<Mat_t>& draws_vec)
+{
+    const size_t n_mats = draws_vec.size();
+    const size_t n_rows = (n_mats > 0) ? draws_vec[0].rows() : 0;
+    const size_t n_cols = (n_mats > 0) ? draws_vec[0].cols() : 0;
+
+    pybind11::array_t<fp_t> draws_arr({n_mats, n_rows, n_cols});
+    auto draws_view = draws_arr.mutable_unchecked<3>();
+
+    for (size_t t = 0; t < n_mats; ++t) {
+        for (size_t j = 0; j < n_cols; ++j) {
+            for (size_t i = 0; i < n_rows; ++i) {
+                draws_view(t, i, j) = draws_vec[t](i, j);
+            }
+        }
+    }
+
+    return draws_arr;
+}
+
+gibbs_multi_tau_output_t
+inline
+bqreg_module_Py::gibbs_multi_tau(
+    const ColVec_t& tau_vec,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor
+)
+{
+    std::vector<Mat_t> beta_draws;
+    std::vector<Mat_t> z_draws;
+    Mat_t sigma_draws;
+
+    compact_window();
+
+    if (size_t(beta_initial_draw.size()) != get_n_features()) {
+        beta_initial_draw.setZero(get_n_features());
+    }
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        if (use_sparse_storage) {
+            qr_gibbs_multi_tau(Y,
+                               X_sp,
+                               tau_vec,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               omp_n_threads,
+                               beta_draws,
+                               z_draws,
+                               sigma_draws,
+                               rand_engine);
+        } else if (use_float_storage) {
+            qr_gibbs_multi_tau(get_Y_f_view(),
+                               get_X_f_view(),
+                               tau_vec,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               omp_n_threads,
+                               beta_draws,
+                               z_draws,
+                               sigma_draws,
+                               rand_engine);
+        } else {
+            qr_gibbs_multi_tau(get_Y_view(),
+                               get_X_view(),
+                               tau_vec,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               omp_n_threads,
+                               beta_draws,
+                               z_draws,
+                               sigma_draws,
+                               rand_engine);
+        }
+    }
+
+    return std::make_tuple(stack_draws_Py(beta_draws), stack_draws_Py(z_draws), to_numpy_Py(Mat_t(sigma_draws.transpose())));
+}
+
+gibbs_multi_chain_output_t
+inline
+bqreg_module_Py::gibbs_multi_chain(
+    const size_t n_chains,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor
+)
+{
+    std::vector<Mat_t> beta_draws;
+    std::vector<Mat_t> z_draws;
+    Mat_t sigma_draws;
+
+    compact_window();
+
+    if (size_t(beta_initial_draw.size()) != get_n_features()) {
+        beta_initial_draw.setZero(get_n_features());
+    }
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        if (use_sparse_storage) {
+            qr_gibbs_multi_chain(Y,
+                                 X_sp,
+                                 tau,
+                                 beta_initial_draw,
+                                 prior_beta_mean,
+                                 prior_beta_var,
+                                 prior_sigma_shape,
+                                 prior_sigma_scale,
+                                 n_chains,
+                                 n_burnin_draws,
+                                 n_keep_draws,
+                                 thinning_factor,
+                                 keep_sigma_fixed,
+                                 omp_n_threads,
+                                 beta_draws,
+                                 z_draws,
+                                 sigma_draws,
+                                 rand_engine);
+        } else if (use_float_storage) {
+            qr_gibbs_multi_chain(get_Y_f_view(),
+                                 get_X_f_view(),
+                                 tau,
+                                 beta_initial_draw,
+                                 prior_beta_mean,
+                                 prior_beta_var,
+                                 prior_sigma_shape,
+                                 prior_sigma_scale,
+                                 n_chains,
+                                 n_burnin_draws,
+                                 n_keep_draws,
+                                 thinning_factor,
+                                 keep_sigma_fixed,
+                                 omp_n_threads,
+                                 beta_draws,
+                                 z_draws,
+                                 sigma_draws,
+                                 rand_engine);
+        } else {
+            qr_gibbs_multi_chain(get_Y_view(),
+                                 get_X_view(),
+                                 tau,
+                                 beta_initial_draw,
+                                 prior_beta_mean,
+                                 prior_beta_var,
+                                 prior_sigma_shape,
+                                 prior_sigma_scale,
+                                 n_chains,
+                                 n_burnin_draws,
+                                 n_keep_draws,
+                                 thinning_factor,
+                                 keep_sigma_fixed,
+                                 omp_n_threads,
+                                 beta_draws,
+                                 z_draws,
+                                 sigma_draws,
+                                 rand_engine);
+        }
+    }
+
+    const convergence_diagnostics_t diag_out = compute_convergence_diagnostics(beta_draws, sigma_draws);
+
+    pybind11::dict diag_dict;
+    diag_dict["rhat"] = diag_out.rhat;
+    diag_dict["ess_bulk"] = diag_out.ess_bulk;
+    diag_dict["ess_tail"] = diag_out.ess_tail;
+
+    return std::make_tuple(stack_draws_Py(beta_draws), stack_draws_Py(z_draws), to_numpy_Py(Mat_t(sigma_draws.transpose())), diag_dict);
+}
+
+
+gibbs_consensus_output_t
+inline
+bqreg_module_Py::gibbs_consensus(
+    const size_t n_shards,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool use_kernel_combiner
+)
+{
+    Mat_t beta_draws;
+    ColVec_t sigma_draws;
+
+    compact_window();
+
+    if (size_t(beta_initial_draw.size()) != get_n_features()) {
+        beta_initial_draw.setZero(get_n_features());
+    }
+
+    {
+        pybind11::gil_scoped_release gil_release;
+
+        if (use_sparse_storage) {
+            qr_gibbs_consensus(Y,
+                               X_sp,
+                               tau,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_shards,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               use_kernel_combiner,
+                               omp_n_threads,
+                               beta_draws,
+                               sigma_draws,
+                               rand_engine);
+        } else if (use_float_storage) {
+            qr_gibbs_consensus(get_Y_f_view(),
+                               get_X_f_view(),
+                               tau,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_shards,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               use_kernel_combiner,
+                               omp_n_threads,
+                               beta_draws,
+                               sigma_draws,
+                               rand_engine);
+        } else {
+            qr_gibbs_consensus(get_Y_view(),
+                               get_X_view(),
+                               tau,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_shards,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               use_kernel_combiner,
+                               omp_n_threads,
+                               beta_draws,
+                               sigma_draws,
+                               rand_engine);
+        }
+    }
+
+    return std::make_tuple(to_numpy_Py(std::move(beta_draws)), to_numpy_Py(std::move(sigma_draws)));
 }
 
 #endif
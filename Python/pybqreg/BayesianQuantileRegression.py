@@ -22,7 +22,7 @@ from typing import Union
 import numpy as np
 import pandas as pd
 
-from bqreg_wrapper import bqreg
+from bqreg_wrapper import bqreg, gibbs_many, gibbs_batch
 
 class BayesianQuantileRegression:
     '''
@@ -38,7 +38,13 @@ class BayesianQuantileRegression:
 
             Parameters:
                 target: An n x 1 vector defining the target variable (Y)
-                features: An n x K matrix of features (X)
+                features: An n x K matrix of features (X); a float32 array is stored in single precision,
+                          and a scipy.sparse matrix is stored in compressed sparse row format
+
+            Notes:
+                float64 and float32 arrays (and data frames of one such dtype) are used in place, in either C or
+                Fortran order, rather than copied; they should not be modified while the object is in use.
+                Fortran-ordered features are the fastest to sample with.
         '''
 
         self.n = target.shape[0]
@@ -55,19 +61,33 @@ class BayesianQuantileRegression:
         else:
             raise Exception("The 'target' vector must be of type 'pandas.DataFrame', 'pandas.Series', or 'numpy.ndarray'")
         
-        if isinstance(features, (pd.Series, pd.DataFrame)):
+        # scipy is only needed for sparse features, so it is not imported at module level
+
+        is_sparse = hasattr(features, "tocsr")
+
+        if is_sparse:
+            self.X = features.tocsr().astype(np.float64, copy=False)
+        elif isinstance(features, (pd.Series, pd.DataFrame)):
             self.X = features.to_numpy()
         elif isinstance(features, np.ndarray):
             self.X = features
         else:
             raise Exception("The 'features' vector/matrix must be of type 'pandas.DataFrame', 'pandas.Series', or 'numpy.ndarray'")
 
-        if self.K == 1:
+        if self.K == 1 and not is_sparse:
             self.X = self.X[:, np.newaxis]
 
+        # float32 features are kept in single precision (the sampler still accumulates in double)
+
+        if not is_sparse and self.X.dtype == np.float32:
+            self.Y = self.Y.astype(np.float32, copy=False)
+
         self.bqreg_obj = bqreg()
 
-        self.bqreg_obj.load_data(self.Y, self.X)
+        if is_sparse:
+            self.bqreg_obj.load_data_sparse(np.asarray(self.Y, dtype=np.float64), self.X)
+        else:
+            self.bqreg_obj.load_data(self.Y, self.X)
 
         self.bqreg_obj.set_prior_params(np.zeros(self.K), np.eye(self.K), 3, 3)
         self.bqreg_obj.set_initial_beta_draw(np.zeros(self.K))
@@ -106,7 +126,79 @@ class BayesianQuantileRegression:
                 omp_n_threads: An integer value
         '''
         self.bqreg_obj.set_omp_n_threads(omp_n_threads)
-    
+
+    def set_autotune(
+        self,
+        autotune: bool = True,
+        cache_path: str = ""
+    ):
+        '''
+        Choose the number of threads for each phase of the sampler by timing a few passes over the data before each fit
+        (fit, fit_resume, fit_warm); the choice is cached per data shape and host, so later fits skip the calibration
+
+            Parameters:
+                autotune: Whether to autotune; the number of threads from set_omp_n_threads is the upper limit (all threads if negative)
+                cache_path: An optional text file that keeps the choices across sessions
+        '''
+        self.bqreg_obj.set_autotune(autotune, cache_path)
+
+    def get_sampler_tuning(
+        self
+    ) -> dict:
+        '''
+        The thread counts chosen by the last autotuned fit
+
+            Returns:
+                A dict with the threads of the setup pass and of the per-iteration data pass, the time of one data pass,
+                the time spent calibrating, and whether the choice came from the cache
+        '''
+        return self.bqreg_obj.get_sampler_tuning()
+
+    def set_sampler_scheme(
+        self,
+        scheme: str = "standard"
+    ):
+        '''
+        Choose how sigma is updated in each iteration of the sampler (fit, fit_resume, fit_warm, and fit_many)
+
+            Parameters:
+                scheme: 'standard' draws sigma given beta and nu; 'collapsed' draws sigma given nu with beta integrated out;
+                        'interweaved' follows the standard draw with a second draw given nu / sigma. The alternatives mix
+                        faster for extreme tau (e.g., 0.01 or 0.99) at a small cost per iteration; tests/sampler_bench.py
+                        compares them by effective draws per CPU second.
+        '''
+        self.bqreg_obj.set_sampler_scheme(scheme)
+
+    def get_sampler_scheme(
+        self
+    ) -> str:
+        '''
+        The update scheme of the sampler, as set by set_sampler_scheme
+        '''
+        return self.bqreg_obj.get_sampler_scheme()
+
+    def set_outer_cache_budget(
+        self,
+        max_bytes: int
+    ):
+        '''
+        Set the memory budget of the packed outer-product cache used by fit, fit_resume, and fit_warm
+
+            Parameters:
+                max_bytes: for dense data with few features (at most 6 by default), the outer products of the rows are
+                           stored once, as n x K(K+1)/2 values, when they fit in max_bytes; each iteration then forms
+                           the Gram matrix with one weighted matrix-vector product. 0 turns the cache off.
+        '''
+        self.bqreg_obj.set_outer_cache_budget(max_bytes)
+
+    def get_outer_cache_budget(
+        self
+    ) -> int:
+        '''
+        The memory budget of the packed outer-product cache, in bytes
+        '''
+        return self.bqreg_obj.get_outer_cache_budget()
+
     def set_prior_params(
         self,
         beta_mean: np.ndarray, 
@@ -148,6 +240,156 @@ class BayesianQuantileRegression:
         '''
         self.bqreg_obj.set_initial_beta_draw(beta_initial_draw)
 
+    def get_sampler_stats(
+        self
+    ) -> dict:
+        '''
+        Per-phase timing, thread load balance, and workspace allocations from the last call of fit
+
+            Returns:
+                A dict with the wall time of each phase of the sampler (beta draw, data pass, sigma draw, storing the draws),
+                the time each thread spent in the data pass ('thread_busy_seconds', 'load_imbalance'), and the number of
+                workspace allocations; every entry is zero, with 'enabled' False, unless the module was built with BQREG_ENABLE_SAMPLER_STATS
+        '''
+        return self.bqreg_obj.get_sampler_stats()
+
+    def set_checkpoint(
+        self,
+        file_path: str,
+        checkpoint_interval: int = 1000
+    ):
+        '''
+        Write the state of the chain to a file during subsequent fits, so that an interrupted fit can be resumed
+
+            Parameters:
+                file_path: the path of the checkpoint file; an empty string keeps only the final state, in memory
+                checkpoint_interval: the number of iterations between checkpoints; the final state is always written
+        '''
+        self.bqreg_obj.set_checkpoint(file_path, checkpoint_interval)
+
+    def save_state(
+        self,
+        file_path: str
+    ):
+        '''
+        Write the state of the chain at the end of the last fit to a checkpoint file
+
+            Parameters:
+                file_path: the path of the checkpoint file
+        '''
+        self.bqreg_obj.save_sampler_state(file_path)
+
+    def fit_resume(
+        self,
+        checkpoint_path: str = "",
+        n_extra_keep_draws: int = 0
+    ) -> tuple:
+        '''
+        Resume an interrupted fit from a checkpoint file, or extend the last fit
+
+            Parameters:
+                checkpoint_path: the path of a checkpoint file; an empty string continues from the end of the last fit
+                n_extra_keep_draws: the number of draws to add to the planned length of the run (0 to finish an interrupted fit)
+            
+            Returns:
+                A tuple of matrices containing the posterior draws after the checkpoint, ordered as follows: (beta, z, sigma)
+            
+            Notes:
+                The quantile, burn-in, and thinning settings are those of the checkpointed run, and the draws are
+                identical to those of an uninterrupted run.
+        '''
+
+        draws = self.bqreg_obj.gibbs_resume(checkpoint_path, n_extra_keep_draws)
+
+        return draws[0], draws[1], draws[2] # (beta, z, sigma)
+
+    def append_rows(
+        self,
+        target: Union[pd.Series, pd.DataFrame, np.ndarray],
+        features: Union[pd.Series, pd.DataFrame, np.ndarray]
+    ):
+        '''
+        Append rows to the window of data, e.g., the newest observations of a rolling window
+
+            Parameters:
+                target: An m x 1 vector defining the target variable of the new rows
+                features: An m x K matrix of features of the new rows; converted to the storage format of the loaded data
+
+            Notes:
+                The new rows take the slots of rows removed by retire_rows, so the columns of the z draws follow
+                the slot order given by get_window_slots rather than time order.
+        '''
+
+        target = target.to_numpy() if isinstance(target, (pd.Series, pd.DataFrame)) else np.asarray(target)
+
+        if hasattr(features, "tocsr"):
+            self.bqreg_obj.append_rows_sparse(np.asarray(target, dtype=np.float64), features.tocsr().astype(np.float64, copy=False))
+        else:
+            features = features.to_numpy() if isinstance(features, (pd.Series, pd.DataFrame)) else np.asarray(features)
+
+            if features.ndim == 1:
+                features = features[:, np.newaxis]
+
+            self.bqreg_obj.append_rows(np.asarray(target, dtype=np.float64), np.asarray(features, dtype=np.float64))
+
+        self.n += target.shape[0]
+
+    def retire_rows(
+        self,
+        n_rows: int
+    ):
+        '''
+        Remove the oldest rows from the window of data
+
+            Parameters:
+                n_rows: the number of rows to remove
+        '''
+        self.bqreg_obj.retire_rows(n_rows)
+
+        self.n -= n_rows
+
+    def get_window_slots(
+        self
+    ) -> np.ndarray:
+        '''
+        The slot order of the window of data
+
+            Returns:
+                For each row of the window, oldest first, the index of its column in the z draws
+        '''
+        return self.bqreg_obj.get_window_slots()
+
+    def fit_warm(
+        self,
+        tau: float = 0.5,
+        n_burnin_draws: int = 100,
+        n_keep_draws: int = 1000,
+        thinning_factor: int = 0
+    ) -> tuple:
+        '''
+        Refit after the window of data moved, starting from the state of the chain at the end of the last fit
+
+            Parameters:
+                tau: the target quantile value
+                n_burnin_draws: the number of burn-in draws; a short burn-in usually suffices
+                n_keep_draws: the number of post burn-in draws to return
+                thinning_factor: the number of draws to skip between keep draws
+            
+            Returns:
+                A tuple of matrices containing posterior draws, ordered as follows: (beta, z, sigma)
+            
+            Notes:
+                beta, sigma, and the latent draws of the retained rows carry over from the last fit, and the sufficient
+                statistics are updated for the appended and retired rows only. Without a previous fit on this data,
+                the chain starts from the initial values, as with fit.
+        '''
+        
+        self.bqreg_obj.set_quantile_target(tau)
+
+        draws = self.bqreg_obj.gibbs_warm(n_burnin_draws, n_keep_draws, thinning_factor)
+
+        return draws[0], draws[1], draws[2] # (beta, z, sigma)
+
     def fit(
         self,
         tau: float = 0.5,
@@ -176,3 +418,284 @@ class BayesianQuantileRegression:
         draws = self.bqreg_obj.gibbs(n_burnin_draws, n_keep_draws, thinning_factor)
 
         return draws[0], draws[1], draws[2] # (beta, z, sigma)
+
+    def fit_adaptive(
+        self,
+        tau: float = 0.5,
+        target_ess: float = 400,
+        target_mcse: float = 0,
+        rhat_max: float = 1.05,
+        check_interval: int = 100,
+        max_burnin_draws: int = 5000,
+        max_draws: int = 20000,
+        thinning_factor: int = 0,
+        keep_z: bool = True
+    ) -> tuple:
+        '''
+        Fit with an adaptive burn-in and an automatic stopping rule
+
+            Parameters:
+                tau: the target quantile value
+                target_ess: stop once the effective sample size of every parameter is at least this value (0 to disable)
+                target_mcse: stop once the Monte Carlo standard error of every posterior mean is at most this value (0 to disable)
+                rhat_max: the split R-hat threshold that ends the burn-in
+                check_interval: the number of draws between checks of the diagnostics
+                max_burnin_draws: the burn-in ends, unconverged, after this many draws
+                max_draws: the hard cap on the number of burn-in plus kept draws
+                thinning_factor: the number of draws to skip between draws
+                keep_z: whether to return the draws of z
+            
+            Returns:
+                A tuple (beta, z, sigma, info), where info is a dict with keys 'n_burnin_draws', 'n_keep_draws',
+                'burnin_converged', 'targets_met', 'ess', 'mcse', and 'rhat' (the last three are vectors of length K + 1, beta then sigma)
+            
+            Notes:
+                Every check_interval draws, the burn-in ends once Geweke's test and the split R-hat pass on the second half
+                of the draws so far; sampling then stops once the batch-means ESS and MCSE targets are met.
+        '''
+        
+        self.bqreg_obj.set_quantile_target(tau)
+
+        draws = self.bqreg_obj.gibbs_adaptive(target_ess, target_mcse, rhat_max, check_interval, max_burnin_draws, max_draws, thinning_factor, keep_z)
+
+        return draws[0], draws[1], draws[2], draws[3] # (beta, z, sigma, info)
+
+    def fit_multi_tau(
+        self,
+        taus: np.ndarray,
+        n_burnin_draws: int = 1000,
+        n_keep_draws: int = 1000,
+        thinning_factor: int = 0
+    ) -> tuple:
+        '''
+        Fit a grid of quantiles in one call
+
+            Parameters:
+                taus: a vector of target quantile values
+                n_burnin_draws: the number of burn-in draws
+                n_keep_draws: the number of post burn-in draws to return
+                thinning_factor: the number of draws to skip between keep draws
+            
+            Returns:
+                A tuple of arrays containing posterior draws, ordered as follows: (beta, z, sigma),
+                with shapes (T, K, n_keep_draws), (T, n, n_keep_draws), and (T, n_keep_draws), where T = len(taus)
+            
+            Notes:
+                The chains for each quantile share a single pass over the features per iteration,
+                and each chain is warm-started from the chain of its neighboring quantile.
+        '''
+
+        draws = self.bqreg_obj.gibbs_multi_tau(np.asarray(taus, dtype = float), n_burnin_draws, n_keep_draws, thinning_factor)
+
+        return draws[0], draws[1], draws[2] # (beta, z, sigma)
+
+    def fit_multi_chain(
+        self,
+        n_chains: int = 4,
+        tau: float = 0.5,
+        n_burnin_draws: int = 1000,
+        n_keep_draws: int = 1000,
+        thinning_factor: int = 0
+    ) -> tuple:
+        '''
+        Run several independent chains and compute convergence diagnostics
+
+            Parameters:
+                n_chains: the number of chains
+                tau: the target quantile value
+                n_burnin_draws: the number of burn-in draws
+                n_keep_draws: the number of post burn-in draws to return
+                thinning_factor: the number of draws to skip between keep draws
+            
+            Returns:
+                A tuple (beta, z, sigma, diagnostics), where the draws have shapes (n_chains, K, n_keep_draws),
+                (n_chains, n, n_keep_draws), and (n_chains, n_keep_draws), and diagnostics is a dict with
+                keys 'rhat', 'ess_bulk', and 'ess_tail', each a vector of length K + 1 (beta, then sigma)
+        '''
+        
+        self.bqreg_obj.set_quantile_target(tau)
+
+        draws = self.bqreg_obj.gibbs_multi_chain(n_chains, n_burnin_draws, n_keep_draws, thinning_factor)
+
+        return draws[0], draws[1], draws[2], draws[3] # (beta, z, sigma, diagnostics)
+
+    def fit_consensus(
+        self,
+        n_shards: int = 4,
+        tau: float = 0.5,
+        n_burnin_draws: int = 1000,
+        n_keep_draws: int = 1000,
+        thinning_factor: int = 0,
+        combiner: str = "weighted"
+    ) -> tuple:
+        '''
+        Divide-and-conquer sampling for large n: sample shards of the rows independently and combine the draws
+
+            Parameters:
+                n_shards: the number of shards; the rows are dealt round-robin into the shards
+                tau: the target quantile value
+                n_burnin_draws: the number of burn-in draws per shard
+                n_keep_draws: the number of post burn-in draws per shard, and the number of combined draws to return
+                thinning_factor: the number of draws to skip between keep draws
+                combiner: 'weighted' for consensus Monte Carlo, or 'kernel' for the semiparametric kernel density product
+            
+            Returns:
+                A tuple of combined posterior draws, ordered as follows: (beta, sigma), with shapes (K, n_keep_draws) and (n_keep_draws,)
+            
+            Notes:
+                Each shard is sampled under the prior raised to the power 1/n_shards; the shards run in parallel.
+        '''
+
+        if combiner not in ("weighted", "kernel"):
+            raise Exception("The 'combiner' must be either 'weighted' or 'kernel'")
+        
+        self.bqreg_obj.set_quantile_target(tau)
+
+        draws = self.bqreg_obj.gibbs_consensus(n_shards, n_burnin_draws, n_keep_draws, thinning_factor, combiner == "kernel")
+
+        return draws[0], draws[1] # (beta, sigma)
+
+    def predict(
+        self,
+        features: Union[pd.Series, pd.DataFrame, np.ndarray],
+        beta_draws: np.ndarray = None,
+        probs: tuple = (0.05, 0.5, 0.95),
+        draw_store_path: str = ""
+    ) -> tuple:
+        '''
+        Posterior predictive summaries of the linear predictor for new rows
+
+            Parameters:
+                features: An m x K matrix of features of the new rows; a scipy.sparse matrix is used in sparse form
+                beta_draws: A K x S matrix of draws of beta, e.g., the first output of fit
+                probs: the probabilities of the quantiles to return
+                draw_store_path: the path of a draw store file to read the draws of beta from, in place of beta_draws
+            
+            Returns:
+                A tuple ordered as follows: (mean, quantiles), with shapes (m,) and (m, len(probs))
+            
+            Notes:
+                The rows are processed in blocks, so memory use does not grow with m times S.
+        '''
+
+        probs = np.asarray(probs, dtype=np.float64).ravel()
+
+        if hasattr(features, "tocsr"):
+            features = features.tocsr().astype(np.float64, copy=False)
+        else:
+            features = features.to_numpy() if isinstance(features, (pd.Series, pd.DataFrame)) else np.asarray(features)
+
+            if features.ndim == 1:
+                features = features[:, np.newaxis]
+
+            features = np.asarray(features, dtype=np.float64)
+
+        if draw_store_path:
+            if hasattr(features, "tocsr"):
+                features = features.toarray()
+
+            return self.bqreg_obj.predict_from_file(features, draw_store_path, probs)
+
+        if beta_draws is None:
+            raise Exception("Either 'beta_draws' or 'draw_store_path' must be given")
+
+        beta_draws = np.asarray(beta_draws, dtype=np.float64)
+
+        if hasattr(features, "tocsr"):
+            return self.bqreg_obj.predict_sparse(features, beta_draws, probs)
+
+        return self.bqreg_obj.predict(features, beta_draws, probs)
+
+def fit_many(
+    models: list,
+    tau: float = 0.5,
+    n_burnin_draws: int = 1000,
+    n_keep_draws: int = 1000,
+    thinning_factor: int = 0,
+    n_threads: int = -1
+) -> list:
+    '''
+    Fit several independent models in one call, scheduled across the C++ threads
+
+        Parameters:
+            models: a list of BayesianQuantileRegression objects, each with its own data, priors, and seed
+            tau: the target quantile value, for every model
+            n_burnin_draws: the number of burn-in draws
+            n_keep_draws: the number of post burn-in draws to return
+            thinning_factor: the number of draws to skip between keep draws
+            n_threads: the number of threads to spread the fits across; a negative value selects half of the available threads
+        
+        Returns:
+            A list with a tuple of posterior draws for each model, ordered as follows: (beta, z, sigma)
+        
+        Notes:
+            Each model runs on one thread when there are at least as many models as threads, and the draws are those
+            of fit with the same seed. The GIL is released while sampling, so fit can also be called from a Python
+            thread pool, with one object per thread.
+    '''
+
+    bqreg_objs = [model.bqreg_obj for model in models]
+
+    for bqreg_obj in bqreg_objs:
+        bqreg_obj.set_quantile_target(tau)
+
+    return gibbs_many(bqreg_objs, n_burnin_draws, n_keep_draws, thinning_factor, n_threads)
+
+def fit_batch(
+    problems: list,
+    n_burnin_draws: int = 1000,
+    n_keep_draws: int = 1000,
+    thinning_factor: int = 0,
+    n_threads: int = -1,
+    seed_value: int = None
+) -> list:
+    '''
+    Fit many small, independent regressions given directly as arrays
+
+        Parameters:
+            problems: a list of dicts, each with a 'target' vector and a 'features' matrix, and optionally 'tau' (0.5),
+                      'beta_mean' (zeros), 'beta_var' (identity), 'sigma_shape' (3), and 'sigma_scale' (3)
+            n_burnin_draws: the number of burn-in draws
+            n_keep_draws: the number of post burn-in draws to return
+            thinning_factor: the number of draws to skip between keep draws
+            n_threads: the number of threads to spread the problems across; a negative value selects half of the available threads
+            seed_value: the RNG seed, shared by the batch; each problem draws from its own stream of it
+        
+        Returns:
+            A list with a tuple of posterior draws for each problem, ordered as follows: (beta, sigma)
+        
+        Notes:
+            Unlike fit_many, no object is built per problem and z is not returned; the draws of all problems are views
+            into one buffer. The draws of a problem do not depend on n_threads or on the rest of the batch.
+    '''
+
+    if seed_value is None:
+        seed_value = int(np.random.SeedSequence().generate_state(1, np.uint64)[0])
+
+    batch_problems = []
+
+    for problem in problems:
+        features = problem['features']
+
+        if isinstance(features, (pd.Series, pd.DataFrame)):
+            features = features.to_numpy()
+
+        if len(features.shape) == 1:
+            features = features[:, np.newaxis]
+
+        target = problem['target']
+
+        if isinstance(target, (pd.Series, pd.DataFrame)):
+            target = target.to_numpy()
+
+        K = features.shape[1]
+
+        batch_problems.append((target,
+                               features,
+                               problem.get('tau', 0.5),
+                               np.asarray(problem.get('beta_mean', np.zeros(K)), dtype=np.float64),
+                               np.asarray(problem.get('beta_var', np.eye(K)), dtype=np.float64),
+                               problem.get('sigma_shape', 3),
+                               problem.get('sigma_scale', 3)))
+
+    return gibbs_batch(batch_problems, n_burnin_draws, n_keep_draws, thinning_factor, n_threads, seed_value)
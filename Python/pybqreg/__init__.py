@@ -1 +1,2 @@
-from .BayesianQuantileRegression import BayesianQuantileRegression
\ No newline at end of file
+from .BayesianQuantileRegression import BayesianQuantileRegression, fit_many, fit_batch
+from .draw_store import DrawStore
@@ -0,0 +1,126 @@
+################################################################################
+##
+##   Copyright (C) 2021-2023 Keith O'Hara
+##
+##   This file is part of the BayesianQuantileRegression library.
+##
+##   Licensed under the Apache License, Version 2.0 (the "License");
+##   you may not use this file except in compliance with the License.
+##   You may obtain a copy of the License at
+##
+##       http://www.apache.org/licenses/LICENSE-2.0
+##
+##   Unless required by applicable law or agreed to in writing, software
+##   distributed under the License is distributed on an "AS IS" BASIS,
+##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+##   See the License for the specific language governing permissions and
+##   limitations under the License.
+##
+################################################################################
+
+import os
+import struct
+import numpy as np
+
+_HEADER_FORMAT = "=8s7QdQQ"
+_BLOCK_FORMAT = "=4Q"
+_BLOCK_NAMES = ("beta", "sigma", "z")
+_TYPE_CODES = {1: np.float32, 2: np.float64}
+
+class DrawStore:
+    '''
+    Zero-copy reader for a draw store file written by the Gibbs sampler
+    '''
+    def __init__(
+        self,
+        file_path: str
+    ):
+        '''
+        Open a draw store file; only the header is read
+
+            Parameters:
+                file_path: path of the draw store file
+        '''
+
+        header_size = struct.calcsize(_HEADER_FORMAT) + len(_BLOCK_NAMES) * struct.calcsize(_BLOCK_FORMAT)
+
+        with open(file_path, "rb") as f:
+            header_bytes = f.read(header_size)
+
+        if len(header_bytes) < header_size:
+            raise Exception("'" + file_path + "' is not a draw store file (or has an unsupported version)")
+
+        fields = struct.unpack_from(_HEADER_FORMAT, header_bytes, 0)
+
+        if fields[0] != b"BQREGDRW" or fields[1] != 1:
+            raise Exception("'" + file_path + "' is not a draw store file (or has an unsupported version)")
+
+        self.file_path = file_path
+        self.n, self.K, self.n_keep_draws, self.n_burnin_draws, self.thinning_factor, self.seed_value = fields[2:8]
+        self.tau = fields[8]
+        self.n_draws_written = fields[9]
+        n_blocks = fields[10]
+
+        self._blocks = {}
+
+        # the block descriptors must fit in the file (as checked by draw_store_reader_t)
+
+        file_size = os.path.getsize(file_path)
+        bad_blocks = Exception("the block descriptors of the draw store file '" + file_path + "' do not fit in the file")
+
+        if n_blocks > len(_BLOCK_NAMES):
+            raise bad_blocks
+
+        for block_ind in range(n_blocks):
+            type_code, n_rows, n_cols, offset = struct.unpack_from(_BLOCK_FORMAT, header_bytes, struct.calcsize(_HEADER_FORMAT) + block_ind * struct.calcsize(_BLOCK_FORMAT))
+
+            if type_code not in _TYPE_CODES:
+                raise bad_blocks
+
+            type_size = np.dtype(_TYPE_CODES[type_code]).itemsize
+
+            if offset < header_size or offset > file_size or offset % type_size != 0 or n_rows * n_cols > (file_size - offset) // type_size:
+                raise bad_blocks
+
+            self._blocks[_BLOCK_NAMES[block_ind]] = (_TYPE_CODES[type_code], n_rows, n_cols, offset)
+
+    def block(
+        self,
+        name: str
+    ) -> np.ndarray:
+        '''
+        Memory-map one block of the file
+
+            Parameters:
+                name: one of 'beta', 'sigma', or 'z'
+            
+            Returns:
+                A read-only (n_rows x n_keep_draws) array view; pages are read from disk only when touched
+        '''
+
+        dtype, n_rows, n_cols, offset = self._blocks[name]
+
+        if n_rows * n_cols == 0:
+            return np.empty((n_rows, n_cols), dtype = dtype)
+
+        # each kept draw is a contiguous column of the block
+
+        return np.memmap(self.file_path, dtype = dtype, mode = "r", offset = offset, shape = (n_cols, n_rows)).T
+
+    def beta_draws(self) -> np.ndarray:
+        '''
+        Draws of beta, as a K x n_keep_draws array
+        '''
+        return self.block("beta")
+
+    def sigma_draws(self) -> np.ndarray:
+        '''
+        Draws of sigma, as a vector of length n_keep_draws
+        '''
+        return self.block("sigma")[0, :]
+
+    def z_draws(self) -> np.ndarray:
+        '''
+        Draws of z, as an n x n_keep_draws array
+        '''
+        return self.block("z")
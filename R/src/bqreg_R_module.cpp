@@ -35,7 +35,15 @@ RCPP_MODULE(bqreg_wrapper)
 
         .method( "set_seed_value", &bqreg_module_R::set_seed_value )
 
+        .method( "set_sampler_scheme", &bqreg_module_R::set_sampler_scheme )
+        .method( "get_sampler_scheme", &bqreg_module_R::get_sampler_scheme )
+        .method( "set_outer_cache_budget", &bqreg_module_R::set_outer_cache_budget )
+        .method( "get_outer_cache_budget", &bqreg_module_R::get_outer_cache_budget )
+        .method( "set_autotune", &bqreg_module_R::set_autotune )
+        .method( "get_sampler_tuning", &bqreg_module_R::get_sampler_tuning )
+
         .method( "load_data", &bqreg_module_R::load_data )
+        .method( "load_data_sparse", &bqreg_module_R::load_data_sparse )
         .method( "set_quantile_target", &bqreg_module_R::set_quantile_target )
         .method( "set_prior_params", &bqreg_module_R::set_prior_params )
 
@@ -43,5 +51,30 @@ RCPP_MODULE(bqreg_wrapper)
         .method( "set_initial_beta_draw", &bqreg_module_R::set_initial_beta_draw )
 
         .method( "gibbs", &bqreg_module_R::gibbs )
+        .method( "gibbs_to_file", &bqreg_module_R::gibbs_to_file )
+        .method( "gibbs_adaptive", &bqreg_module_R::gibbs_adaptive )
+        .method( "gibbs_multi_tau", &bqreg_module_R::gibbs_multi_tau )
+        .method( "gibbs_multi_chain", &bqreg_module_R::gibbs_multi_chain )
+        .method( "gibbs_consensus", &bqreg_module_R::gibbs_consensus )
+
+        .method( "get_sampler_stats", &bqreg_module_R::get_sampler_stats )
+
+        .method( "set_checkpoint", &bqreg_module_R::set_checkpoint )
+        .method( "save_sampler_state", &bqreg_module_R::save_sampler_state )
+        .method( "gibbs_resume", &bqreg_module_R::gibbs_resume )
+
+        .method( "append_rows", &bqreg_module_R::append_rows )
+        .method( "append_rows_sparse", &bqreg_module_R::append_rows_sparse )
+        .method( "retire_rows", &bqreg_module_R::retire_rows )
+        .method( "get_window_slots", &bqreg_module_R::get_window_slots )
+        .method( "gibbs_warm", &bqreg_module_R::gibbs_warm )
+
+        .method( "predict", &bqreg_module_R::predict )
+        .method( "predict_sparse", &bqreg_module_R::predict_sparse )
+        .method( "predict_from_file", &bqreg_module_R::predict_from_file )
     ;
+
+    // a batch of small problems, each a list with its data and prior
+
+    function( "gibbs_batch", &gibbs_batch_R );
 }
@@ -43,7 +43,17 @@ class bqreg_module_R
 
         void set_seed_value(const size_t seed_val_inp);
 
+        void set_sampler_scheme(const std::string& scheme_inp);
+        SEXP get_sampler_scheme() const;
+
+        void set_outer_cache_budget(const size_t outer_cache_max_bytes_inp);
+        SEXP get_outer_cache_budget() const;
+
+        void set_autotune(const bool autotune_inp, const std::string& cache_path_inp);
+        SEXP get_sampler_tuning() const;
+
         void load_data(const ColVec_t& Y_inp, const Mat_t& X_inp);
+        void load_data_sparse(const ColVec_t& Y_inp, const SpMatCSC_t& X_inp);
         void set_quantile_target(const fp_t tau_inp);
         void set_prior_params(const ColVec_t& prior_beta_mean_inp, const Mat_t& prior_beta_var_inp, const fp_t prior_sigma_shape_inp, const fp_t prior_sigma_scale_inp);
 
@@ -51,13 +61,51 @@ class bqreg_module_R
         void set_initial_beta_draw(const ColVec_t& beta_initial_draw_inp);
 
         SEXP gibbs(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor);
+        void gibbs_to_file(const std::string& file_path, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, const bool z_as_float);
+        SEXP gibbs_adaptive(const fp_t target_ess, const fp_t target_mcse, const fp_t rhat_max, const size_t check_interval, const size_t max_burnin_draws, const size_t max_draws, const size_t thinning_factor, const bool keep_z);
+        SEXP gibbs_multi_tau(const ColVec_t& tau_vec, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor);
+        SEXP gibbs_multi_chain(const size_t n_chains, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor);
+        SEXP gibbs_consensus(const size_t n_shards, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, const bool use_kernel_combiner);
+
+        SEXP get_sampler_stats() const;
+
+        void set_checkpoint(const std::string& file_path, const size_t checkpoint_interval);
+        void save_sampler_state(const std::string& file_path);
+        SEXP gibbs_resume(const std::string& file_path, const size_t n_extra_keep_draws);
+
+        void append_rows(const ColVec_t& Y_new, const Mat_t& X_new);
+        void append_rows_sparse(const ColVec_t& Y_new, const SpMatCSC_t& X_new);
+        void retire_rows(const size_t n_rows);
+        SEXP get_window_slots() const;
+        SEXP gibbs_warm(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor);
+
+        SEXP predict(const Mat_t& X_new, const Mat_t& beta_draws, const ColVec_t& probs) const;
+        SEXP predict_sparse(const SpMatCSC_t& X_new, const Mat_t& beta_draws, const ColVec_t& probs) const;
+        SEXP predict_from_file(const Mat_t& X_new, const std::string& file_path, const ColVec_t& probs) const;
     
     private:
         bool keep_sigma_fixed = false;
         int omp_n_threads = -1;
-        rand_engine_t rand_engine = rand_engine_t(std::random_device{}());
+        sampler_scheme_t sampler_scheme = SAMPLER_SCHEME_STANDARD;
+        size_t outer_cache_max_bytes = BQREG_OUTER_CACHE_MAX_BYTES;
+        bool autotune = false;
+        std::string tuning_cache_path;
+        sampler_tuning_t sampler_tuning;
+        size_t seed_val = std::random_device{}();
+        rand_engine_t rand_engine = rand_engine_t(seed_val);
 
         ColVec_t beta_initial_draw;
+
+        bool use_sparse_storage = false;
+        SpMat_t X_sp;
+
+        sampler_stats_t sampler_stats;
+        sampler_checkpoint_t checkpoint;
+        row_window_t window;
+
+        size_t get_n_features() const;
+        void compact_window();
+        void get_run_threads(const fp_t run_tau, const bool run_keep_sigma_fixed, int& run_n_threads, int& setup_n_threads);
 };
 
 #include "bqreg_R_module_fns.hpp"
@@ -46,9 +46,98 @@ void
 inline
 bqreg_module_R::set_seed_value(const size_t seed_val_inp)
 {
+    this->seed_val = seed_val_inp;
     this->rand_engine = rand_engine_t(seed_val_inp);
 }
 
+// "standard", "collapsed", or "interweaved"; see bqreg_schemes.hpp
+
+void
+inline
+bqreg_module_R::set_sampler_scheme(const std::string& scheme_inp)
+{
+    try {
+        this->sampler_scheme = sampler_scheme_from_string(scheme_inp);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+}
+
+SEXP
+inline
+bqreg_module_R::get_sampler_scheme()
+const
+{
+    try {
+        return Rcpp::wrap(sampler_scheme_to_string(sampler_scheme));
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+// bytes; 0 turns the packed outer-product cache off (see outer_prod_cache_t)
+
+void
+inline
+bqreg_module_R::set_outer_cache_budget(const size_t outer_cache_max_bytes_inp)
+{
+    this->outer_cache_max_bytes = outer_cache_max_bytes_inp;
+}
+
+SEXP
+inline
+bqreg_module_R::get_outer_cache_budget()
+const
+{
+    try {
+        return Rcpp::wrap(static_cast<double>(outer_cache_max_bytes));
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+// time a few passes before each single-chain fit to choose the thread counts (see bqreg_autotune.hpp);
+// the decisions are also kept in cache_path, if not empty
+
+void
+inline
+bqreg_module_R::set_autotune(const bool autotune_inp, const std::string& cache_path_inp)
+{
+    this->autotune = autotune_inp;
+    this->tuning_cache_path = cache_path_inp;
+}
+
+// thread counts used by the last autotuned fit
+
+SEXP
+inline
+bqreg_module_R::get_sampler_tuning()
+const
+{
+    try {
+        return Rcpp::List::create(
+            Rcpp::Named("setup_n_threads") = sampler_tuning.setup_n_threads,
+            Rcpp::Named("data_pass_n_threads") = sampler_tuning.data_pass_n_threads,
+            Rcpp::Named("data_pass_seconds") = sampler_tuning.data_pass_seconds,
+            Rcpp::Named("calibration_seconds") = sampler_tuning.calibration_seconds,
+            Rcpp::Named("from_cache") = sampler_tuning.from_cache
+        );
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
 void
 inline
 bqreg_module_R::load_data(const ColVec_t& Y_inp, const Mat_t& X_inp)
@@ -56,7 +145,30 @@ bqreg_module_R::load_data(const ColVec_t& Y_inp, const Mat_t& X_inp)
     this->Y = Y_inp;
     this->X = X_inp;
 
+    this->use_sparse_storage = false;
+    this->X_sp.resize(0,0);
+
     this->beta_initial_draw.setZero(X.cols());
+
+    this->window.reset();
+}
+
+// dgCMatrix features (column storage), converted to row storage for the sampler
+
+void
+inline
+bqreg_module_R::load_data_sparse(const ColVec_t& Y_inp, const SpMatCSC_t& X_inp)
+{
+    this->Y = Y_inp;
+    this->X_sp = X_inp;
+    this->X_sp.makeCompressed();
+
+    this->use_sparse_storage = true;
+    this->X.resize(0,0);
+
+    this->beta_initial_draw.setZero(X_sp.cols());
+
+    this->window.reset();
 }
 
 void
@@ -117,27 +229,517 @@ bqreg_module_R::gibbs(
         Mat_t z_draws;
         ColVec_t sigma_draws;
 
-        if (beta_initial_draw.size() != X.cols()) {
-            beta_initial_draw.setZero(X.cols());
-        }
-
-        qr_gibbs(Y,
-                 X,
-                 tau,
-                 beta_initial_draw,
-                 prior_beta_mean,
-                 prior_beta_var,
-                 prior_sigma_shape,
-                 prior_sigma_scale,
-                 n_burnin_draws,
-                 n_keep_draws,
-                 thinning_factor,
-                 keep_sigma_fixed,
-                 omp_n_threads,
-                 beta_draws,
-                 z_draws,
-                 sigma_draws,
-                 rand_engine);
+        compact_window();
+
+        if (size_t(beta_initial_draw.size()) != get_n_features()) {
+            beta_initial_draw.setZero(get_n_features());
+        }
+
+        int run_n_threads, setup_n_threads;
+        get_run_threads(tau, keep_sigma_fixed, run_n_threads, setup_n_threads);
+
+        memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+        if (use_sparse_storage) {
+            qr_gibbs(Y,
+                     X_sp,
+                     tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     n_burnin_draws,
+                     n_keep_draws,
+                     thinning_factor,
+                     keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        } else {
+            qr_gibbs(Y,
+                     X,
+                     tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     n_burnin_draws,
+                     n_keep_draws,
+                     thinning_factor,
+                     keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        }
+
+        return Rcpp::List::create(Rcpp::Named("beta_draws") = beta_draws, 
+                                  Rcpp::Named("z_draws") = z_draws, 
+                                  Rcpp::Named("sigma_draws") = sigma_draws);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+void
+inline
+bqreg_module_R::gibbs_to_file(
+    const std::string& file_path,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool z_as_float
+)
+{
+    try {
+        compact_window();
+
+        if (size_t(beta_initial_draw.size()) != get_n_features()) {
+            beta_initial_draw.setZero(get_n_features());
+        }
+
+        int run_n_threads, setup_n_threads;
+        get_run_threads(tau, keep_sigma_fixed, run_n_threads, setup_n_threads);
+
+        mmap_draw_sink_t draw_sink(file_path, make_draw_store_meta(tau, n_burnin_draws, thinning_factor, rand_engine), true, z_as_float);
+
+        if (use_sparse_storage) {
+            qr_gibbs(Y,
+                     X_sp,
+                     tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     n_burnin_draws,
+                     n_keep_draws,
+                     thinning_factor,
+                     keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        } else {
+            qr_gibbs(Y,
+                     X,
+                     tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     n_burnin_draws,
+                     n_keep_draws,
+                     thinning_factor,
+                     keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        }
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+}
+
+SEXP
+inline
+bqreg_module_R::gibbs_adaptive(
+    const fp_t target_ess,
+    const fp_t target_mcse,
+    const fp_t rhat_max,
+    const size_t check_interval,
+    const size_t max_burnin_draws,
+    const size_t max_draws,
+    const size_t thinning_factor,
+    const bool keep_z
+)
+{
+    try {
+        Mat_t beta_draws;
+        Mat_t z_draws;
+        ColVec_t sigma_draws;
+
+        adaptive_settings_t settings;
+
+        settings.target_ess = target_ess;
+        settings.target_mcse = target_mcse;
+        settings.rhat_max = rhat_max;
+        settings.check_interval = check_interval;
+        settings.min_burnin_draws = std::min(settings.min_burnin_draws, max_burnin_draws);
+        settings.max_burnin_draws = max_burnin_draws;
+        settings.max_draws = max_draws;
+        settings.thinning_factor = thinning_factor;
+
+        compact_window();
+
+        if (size_t(beta_initial_draw.size()) != get_n_features()) {
+            beta_initial_draw.setZero(get_n_features());
+        }
+
+        int run_n_threads, setup_n_threads;
+        get_run_threads(tau, keep_sigma_fixed, run_n_threads, setup_n_threads);
+
+        adaptive_sink_t draw_sink(settings, beta_draws, z_draws, sigma_draws, keep_z);
+
+        if (use_sparse_storage) {
+            qr_gibbs(Y,
+                     X_sp,
+                     tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     0,
+                     settings.max_draws,
+                     settings.thinning_factor,
+                     keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        } else {
+            qr_gibbs(Y,
+                     X,
+                     tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     0,
+                     settings.max_draws,
+                     settings.thinning_factor,
+                     keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        }
+
+        const adaptive_result_t& result = draw_sink.get_result();
+
+        return Rcpp::List::create(Rcpp::Named("beta_draws") = beta_draws, 
+                                  Rcpp::Named("z_draws") = z_draws, 
+                                  Rcpp::Named("sigma_draws") = sigma_draws,
+                                  Rcpp::Named("n_burnin_draws") = static_cast<double>(result.n_burnin_draws),
+                                  Rcpp::Named("n_keep_draws") = static_cast<double>(result.n_keep_draws),
+                                  Rcpp::Named("burnin_converged") = result.burnin_converged,
+                                  Rcpp::Named("targets_met") = result.targets_met,
+                                  Rcpp::Named("ess") = result.ess,
+                                  Rcpp::Named("mcse") = result.mcse,
+                                  Rcpp::Named("rhat") = result.rhat);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+void
+inline
+bqreg_module_R::set_checkpoint(
+    const std::string& file_path,
+    const size_t checkpoint_interval
+)
+{
+    checkpoint.file_path = file_path;
+    checkpoint.interval = checkpoint_interval;
+}
+
+void
+inline
+bqreg_module_R::save_sampler_state(
+    const std::string& file_path
+)
+{
+    try {
+        bqreg::save_sampler_state(file_path, checkpoint.state);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+}
+
+// resume from a checkpoint file, or, with an empty path, extend the last run
+
+SEXP
+inline
+bqreg_module_R::gibbs_resume(
+    const std::string& file_path,
+    const size_t n_extra_keep_draws
+)
+{
+    try {
+        Mat_t beta_draws;
+        Mat_t z_draws;
+        ColVec_t sigma_draws;
+
+        compact_window();
+
+        sampler_checkpoint_t resume_checkpoint = checkpoint;
+        resume_checkpoint.resume = true;
+
+        if (!file_path.empty()) {
+            resume_checkpoint.state = load_sampler_state(file_path);
+        } else if (resume_checkpoint.state.beta_draw.size() == 0) {
+            throw std::invalid_argument("bqreg: there is no previous run to extend");
+        }
+
+        if (size_t(beta_initial_draw.size()) != get_n_features()) {
+            beta_initial_draw.setZero(get_n_features());
+        }
+
+        int run_n_threads, setup_n_threads;
+        get_run_threads(resume_checkpoint.state.tau, resume_checkpoint.state.keep_sigma_fixed, run_n_threads, setup_n_threads);
+
+        memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+        if (use_sparse_storage) {
+            qr_gibbs(Y,
+                     X_sp,
+                     resume_checkpoint.state.tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     resume_checkpoint.state.n_burnin_draws,
+                     resume_checkpoint.state.n_keep_draws + n_extra_keep_draws,
+                     resume_checkpoint.state.thinning_factor,
+                     resume_checkpoint.state.keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &resume_checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        } else {
+            qr_gibbs(Y,
+                     X,
+                     resume_checkpoint.state.tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     resume_checkpoint.state.n_burnin_draws,
+                     resume_checkpoint.state.n_keep_draws + n_extra_keep_draws,
+                     resume_checkpoint.state.thinning_factor,
+                     resume_checkpoint.state.keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &resume_checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        }
+
+        checkpoint.state = resume_checkpoint.state;
+
+        tau = checkpoint.state.tau;
+        keep_sigma_fixed = checkpoint.state.keep_sigma_fixed;
+
+        return Rcpp::List::create(Rcpp::Named("beta_draws") = beta_draws, 
+                                  Rcpp::Named("z_draws") = z_draws, 
+                                  Rcpp::Named("sigma_draws") = sigma_draws);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+void
+inline
+bqreg_module_R::append_rows(
+    const ColVec_t& Y_new,
+    const Mat_t& X_new
+)
+{
+    try {
+        if (use_sparse_storage) {
+            window.append(Y, X_sp, Y_new, SpMat_t(X_new.sparseView()), checkpoint.state);
+        } else {
+            window.append(Y, X, Y_new, X_new, checkpoint.state);
+        }
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+}
+
+void
+inline
+bqreg_module_R::append_rows_sparse(
+    const ColVec_t& Y_new,
+    const SpMatCSC_t& X_new
+)
+{
+    if (use_sparse_storage) {
+        try {
+            window.append(Y, X_sp, Y_new, SpMat_t(X_new), checkpoint.state);
+        } catch( std::exception &ex ) {
+            forward_exception_to_r( ex );
+        } catch(...) {
+            ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+        }
+    } else {
+        append_rows(Y_new, Mat_t(X_new));
+    }
+}
+
+void
+inline
+bqreg_module_R::retire_rows(const size_t n_rows)
+{
+    try {
+        if (use_sparse_storage) {
+            window.retire(n_rows, Y, X_sp, checkpoint.state);
+        } else {
+            window.retire(n_rows, Y, X, checkpoint.state);
+        }
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+}
+
+// (one-based) row of the data, and column of the z draws, of each row of the window, oldest first
+
+SEXP
+inline
+bqreg_module_R::get_window_slots()
+const
+{
+    const std::vector<size_t> slots = window.get_slots(Y.size());
+
+    Rcpp::NumericVector slots_vec(slots.size());
+
+    for (size_t j = 0; j < slots.size(); ++j) {
+        slots_vec[j] = static_cast<double>(slots[j] + 1);
+    }
+
+    return slots_vec;
+}
+
+// start from the state of the last run, after the window moved
+
+SEXP
+inline
+bqreg_module_R::gibbs_warm(
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor
+)
+{
+    try {
+        Mat_t beta_draws;
+        Mat_t z_draws;
+        ColVec_t sigma_draws;
+
+        compact_window();
+
+        if (size_t(beta_initial_draw.size()) != get_n_features()) {
+            beta_initial_draw.setZero(get_n_features());
+        }
+
+        sampler_checkpoint_t warm_checkpoint = checkpoint;
+        warm_checkpoint.warm_start = window_has_state(warm_checkpoint.state, Y.size(), get_n_features());
+
+        int run_n_threads, setup_n_threads;
+        get_run_threads(tau, keep_sigma_fixed, run_n_threads, setup_n_threads);
+
+        memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+        if (use_sparse_storage) {
+            qr_gibbs(Y,
+                     X_sp,
+                     tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     n_burnin_draws,
+                     n_keep_draws,
+                     thinning_factor,
+                     keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &warm_checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        } else {
+            qr_gibbs(Y,
+                     X,
+                     tau,
+                     beta_initial_draw,
+                     prior_beta_mean,
+                     prior_beta_var,
+                     prior_sigma_shape,
+                     prior_sigma_scale,
+                     n_burnin_draws,
+                     n_keep_draws,
+                     thinning_factor,
+                     keep_sigma_fixed,
+                     run_n_threads,
+                     draw_sink,
+                     rand_engine,
+                     &sampler_stats,
+                     &warm_checkpoint,
+                     setup_n_threads,
+                     sampler_scheme,
+                     outer_cache_max_bytes);
+        }
+
+        checkpoint.state = warm_checkpoint.state;
 
         return Rcpp::List::create(Rcpp::Named("beta_draws") = beta_draws, 
                                   Rcpp::Named("z_draws") = z_draws, 
@@ -150,4 +752,475 @@ bqreg_module_R::gibbs(
     return R_NilValue;
 }
 
+// posterior mean and quantiles of x' beta for new rows, in blocks of rows
+
+SEXP
+inline
+bqreg_module_R::predict(
+    const Mat_t& X_new,
+    const Mat_t& beta_draws,
+    const ColVec_t& probs
+)
+const
+{
+    try {
+        ColVec_t pred_mean;
+        Mat_t pred_quantiles;
+
+        qr_predict(X_new, beta_draws, probs, omp_n_threads, pred_mean, pred_quantiles);
+
+        return Rcpp::List::create(Rcpp::Named("mean") = pred_mean, 
+                                  Rcpp::Named("quantiles") = pred_quantiles);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+SEXP
+inline
+bqreg_module_R::predict_sparse(
+    const SpMatCSC_t& X_new,
+    const Mat_t& beta_draws,
+    const ColVec_t& probs
+)
+const
+{
+    try {
+        ColVec_t pred_mean;
+        Mat_t pred_quantiles;
+
+        qr_predict(SpMat_t(X_new), beta_draws, probs, omp_n_threads, pred_mean, pred_quantiles);
+
+        return Rcpp::List::create(Rcpp::Named("mean") = pred_mean, 
+                                  Rcpp::Named("quantiles") = pred_quantiles);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+// the draws of beta are read through the memory map of the draw store
+
+SEXP
+inline
+bqreg_module_R::predict_from_file(
+    const Mat_t& X_new,
+    const std::string& file_path,
+    const ColVec_t& probs
+)
+const
+{
+    try {
+        ColVec_t pred_mean;
+        Mat_t pred_quantiles;
+
+        draw_store_reader_t draw_store(file_path);
+
+        const size_t n_draws = draw_store.header().n_draws_written;
+
+        qr_predict(X_new, draw_store.beta_draws().leftCols(n_draws), probs, omp_n_threads, pred_mean, pred_quantiles);
+
+        return Rcpp::List::create(Rcpp::Named("mean") = pred_mean, 
+                                  Rcpp::Named("quantiles") = pred_quantiles);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+SEXP
+inline
+bqreg_module_R::get_sampler_stats()
+const
+{
+    try {
+        return Rcpp::List::create(
+            Rcpp::Named("enabled") = sampler_stats.enabled,
+            Rcpp::Named("n_iterations") = static_cast<double>(sampler_stats.n_iterations),
+            Rcpp::Named("n_threads") = sampler_stats.n_threads,
+            Rcpp::Named("total_seconds") = sampler_stats.total_seconds,
+            Rcpp::Named("setup_seconds") = sampler_stats.setup_seconds,
+            Rcpp::Named("beta_draw_seconds") = sampler_stats.beta_draw_seconds,
+            Rcpp::Named("data_pass_seconds") = sampler_stats.data_pass_seconds,
+            Rcpp::Named("reduce_seconds") = sampler_stats.reduce_seconds,
+            Rcpp::Named("sigma_draw_seconds") = sampler_stats.sigma_draw_seconds,
+            Rcpp::Named("store_seconds") = sampler_stats.store_seconds,
+            Rcpp::Named("nu_draw_thread_seconds") = sampler_stats.nu_draw_thread_seconds,
+            Rcpp::Named("gram_thread_seconds") = sampler_stats.gram_thread_seconds,
+            Rcpp::Named("thread_busy_seconds") = Rcpp::NumericVector(sampler_stats.thread_busy_seconds.begin(), sampler_stats.thread_busy_seconds.end()),
+            Rcpp::Named("load_imbalance") = sampler_stats.load_imbalance(),
+            Rcpp::Named("n_workspace_allocs") = static_cast<double>(sampler_stats.n_workspace_allocs),
+            Rcpp::Named("workspace_alloc_bytes") = static_cast<double>(sampler_stats.workspace_alloc_bytes),
+            Rcpp::Named("outer_cache_bytes") = static_cast<double>(sampler_stats.outer_cache_bytes)
+        );
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+// free slots left by retire_rows are dropped before each run
+
+void
+inline
+bqreg_module_R::compact_window()
+{
+    if (use_sparse_storage) {
+        window.compact(Y, X_sp, checkpoint.state);
+    } else {
+        window.compact(Y, X, checkpoint.state);
+    }
+}
+
+// the thread counts of a single-chain fit: omp_n_threads for both phases, unless autotuned
+
+void
+inline
+bqreg_module_R::get_run_threads(const fp_t run_tau, const bool run_keep_sigma_fixed, int& run_n_threads, int& setup_n_threads)
+{
+    run_n_threads = omp_n_threads;
+    setup_n_threads = 0;
+
+    if (!autotune) {
+        return;
+    }
+
+    if (use_sparse_storage) {
+        sampler_tuning = tune_sampler_threads(Y, X_sp, omp_n_threads, tuning_cache_path, run_tau, run_keep_sigma_fixed, outer_cache_max_bytes);
+    } else {
+        sampler_tuning = tune_sampler_threads(Y, X, omp_n_threads, tuning_cache_path, run_tau, run_keep_sigma_fixed, outer_cache_max_bytes);
+    }
+
+    run_n_threads = sampler_tuning.data_pass_n_threads;
+    setup_n_threads = sampler_tuning.setup_n_threads;
+}
+
+size_t
+inline
+bqreg_module_R::get_n_features()
+const
+{
+    return use_sparse_storage ? X_sp.cols() : X.cols();
+}
+
+// stack a vector of T (rows x cols) matrices into a rows x cols x T array
+
+inline
+Rcpp::NumericVector
+stack_draws_R(const std::vector<Mat_t>& draws_vec)
+{
+    const size_t n_mats = draws_vec.size();
+    const size_t n_rows = (n_mats > 0) ? draws_vec[0].rows() : 0;
+    const size_t n_cols = (n_mats > 0) ? draws_vec[0].cols() : 0;
+
+    Rcpp::NumericVector draws_arr(n_rows * n_cols * n_mats);
+
+    for (size_t t = 0; t < n_mats; ++t) {
+        std::copy(draws_vec[t].data(), draws_vec[t].data() + n_rows * n_cols, draws_arr.begin() + t * n_rows * n_cols);
+    }
+
+    draws_arr.attr("dim") = Rcpp::IntegerVector::create(n_rows, n_cols, n_mats);
+
+    return draws_arr;
+}
+
+SEXP
+inline
+bqreg_module_R::gibbs_multi_tau(
+    const ColVec_t& tau_vec,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor
+)
+{
+    try {
+        std::vector<Mat_t> beta_draws;
+        std::vector<Mat_t> z_draws;
+        Mat_t sigma_draws;
+
+        compact_window();
+
+        if (size_t(beta_initial_draw.size()) != get_n_features()) {
+            beta_initial_draw.setZero(get_n_features());
+        }
+
+        if (use_sparse_storage) {
+            qr_gibbs_multi_tau(Y,
+                               X_sp,
+                               tau_vec,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               omp_n_threads,
+                               beta_draws,
+                               z_draws,
+                               sigma_draws,
+                               rand_engine);
+        } else {
+            qr_gibbs_multi_tau(Y,
+                               X,
+                               tau_vec,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               omp_n_threads,
+                               beta_draws,
+                               z_draws,
+                               sigma_draws,
+                               rand_engine);
+        }
+
+        return Rcpp::List::create(Rcpp::Named("beta_draws") = stack_draws_R(beta_draws), 
+                                  Rcpp::Named("z_draws") = stack_draws_R(z_draws), 
+                                  Rcpp::Named("sigma_draws") = sigma_draws);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+SEXP
+inline
+bqreg_module_R::gibbs_multi_chain(
+    const size_t n_chains,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor
+)
+{
+    try {
+        std::vector<Mat_t> beta_draws;
+        std::vector<Mat_t> z_draws;
+        Mat_t sigma_draws;
+
+        compact_window();
+
+        if (size_t(beta_initial_draw.size()) != get_n_features()) {
+            beta_initial_draw.setZero(get_n_features());
+        }
+
+        if (use_sparse_storage) {
+            qr_gibbs_multi_chain(Y,
+                                 X_sp,
+                                 tau,
+                                 beta_initial_draw,
+                                 prior_beta_mean,
+                                 prior_beta_var,
+                                 prior_sigma_shape,
+                                 prior_sigma_scale,
+                                 n_chains,
+                                 n_burnin_draws,
+                                 n_keep_draws,
+                                 thinning_factor,
+                                 keep_sigma_fixed,
+                                 omp_n_threads,
+                                 beta_draws,
+                                 z_draws,
+                                 sigma_draws,
+                                 rand_engine);
+        } else {
+            qr_gibbs_multi_chain(Y,
+                                 X,
+                                 tau,
+                                 beta_initial_draw,
+                                 prior_beta_mean,
+                                 prior_beta_var,
+                                 prior_sigma_shape,
+                                 prior_sigma_scale,
+                                 n_chains,
+                                 n_burnin_draws,
+                                 n_keep_draws,
+                                 thinning_factor,
+                                 keep_sigma_fixed,
+                                 omp_n_threads,
+                                 beta_draws,
+                                 z_draws,
+                                 sigma_draws,
+                                 rand_engine);
+        }
+
+        const convergence_diagnostics_t diag_out = compute_convergence_diagnostics(beta_draws, sigma_draws);
+
+        return Rcpp::List::create(Rcpp::Named("beta_draws") = stack_draws_R(beta_draws), 
+                                  Rcpp::Named("z_draws") = stack_draws_R(z_draws), 
+                                  Rcpp::Named("sigma_draws") = sigma_draws,
+                                  Rcpp::Named("rhat") = diag_out.rhat,
+                                  Rcpp::Named("ess_bulk") = diag_out.ess_bulk,
+                                  Rcpp::Named("ess_tail") = diag_out.ess_tail);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+
+SEXP
+inline
+bqreg_module_R::gibbs_consensus(
+    const size_t n_shards,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool use_kernel_combiner
+)
+{
+    try {
+        Mat_t beta_draws;
+        ColVec_t sigma_draws;
+
+        compact_window();
+
+        if (size_t(beta_initial_draw.size()) != get_n_features()) {
+            beta_initial_draw.setZero(get_n_features());
+        }
+
+        if (use_sparse_storage) {
+            qr_gibbs_consensus(Y,
+                               X_sp,
+                               tau,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_shards,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               use_kernel_combiner,
+                               omp_n_threads,
+                               beta_draws,
+                               sigma_draws,
+                               rand_engine);
+        } else {
+            qr_gibbs_consensus(Y,
+                               X,
+                               tau,
+                               beta_initial_draw,
+                               prior_beta_mean,
+                               prior_beta_var,
+                               prior_sigma_shape,
+                               prior_sigma_scale,
+                               n_shards,
+                               n_burnin_draws,
+                               n_keep_draws,
+                               thinning_factor,
+                               keep_sigma_fixed,
+                               use_kernel_combiner,
+                               omp_n_threads,
+                               beta_draws,
+                               sigma_draws,
+                               rand_engine);
+        }
+
+        return Rcpp::List::create(Rcpp::Named("beta_draws") = beta_draws, 
+                                  Rcpp::Named("sigma_draws") = sigma_draws);
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
+/*
+ * A batch of small problems (see qr_gibbs_batch). Each element of the list holds target and
+ * features, and optionally tau (0.5), beta_mean (zero), beta_var (identity), sigma_shape (3),
+ * and sigma_scale (3). The data are copied, as for load_data.
+ */
+
+SEXP
+inline
+gibbs_batch_R(
+    const Rcpp::List& problems,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const int omp_n_threads,
+    const size_t seed_value
+)
+{
+    try {
+        const size_t n_problems = problems.size();
+
+        std::vector<ColVec_t> Y_vecs(n_problems);
+        std::vector<Mat_t> X_mats(n_problems);
+        std::vector<batch_problem_t<ColVec_t,Mat_t>> batch_problems(n_problems);
+
+        for (size_t p = 0; p < n_problems; ++p) {
+            const Rcpp::List problem = problems[p];
+
+            Y_vecs[p] = Rcpp::as<ColVec_t>(problem["target"]);
+            X_mats[p] = Rcpp::as<Mat_t>(problem["features"]);
+
+            batch_problems[p].Y = &Y_vecs[p];
+            batch_problems[p].X = &X_mats[p];
+
+            if (problem.containsElementNamed("tau")) {
+                batch_problems[p].tau = Rcpp::as<fp_t>(problem["tau"]);
+            }
+
+            if (problem.containsElementNamed("beta_mean")) {
+                batch_problems[p].prior_beta_mean = Rcpp::as<ColVec_t>(problem["beta_mean"]);
+            }
+
+            if (problem.containsElementNamed("beta_var")) {
+                batch_problems[p].prior_beta_var = Rcpp::as<Mat_t>(problem["beta_var"]);
+            }
+
+            if (problem.containsElementNamed("sigma_shape")) {
+                batch_problems[p].prior_sigma_shape = Rcpp::as<fp_t>(problem["sigma_shape"]);
+            }
+
+            if (problem.containsElementNamed("sigma_scale")) {
+                batch_problems[p].prior_sigma_scale = Rcpp::as<fp_t>(problem["sigma_scale"]);
+            }
+        }
+
+        batch_result_t result;
+
+        qr_gibbs_batch(batch_problems, n_burnin_draws, n_keep_draws, thinning_factor, omp_n_threads, static_cast<uint64_t>(seed_value), result);
+
+        Rcpp::List draws_out(n_problems);
+
+        for (size_t p = 0; p < n_problems; ++p) {
+            draws_out[p] = Rcpp::List::create(Rcpp::Named("beta_draws") = Mat_t(result.beta_draws(p)), 
+                                              Rcpp::Named("sigma_draws") = ColVec_t(result.sigma_draws(p)));
+        }
+
+        return draws_out;
+    } catch( std::exception &ex ) {
+        forward_exception_to_r( ex );
+    } catch(...) {
+        ::Rf_error( "bqreg: C++ exception (unknown reason)" );
+    }
+    return R_NilValue;
+}
+
 #endif
@@ -25,7 +25,26 @@
 
 namespace bqreg
 {
+    #include "bqreg/bqreg_linalg.hpp"
+    #include "bqreg/bqreg_rng.hpp"
+    #include "bqreg/bqreg_sampler_stats.hpp"
+    #include "bqreg/bqreg_kernels.hpp"
+    #include "bqreg/bqreg_sparse_kernels.hpp"
+    #include "bqreg/bqreg_draw_sink.hpp"
+    #include "bqreg/bqreg_draw_store.hpp"
+    #include "bqreg/bqreg_checkpoint.hpp"
+    #include "bqreg/bqreg_window.hpp"
+    #include "bqreg/bqreg_schemes.hpp"
     #include "bqreg/bqreg_sampler.hpp"
+    #include "bqreg/bqreg_sparse_sampler.hpp"
+    #include "bqreg/bqreg_autotune.hpp"
+    #include "bqreg/bqreg_multi_tau.hpp"
+    #include "bqreg/bqreg_multi_chain.hpp"
+    #include "bqreg/bqreg_batch.hpp"
+    #include "bqreg/bqreg_consensus.hpp"
+    #include "bqreg/bqreg_diagnostics.hpp"
+    #include "bqreg/bqreg_adaptive.hpp"
+    #include "bqreg/bqreg_predict.hpp"
     #include "bqreg/bqreg_class.hpp"
 }
 
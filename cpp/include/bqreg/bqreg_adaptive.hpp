@@ -0,0 +1,380 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Adaptive burn-in and stopping rule
+ *
+ * The sampler runs up to a hard cap on the number of iterations, and every check_interval
+ * draws the running diagnostics decide whether to end the burn-in or to stop:
+ *
+ *   - burn-in ends once, over the second half of the draws so far, every parameter passes
+ *     Geweke's test (first 10% against last 50%, with batch-means variances) and the
+ *     rank-normalized split R-hat of four segments is below rhat_max;
+ *
+ *   - sampling stops once the batch-means ESS of every parameter reaches target_ess and
+ *     its Monte Carlo standard error is at most target_mcse (either target can be disabled).
+ *
+ * Batch means (Flegal and Jones, 2010) use sqrt(N) batches of sqrt(N) draws, so each check
+ * costs O(N) per parameter in the sampling phase.
+ */
+
+#ifndef _bqreg_adaptive_HPP
+#define _bqreg_adaptive_HPP
+
+/**
+ * Settings of the adaptive mode of the Gibbs sampler
+ */
+
+struct adaptive_settings_t
+{
+    fp_t target_ess = 400;       /*!< Stop once the ESS of every parameter is at least this value; 0 to disable */
+    fp_t target_mcse = 0;        /*!< Stop once the Monte Carlo standard error of every posterior mean is at most this value; 0 to disable */
+
+    fp_t rhat_max = fp_t(1.05);  /*!< Largest split R-hat, over four segments of the burn-in window, that ends the burn-in */
+    fp_t geweke_z_max = fp_t(2.5); /*!< Largest absolute Geweke z-score that ends the burn-in */
+
+    size_t check_interval = 100; /*!< Number of draws between checks */
+    size_t min_burnin_draws = 200;
+    size_t max_burnin_draws = 5000; /*!< Burn-in ends, unconverged, after this many draws */
+    size_t min_keep_draws = 200;
+    size_t max_draws = 20000;    /*!< Hard cap on the number of burn-in plus kept draws */
+
+    size_t thinning_factor = 0;  /*!< The number of iterations to skip between draws, in both phases */
+};
+
+/**
+ * Outcome of an adaptive run
+ */
+
+struct adaptive_result_t
+{
+    size_t n_burnin_draws = 0;     /*!< Number of burn-in draws, i.e., iterations / (thinning_factor + 1) */
+    size_t n_keep_draws = 0;
+    bool burnin_converged = false; /*!< Whether the burn-in ended by passing the diagnostics rather than by reaching \c max_burnin_draws */
+    bool targets_met = false;      /*!< Whether sampling stopped by meeting the targets rather than by reaching \c max_draws */
+
+    ColVec_t ess;  /*!< Batch-means ESS of the kept draws, at most their number; the first K entries are for \f$ \beta \f$, the last for \f$ \sigma \f$ */
+    ColVec_t mcse; /*!< Monte Carlo standard error of the posterior means, ordered as \c ess */
+    ColVec_t rhat; /*!< Split R-hat of the burn-in window at the end of the burn-in, ordered as \c ess */
+};
+
+// long-run variance of a series by non-overlapping batch means; draws beyond the last full batch are dropped
+
+inline
+fp_t
+batch_means_var(const ColVec_t& draws)
+{
+    const size_t n_draws = draws.size();
+    const size_t batch_size = std::max(size_t(1), static_cast<size_t>(std::sqrt(double(n_draws))));
+    const size_t n_batches = n_draws / batch_size;
+
+    if (n_batches < 2) {
+        return std::numeric_limits<fp_t>::quiet_NaN();
+    }
+
+    ColVec_t batch_means(n_batches);
+
+    for (size_t j = 0; j < n_batches; ++j) {
+        batch_means(j) = draws.segment(j * batch_size, batch_size).mean();
+    }
+
+    return batch_size * (batch_means.array() - batch_means.mean()).square().sum() / fp_t(n_batches - 1);
+}
+
+// Geweke z-score: the mean of the first 10% of the draws against the mean of the last 50%
+
+inline
+fp_t
+geweke_z(const ColVec_t& draws)
+{
+    const size_t n_draws = draws.size();
+    const size_t n_first = n_draws / 10;
+    const size_t n_last = n_draws / 2;
+
+    const ColVec_t first_draws = draws.head(n_first);
+    const ColVec_t last_draws = draws.tail(n_last);
+
+    const fp_t var_val = batch_means_var(first_draws) / n_first + batch_means_var(last_draws) / n_last;
+
+    if (!(var_val > fp_t(0))) {
+        // constant (e.g., a fixed sigma) or too few draws
+        return (first_draws.mean() == last_draws.mean()) ? fp_t(0) : std::numeric_limits<fp_t>::infinity();
+    }
+
+    return (first_draws.mean() - last_draws.mean()) / std::sqrt(var_val);
+}
+
+/**
+ * Draw sink that ends the burn-in and stops the sampler using running diagnostics
+ *
+ * The sampler must be run with no burn-in and no thinning of its own beyond
+ * \c thinning_factor, and with n_keep_draws = max_draws: every draw is pushed, and the sink
+ * requests the stop. The kept draws of \f$ \beta \f$ and \f$ \sigma \f$ (and of \f$ z \f$,
+ * if requested) are held in growing buffers and trimmed by \c end.
+ */
+
+class adaptive_sink_t : public draw_sink_t
+{
+    public:
+        adaptive_sink_t(const adaptive_settings_t& settings_inp, Mat_t& beta_draws_inp, Mat_t& z_draws_inp, ColVec_t& sigma_draws_inp, const bool keep_z_inp)
+            : settings(settings_inp), beta_draws(beta_draws_inp), z_draws(z_draws_inp), sigma_draws(sigma_draws_inp), keep_z(keep_z_inp)
+        {
+            settings.check_interval = std::max(settings.check_interval, size_t(1));
+            settings.max_burnin_draws = std::min(settings.max_burnin_draws, settings.max_draws);
+        }
+
+        void begin(const size_t n_inp, const size_t K_inp, const size_t n_keep_draws) override
+        {
+            (void)(n_keep_draws);
+
+            n = n_inp;
+            K = K_inp;
+
+            in_burnin = true;
+            stop_flag = false;
+            n_pushed = 0;
+            n_burnin_pushed = 0;
+            n_kept = 0;
+
+            result = adaptive_result_t();
+
+            burnin_draws.resize(K + 1, std::min(settings.max_burnin_draws, settings.check_interval * 8));
+
+            if (settings.max_burnin_draws == 0) {
+                end_burnin(false);
+            }
+
+            beta_draws.resize(K, 0);
+            z_draws.resize(keep_z ? n : 0, 0);
+            sigma_draws.resize(0);
+        }
+
+        void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) override
+        {
+            (void)(draw_ind);
+
+            ++n_pushed;
+
+            if (in_burnin) {
+                if (n_burnin_pushed == size_t(burnin_draws.cols())) {
+                    burnin_draws.conservativeResize(Eigen::NoChange, std::min(2 * n_burnin_pushed, settings.max_burnin_draws));
+                }
+
+                burnin_draws.col(n_burnin_pushed).head(K) = beta_draw;
+                burnin_draws(K, n_burnin_pushed) = sigma_draw;
+
+                ++n_burnin_pushed;
+
+                if (n_burnin_pushed >= settings.max_burnin_draws) {
+                    end_burnin(false);
+                } else if (n_burnin_pushed >= settings.min_burnin_draws && n_burnin_pushed % settings.check_interval == 0) {
+                    check_burnin();
+                }
+            } else {
+                if (n_kept == size_t(sigma_draws.size())) {
+                    grow_keep_buffers();
+                }
+
+                beta_draws.col(n_kept) = beta_draw;
+                sigma_draws(n_kept) = sigma_draw;
+
+                if (keep_z) {
+                    z_draws.col(n_kept) = z_draw;
+                }
+
+                ++n_kept;
+
+                if (n_kept >= settings.min_keep_draws && n_kept % settings.check_interval == 0) {
+                    check_targets();
+                }
+            }
+
+            if (n_pushed >= settings.max_draws) {
+                stop_flag = true;
+            }
+        }
+
+        void end() override
+        {
+            beta_draws.conservativeResize(Eigen::NoChange, n_kept);
+            z_draws.conservativeResize(Eigen::NoChange, keep_z ? n_kept : 0);
+            sigma_draws.conservativeResize(n_kept);
+
+            result.n_burnin_draws = n_burnin_pushed;
+            result.n_keep_draws = n_kept;
+
+            if (!result.targets_met) {
+                compute_keep_diagnostics();
+            }
+        }
+
+        bool wants_z() const override { return keep_z && !in_burnin; }
+
+        bool stop_requested() const override { return stop_flag; }
+
+        /**
+         * @return the outcome of the last run
+         */
+
+        const adaptive_result_t& get_result() const { return result; }
+
+    private:
+        adaptive_settings_t settings;
+
+        Mat_t& beta_draws;
+        Mat_t& z_draws;
+        ColVec_t& sigma_draws;
+        bool keep_z;
+
+        size_t n = 0;
+        size_t K = 0;
+
+        bool in_burnin = true;
+        bool stop_flag = false;
+        size_t n_pushed = 0;
+        size_t n_burnin_pushed = 0;
+        size_t n_kept = 0;
+
+        Mat_t burnin_draws; // (K + 1) x capacity: beta, then sigma
+
+        adaptive_result_t result;
+
+        void end_burnin(const bool converged)
+        {
+            in_burnin = false;
+            result.burnin_converged = converged;
+
+            if (!converged) {
+                result.rhat = (n_burnin_pushed >= 8) ? burnin_rhat() : ColVec_t::Constant(K + 1, std::numeric_limits<fp_t>::quiet_NaN());
+            }
+
+            burnin_draws.resize(0, 0);
+        }
+
+        // split R-hat of the second half of the burn-in draws, cut into four segments
+
+        ColVec_t burnin_rhat() const
+        {
+            const size_t n_window = n_burnin_pushed / 2;
+
+            ColVec_t rhat_vec(K + 1);
+            Mat_t param_draws(n_window / 2, 2);
+
+            for (size_t k = 0; k < K + 1; ++k) {
+                const auto window_draws = burnin_draws.row(k).segment(n_burnin_pushed - n_window, n_window);
+
+                param_draws.col(0) = window_draws.head(n_window / 2).transpose();
+                param_draws.col(1) = window_draws.tail(n_window / 2).transpose();
+
+                rhat_vec(k) = split_rhat(param_draws);
+            }
+
+            return rhat_vec;
+        }
+
+        void check_burnin()
+        {
+            const size_t n_window = n_burnin_pushed / 2;
+
+            for (size_t k = 0; k < K + 1; ++k) {
+                const ColVec_t window_draws = burnin_draws.row(k).segment(n_burnin_pushed - n_window, n_window).transpose();
+
+                if (!(std::abs(geweke_z(window_draws)) <= settings.geweke_z_max)) {
+                    return;
+                }
+            }
+
+            // the rank-based R-hat is the more expensive test, so it runs only once every Geweke test has passed
+
+            const ColVec_t rhat_vec = burnin_rhat();
+
+            for (size_t k = 0; k < K + 1; ++k) {
+                // NaN for a constant parameter (e.g., a fixed sigma)
+                if (rhat_vec(k) > settings.rhat_max) {
+                    return;
+                }
+            }
+
+            result.rhat = rhat_vec;
+
+            end_burnin(true);
+        }
+
+        void grow_keep_buffers()
+        {
+            const size_t max_keep_draws = settings.max_draws - n_burnin_pushed;
+            const size_t new_size = std::min(std::max(2 * n_kept, settings.check_interval * 8), max_keep_draws);
+
+            beta_draws.conservativeResize(Eigen::NoChange, new_size);
+            sigma_draws.conservativeResize(new_size);
+
+            if (keep_z) {
+                z_draws.conservativeResize(Eigen::NoChange, new_size);
+            }
+        }
+
+        void compute_keep_diagnostics()
+        {
+            result.ess.resize(K + 1);
+            result.mcse.resize(K + 1);
+
+            ColVec_t param_draws;
+
+            for (size_t k = 0; k < K + 1; ++k) {
+                if (k < K) {
+                    param_draws = beta_draws.row(k).head(n_kept).transpose();
+                } else {
+                    param_draws = sigma_draws.head(n_kept);
+                }
+
+                const fp_t lr_var_val = batch_means_var(param_draws);
+                const fp_t var_val = (n_kept > 1) ? (param_draws.array() - param_draws.mean()).square().sum() / fp_t(n_kept - 1) : fp_t(0);
+
+                if (lr_var_val > fp_t(0)) {
+                    result.ess(k) = std::min(fp_t(n_kept) * var_val / lr_var_val, fp_t(n_kept));
+                    result.mcse(k) = std::sqrt(lr_var_val / n_kept);
+                } else if (var_val == fp_t(0) && n_kept > 0) {
+                    // constant parameter
+                    result.ess(k) = fp_t(n_kept);
+                    result.mcse(k) = fp_t(0);
+                } else {
+                    result.ess(k) = std::numeric_limits<fp_t>::quiet_NaN();
+                    result.mcse(k) = std::numeric_limits<fp_t>::quiet_NaN();
+                }
+            }
+        }
+
+        void check_targets()
+        {
+            compute_keep_diagnostics();
+
+            // NaN entries fail both comparisons
+
+            const bool ess_met = (settings.target_ess <= fp_t(0)) || (result.ess.array() >= settings.target_ess).all();
+            const bool mcse_met = (settings.target_mcse <= fp_t(0)) || (result.mcse.array() <= settings.target_mcse).all();
+
+            if (ess_met && mcse_met) {
+                result.targets_met = true;
+                stop_flag = true;
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,523 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Runtime tuning of the thread counts
+ *
+ * A few timed calibration passes on the data to be sampled choose the number of threads for
+ * each parallel phase of the sampler: the one-off Gram pass of the setup and the data pass run
+ * at every iteration. One thread is the serial path. Thread counts are tried in doubling steps,
+ * and more threads are used only while they cut the time of a pass by BQREG_AUTOTUNE_MIN_GAIN,
+ * so small problems stay serial and large ones stop adding threads once scaling flattens out.
+ *
+ * The passes are those of the fit: the same data-pass variant (see get_data_pass_variant) and, for
+ * small K, the same packed outer-product cache (see outer_prod_cache_t).
+ *
+ * The choice is cached per (host, n, K, storage and kernel, thread cap) for the life of the process
+ * and, optionally, in a text file, so later fits on data of the same shape skip the calibration.
+ *
+ * The row block size is not tuned: it fixes the partition of the reductions, so (unlike the
+ * thread count) it changes the draws, and a per-host choice would make them host-dependent.
+ */
+
+#ifndef _bqreg_autotune_HPP
+#define _bqreg_autotune_HPP
+
+// timed passes per candidate thread count (after one untimed warm-up pass)
+
+#ifndef BQREG_AUTOTUNE_PASSES
+    #define BQREG_AUTOTUNE_PASSES 3
+#endif
+
+// relative reduction in the time of a pass needed to move to the next thread count
+
+#ifndef BQREG_AUTOTUNE_MIN_GAIN
+    #define BQREG_AUTOTUNE_MIN_GAIN 0.1
+#endif
+
+struct sampler_tuning_t
+{
+    int setup_n_threads = 1;     // the initial Gram pass
+    int data_pass_n_threads = 1; // the per-iteration data pass
+
+    double data_pass_seconds = 0;   // time of one data pass with data_pass_n_threads
+    double calibration_seconds = 0; // zero if the choice came from the cache
+    bool from_cache = false;
+};
+
+struct tuning_key_t
+{
+    std::string host;
+    size_t n = 0;
+    size_t K = 0;
+    std::string storage;
+    int max_n_threads = 1;
+
+    std::string to_string() const
+    {
+        return host + " " + std::to_string(n) + " " + std::to_string(K) + " " + storage + " " + std::to_string(max_n_threads);
+    }
+};
+
+// the host name and the number of logical cores
+
+inline
+std::string
+get_tuning_host()
+{
+    char host_name[256] = { 0 };
+
+    if (gethostname(host_name, sizeof(host_name) - 1) != 0 || host_name[0] == '\0') {
+        std::strcpy(host_name, "localhost");
+    }
+
+    std::string host(host_name);
+    std::replace(host.begin(), host.end(), ' ', '_');
+
+    return host + "/" + std::to_string(std::max(1U, std::thread::hardware_concurrency()));
+}
+
+template<typename DataMat_t>
+inline
+std::string
+get_tuning_storage(const DataMat_t& X)
+{
+    (void)(X);
+    return sizeof(typename DataMat_t::Scalar) == sizeof(float) ? "float" : "dense";
+}
+
+inline
+std::string
+get_tuning_storage(const SpMat_t& X)
+{
+    (void)(X);
+    return "sparse";
+}
+
+// whether the sampler packs the outer products of the rows of X; never for a sparse X
+
+template<typename DataMat_t>
+inline
+bool
+get_tuning_outer_cache(const DataMat_t& X, const size_t outer_cache_max_bytes)
+{
+    return X.rows() >= X.cols() && use_outer_prod_cache(X.rows(), X.cols(), outer_cache_max_bytes);
+}
+
+inline
+bool
+get_tuning_outer_cache(const SpMat_t& X, const size_t outer_cache_max_bytes)
+{
+    (void)(X); (void)(outer_cache_max_bytes);
+    return false;
+}
+
+// the kernel of the data pass, appended to the storage in the key, e.g. "dense+cache+v1"
+
+inline
+std::string
+get_tuning_kernel(const bool use_outer_cache, const int pass_variant)
+{
+    return std::string(use_outer_cache ? "+cache" : "") + "+v" + std::to_string(pass_variant);
+}
+
+/**
+ * Tuning decisions, keyed by tuning_key_t; shared by all samplers in the process
+ */
+
+class tuning_cache_t
+{
+    public:
+        bool find(const tuning_key_t& key, sampler_tuning_t& tuning)
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+
+            auto it = entries.find(key.to_string());
+
+            if (it == entries.end()) {
+                return false;
+            }
+
+            tuning = it->second;
+            tuning.calibration_seconds = 0;
+            tuning.from_cache = true;
+
+            return true;
+        }
+
+        void insert(const tuning_key_t& key, const sampler_tuning_t& tuning)
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+
+            entries[key.to_string()] = tuning;
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+
+            entries.clear();
+        }
+
+        /**
+         * Merge the entries of a cache file, one per line:
+         * host n K storage max_n_threads setup_n_threads data_pass_n_threads data_pass_seconds.
+         * A missing file is not an error, and malformed lines are skipped.
+         */
+
+        void load(const std::string& file_path)
+        {
+            std::ifstream in_stream(file_path);
+
+            if (!in_stream) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(cache_mutex);
+
+            std::string line;
+
+            while (std::getline(in_stream, line)) {
+                std::istringstream line_stream(line);
+
+                tuning_key_t key;
+                sampler_tuning_t tuning;
+
+                if (line_stream >> key.host >> key.n >> key.K >> key.storage >> key.max_n_threads
+                                >> tuning.setup_n_threads >> tuning.data_pass_n_threads >> tuning.data_pass_seconds) {
+                    if (tuning.setup_n_threads > 0 && tuning.data_pass_n_threads > 0) {
+                        entries[key.to_string()] = tuning;
+                    }
+                }
+            }
+        }
+
+        // write all entries, through a temporary file so that a reader never sees a partial file
+
+        void save(const std::string& file_path)
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+
+            const std::string tmp_path = file_path + ".tmp";
+
+            {
+                std::ofstream out_stream(tmp_path, std::ios::trunc);
+
+                if (!out_stream) {
+                    throw std::runtime_error("bqreg: could not create the tuning cache file " + tmp_path);
+                }
+
+                for (const auto& entry : entries) {
+                    out_stream << entry.first << " " << entry.second.setup_n_threads << " " << entry.second.data_pass_n_threads
+                               << " " << entry.second.data_pass_seconds << "\n";
+                }
+
+                if (!out_stream) {
+                    throw std::runtime_error("bqreg: could not write the tuning cache file " + tmp_path);
+                }
+            }
+
+            if (std::rename(tmp_path.c_str(), file_path.c_str()) != 0) {
+                throw std::runtime_error("bqreg: could not move the tuning cache file into place at " + file_path);
+            }
+        }
+
+    private:
+        std::mutex cache_mutex;
+        std::map<std::string, sampler_tuning_t> entries;
+};
+
+inline
+tuning_cache_t&
+get_tuning_cache()
+{
+    static tuning_cache_t tuning_cache;
+    return tuning_cache;
+}
+
+/*
+ * Calibration
+ */
+
+// fastest of the timed calls of pass_fn, after one warm-up call
+
+template<typename PassFn_t>
+inline
+double
+time_tuning_pass(PassFn_t&& pass_fn)
+{
+    double best_seconds = std::numeric_limits<double>::max();
+
+    for (size_t pass_ind = 0; pass_ind <= size_t(BQREG_AUTOTUNE_PASSES); ++pass_ind) {
+        const auto start_time = std::chrono::steady_clock::now();
+
+        pass_fn();
+
+        const double pass_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+        if (pass_ind > 0) {
+            best_seconds = std::min(best_seconds, pass_seconds);
+        }
+    }
+
+    return best_seconds;
+}
+
+// try 1, 2, 4, ..., max_n_threads threads; stop at the first step that does not pay off
+
+template<typename PassFn_t>
+inline
+int
+tune_pass_threads(const int max_n_threads, PassFn_t&& pass_fn, double& best_seconds)
+{
+    int best_n_threads = 1;
+    best_seconds = time_tuning_pass([&]() { pass_fn(1); });
+
+    for (int n_threads = 2; best_n_threads < max_n_threads; n_threads *= 2) {
+        n_threads = std::min(n_threads, max_n_threads);
+
+        const double pass_seconds = time_tuning_pass([&]() { pass_fn(n_threads); });
+
+        if (pass_seconds > (1 - BQREG_AUTOTUNE_MIN_GAIN) * best_seconds) {
+            break;
+        }
+
+        best_n_threads = n_threads;
+        best_seconds = pass_seconds;
+    }
+
+    return best_n_threads;
+}
+
+/**
+ * Choose the thread counts of the sampler phases by timing them on (Y, X)
+ *
+ * The passes run at a fixed, representative state (beta = 0, sigma = 1) with the kernel of the
+ * fit: the data-pass variant for tau and keep_sigma_fixed, and the outer-product cache if the fit
+ * would build it; their output is discarded. For n < K the data pass is the nu-only pass of the
+ * Woodbury sampler.
+ *
+ * @param Y an n x 1 vector
+ * @param X an n x K matrix
+ * @param max_n_threads the largest number of threads to try
+ * @param tau the quantile of the fit
+ * @param keep_sigma_fixed whether the fit holds sigma fixed
+ * @param outer_cache_max_bytes the budget of the outer-product cache of the fit; 0 if it is off
+ * @return the thread counts, with the time of one data pass
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+sampler_tuning_t
+calibrate_sampler_threads(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const int max_n_threads,
+    const fp_t tau = fp_t(0.5),
+    const bool keep_sigma_fixed = false,
+    const size_t outer_cache_max_bytes = BQREG_OUTER_CACHE_MAX_BYTES
+)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    const fp_t theta_par = (1 - 2 * tau) / (tau * (1 - tau));
+    const fp_t omega_sq_par = 2 / (tau * (1 - tau));
+    const fp_t sigma_draw = 1;
+
+    const ColVec_t beta_draw = ColVec_t::Zero(K);
+    const counter_rng_t rng(0, 0);
+
+    reduction_slots_t slots_ws;
+    ColVec_t nu_draw = ColVec_t::Ones(n);
+    Mat_t gram_mat;
+    ColVec_t gram_vec;
+    fp_t sum_nu, sum_err_val;
+
+    sampler_tuning_t tuning;
+
+    if (n < K) {
+        tuning.data_pass_n_threads = tune_pass_threads(max_n_threads, [&](const int n_threads) {
+            qr_nu_pass(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, n_threads, rng, slots_ws, nu_draw, sum_nu, sum_err_val);
+        }, tuning.data_pass_seconds);
+
+        tuning.setup_n_threads = tuning.data_pass_n_threads;
+    } else {
+        outer_prod_cache_t outer_cache;
+
+        if (get_tuning_outer_cache(X, outer_cache_max_bytes)) {
+            build_outer_prod_cache(X, n, max_n_threads, outer_cache);
+        }
+
+        const outer_prod_cache_t* outer_cache_ptr = outer_cache.is_built() ? &outer_cache : nullptr;
+        const int pass_variant = get_data_pass_variant(theta_par, keep_sigma_fixed);
+
+        tuning.data_pass_n_threads = tune_pass_threads(max_n_threads, [&](const int n_threads) {
+            qr_data_pass(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, n_threads, rng, slots_ws, nu_draw, gram_mat, gram_vec, sum_nu, sum_err_val,
+                         nullptr, pass_variant, outer_cache_ptr);
+        }, tuning.data_pass_seconds);
+
+        // the setup pass has no random draws, so it is more often bound by memory than the data pass
+
+        double setup_seconds = 0;
+
+        tuning.setup_n_threads = tune_pass_threads(max_n_threads, [&](const int n_threads) {
+            qr_gram_pass(Y, X, nu_draw, theta_par, n_threads, gram_mat, gram_vec);
+        }, setup_seconds);
+    }
+
+    tuning.calibration_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    return tuning;
+}
+
+// a sparse X with the sparse precision sampler (see use_sparse_precision, with the default diagonal prior) is timed on its sparse Gram kernels
+
+template<typename DataVec_t>
+inline
+sampler_tuning_t
+calibrate_sampler_threads(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const int max_n_threads,
+    const fp_t tau = fp_t(0.5),
+    const bool keep_sigma_fixed = false,
+    const size_t outer_cache_max_bytes = 0 // unused: sparse rows are not cached
+)
+{
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    SpMatCSC_t prior_prec_lower(K,K);
+    prior_prec_lower.setIdentity();
+
+    sparse_reduction_slots_t slots_ws;
+
+    if (!use_sparse_precision(X, prior_prec_lower, &slots_ws.gram_pattern)) {
+        return calibrate_sampler_threads<DataVec_t, SpMat_t>(Y, X, max_n_threads, tau, keep_sigma_fixed, outer_cache_max_bytes);
+    }
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    // the sparse Gram kernels have no variants
+
+    (void)(keep_sigma_fixed);
+
+    const fp_t theta_par = (1 - 2 * tau) / (tau * (1 - tau));
+    const fp_t omega_sq_par = 2 / (tau * (1 - tau));
+    const fp_t sigma_draw = 1;
+
+    const ColVec_t beta_draw = ColVec_t::Zero(K);
+    const counter_rng_t rng(0, 0);
+
+    ColVec_t nu_draw = ColVec_t::Ones(n);
+    SpMatCSC_t gram_mat;
+    ColVec_t gram_vec;
+    fp_t sum_nu, sum_err_val;
+
+    sampler_tuning_t tuning;
+    double setup_seconds = 0;
+
+    tuning.setup_n_threads = tune_pass_threads(max_n_threads, [&](const int n_threads) {
+        qr_gram_pass(Y, X, nu_draw, theta_par, n_threads, slots_ws, gram_mat, gram_vec);
+    }, setup_seconds);
+
+    tuning.data_pass_n_threads = tune_pass_threads(max_n_threads, [&](const int n_threads) {
+        qr_data_pass(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, n_threads, rng, slots_ws, nu_draw, gram_mat, gram_vec, sum_nu, sum_err_val);
+    }, tuning.data_pass_seconds);
+
+    tuning.calibration_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    return tuning;
+}
+
+/**
+ * Thread counts for sampling (Y, X), from the cache or by calibration
+ *
+ * @param Y an n x 1 vector
+ * @param X an n x K matrix
+ * @param max_n_threads the largest number of threads to use
+ * @param cache_path an optional file that holds the decisions across processes; read before the
+ * cache is searched, and rewritten after a calibration
+ * @param tau the quantile of the fit
+ * @param keep_sigma_fixed whether the fit holds sigma fixed
+ * @param outer_cache_max_bytes the budget of the outer-product cache of the fit; 0 if it is off
+ * @return the thread counts
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+sampler_tuning_t
+tune_sampler_threads(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    int max_n_threads,
+    const std::string& cache_path = "",
+    const fp_t tau = fp_t(0.5),
+    const bool keep_sigma_fixed = false,
+    const size_t outer_cache_max_bytes = BQREG_OUTER_CACHE_MAX_BYTES
+)
+{
+#ifdef BQREG_USE_OPENMP
+    if (max_n_threads <= 0) {
+        max_n_threads = omp_get_max_threads();
+    }
+#else
+    max_n_threads = 1;
+#endif
+
+    tuning_key_t key;
+
+    key.host = get_tuning_host();
+    key.n = Y.size();
+    key.K = X.cols();
+    key.storage = get_tuning_storage(X) + get_tuning_kernel(get_tuning_outer_cache(X, outer_cache_max_bytes), get_data_pass_variant((1 - 2 * tau) / (tau * (1 - tau)), keep_sigma_fixed));
+    key.max_n_threads = max_n_threads;
+
+    tuning_cache_t& tuning_cache = get_tuning_cache();
+
+    if (!cache_path.empty()) {
+        tuning_cache.load(cache_path);
+    }
+
+    sampler_tuning_t tuning;
+
+    if (tuning_cache.find(key, tuning)) {
+        return tuning;
+    }
+
+    if (max_n_threads == 1) {
+        return tuning;
+    }
+
+    tuning = calibrate_sampler_threads(Y, X, max_n_threads, tau, keep_sigma_fixed, outer_cache_max_bytes);
+
+    tuning_cache.insert(key, tuning);
+
+    if (!cache_path.empty()) {
+        tuning_cache.save(cache_path);
+    }
+
+    return tuning;
+}
+
+#endif
@@ -0,0 +1,271 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Batches of small, independent regressions
+ *
+ * Each problem (Y, X, tau, prior) runs its own chain on one thread, and the threads share the
+ * problems: they are ordered by decreasing cost (n K^2 per iteration) and handed out one at a
+ * time, so that the long problems start first and the short ones fill in at the end. Problems
+ * below BQREG_MIN_ROWS_PER_THREAD rows per thread gain nothing from a parallel data pass, and
+ * the per-iteration beta draws reuse their storage (see mvnorm_prec_ws_t), which is most of the
+ * cost beyond the data pass when K is small.
+ *
+ * The kept draws of beta and sigma for all problems are written into one arena, allocated once;
+ * z is not stored. Problem p uses chain index p of one seed (as qr_gibbs_multi_chain), so its
+ * draws do not depend on the number of threads or on the other problems in the batch.
+ */
+
+#ifndef _bqreg_batch_HPP
+#define _bqreg_batch_HPP
+
+/**
+ * One problem of a batch; Y and X are used in place and must outlive the call
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+struct batch_problem_t
+{
+    const DataVec_t* Y = nullptr;
+    const DataMat_t* X = nullptr;
+
+    fp_t tau = fp_t(0.5);
+
+    ColVec_t prior_beta_mean; // empty: zero
+    Mat_t prior_beta_var;     // empty: identity
+    fp_t prior_sigma_shape = 3;
+    fp_t prior_sigma_scale = 3;
+};
+
+/**
+ * The draws of a batch: for problem p, the K_p x n_keep_draws draws of beta (column-major)
+ * followed by the n_keep_draws draws of sigma, starting at offsets[p] of the arena
+ */
+
+struct batch_result_t
+{
+    size_t n_keep_draws = 0;
+
+    std::vector<size_t> n_features;
+    std::vector<size_t> offsets;
+
+    ColVec_t arena;
+
+    Eigen::Map<const Mat_t> beta_draws(const size_t problem_ind) const
+    {
+        return Eigen::Map<const Mat_t>(arena.data() + offsets[problem_ind], n_features[problem_ind], n_keep_draws);
+    }
+
+    Eigen::Map<const ColVec_t> sigma_draws(const size_t problem_ind) const
+    {
+        return Eigen::Map<const ColVec_t>(arena.data() + offsets[problem_ind] + n_features[problem_ind] * n_keep_draws, n_keep_draws);
+    }
+};
+
+// writes the draws of one problem into its part of the arena
+
+class arena_sink_t : public draw_sink_t
+{
+    public:
+        arena_sink_t(fp_t* draws_ptr_inp, const size_t K_inp, const size_t n_keep_draws_inp)
+            : draws_ptr(draws_ptr_inp), K(K_inp), n_keep_draws(n_keep_draws_inp) {}
+
+        void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) override
+        {
+            (void)(z_draw);
+
+            Eigen::Map<ColVec_t>(draws_ptr + draw_ind * K, K) = beta_draw;
+            draws_ptr[K * n_keep_draws + draw_ind] = sigma_draw;
+        }
+
+        bool wants_z() const override { return false; }
+
+    private:
+        fp_t* draws_ptr;
+        size_t K;
+        size_t n_keep_draws;
+};
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+check_batch_problem(const batch_problem_t<DataVec_t,DataMat_t>& problem, const size_t problem_ind)
+{
+    const std::string problem_str = "bqreg: batch problem " + std::to_string(problem_ind) + ": ";
+
+    if (!problem.Y || !problem.X) {
+        throw std::invalid_argument(problem_str + "no data");
+    }
+
+    const size_t K = problem.X->cols();
+
+    if (size_t(problem.Y->size()) != size_t(problem.X->rows()) || problem.Y->size() == 0 || K == 0) {
+        throw std::invalid_argument(problem_str + "Y must have one element per row of X, and X must be nonempty");
+    }
+
+    if (!(problem.tau > 0 && problem.tau < 1)) {
+        throw std::invalid_argument(problem_str + "tau must be in (0,1)");
+    }
+
+    if (problem.prior_beta_mean.size() > 0 && size_t(problem.prior_beta_mean.size()) != K) {
+        throw std::invalid_argument(problem_str + "the prior mean of beta must have one element per column of X");
+    }
+
+    if (problem.prior_beta_var.size() > 0 && (size_t(problem.prior_beta_var.rows()) != K || size_t(problem.prior_beta_var.cols()) != K)) {
+        throw std::invalid_argument(problem_str + "the prior variance of beta must be K x K");
+    }
+}
+
+/**
+ * Sample a batch of independent problems
+ *
+ * @param problems the problems
+ * @param n_burnin_draws the number of burn-in draws
+ * @param n_keep_draws the number of post burn-in draws to keep
+ * @param thinning_factor the number of draws to skip between kept draws
+ * @param omp_n_threads the number of threads; a negative value selects half of the available threads
+ * @param seed_val the key of the counter-based generator, shared by all problems
+ * @param result the draws
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs_batch(
+    const std::vector<batch_problem_t<DataVec_t,DataMat_t>>& problems,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    int omp_n_threads,
+    const uint64_t seed_val,
+    batch_result_t& result
+)
+{
+#ifdef BQREG_USE_OPENMP
+    if (omp_n_threads < 0) {
+        omp_n_threads = std::max(1, static_cast<int>(omp_get_max_threads()) / 2);
+    }
+
+    if (omp_n_threads == 0) {
+        omp_n_threads = 1;
+    }
+#else
+    omp_n_threads = 1;
+#endif
+
+    const size_t n_problems = problems.size();
+
+    if (n_problems >= (size_t(1) << 24)) {
+        throw std::invalid_argument("bqreg: a batch holds at most 2^24 - 1 problems"); // the chain index of counter_rng_t
+    }
+
+    // the arena: one allocation for the draws of every problem
+
+    result.n_keep_draws = n_keep_draws;
+    result.n_features.resize(n_problems);
+    result.offsets.resize(n_problems);
+
+    size_t n_max = 0;
+    size_t arena_size = 0;
+
+    for (size_t p = 0; p < n_problems; ++p) {
+        check_batch_problem(problems[p], p);
+
+        result.n_features[p] = problems[p].X->cols();
+        result.offsets[p] = arena_size;
+
+        arena_size += (result.n_features[p] + 1) * n_keep_draws;
+        n_max = std::max(n_max, size_t(problems[p].Y->size()));
+    }
+
+    result.arena.setZero(arena_size);
+
+    // largest problems first
+
+    std::vector<size_t> problem_order(n_problems);
+    std::iota(problem_order.begin(), problem_order.end(), size_t(0));
+
+    std::stable_sort(problem_order.begin(), problem_order.end(), [&](const size_t p_a, const size_t p_b) {
+        return problems[p_a].Y->size() * result.n_features[p_a] * result.n_features[p_a] > problems[p_b].Y->size() * result.n_features[p_b] * result.n_features[p_b];
+    });
+
+    int n_outer_threads = 1;
+    int n_inner_threads = 1;
+
+    set_chain_threading(n_max, n_problems, omp_n_threads, n_outer_threads, n_inner_threads);
+
+    (void)(n_outer_threads); // for !BQREG_USE_OPENMP case
+
+    // exceptions cannot leave an OpenMP region, so they are passed out by hand
+
+    std::vector<std::exception_ptr> problem_exceptions(n_problems);
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel for num_threads(n_outer_threads) schedule(dynamic, 1)
+#endif
+    for (size_t order_ind = 0; order_ind < n_problems; ++order_ind) {
+        const size_t p = problem_order[order_ind];
+
+        try {
+            const batch_problem_t<DataVec_t,DataMat_t>& problem = problems[p];
+            const size_t K = result.n_features[p];
+
+            const ColVec_t prior_beta_mean = (problem.prior_beta_mean.size() > 0) ? problem.prior_beta_mean : ColVec_t::Zero(K);
+            const Mat_t prior_beta_var = (problem.prior_beta_var.size() > 0) ? problem.prior_beta_var : Mat_t::Identity(K,K);
+
+            counter_rng_t rng(seed_val, static_cast<uint32_t>(p));
+            arena_sink_t draw_sink(result.arena.data() + result.offsets[p], K, n_keep_draws);
+
+            qr_gibbs(*problem.Y, *problem.X, problem.tau, ColVec_t::Zero(K), prior_beta_mean, prior_beta_var, problem.prior_sigma_shape, problem.prior_sigma_scale,
+                     n_burnin_draws, n_keep_draws, thinning_factor, false, n_inner_threads, draw_sink, rng, nullptr, nullptr, 0, SAMPLER_SCHEME_STANDARD,
+                     BQREG_OUTER_CACHE_MAX_BYTES / n_outer_threads); // the concurrent runs share the cache budget
+        } catch (...) {
+            problem_exceptions[p] = std::current_exception();
+        }
+    }
+
+    for (size_t p = 0; p < n_problems; ++p) {
+        if (problem_exceptions[p]) {
+            std::rethrow_exception(problem_exceptions[p]);
+        }
+    }
+}
+
+// the generator key is drawn from rand_engine
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs_batch(
+    const std::vector<batch_problem_t<DataVec_t,DataMat_t>>& problems,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const int omp_n_threads,
+    rand_engine_t& rand_engine,
+    batch_result_t& result
+)
+{
+    const uint64_t seed_val = rand_engine();
+
+    qr_gibbs_batch(problems, n_burnin_draws, n_keep_draws, thinning_factor, omp_n_threads, seed_val, result);
+}
+
+#endif
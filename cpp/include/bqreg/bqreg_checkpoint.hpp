@@ -0,0 +1,552 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Checkpoint and resume
+ *
+ * The state of a chain between two iterations is (beta, nu, sigma), the data-pass products
+ * X' N^{-1} X and X' N^{-1} (Y - theta nu) for the current nu, and the position of the chain
+ * (iteration and kept-draw counts). Since every random draw is a function of
+ * (seed, chain, iteration, stream, index), the seed and chain index are the full state of
+ * the counter-based generator, and a chain resumed from a checkpoint continues bitwise
+ * identically to an uninterrupted run.
+ *
+ * File layout (native byte order; sizes and counts are uint64):
+ *
+ *   magic "BQREGCKP", version, sizeof(fp_t), seed, chain, tau (float64), n_burnin_draws,
+ *   n_keep_draws, thinning_factor, keep_sigma_fixed, n_iterations, n_saved, sigma_draw,
+ *   beta_draw, nu_draw, gram_vec (each: length, values), gram_mat (rows, cols, values),
+ *   sparse gram_mat (rows, cols, nnz, outer indices, inner indices, values), and the
+ *   state of the engine that seeded the chain (length, text)
+ *
+ * Checkpoints are written to a temporary file that is then renamed over the previous one,
+ * so an interrupted write leaves the last complete checkpoint in place.
+ */
+
+#ifndef _bqreg_checkpoint_HPP
+#define _bqreg_checkpoint_HPP
+
+#define BQREG_CHECKPOINT_VERSION 1
+
+/**
+ * State of a chain of the Gibbs sampler between two iterations
+ */
+
+struct sampler_state_t
+{
+    uint64_t seed_val = 0;       /*!< Key of the counter-based generator */
+    uint32_t chain_ind = 0;
+    std::string rand_engine_state; /*!< State of the engine that drew \c seed_val, just after the draw */
+
+    fp_t tau = fp_t(0.5);
+    size_t n_burnin_draws = 0;
+    size_t n_keep_draws = 0;
+    size_t thinning_factor = 0;
+    bool keep_sigma_fixed = false;
+
+    size_t n_iterations = 0; /*!< Number of completed iterations; the next has index \c n_iterations */
+    size_t n_saved = 0;      /*!< Number of kept draws produced so far */
+
+    ColVec_t beta_draw;
+    ColVec_t nu_draw;
+    fp_t sigma_draw = 0;
+
+    Mat_t gram_mat;         /*!< \f$ X^\top N^{-1} X \f$ for the current \f$ \nu \f$ (dense precision); empty otherwise */
+    SpMatCSC_t gram_mat_sp; /*!< The lower triangle of \f$ X^\top N^{-1} X \f$ (sparse precision); empty otherwise */
+    ColVec_t gram_vec;      /*!< \f$ X^\top N^{-1} (Y - \theta \nu) \f$; empty for the n-dimensional draw of \f$ \beta \f$ */
+
+    /**
+     * @return the total number of iterations of the run
+     */
+
+    size_t n_total_draws() const { return n_burnin_draws + (thinning_factor + 1) * n_keep_draws; }
+};
+
+// engine state as text (the format of operator<< for the standard engines)
+
+inline
+std::string
+rand_engine_to_string(const rand_engine_t& rand_engine)
+{
+    std::ostringstream state_stream;
+    state_stream << rand_engine;
+
+    return state_stream.str();
+}
+
+inline
+void
+rand_engine_from_string(const std::string& state_str, rand_engine_t& rand_engine)
+{
+    std::istringstream state_stream(state_str);
+    state_stream >> rand_engine;
+
+    if (state_stream.fail()) {
+        throw std::runtime_error("bqreg: invalid random engine state in checkpoint");
+    }
+}
+
+//
+// binary I/O
+
+template<typename T>
+inline
+void
+checkpoint_write_pod(std::ofstream& out_stream, const T& val)
+{
+    out_stream.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template<typename T>
+inline
+void
+checkpoint_write_array(std::ofstream& out_stream, const T* data_ptr, const size_t n_vals)
+{
+    if (n_vals > 0) {
+        out_stream.write(reinterpret_cast<const char*>(data_ptr), n_vals * sizeof(T));
+    }
+}
+
+template<typename T>
+inline
+T
+checkpoint_read_pod(std::ifstream& in_stream)
+{
+    T val;
+    in_stream.read(reinterpret_cast<char*>(&val), sizeof(T));
+
+    return val;
+}
+
+template<typename T>
+inline
+void
+checkpoint_read_array(std::ifstream& in_stream, T* data_ptr, const size_t n_vals)
+{
+    if (n_vals > 0) {
+        in_stream.read(reinterpret_cast<char*>(data_ptr), n_vals * sizeof(T));
+    }
+}
+
+// read the number of values of an array that follows it in the file; throws if the stream failed,
+// or if that many values of value_size bytes do not fit in the rest of the file
+
+inline
+size_t
+checkpoint_read_count(std::ifstream& in_stream, const size_t value_size, const uint64_t file_size, const std::string& file_path)
+{
+    const uint64_t n_vals = checkpoint_read_pod<uint64_t>(in_stream);
+    const std::streamoff pos = in_stream.tellg();
+
+    if (!in_stream || pos < 0) {
+        throw std::runtime_error("bqreg: the checkpoint file " + file_path + " is truncated");
+    }
+
+    if (n_vals > (file_size - uint64_t(pos)) / value_size) {
+        throw std::runtime_error("bqreg: the checkpoint file " + file_path + " is corrupt: an array runs past the end of the file");
+    }
+
+    return n_vals;
+}
+
+/**
+ * Write a sampler state to a checkpoint file
+ *
+ * @param file_path the path of the file; replaced atomically if it exists
+ * @param state the state to write
+ */
+
+inline
+void
+save_sampler_state(const std::string& file_path, const sampler_state_t& state)
+{
+    const std::string tmp_path = file_path + ".tmp";
+
+    {
+        std::ofstream out_stream(tmp_path, std::ios::binary | std::ios::trunc);
+
+        if (!out_stream) {
+            throw std::runtime_error("bqreg: could not create the checkpoint file " + tmp_path);
+        }
+
+        out_stream.write("BQREGCKP", 8);
+
+        checkpoint_write_pod<uint64_t>(out_stream, BQREG_CHECKPOINT_VERSION);
+        checkpoint_write_pod<uint64_t>(out_stream, sizeof(fp_t));
+        checkpoint_write_pod<uint64_t>(out_stream, state.seed_val);
+        checkpoint_write_pod<uint64_t>(out_stream, state.chain_ind);
+        checkpoint_write_pod<double>(out_stream, static_cast<double>(state.tau));
+        checkpoint_write_pod<uint64_t>(out_stream, state.n_burnin_draws);
+        checkpoint_write_pod<uint64_t>(out_stream, state.n_keep_draws);
+        checkpoint_write_pod<uint64_t>(out_stream, state.thinning_factor);
+        checkpoint_write_pod<uint64_t>(out_stream, state.keep_sigma_fixed);
+        checkpoint_write_pod<uint64_t>(out_stream, state.n_iterations);
+        checkpoint_write_pod<uint64_t>(out_stream, state.n_saved);
+        checkpoint_write_pod<fp_t>(out_stream, state.sigma_draw);
+
+        for (const ColVec_t* vec : {&state.beta_draw, &state.nu_draw, &state.gram_vec}) {
+            checkpoint_write_pod<uint64_t>(out_stream, vec->size());
+            checkpoint_write_array(out_stream, vec->data(), vec->size());
+        }
+
+        checkpoint_write_pod<uint64_t>(out_stream, state.gram_mat.rows());
+        checkpoint_write_pod<uint64_t>(out_stream, state.gram_mat.cols());
+        checkpoint_write_array(out_stream, state.gram_mat.data(), state.gram_mat.size());
+
+        SpMatCSC_t gram_mat_sp = state.gram_mat_sp;
+        gram_mat_sp.makeCompressed();
+
+        const size_t nnz_sp = gram_mat_sp.nonZeros();
+
+        checkpoint_write_pod<uint64_t>(out_stream, gram_mat_sp.rows());
+        checkpoint_write_pod<uint64_t>(out_stream, gram_mat_sp.cols());
+        checkpoint_write_pod<uint64_t>(out_stream, nnz_sp);
+
+        if (gram_mat_sp.cols() > 0) {
+            checkpoint_write_array(out_stream, gram_mat_sp.outerIndexPtr(), gram_mat_sp.cols() + 1);
+            checkpoint_write_array(out_stream, gram_mat_sp.innerIndexPtr(), nnz_sp);
+            checkpoint_write_array(out_stream, gram_mat_sp.valuePtr(), nnz_sp);
+        }
+
+        checkpoint_write_pod<uint64_t>(out_stream, state.rand_engine_state.size());
+        checkpoint_write_array(out_stream, state.rand_engine_state.data(), state.rand_engine_state.size());
+
+        out_stream.flush();
+
+        if (!out_stream) {
+            throw std::runtime_error("bqreg: could not write the checkpoint file " + tmp_path);
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), file_path.c_str()) != 0) {
+        throw std::runtime_error("bqreg: could not move the checkpoint file into place at " + file_path);
+    }
+}
+
+/**
+ * Read a sampler state from a checkpoint file
+ *
+ * @param file_path the path of a file written by \c save_sampler_state
+ * @return the sampler state
+ */
+
+inline
+sampler_state_t
+load_sampler_state(const std::string& file_path)
+{
+    std::ifstream in_stream(file_path, std::ios::binary | std::ios::ate);
+
+    if (!in_stream) {
+        throw std::runtime_error("bqreg: could not open the checkpoint file " + file_path);
+    }
+
+    const uint64_t file_size = uint64_t(in_stream.tellg());
+    in_stream.seekg(0);
+
+    const std::string truncated_msg = "bqreg: the checkpoint file " + file_path + " is truncated";
+    const std::string corrupt_msg = "bqreg: the checkpoint file " + file_path + " is corrupt: ";
+
+    char magic[8];
+    in_stream.read(magic, 8);
+
+    if (!in_stream || std::memcmp(magic, "BQREGCKP", 8) != 0 || checkpoint_read_pod<uint64_t>(in_stream) != BQREG_CHECKPOINT_VERSION) {
+        throw std::runtime_error("bqreg: " + file_path + " is not a checkpoint file (or has an unsupported version)");
+    }
+
+    if (checkpoint_read_pod<uint64_t>(in_stream) != sizeof(fp_t)) {
+        throw std::runtime_error("bqreg: the checkpoint file " + file_path + " was written with a different BQREG_FPN_TYPE");
+    }
+
+    sampler_state_t state;
+
+    state.seed_val = checkpoint_read_pod<uint64_t>(in_stream);
+    state.chain_ind = static_cast<uint32_t>(checkpoint_read_pod<uint64_t>(in_stream));
+    state.tau = static_cast<fp_t>(checkpoint_read_pod<double>(in_stream));
+    state.n_burnin_draws = checkpoint_read_pod<uint64_t>(in_stream);
+    state.n_keep_draws = checkpoint_read_pod<uint64_t>(in_stream);
+    state.thinning_factor = checkpoint_read_pod<uint64_t>(in_stream);
+    state.keep_sigma_fixed = checkpoint_read_pod<uint64_t>(in_stream) != 0;
+    state.n_iterations = checkpoint_read_pod<uint64_t>(in_stream);
+    state.n_saved = checkpoint_read_pod<uint64_t>(in_stream);
+    state.sigma_draw = checkpoint_read_pod<fp_t>(in_stream);
+
+    if (!in_stream) {
+        throw std::runtime_error(truncated_msg);
+    }
+
+    for (ColVec_t* vec : {&state.beta_draw, &state.nu_draw, &state.gram_vec}) {
+        vec->resize(checkpoint_read_count(in_stream, sizeof(fp_t), file_size, file_path));
+        checkpoint_read_array(in_stream, vec->data(), vec->size());
+    }
+
+    // K is the length of the chain state of beta; the data-pass products are either absent or K x K
+
+    const size_t K = state.beta_draw.size();
+
+    if (state.gram_vec.size() != 0 && size_t(state.gram_vec.size()) != K) {
+        throw std::runtime_error(corrupt_msg + "the length of X'N^{-1}Y does not match the number of features");
+    }
+
+    const size_t gram_rows = checkpoint_read_pod<uint64_t>(in_stream);
+    const size_t gram_cols = checkpoint_read_pod<uint64_t>(in_stream);
+
+    if (!in_stream) {
+        throw std::runtime_error(truncated_msg);
+    }
+
+    if (!( (gram_rows == 0 && gram_cols == 0) || (gram_rows == K && gram_cols == K) )) {
+        throw std::runtime_error(corrupt_msg + "the dimensions of the Gram matrix do not match the number of features");
+    }
+
+    if (gram_rows > 0 && gram_cols > (file_size / sizeof(fp_t)) / gram_rows) {
+        throw std::runtime_error(corrupt_msg + "the Gram matrix runs past the end of the file");
+    }
+
+    state.gram_mat.resize(gram_rows, gram_cols);
+    checkpoint_read_array(in_stream, state.gram_mat.data(), state.gram_mat.size());
+
+    const size_t gram_sp_rows = checkpoint_read_pod<uint64_t>(in_stream);
+    const size_t gram_sp_cols = checkpoint_read_pod<uint64_t>(in_stream);
+    const size_t nnz_sp = checkpoint_read_count(in_stream, sizeof(fp_t) + sizeof(SpMatCSC_t::StorageIndex), file_size, file_path);
+
+    if (!( (gram_sp_rows == 0 && gram_sp_cols == 0) || (gram_sp_rows == K && gram_sp_cols == K) )) {
+        throw std::runtime_error(corrupt_msg + "the dimensions of the sparse Gram matrix do not match the number of features");
+    }
+
+    if (nnz_sp > K * K) {
+        throw std::runtime_error(corrupt_msg + "the sparse Gram matrix has more nonzeros than entries");
+    }
+
+    state.gram_mat_sp.resize(gram_sp_rows, gram_sp_cols);
+
+    if (gram_sp_cols > 0) {
+        state.gram_mat_sp.resizeNonZeros(nnz_sp);
+
+        checkpoint_read_array(in_stream, state.gram_mat_sp.outerIndexPtr(), gram_sp_cols + 1);
+        checkpoint_read_array(in_stream, state.gram_mat_sp.innerIndexPtr(), nnz_sp);
+        checkpoint_read_array(in_stream, state.gram_mat_sp.valuePtr(), nnz_sp);
+
+        if (!in_stream) {
+            throw std::runtime_error(truncated_msg);
+        }
+
+        // the compressed storage: the outer index runs from 0 to nnz without decreasing, and
+        // each inner index is a row of the matrix
+
+        const SpMatCSC_t::StorageIndex* outer_ptr = state.gram_mat_sp.outerIndexPtr();
+        const SpMatCSC_t::StorageIndex* inner_ptr = state.gram_mat_sp.innerIndexPtr();
+
+        if (outer_ptr[0] != 0 || size_t(outer_ptr[gram_sp_cols]) != nnz_sp) {
+            throw std::runtime_error(corrupt_msg + "the outer index of the sparse Gram matrix does not run from 0 to the number of nonzeros");
+        }
+
+        for (size_t col_ind = 0; col_ind < gram_sp_cols; ++col_ind) {
+            if (outer_ptr[col_ind + 1] < outer_ptr[col_ind]) {
+                throw std::runtime_error(corrupt_msg + "the outer index of the sparse Gram matrix decreases");
+            }
+        }
+
+        for (size_t val_ind = 0; val_ind < nnz_sp; ++val_ind) {
+            if (inner_ptr[val_ind] < 0 || size_t(inner_ptr[val_ind]) >= gram_sp_rows) {
+                throw std::runtime_error(corrupt_msg + "an inner index of the sparse Gram matrix is not a row of the matrix");
+            }
+        }
+    }
+
+    state.rand_engine_state.resize(checkpoint_read_count(in_stream, 1, file_size, file_path));
+    checkpoint_read_array(in_stream, &state.rand_engine_state[0], state.rand_engine_state.size());
+
+    if (!in_stream) {
+        throw std::runtime_error(truncated_msg);
+    }
+
+    return state;
+}
+
+//
+// the data-pass products, for each form of the posterior precision
+
+inline
+void
+set_state_gram(sampler_state_t& state, const Mat_t& gram_mat, const ColVec_t& gram_vec)
+{
+    state.gram_mat = gram_mat;
+    state.gram_mat_sp.resize(0,0);
+    state.gram_vec = gram_vec;
+}
+
+inline
+void
+set_state_gram(sampler_state_t& state, const SpMatCSC_t& gram_mat, const ColVec_t& gram_vec)
+{
+    state.gram_mat.resize(0,0);
+    state.gram_mat_sp = gram_mat;
+    state.gram_vec = gram_vec;
+}
+
+// false if the state does not hold the products in this form (e.g., the window of rows changed); the sampler then recomputes them
+
+inline
+bool
+get_state_gram(const sampler_state_t& state, Mat_t& gram_mat, ColVec_t& gram_vec)
+{
+    if (state.gram_mat.cols() != state.beta_draw.size() || state.gram_vec.size() != state.beta_draw.size()) {
+        return false;
+    }
+
+    gram_mat = state.gram_mat;
+    gram_vec = state.gram_vec;
+
+    return true;
+}
+
+inline
+bool
+get_state_gram(const sampler_state_t& state, SpMatCSC_t& gram_mat, ColVec_t& gram_vec)
+{
+    if (state.gram_mat_sp.cols() != state.beta_draw.size() || state.gram_vec.size() != state.beta_draw.size()) {
+        return false;
+    }
+
+    gram_mat = state.gram_mat_sp;
+    gram_vec = state.gram_vec;
+
+    return true;
+}
+
+/**
+ * Checkpointing of a run of the Gibbs sampler
+ *
+ * The sampler copies its state into \c state every \c interval iterations, writing it to
+ * \c file_path if one is set, and once more at the end of the run, so that \c state always
+ * holds the final state of the last run. With \c resume set, the run continues from \c state
+ * instead of starting from the initial values. With \c warm_start set, a new run (a new key for
+ * the generator, and counts from zero) starts from the draws in \c state, e.g., after the window
+ * of rows moved (see bqreg_window.hpp).
+ */
+
+class sampler_checkpoint_t
+{
+    public:
+        std::string file_path; /*!< Where to write checkpoints; empty to keep the state in memory only */
+        size_t interval = 0;   /*!< Number of iterations between checkpoints; 0 for the final state only */
+        bool resume = false;   /*!< Continue from \c state */
+        bool warm_start = false; /*!< Start a new run from the draws in \c state */
+
+        sampler_state_t state;
+
+        /**
+         * Called by the sampler before the first iteration: record the run, or, on resume,
+         * check it against the saved state and set the generator to the saved seed
+         */
+
+        void begin_run(counter_rng_t& rng, const size_t n, const size_t K, const fp_t tau, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, const bool keep_sigma_fixed)
+        {
+            if (resume) {
+                if (size_t(state.beta_draw.size()) != K || size_t(state.nu_draw.size()) != n) {
+                    throw std::invalid_argument("bqreg: the dimensions of the data do not match the checkpoint");
+                }
+
+                if (tau != state.tau || n_burnin_draws != state.n_burnin_draws || thinning_factor != state.thinning_factor || keep_sigma_fixed != state.keep_sigma_fixed) {
+                    throw std::invalid_argument("bqreg: the settings of the run do not match the checkpoint");
+                }
+
+                if (n_keep_draws < state.n_saved) {
+                    throw std::invalid_argument("bqreg: a resumed run cannot keep fewer draws than the checkpoint already holds");
+                }
+
+                rng.seed_val = state.seed_val;
+                rng.chain_ind = state.chain_ind;
+            } else {
+                if (warm_start && (size_t(state.beta_draw.size()) != K || size_t(state.nu_draw.size()) != n)) {
+                    throw std::invalid_argument("bqreg: the dimensions of the data do not match the chain state of the warm start");
+                }
+
+                // the products are kept for a warm start, unless theta changed with tau
+
+                if (!warm_start || tau != state.tau) {
+                    state.gram_mat.resize(0,0);
+                    state.gram_mat_sp.resize(0,0);
+                    state.gram_vec.resize(0);
+                }
+
+                state.seed_val = rng.seed_val;
+                state.chain_ind = rng.chain_ind;
+                state.tau = tau;
+                state.n_burnin_draws = n_burnin_draws;
+                state.thinning_factor = thinning_factor;
+                state.keep_sigma_fixed = keep_sigma_fixed;
+                state.n_iterations = 0;
+                state.n_saved = 0;
+            }
+
+            state.n_keep_draws = n_keep_draws;
+        }
+
+        /**
+         * Called by the sampler after each iteration
+         *
+         * @param n_iterations the number of completed iterations
+         * @param n_saved the number of kept draws produced so far
+         * @param final_flag whether this is the last iteration of the run
+         */
+
+        template<typename GramMat_t>
+        void update(const size_t n_iterations, const size_t n_saved, const ColVec_t& beta_draw, const ColVec_t& nu_draw, const fp_t sigma_draw,
+                    const GramMat_t& gram_mat, const ColVec_t& gram_vec, const bool final_flag)
+        {
+            if (!is_due(n_iterations, final_flag)) {
+                return;
+            }
+
+            set_state_gram(state, gram_mat, gram_vec);
+
+            update(n_iterations, n_saved, beta_draw, nu_draw, sigma_draw, final_flag);
+        }
+
+        /**
+         * As above, for the n-dimensional draw of \f$ \beta \f$, which has no data-pass products to carry
+         */
+
+        void update(const size_t n_iterations, const size_t n_saved, const ColVec_t& beta_draw, const ColVec_t& nu_draw, const fp_t sigma_draw, const bool final_flag)
+        {
+            if (!is_due(n_iterations, final_flag)) {
+                return;
+            }
+
+            state.n_iterations = n_iterations;
+            state.n_saved = n_saved;
+            state.beta_draw = beta_draw;
+            state.nu_draw = nu_draw;
+            state.sigma_draw = sigma_draw;
+
+            if (!file_path.empty()) {
+                save_sampler_state(file_path, state);
+            }
+        }
+
+    private:
+        bool is_due(const size_t n_iterations, const bool final_flag) const
+        {
+            return final_flag || (interval > 0 && n_iterations % interval == 0);
+        }
+};
+
+#endif
@@ -116,6 +116,54 @@ class bqreg_t
         
         void set_omp_n_threads(const int omp_n_threads_inp);
 
+        /**
+         * Autotuning of the thread counts
+         * @brief Before each single-chain fit (\c gibbs, \c gibbs_to_file, \c gibbs_resume, \c gibbs_warm), time a few passes over the loaded data to choose the number of threads for each phase of the sampler, up to the value of \c set_omp_n_threads (all available threads if negative). The choice is cached per data shape and host; see bqreg_autotune.hpp.
+         *
+         * @param autotune_inp whether to autotune.
+         * @param cache_path_inp an optional text file that keeps the choices across processes.
+         */
+
+        void set_autotune(const bool autotune_inp, const std::string& cache_path_inp = "");
+
+        /**
+         * Autotuning result
+         *
+         * @return the thread counts used by the last autotuned fit.
+         */
+
+        const sampler_tuning_t& get_sampler_tuning() const;
+
+        /**
+         * Update scheme of the sampler
+         * @brief The collapsed and interweaved schemes change only the sigma step of each iteration, and usually give more effective draws per second for extreme values of tau; see bqreg_schemes.hpp. They apply to the single-chain fits (\c gibbs, \c gibbs_to_file, \c gibbs_resume, \c gibbs_warm) when n >= K.
+         *
+         * @param sampler_scheme_inp one of \c SAMPLER_SCHEME_STANDARD (the default), \c SAMPLER_SCHEME_COLLAPSED, or \c SAMPLER_SCHEME_INTERWEAVED.
+         */
+
+        void set_sampler_scheme(const sampler_scheme_t sampler_scheme_inp);
+
+        /**
+         * @return the update scheme of the sampler.
+         */
+
+        sampler_scheme_t get_sampler_scheme() const;
+
+        /**
+         * Memory budget of the packed outer-product cache
+         * @brief For dense data with at most \c BQREG_OUTER_CACHE_MAX_K features, the single-chain fits store the outer products of the rows once, as n x K(K+1)/2 values, when they fit in the budget; each iteration then forms the Gram matrix with one weighted GEMV instead of a rank update of each row block. See outer_prod_cache_t.
+         *
+         * @param outer_cache_max_bytes_inp the budget in bytes (\c BQREG_OUTER_CACHE_MAX_BYTES by default); 0 turns the cache off.
+         */
+
+        void set_outer_cache_budget(const size_t outer_cache_max_bytes_inp);
+
+        /**
+         * @return the memory budget of the packed outer-product cache, in bytes.
+         */
+
+        size_t get_outer_cache_budget() const;
+
         /**
          * RNG engine seeding
          *
@@ -133,6 +181,38 @@ class bqreg_t
 
         void load_data(const ColVec_t& Y_inp, const Mat_t& X_inp);
 
+        /**
+         * Load data stored in single precision
+         * @brief The data are kept in single precision, halving the memory traffic of each pass over \c X; all sampler arithmetic is still carried out in \c fp_t
+         *
+         * @param Y_inp an n x 1 vector defining the target variable
+         * @param X_inp an n x K matrix of features
+         *
+         * A template so that it does not collide with the overload above when \c fp_t is \c float, in which case the data are always stored in \c fp_t
+         */
+
+        template<typename T = fp_t>
+        void load_data(const ColVecF_t& Y_inp, const MatF_t& X_inp);
+
+        /**
+         * Load data with a sparse feature matrix
+         * @brief Each pass over \c X touches only the stored nonzeros; when \f$ X^\top X \f$ is itself sparse, the \f$ \beta \f$ draw uses a sparse Cholesky factorization
+         *
+         * @param Y_inp an n x 1 vector defining the target variable
+         * @param X_inp an n x K sparse matrix of features, stored by row
+         */
+
+        void load_data(const ColVec_t& Y_inp, const SpMat_t& X_inp);
+
+        /**
+         * Load data with a sparse feature matrix stored by column
+         *
+         * @param Y_inp an n x 1 vector defining the target variable
+         * @param X_inp an n x K sparse matrix of features, stored by column; converted to row storage
+         */
+
+        void load_data(const ColVec_t& Y_inp, const SpMatCSC_t& X_inp);
+
         /**
          * Set the target quantile value
          *
@@ -181,13 +261,289 @@ class bqreg_t
          */
 
         void gibbs(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, Mat_t& beta_draws, Mat_t& z_draws, ColVec_t& sigma_draws);
+
+        /**
+         * Run the Gibbs sampler, streaming the draws to a sink
+         *
+         * @param n_burnin_draws the number of burnin draws
+         * @param n_keep_draws the number of draws to keep, post burnin
+         * @param thinning_factor the number of draws to skip between keep draws
+         * @param draw_sink an object derived from \c draw_sink_t that receives each kept draw as it is produced
+         */
+
+        void gibbs(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, draw_sink_t& draw_sink);
+
+        /**
+         * Run the Gibbs sampler in adaptive mode
+         * @brief The burn-in ends when running Geweke and split R-hat checks pass, and sampling stops once the ESS and Monte Carlo standard error targets are met, up to a hard cap on the number of draws
+         *
+         * @param settings the targets, the interval between checks, and the caps on the number of draws
+         * @param beta_draws a writable matrix to store the kept draws of \f$ \beta \f$
+         * @param z_draws a writable matrix to store the kept draws of \f$ z \f$; left empty if \c keep_z is false
+         * @param sigma_draws a writable vector to store the kept draws of \f$ \sigma \f$
+         * @param keep_z whether to store the draws of \f$ z \f$
+         * @return the number of burn-in and kept draws, whether the targets were met, and the final diagnostics
+         */
+
+        adaptive_result_t gibbs(const adaptive_settings_t& settings, Mat_t& beta_draws, Mat_t& z_draws, ColVec_t& sigma_draws, const bool keep_z = true);
+
+        /**
+         * Run the Gibbs sampler, writing the draws to a memory-mapped draw store file
+         *
+         * @param file_path the path of the draw store file to create
+         * @param n_burnin_draws the number of burnin draws
+         * @param n_keep_draws the number of draws to keep, post burnin
+         * @param thinning_factor the number of draws to skip between keep draws
+         * @param z_as_float store the draws of \f$ z \f$ in single precision
+         */
+
+        void gibbs_to_file(const std::string& file_path, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, const bool z_as_float);
+
+        /**
+         * Run the Gibbs sampler for a grid of quantiles
+         * @brief One chain per quantile value; the chains share a single pass over \c X per iteration
+         *
+         * @param tau_vec a vector of T quantile values, each between zero and one
+         * @param n_burnin_draws the number of burnin draws
+         * @param n_keep_draws the number of draws to keep, post burnin
+         * @param thinning_factor the number of draws to skip between keep draws
+         * @param beta_draws a writable vector of T matrices to store the draws of \f$ \beta \f$, indexed by tau
+         * @param z_draws a writable vector of T matrices to store the draws of \f$ z \f$, indexed by tau
+         * @param sigma_draws a writable n_keep_draws x T matrix to store the draws of \f$ \sigma \f$
+         */
+
+        void gibbs_multi_tau(const ColVec_t& tau_vec, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, std::vector<Mat_t>& beta_draws, std::vector<Mat_t>& z_draws, Mat_t& sigma_draws);
+
+        /**
+         * Run the Gibbs sampler for a grid of quantiles, streaming the draws to sinks
+         *
+         * @param tau_vec a vector of T quantile values, each between zero and one
+         * @param n_burnin_draws the number of burnin draws
+         * @param n_keep_draws the number of draws to keep, post burnin
+         * @param thinning_factor the number of draws to skip between keep draws
+         * @param draw_sinks T pointers to objects derived from \c draw_sink_t; sink t receives the kept draws for \c tau_vec(t)
+         */
+
+        void gibbs_multi_tau(const ColVec_t& tau_vec, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, const std::vector<draw_sink_t*>& draw_sinks);
+
+        /**
+         * Run multiple independent chains of the Gibbs sampler
+         * @brief The OpenMP threads are split between chains and rows depending on the number of chains and the size of the data
+         *
+         * @param n_chains the number of chains
+         * @param n_burnin_draws the number of burnin draws
+         * @param n_keep_draws the number of draws to keep, post burnin
+         * @param thinning_factor the number of draws to skip between keep draws
+         * @param beta_draws a writable vector of matrices to store the draws of \f$ \beta \f$, one per chain
+         * @param z_draws a writable vector of matrices to store the draws of \f$ z \f$, one per chain
+         * @param sigma_draws a writable n_keep_draws x n_chains matrix to store the draws of \f$ \sigma \f$
+         */
+
+        void gibbs_multi_chain(const size_t n_chains, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, std::vector<Mat_t>& beta_draws, std::vector<Mat_t>& z_draws, Mat_t& sigma_draws);
+
+        /**
+         * Run the Gibbs sampler on shards of the data and combine the draws
+         * @brief Divide-and-conquer sampling for large n: the rows are dealt round-robin into \c n_shards shards, each sampled independently under the prior raised to the power 1/n_shards, and the sub-posterior draws are combined. Unless sigma is fixed, the prior shape of \f$ \sigma \f$ must be above -1 (see bqreg_consensus.hpp)
+         *
+         * @param n_shards the number of shards
+         * @param n_burnin_draws the number of burnin draws per shard
+         * @param n_keep_draws the number of draws to keep per shard, post burnin; also the number of combined draws
+         * @param thinning_factor the number of draws to skip between keep draws
+         * @param use_kernel_combiner combine with the semiparametric kernel density product instead of consensus Monte Carlo weighted averaging
+         * @param beta_draws a writable matrix to store the combined draws of \f$ \beta \f$
+         * @param sigma_draws a writable vector to store the combined draws of \f$ \sigma \f$
+         */
+
+        void gibbs_consensus(const size_t n_shards, const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, const bool use_kernel_combiner, Mat_t& beta_draws, ColVec_t& sigma_draws);
+
+        /**
+         * Convergence diagnostics
+         * @brief Rank-normalized split R-hat, bulk-ESS, and tail-ESS computed from the output of \c gibbs_multi_chain
+         *
+         * @param beta_draws a vector of matrices of draws of \f$ \beta \f$, one per chain
+         * @param sigma_draws an n_keep_draws x n_chains matrix of draws of \f$ \sigma \f$
+         * @return the diagnostics for each element of \f$ \beta \f$ followed by \f$ \sigma \f$
+         */
+
+        convergence_diagnostics_t get_convergence_diagnostics(const std::vector<Mat_t>& beta_draws, const Mat_t& sigma_draws) const;
+
+        /**
+         * Sampler statistics
+         * @brief Per-phase wall time, thread load balance of the data pass, and workspace allocations; zero unless compiled with \c BQREG_ENABLE_SAMPLER_STATS
+         *
+         * @return the statistics of the last call of \c gibbs (or \c gibbs_to_file)
+         */
+
+        const sampler_stats_t& get_sampler_stats() const;
+
+        /**
+         * Posterior predictive summaries
+         * @brief The posterior mean and quantiles of \f$ x^\top \beta \f$ for each new row, computed in blocks of rows on the OpenMP threads, without forming the full matrix of predictions
+         *
+         * @param X_new an m x K matrix of features
+         * @param beta_draws a K x S matrix of draws of \f$ \beta \f$, e.g., from \c gibbs
+         * @param probs a vector of probabilities, e.g., (0.05, 0.5, 0.95) for the median and a 90% credible interval
+         * @param pred_mean a writable vector to store the m posterior means
+         * @param pred_quantiles a writable m x P matrix to store the quantiles, one column per value of \c probs
+         */
+
+        void predict(const Mat_t& X_new, const Eigen::Ref<const Mat_t>& beta_draws, const ColVec_t& probs, ColVec_t& pred_mean, Mat_t& pred_quantiles) const;
+
+        /**
+         * Posterior predictive summaries for sparse features
+         *
+         * @param X_new an m x K sparse matrix of features, stored by row
+         * @param beta_draws a K x S matrix of draws of \f$ \beta \f$
+         * @param probs a vector of probabilities
+         * @param pred_mean a writable vector to store the m posterior means
+         * @param pred_quantiles a writable m x P matrix to store the quantiles
+         */
+
+        void predict(const SpMat_t& X_new, const Eigen::Ref<const Mat_t>& beta_draws, const ColVec_t& probs, ColVec_t& pred_mean, Mat_t& pred_quantiles) const;
+
+        /**
+         * Posterior predictive summaries from a draw store
+         * @brief The draws of \f$ \beta \f$ are read through the memory map of the file, e.g., one written by \c gibbs_to_file
+         *
+         * @param X_new an m x K matrix of features
+         * @param file_path the path of the draw store file
+         * @param probs a vector of probabilities
+         * @param pred_mean a writable vector to store the m posterior means
+         * @param pred_quantiles a writable m x P matrix to store the quantiles
+         */
+
+        void predict(const Mat_t& X_new, const std::string& file_path, const ColVec_t& probs, ColVec_t& pred_mean, Mat_t& pred_quantiles) const;
+
+        /**
+         * Checkpointing
+         * @brief Write the state of the chain to a file every \c checkpoint_interval iterations of subsequent runs, and once more at the end of each run
+         *
+         * @param file_path the path of the checkpoint file; empty to keep only the final state, in memory
+         * @param checkpoint_interval the number of iterations between checkpoints
+         */
+
+        void set_checkpoint(const std::string& file_path, const size_t checkpoint_interval);
+
+        /**
+         * Sampler state
+         *
+         * @return the state of the chain at the end of the last run, e.g., to pass to \c gibbs_resume or \c save_sampler_state
+         */
+
+        const sampler_state_t& get_sampler_state() const;
+
+        /**
+         * Resume or extend a chain
+         * @brief Continue from a checkpoint, e.g., one read with \c load_sampler_state; the draws are bitwise identical to those of an uninterrupted run
+         *
+         * @param state the state to continue from; its quantile value and burn-in and thinning settings are used
+         * @param n_extra_keep_draws the number of kept draws to add to the planned length of the run; 0 to finish an interrupted run
+         * @param draw_sink an object derived from \c draw_sink_t that receives the kept draws after the checkpoint, indexed from zero
+         */
+
+        void gibbs_resume(const sampler_state_t& state, const size_t n_extra_keep_draws, draw_sink_t& draw_sink);
+
+        /**
+         * Resume or extend a chain
+         *
+         * @param state the state to continue from
+         * @param n_extra_keep_draws the number of kept draws to add to the planned length of the run; 0 to finish an interrupted run
+         * @param beta_draws a writable matrix to store the draws of \f$ \beta \f$ after the checkpoint
+         * @param z_draws a writable matrix to store the draws of \f$ z \f$ after the checkpoint
+         * @param sigma_draws a writable vector to store the draws of \f$ \sigma \f$ after the checkpoint
+         */
+
+        void gibbs_resume(const sampler_state_t& state, const size_t n_extra_keep_draws, Mat_t& beta_draws, Mat_t& z_draws, ColVec_t& sigma_draws);
+
+        /**
+         * Append rows to the window of data
+         * @brief The rows are written into the slots of retired rows where possible, and the chain state of the last run is kept in step, so that \c gibbs_warm can start from it
+         *
+         * @param Y_new an m x 1 vector defining the target variable for the new rows
+         * @param X_new an m x K matrix of features for the new rows; converted to the storage format of the loaded data
+         */
+
+        void append_rows(const ColVec_t& Y_new, const Mat_t& X_new);
+
+        /**
+         * Append rows to the window of data
+         *
+         * @param Y_new an m x 1 vector defining the target variable for the new rows
+         * @param X_new an m x K sparse matrix of features for the new rows, stored by row
+         */
+
+        void append_rows(const ColVec_t& Y_new, const SpMat_t& X_new);
+
+        /**
+         * Retire the oldest rows from the window of data
+         * @brief The slots of the retired rows are refilled by later calls of \c append_rows; the contributions of the rows are removed from the chain state of the last run
+         *
+         * @param n_rows the number of rows to retire
+         */
+
+        void retire_rows(const size_t n_rows);
+
+        /**
+         * Window of data
+         * @brief Appended rows take the slots of retired rows, so the rows of \c X (and the columns of the \c z draws) are in slot order rather than time order
+         *
+         * @return the slot (row of \c X) of each row of the window, oldest first
+         */
+
+        std::vector<size_t> get_window_slots() const;
+
+        /**
+         * Run the Gibbs sampler from the state of the last run
+         * @brief After the window of data moved: \f$ \beta \f$, \f$ \sigma \f$, and the \f$ \nu \f$ draws of the retained rows carry over, so a short burn-in suffices; a cold start if there is no state for the current data
+         *
+         * @param n_burnin_draws the number of burnin draws
+         * @param n_keep_draws the number of draws to keep, post burnin
+         * @param thinning_factor the number of draws to skip between keep draws
+         * @param draw_sink an object derived from \c draw_sink_t that receives each kept draw as it is produced
+         */
+
+        void gibbs_warm(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, draw_sink_t& draw_sink);
+
+        /**
+         * Run the Gibbs sampler from the state of the last run
+         *
+         * @param n_burnin_draws the number of burnin draws
+         * @param n_keep_draws the number of draws to keep, post burnin
+         * @param thinning_factor the number of draws to skip between keep draws
+         * @param beta_draws a writable matrix to store the draws of \f$ \beta \f$
+         * @param z_draws a writable matrix to store the draws of \f$ z \f$
+         * @param sigma_draws a writable vector to store the draws of \f$ \sigma \f$
+         */
+
+        void gibbs_warm(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, Mat_t& beta_draws, Mat_t& z_draws, ColVec_t& sigma_draws);
     
     private:
         bool keep_sigma_fixed = false;
         int omp_n_threads = -1;
-        rand_engine_t rand_engine = rand_engine_t(std::random_device{}());
+        bool autotune = false;
+        std::string tuning_cache_path;
+        sampler_tuning_t sampler_tuning;
+        sampler_scheme_t sampler_scheme = SAMPLER_SCHEME_STANDARD;
+        size_t outer_cache_max_bytes = BQREG_OUTER_CACHE_MAX_BYTES;
+        size_t seed_val = std::random_device{}();
+        rand_engine_t rand_engine = rand_engine_t(seed_val);
 
         ColVec_t beta_initial_draw;
+
+        bool use_float_storage = false;
+        ColVecF_t Y_f;
+        MatF_t X_f;
+
+        bool use_sparse_storage = false;
+        SpMat_t X_sp;
+
+        sampler_stats_t sampler_stats;
+        sampler_checkpoint_t checkpoint;
+        row_window_t window;
+
+        size_t get_n_features() const;
+        void compact_window();
+        void run_gibbs(const size_t n_burnin_draws, const size_t n_keep_draws, const size_t thinning_factor, draw_sink_t& draw_sink);
 };
 
 // member functions
@@ -221,6 +577,15 @@ bqreg_t::operator=(const bqreg_t& obj_inp)
     Y = obj_inp.Y;
     X = obj_inp.X;
 
+    Y_f = obj_inp.Y_f;
+    X_f = obj_inp.X_f;
+    use_float_storage = obj_inp.use_float_storage;
+
+    X_sp = obj_inp.X_sp;
+    use_sparse_storage = obj_inp.use_sparse_storage;
+
+    window = obj_inp.window;
+
     prior_beta_mean   = obj_inp.prior_beta_mean;
     prior_beta_var    = obj_inp.prior_beta_var;
     prior_sigma_shape = obj_inp.prior_sigma_shape;
@@ -238,6 +603,15 @@ bqreg_t::operator=(bqreg_t&& obj_inp)
     Y = std::move(obj_inp.Y);
     X = std::move(obj_inp.X);
 
+    Y_f = std::move(obj_inp.Y_f);
+    X_f = std::move(obj_inp.X_f);
+    use_float_storage = obj_inp.use_float_storage;
+
+    X_sp = std::move(obj_inp.X_sp);
+    use_sparse_storage = obj_inp.use_sparse_storage;
+
+    window = std::move(obj_inp.window);
+
     prior_beta_mean = std::move(obj_inp.prior_beta_mean);
     prior_beta_var  = std::move(obj_inp.prior_beta_var);
     prior_sigma_shape = obj_inp.prior_sigma_shape;
@@ -264,10 +638,57 @@ bqreg_t::set_omp_n_threads(const int omp_n_threads_inp)
     this->omp_n_threads = omp_n_threads_inp;
 }
 
+void
+inline
+bqreg_t::set_autotune(const bool autotune_inp, const std::string& cache_path_inp)
+{
+    this->autotune = autotune_inp;
+    this->tuning_cache_path = cache_path_inp;
+}
+
+inline
+const sampler_tuning_t&
+bqreg_t::get_sampler_tuning()
+const
+{
+    return sampler_tuning;
+}
+
+void
+inline
+bqreg_t::set_sampler_scheme(const sampler_scheme_t sampler_scheme_inp)
+{
+    this->sampler_scheme = sampler_scheme_inp;
+}
+
+sampler_scheme_t
+inline
+bqreg_t::get_sampler_scheme()
+const
+{
+    return sampler_scheme;
+}
+
+void
+inline
+bqreg_t::set_outer_cache_budget(const size_t outer_cache_max_bytes_inp)
+{
+    this->outer_cache_max_bytes = outer_cache_max_bytes_inp;
+}
+
+size_t
+inline
+bqreg_t::get_outer_cache_budget()
+const
+{
+    return outer_cache_max_bytes;
+}
+
 void
 inline
 bqreg_t::set_seed_value(const size_t seed_val_inp)
 {
+    this->seed_val = seed_val_inp;
     this->rand_engine = rand_engine_t(seed_val_inp);
 }
 
@@ -277,6 +698,58 @@ bqreg_t::load_data(const ColVec_t& Y_inp, const Mat_t& X_inp)
 {
     this->Y = Y_inp;
     this->X = X_inp;
+
+    this->use_float_storage = false;
+    this->Y_f.resize(0);
+    this->X_f.resize(0,0);
+
+    this->use_sparse_storage = false;
+    this->X_sp.resize(0,0);
+
+    this->window.reset();
+}
+
+template<typename T>
+void
+inline
+bqreg_t::load_data(const ColVecF_t& Y_inp, const MatF_t& X_inp)
+{
+    this->Y_f = Y_inp;
+    this->X_f = X_inp;
+
+    this->use_float_storage = true;
+    this->Y.resize(0);
+    this->X.resize(0,0);
+
+    this->use_sparse_storage = false;
+    this->X_sp.resize(0,0);
+
+    this->window.reset();
+}
+
+void
+inline
+bqreg_t::load_data(const ColVec_t& Y_inp, const SpMat_t& X_inp)
+{
+    this->Y = Y_inp;
+    this->X_sp = X_inp;
+    this->X_sp.makeCompressed();
+
+    this->use_sparse_storage = true;
+    this->X.resize(0,0);
+
+    this->use_float_storage = false;
+    this->Y_f.resize(0);
+    this->X_f.resize(0,0);
+
+    this->window.reset();
+}
+
+void
+inline
+bqreg_t::load_data(const ColVec_t& Y_inp, const SpMatCSC_t& X_inp)
+{
+    load_data(Y_inp, SpMat_t(X_inp));
 }
 
 void
@@ -328,27 +801,650 @@ bqreg_t::gibbs(
     ColVec_t& sigma_draws
 )
 {
-    if (beta_initial_draw.size() != X.cols()) {
-        beta_initial_draw.setZero(X.cols());
+    memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+    gibbs(n_burnin_draws, n_keep_draws, thinning_factor, draw_sink);
+}
+
+void
+inline
+bqreg_t::gibbs(
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    draw_sink_t& draw_sink
+)
+{
+    checkpoint.resume = false;
+    checkpoint.warm_start = false;
+
+    run_gibbs(n_burnin_draws, n_keep_draws, thinning_factor, draw_sink);
+}
+
+void
+inline
+bqreg_t::gibbs_resume(
+    const sampler_state_t& state,
+    const size_t n_extra_keep_draws,
+    draw_sink_t& draw_sink
+)
+{
+    checkpoint.state = state;
+    checkpoint.resume = true;
+    checkpoint.warm_start = false;
+
+    tau = state.tau;
+    keep_sigma_fixed = state.keep_sigma_fixed;
+
+    run_gibbs(state.n_burnin_draws, state.n_keep_draws + n_extra_keep_draws, state.thinning_factor, draw_sink);
+
+    checkpoint.resume = false;
+}
+
+void
+inline
+bqreg_t::gibbs_resume(
+    const sampler_state_t& state,
+    const size_t n_extra_keep_draws,
+    Mat_t& beta_draws, 
+    Mat_t& z_draws, 
+    ColVec_t& sigma_draws
+)
+{
+    memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+    gibbs_resume(state, n_extra_keep_draws, draw_sink);
+}
+
+void
+inline
+bqreg_t::append_rows(
+    const ColVec_t& Y_new,
+    const Mat_t& X_new
+)
+{
+    if (use_sparse_storage) {
+        window.append(Y, X_sp, Y_new, SpMat_t(X_new.sparseView()), checkpoint.state);
+    } else if (use_float_storage) {
+        window.append(Y_f, X_f, ColVecF_t(Y_new.cast<float>()), MatF_t(X_new.cast<float>()), checkpoint.state);
+    } else {
+        window.append(Y, X, Y_new, X_new, checkpoint.state);
+    }
+}
+
+void
+inline
+bqreg_t::append_rows(
+    const ColVec_t& Y_new,
+    const SpMat_t& X_new
+)
+{
+    if (use_sparse_storage) {
+        window.append(Y, X_sp, Y_new, X_new, checkpoint.state);
+    } else {
+        append_rows(Y_new, Mat_t(X_new));
+    }
+}
+
+void
+inline
+bqreg_t::retire_rows(const size_t n_rows)
+{
+    if (use_sparse_storage) {
+        window.retire(n_rows, Y, X_sp, checkpoint.state);
+    } else if (use_float_storage) {
+        window.retire(n_rows, Y_f, X_f, checkpoint.state);
+    } else {
+        window.retire(n_rows, Y, X, checkpoint.state);
+    }
+}
+
+inline
+std::vector<size_t>
+bqreg_t::get_window_slots()
+const
+{
+    return window.get_slots(use_float_storage ? Y_f.size() : Y.size());
+}
+
+void
+inline
+bqreg_t::gibbs_warm(
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    draw_sink_t& draw_sink
+)
+{
+    compact_window();
+
+    const size_t n = use_float_storage ? Y_f.size() : Y.size();
+
+    checkpoint.resume = false;
+    checkpoint.warm_start = window_has_state(checkpoint.state, n, get_n_features());
+
+    run_gibbs(n_burnin_draws, n_keep_draws, thinning_factor, draw_sink);
+
+    checkpoint.warm_start = false;
+}
+
+void
+inline
+bqreg_t::gibbs_warm(
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    Mat_t& beta_draws, 
+    Mat_t& z_draws, 
+    ColVec_t& sigma_draws
+)
+{
+    memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+    gibbs_warm(n_burnin_draws, n_keep_draws, thinning_factor, draw_sink);
+}
+
+// free slots left by retire_rows are dropped before each run
+
+void
+inline
+bqreg_t::compact_window()
+{
+    if (use_sparse_storage) {
+        window.compact(Y, X_sp, checkpoint.state);
+    } else if (use_float_storage) {
+        window.compact(Y_f, X_f, checkpoint.state);
+    } else {
+        window.compact(Y, X, checkpoint.state);
+    }
+}
+
+// single-tau sampler on whichever copy of the data was loaded
+
+void
+inline
+bqreg_t::run_gibbs(
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    draw_sink_t& draw_sink
+)
+{
+    compact_window();
+
+    if (size_t(beta_initial_draw.size()) != get_n_features()) {
+        beta_initial_draw.setZero(get_n_features());
+    }
+
+    int run_n_threads = omp_n_threads;
+    int setup_n_threads = 0;
+
+    if (autotune) {
+        if (use_sparse_storage) {
+            sampler_tuning = tune_sampler_threads(Y, X_sp, omp_n_threads, tuning_cache_path, tau, keep_sigma_fixed, outer_cache_max_bytes);
+        } else if (use_float_storage) {
+            sampler_tuning = tune_sampler_threads(Y_f, X_f, omp_n_threads, tuning_cache_path, tau, keep_sigma_fixed, outer_cache_max_bytes);
+        } else {
+            sampler_tuning = tune_sampler_threads(Y, X, omp_n_threads, tuning_cache_path, tau, keep_sigma_fixed, outer_cache_max_bytes);
+        }
+
+        run_n_threads = sampler_tuning.data_pass_n_threads;
+        setup_n_threads = sampler_tuning.setup_n_threads;
+    }
+
+    if (use_sparse_storage) {
+        qr_gibbs(Y,
+                 X_sp,
+                 tau,
+                 beta_initial_draw,
+                 prior_beta_mean,
+                 prior_beta_var,
+                 prior_sigma_shape,
+                 prior_sigma_scale,
+                 n_burnin_draws,
+                 n_keep_draws,
+                 thinning_factor,
+                 keep_sigma_fixed,
+                 run_n_threads,
+                 draw_sink,
+                 rand_engine,
+                 &sampler_stats,
+                 &checkpoint,
+                 setup_n_threads,
+                 sampler_scheme,
+                 outer_cache_max_bytes);
+    } else if (use_float_storage) {
+        qr_gibbs(Y_f,
+                 X_f,
+                 tau,
+                 beta_initial_draw,
+                 prior_beta_mean,
+                 prior_beta_var,
+                 prior_sigma_shape,
+                 prior_sigma_scale,
+                 n_burnin_draws,
+                 n_keep_draws,
+                 thinning_factor,
+                 keep_sigma_fixed,
+                 run_n_threads,
+                 draw_sink,
+                 rand_engine,
+                 &sampler_stats,
+                 &checkpoint,
+                 setup_n_threads,
+                 sampler_scheme,
+                 outer_cache_max_bytes);
+    } else {
+        qr_gibbs(Y,
+                 X,
+                 tau,
+                 beta_initial_draw,
+                 prior_beta_mean,
+                 prior_beta_var,
+                 prior_sigma_shape,
+                 prior_sigma_scale,
+                 n_burnin_draws,
+                 n_keep_draws,
+                 thinning_factor,
+                 keep_sigma_fixed,
+                 run_n_threads,
+                 draw_sink,
+                 rand_engine,
+                 &sampler_stats,
+                 &checkpoint,
+                 setup_n_threads,
+                 sampler_scheme,
+                 outer_cache_max_bytes);
+    }
+}
+
+adaptive_result_t
+inline
+bqreg_t::gibbs(
+    const adaptive_settings_t& settings,
+    Mat_t& beta_draws, 
+    Mat_t& z_draws, 
+    ColVec_t& sigma_draws,
+    const bool keep_z
+)
+{
+    adaptive_sink_t draw_sink(settings, beta_draws, z_draws, sigma_draws, keep_z);
+
+    gibbs(0, settings.max_draws, settings.thinning_factor, draw_sink);
+
+    return draw_sink.get_result();
+}
+
+void
+inline
+bqreg_t::gibbs_to_file(
+    const std::string& file_path,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool z_as_float
+)
+{
+    mmap_draw_sink_t draw_sink(file_path, make_draw_store_meta(tau, n_burnin_draws, thinning_factor, rand_engine), true, z_as_float);
+
+    gibbs(n_burnin_draws, n_keep_draws, thinning_factor, draw_sink);
+}
+
+void
+inline
+bqreg_t::gibbs_multi_tau(
+    const ColVec_t& tau_vec,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    std::vector<Mat_t>& beta_draws, 
+    std::vector<Mat_t>& z_draws, 
+    Mat_t& sigma_draws
+)
+{
+    const size_t n_tau = tau_vec.size();
+
+    beta_draws.resize(n_tau);
+    z_draws.resize(n_tau);
+
+    std::vector<ColVec_t> sigma_draws_vec(n_tau);
+
+    std::vector<memory_sink_t> memory_sinks;
+    std::vector<draw_sink_t*> draw_sinks;
+
+    memory_sinks.reserve(n_tau);
+
+    for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+        memory_sinks.emplace_back(beta_draws[tau_ind], z_draws[tau_ind], sigma_draws_vec[tau_ind]);
+        draw_sinks.push_back(&memory_sinks[tau_ind]);
+    }
+
+    gibbs_multi_tau(tau_vec, n_burnin_draws, n_keep_draws, thinning_factor, draw_sinks);
+
+    sigma_draws.setZero(n_keep_draws, n_tau);
+
+    for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+        sigma_draws.col(tau_ind) = sigma_draws_vec[tau_ind];
+    }
+}
+
+void
+inline
+bqreg_t::gibbs_multi_tau(
+    const ColVec_t& tau_vec,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const std::vector<draw_sink_t*>& draw_sinks
+)
+{
+    compact_window();
+
+    if (size_t(beta_initial_draw.size()) != get_n_features()) {
+        beta_initial_draw.setZero(get_n_features());
+    }
+
+    if (use_sparse_storage) {
+        qr_gibbs_multi_tau(Y,
+                           X_sp,
+                           tau_vec,
+                           beta_initial_draw,
+                           prior_beta_mean,
+                           prior_beta_var,
+                           prior_sigma_shape,
+                           prior_sigma_scale,
+                           n_burnin_draws,
+                           n_keep_draws,
+                           thinning_factor,
+                           keep_sigma_fixed,
+                           omp_n_threads,
+                           draw_sinks,
+                           rand_engine);
+    } else if (use_float_storage) {
+        qr_gibbs_multi_tau(Y_f,
+                           X_f,
+                           tau_vec,
+                           beta_initial_draw,
+                           prior_beta_mean,
+                           prior_beta_var,
+                           prior_sigma_shape,
+                           prior_sigma_scale,
+                           n_burnin_draws,
+                           n_keep_draws,
+                           thinning_factor,
+                           keep_sigma_fixed,
+                           omp_n_threads,
+                           draw_sinks,
+                           rand_engine);
+    } else {
+        qr_gibbs_multi_tau(Y,
+                           X,
+                           tau_vec,
+                           beta_initial_draw,
+                           prior_beta_mean,
+                           prior_beta_var,
+                           prior_sigma_shape,
+                           prior_sigma_scale,
+                           n_burnin_draws,
+                           n_keep_draws,
+                           thinning_factor,
+                           keep_sigma_fixed,
+                           omp_n_threads,
+                           draw_sinks,
+                           rand_engine);
+    }
+}
+
+void
+inline
+bqreg_t::gibbs_multi_chain(
+    const size_t n_chains,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    std::vector<Mat_t>& beta_draws, 
+    std::vector<Mat_t>& z_draws, 
+    Mat_t& sigma_draws
+)
+{
+    compact_window();
+
+    if (size_t(beta_initial_draw.size()) != get_n_features()) {
+        beta_initial_draw.setZero(get_n_features());
+    }
+
+    if (use_sparse_storage) {
+        qr_gibbs_multi_chain(Y,
+                             X_sp,
+                             tau,
+                             beta_initial_draw,
+                             prior_beta_mean,
+                             prior_beta_var,
+                             prior_sigma_shape,
+                             prior_sigma_scale,
+                             n_chains,
+                             n_burnin_draws,
+                             n_keep_draws,
+                             thinning_factor,
+                             keep_sigma_fixed,
+                             omp_n_threads,
+                             beta_draws,
+                             z_draws,
+                             sigma_draws,
+                             rand_engine);
+    } else if (use_float_storage) {
+        qr_gibbs_multi_chain(Y_f,
+                             X_f,
+                             tau,
+                             beta_initial_draw,
+                             prior_beta_mean,
+                             prior_beta_var,
+                             prior_sigma_shape,
+                             prior_sigma_scale,
+                             n_chains,
+                             n_burnin_draws,
+                             n_keep_draws,
+                             thinning_factor,
+                             keep_sigma_fixed,
+                             omp_n_threads,
+                             beta_draws,
+                             z_draws,
+                             sigma_draws,
+                             rand_engine);
+    } else {
+        qr_gibbs_multi_chain(Y,
+                             X,
+                             tau,
+                             beta_initial_draw,
+                             prior_beta_mean,
+                             prior_beta_var,
+                             prior_sigma_shape,
+                             prior_sigma_scale,
+                             n_chains,
+                             n_burnin_draws,
+                             n_keep_draws,
+                             thinning_factor,
+                             keep_sigma_fixed,
+                             omp_n_threads,
+                             beta_draws,
+                             z_draws,
+                             sigma_draws,
+                             rand_engine);
+    }
+}
+
+void
+inline
+bqreg_t::gibbs_consensus(
+    const size_t n_shards,
+    const size_t n_burnin_draws, 
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool use_kernel_combiner,
+    Mat_t& beta_draws, 
+    ColVec_t& sigma_draws
+)
+{
+    compact_window();
+
+    if (size_t(beta_initial_draw.size()) != get_n_features()) {
+        beta_initial_draw.setZero(get_n_features());
+    }
+
+    if (use_sparse_storage) {
+        qr_gibbs_consensus(Y,
+                           X_sp,
+                           tau,
+                           beta_initial_draw,
+                           prior_beta_mean,
+                           prior_beta_var,
+                           prior_sigma_shape,
+                           prior_sigma_scale,
+                           n_shards,
+                           n_burnin_draws,
+                           n_keep_draws,
+                           thinning_factor,
+                           keep_sigma_fixed,
+                           use_kernel_combiner,
+                           omp_n_threads,
+                           beta_draws,
+                           sigma_draws,
+                           rand_engine);
+    } else if (use_float_storage) {
+        qr_gibbs_consensus(Y_f,
+                           X_f,
+                           tau,
+                           beta_initial_draw,
+                           prior_beta_mean,
+                           prior_beta_var,
+                           prior_sigma_shape,
+                           prior_sigma_scale,
+                           n_shards,
+                           n_burnin_draws,
+                           n_keep_draws,
+                           thinning_factor,
+                           keep_sigma_fixed,
+                           use_kernel_combiner,
+                           omp_n_threads,
+                           beta_draws,
+                           sigma_draws,
+                           rand_engine);
+    } else {
+        qr_gibbs_consensus(Y,
+                           X,
+                           tau,
+                           beta_initial_draw,
+                           prior_beta_mean,
+                           prior_beta_var,
+                           prior_sigma_shape,
+                           prior_sigma_scale,
+                           n_shards,
+                           n_burnin_draws,
+                           n_keep_draws,
+                           thinning_factor,
+                           keep_sigma_fixed,
+                           use_kernel_combiner,
+                           omp_n_threads,
+                           beta_draws,
+                           sigma_draws,
+                           rand_engine);
+    }
+}
+
+convergence_diagnostics_t
+inline
+bqreg_t::get_convergence_diagnostics(
+    const std::vector<Mat_t>& beta_draws, 
+    const Mat_t& sigma_draws
+)
+const
+{
+    return compute_convergence_diagnostics(beta_draws, sigma_draws);
+}
+
+inline
+const sampler_stats_t&
+bqreg_t::get_sampler_stats()
+const
+{
+    return sampler_stats;
+}
+
+void
+inline
+bqreg_t::predict(
+    const Mat_t& X_new,
+    const Eigen::Ref<const Mat_t>& beta_draws,
+    const ColVec_t& probs,
+    ColVec_t& pred_mean,
+    Mat_t& pred_quantiles
+)
+const
+{
+    qr_predict(X_new, beta_draws, probs, omp_n_threads, pred_mean, pred_quantiles);
+}
+
+void
+inline
+bqreg_t::predict(
+    const SpMat_t& X_new,
+    const Eigen::Ref<const Mat_t>& beta_draws,
+    const ColVec_t& probs,
+    ColVec_t& pred_mean,
+    Mat_t& pred_quantiles
+)
+const
+{
+    qr_predict(X_new, beta_draws, probs, omp_n_threads, pred_mean, pred_quantiles);
+}
+
+void
+inline
+bqreg_t::predict(
+    const Mat_t& X_new,
+    const std::string& file_path,
+    const ColVec_t& probs,
+    ColVec_t& pred_mean,
+    Mat_t& pred_quantiles
+)
+const
+{
+    draw_store_reader_t draw_store(file_path);
+
+    const size_t n_draws = draw_store.header().n_draws_written;
+
+    qr_predict(X_new, draw_store.beta_draws().leftCols(n_draws), probs, omp_n_threads, pred_mean, pred_quantiles);
+}
+
+void
+inline
+bqreg_t::set_checkpoint(
+    const std::string& file_path,
+    const size_t checkpoint_interval
+)
+{
+    checkpoint.file_path = file_path;
+    checkpoint.interval = checkpoint_interval;
+}
+
+inline
+const sampler_state_t&
+bqreg_t::get_sampler_state()
+const
+{
+    return checkpoint.state;
+}
+
+size_t
+inline
+bqreg_t::get_n_features()
+const
+{
+    if (use_sparse_storage) {
+        return X_sp.cols();
     }
 
-    qr_gibbs(Y,
-             X,
-             tau,
-             beta_initial_draw,
-             prior_beta_mean,
-             prior_beta_var,
-             prior_sigma_shape,
-             prior_sigma_scale,
-             n_burnin_draws,
-             n_keep_draws,
-             thinning_factor,
-             keep_sigma_fixed,
-             omp_n_threads,
-             beta_draws,
-             z_draws,
-             sigma_draws,
-             rand_engine);
+    return use_float_storage ? X_f.cols() : X.cols();
 }
 
 #endif
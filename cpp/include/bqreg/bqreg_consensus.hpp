@@ -0,0 +1,498 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Divide-and-conquer (consensus) sampling
+ *
+ * The rows are split into S shards and each shard is sampled independently under the prior
+ * raised to the power 1/S, so that the product of the S sub-posteriors is proportional to
+ * the full posterior. The sub-posterior draws are then combined by consensus Monte Carlo
+ * (Scott et al., 2016) or, optionally, by the semiparametric kernel density product of
+ * Neiswanger, Wang, and Xing (2014).
+ */
+
+#ifndef _bqreg_consensus_HPP
+#define _bqreg_consensus_HPP
+
+// the type that holds a copy of the rows of the data: a view is copied into the matrix type it views
+
+template<typename T>
+struct data_storage
+{
+    using type = T;
+};
+
+template<typename T, int Options, typename Stride_t>
+struct data_storage<Eigen::Map<const T, Options, Stride_t>>
+{
+    using type = T;
+};
+
+/*
+ * Copy the rows of shard shard_ind into contiguous storage; rows are dealt round-robin,
+ * so that the shards are exchangeable even if the data are sorted
+ */
+
+template<typename DataVec_t, typename DataMat_t, typename ShardVec_t, typename ShardMat_t>
+inline
+void
+get_shard_rows(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const size_t shard_ind,
+    const size_t n_shards,
+    ShardVec_t& Y_shard,
+    ShardMat_t& X_shard
+)
+{
+    const size_t n = Y.size();
+    const size_t n_shard = (n - shard_ind + n_shards - 1) / n_shards;
+
+    Y_shard.resize(n_shard);
+    X_shard.resize(n_shard, X.cols());
+
+    for (size_t j = 0; j < n_shard; ++j) {
+        Y_shard(j) = Y(shard_ind + j * n_shards);
+        X_shard.row(j) = X.row(shard_ind + j * n_shards);
+    }
+}
+
+inline
+void
+get_shard_rows(
+    const ColVec_t& Y,
+    const SpMat_t& X,
+    const size_t shard_ind,
+    const size_t n_shards,
+    ColVec_t& Y_shard,
+    SpMat_t& X_shard
+)
+{
+    const size_t n = Y.size();
+    const size_t n_shard = (n - shard_ind + n_shards - 1) / n_shards;
+
+    size_t nnz_shard = 0;
+
+    for (size_t j = 0; j < n_shard; ++j) {
+        const size_t row_ind = shard_ind + j * n_shards;
+        nnz_shard += X.outerIndexPtr()[row_ind + 1] - X.outerIndexPtr()[row_ind];
+    }
+
+    Y_shard.resize(n_shard);
+
+    X_shard.resize(n_shard, X.cols());
+    X_shard.reserve(nnz_shard);
+
+    for (size_t j = 0; j < n_shard; ++j) {
+        const size_t row_ind = shard_ind + j * n_shards;
+
+        Y_shard(j) = Y(row_ind);
+
+        X_shard.startVec(j);
+
+        for (SpMat_t::InnerIterator it(X, row_ind); it; ++it) {
+            X_shard.insertBack(j, it.col()) = it.value();
+        }
+    }
+
+    X_shard.finalize();
+}
+
+/*
+ * Consensus Monte Carlo: draw g of the combined sample is the precision-weighted average
+ * of draw g of every shard, with the weights set to the inverse sample covariance matrices
+ * of the shard draws
+ */
+
+inline
+void
+consensus_weighted_combine(
+    const std::vector<Mat_t>& shard_draws,
+    Mat_t& combined_draws
+)
+{
+    const size_t n_shards = shard_draws.size();
+    const size_t n_params = shard_draws[0].rows();
+    const size_t n_draws = shard_draws[0].cols();
+
+    Mat_t weight_sum = Mat_t::Zero(n_params, n_params);
+    Mat_t weighted_draws_sum = Mat_t::Zero(n_params, n_draws);
+
+    for (size_t s = 0; s < n_shards; ++s) {
+        const Mat_t centered_draws = shard_draws[s].colwise() - shard_draws[s].rowwise().mean();
+
+        Mat_t shard_cov = centered_draws * centered_draws.transpose() / fp_t(std::max(n_draws, size_t(2)) - 1);
+
+        // a (near-)degenerate shard gets a small ridge instead of an infinite weight
+
+        Eigen::LLT<Mat_t> llt_obj(shard_cov);
+
+        if (llt_obj.info() != Eigen::Success) {
+            shard_cov.diagonal().array() += std::max(fp_t(1e-10), fp_t(1e-8) * shard_cov.diagonal().maxCoeff());
+            llt_obj.compute(shard_cov);
+        }
+
+        const Mat_t shard_weight = llt_obj.solve(Mat_t::Identity(n_params, n_params));
+
+        weight_sum += shard_weight;
+        weighted_draws_sum.noalias() += shard_weight * shard_draws[s];
+    }
+
+    combined_draws = weight_sum.llt().solve(weighted_draws_sum);
+}
+
+/*
+ * Semiparametric kernel combiner (Neiswanger, Wang, and Xing, 2014, section 3.2): the product
+ * of the S Gaussian kernel density estimates, each reweighted by a Gaussian fit to its shard,
+ * is a mixture over one draw index per shard. The parameters are standardized by the average
+ * shard standard deviation first, and the bandwidth shrinks as h = c g^(-1/(4+d)), with
+ * c = BQREG_KERNEL_COMBINE_BANDWIDTH_SCALE.
+ *
+ * With x_s the selected draw of shard s, x_bar their mean, N(mu_s, Sigma_s) the fit to shard s,
+ * and N(mu_M, Sigma_M) the product of the fits, the weight of an index tuple is
+ *
+ *   exp( -sum_s ||x_s - x_bar||^2 / (2 h^2) ) N(x_bar | mu_M, Sigma_M + (h^2/S) I) / prod_s N(x_s | mu_s, Sigma_s)
+ *
+ * and its component is N(mu_t, Sigma_t), Sigma_t^{-1} = (S/h^2) I + Sigma_M^{-1}, mu_t = Sigma_t ( (S/h^2) x_bar + Sigma_M^{-1} mu_M ).
+ * The kernel product alone is built from the few draws of each shard that lie where all of
+ * the shards overlap; with a few hundred draws per shard and more than a handful of shards,
+ * it leaves the combined mean off by up to a posterior standard deviation. Here the Gaussian
+ * factors carry the bulk of the posterior, and the kernel product corrects for departures
+ * from normality on the scale of h: c is a few shard standard deviations, so the correction
+ * is not dominated by the noise of the kernel estimates (as c grows, the combiner tends to
+ * the product of the Gaussian fits).
+ *
+ * Each index is drawn exactly from its full conditional (the weights over its n draws, given
+ * the other indices), in BQREG_KERNEL_COMBINE_SWEEPS sweeps between combined draws.
+ */
+
+inline
+void
+consensus_kernel_combine(
+    const std::vector<Mat_t>& shard_draws,
+    counter_rng_t& rng,
+    Mat_t& combined_draws
+)
+{
+    const size_t n_shards = shard_draws.size();
+    const size_t n_params = shard_draws[0].rows();
+    const size_t n_draws = shard_draws[0].cols();
+    const size_t n_sweeps = std::max(size_t(BQREG_KERNEL_COMBINE_SWEEPS), size_t(1));
+
+    ColVec_t param_scale = ColVec_t::Zero(n_params);
+
+    for (size_t s = 0; s < n_shards; ++s) {
+        const Mat_t centered_draws = shard_draws[s].colwise() - shard_draws[s].rowwise().mean();
+        param_scale += ( centered_draws.rowwise().squaredNorm() / fp_t(std::max(n_draws, size_t(2)) - 1) ).cwiseSqrt();
+    }
+
+    param_scale /= fp_t(n_shards);
+    param_scale = param_scale.cwiseMax(std::numeric_limits<fp_t>::min());
+
+    std::vector<Mat_t> std_draws(n_shards);
+
+    for (size_t s = 0; s < n_shards; ++s) {
+        std_draws[s] = param_scale.cwiseInverse().asDiagonal() * shard_draws[s];
+    }
+
+    // Gaussian fits: the product precision P_M and P_M mu_M, and the Mahalanobis distance of every shard draw to its own fit
+
+    const Mat_t identity_mat = Mat_t::Identity(n_params, n_params);
+
+    Mat_t prod_prec = Mat_t::Zero(n_params, n_params);
+    ColVec_t prod_prec_mean = ColVec_t::Zero(n_params);
+    Mat_t shard_mahal_dists(n_shards, n_draws);
+
+    for (size_t s = 0; s < n_shards; ++s) {
+        const ColVec_t shard_mean = std_draws[s].rowwise().mean();
+        const Mat_t centered_draws = std_draws[s].colwise() - shard_mean;
+
+        Mat_t shard_cov = centered_draws * centered_draws.transpose() / fp_t(std::max(n_draws, size_t(2)) - 1);
+
+        Eigen::LLT<Mat_t> llt_obj(shard_cov);
+
+        if (llt_obj.info() != Eigen::Success) {
+            shard_cov.diagonal().array() += std::max(fp_t(1e-10), fp_t(1e-8) * shard_cov.diagonal().maxCoeff());
+            llt_obj.compute(shard_cov);
+        }
+
+        const Mat_t shard_prec = llt_obj.solve(identity_mat);
+
+        prod_prec += shard_prec;
+        prod_prec_mean += shard_prec * shard_mean;
+
+        shard_mahal_dists.row(s) = Mat_t(llt_obj.matrixL().solve(centered_draws)).colwise().squaredNorm();
+    }
+
+    const Eigen::LLT<Mat_t> prod_llt(prod_prec);
+    const Mat_t prod_cov = prod_llt.solve(identity_mat);
+    const ColVec_t prod_mean = prod_llt.solve(prod_prec_mean);
+
+    // current index per shard, and the sum of the selected draws
+
+    std::vector<size_t> draw_inds(n_shards);
+
+    rng.iter_ind = 0;
+
+    for (size_t s = 0; s < n_shards; ++s) {
+        const philox_block_t rand_block = rng.block(RNG_STREAM_COMBINE, s);
+        draw_inds[s] = std::min(size_t( u01_from_u64( (uint64_t(rand_block.v[1]) << 32) | rand_block.v[0] ) * n_draws ), n_draws - 1);
+    }
+
+    combined_draws.resize(n_params, n_draws);
+
+    ColVec_t sum_vec = ColVec_t::Zero(n_params);
+
+    for (size_t s = 0; s < n_shards; ++s) {
+        sum_vec += std_draws[s].col(draw_inds[s]);
+    }
+
+    Eigen::LLT<Mat_t> mean_llt(n_params);
+    std::vector<Mat_t> white_draws(n_shards);
+    ColVec_t other_mean_vec(n_params), white_other_vec(n_params), index_weights(n_draws);
+
+    mvnorm_prec_ws_t prec_ws;
+    ColVec_t mean_vec, draw_vec;
+
+    for (size_t g = 0; g < n_draws; ++g) {
+        rng.iter_ind = static_cast<uint32_t>(g + 1);
+
+        const fp_t bandwidth = fp_t(BQREG_KERNEL_COMBINE_BANDWIDTH_SCALE) * std::pow(fp_t(g + 1), - fp_t(1) / (4 + n_params));
+        const fp_t kernel_prec = fp_t(n_shards) / (bandwidth * bandwidth);
+
+        // the covariance of x_bar under the Gaussian part of the weight
+
+        mean_llt.compute(prod_cov + identity_mat / kernel_prec);
+
+        // the whitened draws of each shard depend on g only through the factor, so are formed once per g
+
+        for (size_t s = 0; s < n_shards; ++s) {
+            white_draws[s].noalias() = mean_llt.matrixL().solve(std_draws[s] / fp_t(n_shards));
+        }
+
+        for (size_t sweep_ind = 0; sweep_ind < n_sweeps; ++sweep_ind) {
+            for (size_t s = 0; s < n_shards; ++s) {
+                const philox_block_t rand_block = rng.block(RNG_STREAM_COMBINE, sweep_ind * n_shards + s);
+
+                sum_vec -= std_draws[s].col(draw_inds[s]);
+
+                other_mean_vec = (n_shards > 1) ? ColVec_t(sum_vec / fp_t(n_shards - 1)) : ColVec_t::Zero(n_params);
+
+                // with x_s = draw i of shard s: x_bar - mu_M = (sum_(-s) - S mu_M + x_s) / S, whitened by the factor of its covariance
+
+                white_other_vec = mean_llt.matrixL().solve( (sum_vec - fp_t(n_shards) * prod_mean) / fp_t(n_shards) );
+
+                // log weights, then weights relative to the largest
+
+                for (size_t i = 0; i < n_draws; ++i) {
+                    index_weights(i) = - fp_t(n_shards - 1) * kernel_prec / fp_t(2 * n_shards * n_shards) * (std_draws[s].col(i) - other_mean_vec).squaredNorm()
+                                       - (white_other_vec + white_draws[s].col(i)).squaredNorm() / 2
+                                       + shard_mahal_dists(s, i) / 2;
+                }
+
+                index_weights = (index_weights.array() - index_weights.maxCoeff()).exp();
+
+                // inverse CDF of the (unnormalized) weights
+
+                fp_t target_val = fp_t(u01_from_u64( (uint64_t(rand_block.v[1]) << 32) | rand_block.v[0] )) * index_weights.sum();
+
+                size_t new_ind = n_draws - 1;
+
+                for (size_t i = 0; i < n_draws; ++i) {
+                    target_val -= index_weights(i);
+
+                    if (target_val < 0) {
+                        new_ind = i;
+                        break;
+                    }
+                }
+
+                draw_inds[s] = new_ind;
+                sum_vec += std_draws[s].col(new_ind);
+            }
+        }
+
+        // a draw from the component of the selected tuple; normals are read from the blocks after the n_sweeps * n_shards index blocks
+
+        prec_ws.post_prec = prod_prec;
+        prec_ws.post_prec.diagonal().array() += kernel_prec;
+        prec_ws.post_vec = kernel_prec * sum_vec / fp_t(n_shards) + prod_prec_mean;
+        prec_ws.std_norm_vec.resize(n_params);
+
+        for (size_t j = 0; j < n_params; j += 2) {
+            double norm_val_0, norm_val_1;
+            counter_rnorm_pair(rng.block(RNG_STREAM_COMBINE, n_sweeps * n_shards + j / 2), norm_val_0, norm_val_1);
+
+            prec_ws.std_norm_vec(j) = static_cast<fp_t>(norm_val_0);
+
+            if (j + 1 < n_params) {
+                prec_ws.std_norm_vec(j + 1) = static_cast<fp_t>(norm_val_1);
+            }
+        }
+
+        draw_mvnorm_prec(prec_ws, draw_vec);
+
+        combined_draws.col(g) = param_scale.cwiseProduct(draw_vec);
+    }
+}
+
+/*
+ * The sharded sampler. The prior N(m, V) on beta becomes N(m, S V) in each shard, and the
+ * inverse-gamma(a, b) prior on sigma becomes inverse-gamma((a + 1) / S - 1, b / S). Sigma is
+ * combined on the log scale, jointly with beta.
+ *
+ * The shard shape is below a whenever a > -1 and S > 1, and may be negative: such a shard prior
+ * is improper, but each shard posterior of sigma stays proper, as the n_s rows of the shard add
+ * 3 n_s / 2 to the shape. A shard shape of -1 or less (i.e., a <= -1) leaves the shard prior
+ * without any decay in sigma, and is rejected unless sigma is fixed.
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs_consensus(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const fp_t tau,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_shards,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    const bool use_kernel_combiner,
+    int omp_n_threads,
+    Mat_t& beta_draws_storage,
+    ColVec_t& sigma_draws_storage,
+    rand_engine_t& rand_engine
+)
+{
+#ifdef BQREG_USE_OPENMP
+    if (omp_n_threads < 0) {
+        omp_n_threads = std::max(1, static_cast<int>(omp_get_max_threads()) / 2);
+    }
+
+    if (omp_n_threads == 0) {
+        omp_n_threads = 1;
+    }
+#else
+    omp_n_threads = 1;
+#endif
+
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    if (n_shards == 0 || n_shards > n) {
+        throw std::invalid_argument("bqreg: the number of shards must be between one and the number of observations");
+    }
+
+    if (n_keep_draws < 2) {
+        throw std::invalid_argument("bqreg: consensus sampling needs at least two kept draws per shard");
+    }
+
+    int n_outer_threads = 1;
+    int n_inner_threads = 1;
+
+    set_chain_threading(n / n_shards, n_shards, omp_n_threads, n_outer_threads, n_inner_threads);
+
+    (void)(n_outer_threads); // for !BQREG_USE_OPENMP case
+
+    // fractional prior
+
+    const Mat_t shard_prior_beta_var = fp_t(n_shards) * prior_beta_var;
+    const fp_t shard_prior_sigma_shape = (prior_sigma_shape + 1) / fp_t(n_shards) - 1;
+
+    if (!keep_sigma_fixed && !(shard_prior_sigma_shape > -1)) {
+        throw std::invalid_argument("bqreg: consensus sampling needs a prior shape of sigma above -1, so that the shard prior (a + 1) / S - 1 is above -1");
+    }
+    const fp_t shard_prior_sigma_scale = prior_sigma_scale / fp_t(n_shards);
+
+    const uint64_t seed_val = rand_engine();
+
+    const size_t n_params = keep_sigma_fixed ? K : K + 1;
+
+    std::vector<Mat_t> shard_draws(n_shards);
+    std::vector<std::exception_ptr> shard_exceptions(n_shards);
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel for num_threads(n_outer_threads) schedule(dynamic)
+#endif
+    for (size_t s = 0; s < n_shards; ++s) {
+        try {
+            // each shard is copied by the thread that samples it, and freed when it is done
+
+            typename data_storage<DataVec_t>::type Y_shard;
+            typename data_storage<DataMat_t>::type X_shard;
+
+            get_shard_rows(Y, X, s, n_shards, Y_shard, X_shard);
+
+            Mat_t beta_draws;
+            ColVec_t sigma_draws;
+
+            counter_rng_t rng(seed_val, static_cast<uint32_t>(s));
+            param_memory_sink_t draw_sink(beta_draws, sigma_draws);
+
+            qr_gibbs(Y_shard, X_shard, tau, beta_initial_draw, prior_beta_mean, shard_prior_beta_var, shard_prior_sigma_shape, shard_prior_sigma_scale,
+                     n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed, n_inner_threads,
+                     draw_sink, rng, nullptr, nullptr, 0, SAMPLER_SCHEME_STANDARD,
+                     BQREG_OUTER_CACHE_MAX_BYTES / n_outer_threads); // the concurrent runs share the cache budget
+
+            shard_draws[s].resize(n_params, n_keep_draws);
+            shard_draws[s].topRows(K) = beta_draws;
+
+            if (!keep_sigma_fixed) {
+                shard_draws[s].row(K) = sigma_draws.array().log().matrix().transpose();
+            }
+        } catch (...) {
+            shard_exceptions[s] = std::current_exception();
+        }
+    }
+
+    for (size_t s = 0; s < n_shards; ++s) {
+        if (shard_exceptions[s]) {
+            std::rethrow_exception(shard_exceptions[s]);
+        }
+    }
+
+    Mat_t combined_draws;
+
+    if (n_shards == 1) {
+        combined_draws = shard_draws[0];
+    } else if (use_kernel_combiner) {
+        counter_rng_t rng(seed_val, static_cast<uint32_t>(n_shards));
+        consensus_kernel_combine(shard_draws, rng, combined_draws);
+    } else {
+        consensus_weighted_combine(shard_draws, combined_draws);
+    }
+
+    beta_draws_storage = combined_draws.topRows(K);
+
+    if (keep_sigma_fixed) {
+        sigma_draws_storage.setOnes(n_keep_draws);
+    } else {
+        sigma_draws_storage = combined_draws.row(K).transpose().array().exp().matrix();
+    }
+}
+
+#endif
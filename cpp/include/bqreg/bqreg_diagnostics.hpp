@@ -0,0 +1,313 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Convergence diagnostics: rank-normalized split R-hat, bulk-ESS, and tail-ESS
+ *
+ * Following Vehtari, Gelman, Simpson, Carpenter, and Buerkner (2021). Throughout, the draws
+ * of a single parameter are held in an N x M matrix, one column per chain.
+ */
+
+#ifndef _bqreg_diagnostics_HPP
+#define _bqreg_diagnostics_HPP
+
+struct convergence_diagnostics_t
+{
+    ColVec_t rhat;     /*!< Rank-normalized split R-hat; the first K entries are for \f$ \beta \f$, the last for \f$ \sigma \f$ */
+    ColVec_t ess_bulk; /*!< Bulk effective sample size, ordered as \c rhat */
+    ColVec_t ess_tail; /*!< Tail effective sample size (minimum over the 5% and 95% quantiles), ordered as \c rhat */
+};
+
+// split each chain in half: N x M -> floor(N/2) x 2M
+
+inline
+Mat_t
+split_chains(const Mat_t& draws)
+{
+    const size_t n_half = draws.rows() / 2;
+    const size_t n_chains = draws.cols();
+
+    Mat_t split_draws(n_half, 2 * n_chains);
+
+    for (size_t m = 0; m < n_chains; ++m) {
+        split_draws.col(2*m) = draws.col(m).head(n_half);
+        split_draws.col(2*m + 1) = draws.col(m).tail(n_half);
+    }
+
+    return split_draws;
+}
+
+// normal scores of the pooled ranks (average ranks for ties)
+
+inline
+Mat_t
+rank_normalize(const Mat_t& draws)
+{
+    const size_t n_total = draws.size();
+
+    std::vector<size_t> sort_ind(n_total);
+    std::iota(sort_ind.begin(), sort_ind.end(), size_t(0));
+    std::sort(sort_ind.begin(), sort_ind.end(), [&](const size_t a, const size_t b) { return draws.data()[a] < draws.data()[b]; });
+
+    Mat_t z_draws(draws.rows(), draws.cols());
+
+    size_t i = 0;
+
+    while (i < n_total) {
+        size_t j = i;
+
+        while (j + 1 < n_total && draws.data()[sort_ind[j+1]] == draws.data()[sort_ind[i]]) {
+            ++j;
+        }
+
+        const fp_t avg_rank_val = fp_t(i + j + 2) / 2;
+        const fp_t z_val = stats::qnorm( (avg_rank_val - fp_t(0.375)) / (n_total + fp_t(0.25)) );
+
+        for (size_t k = i; k <= j; ++k) {
+            z_draws.data()[sort_ind[k]] = z_val;
+        }
+
+        i = j + 1;
+    }
+
+    return z_draws;
+}
+
+// R-hat of (already split) chains
+
+inline
+fp_t
+rhat_basic(const Mat_t& draws)
+{
+    const size_t n_draws = draws.rows();
+
+    if (n_draws < 2) {
+        return std::numeric_limits<fp_t>::quiet_NaN();
+    }
+
+    const ColVec_t chain_means = draws.colwise().mean().transpose();
+    const ColVec_t chain_vars = (draws.rowwise() - chain_means.transpose()).colwise().squaredNorm().transpose() / fp_t(n_draws - 1);
+
+    const fp_t W_val = chain_vars.mean();
+    const fp_t B_val = (chain_means.size() > 1) ? n_draws * (chain_means.array() - chain_means.mean()).square().sum() / fp_t(chain_means.size() - 1) : fp_t(0);
+
+    if (W_val <= fp_t(0)) {
+        return std::numeric_limits<fp_t>::quiet_NaN();
+    }
+
+    const fp_t var_hat_val = (n_draws - 1) * W_val / n_draws + B_val / n_draws;
+
+    return std::sqrt(var_hat_val / W_val);
+}
+
+// multi-chain ESS of (already split) chains, using Geyer's initial monotone sequence
+
+inline
+fp_t
+ess_basic(const Mat_t& draws)
+{
+    const size_t n_draws = draws.rows();
+    const size_t n_chains = draws.cols();
+    const fp_t n_total = fp_t(n_draws * n_chains);
+
+    if (n_draws < 4) {
+        return std::numeric_limits<fp_t>::quiet_NaN();
+    }
+
+    const ColVec_t chain_means = draws.colwise().mean().transpose();
+    const Mat_t centered_draws = draws.rowwise() - chain_means.transpose();
+
+    const fp_t W_val = centered_draws.colwise().squaredNorm().mean() / fp_t(n_draws - 1);
+    const fp_t B_val = (n_chains > 1) ? n_draws * (chain_means.array() - chain_means.mean()).square().sum() / fp_t(n_chains - 1) : fp_t(0);
+    const fp_t var_hat_val = (n_draws - 1) * W_val / n_draws + B_val / n_draws;
+
+    if (!(var_hat_val > fp_t(0))) {
+        return n_total;
+    }
+
+    // mean over chains of the (biased) autocovariance at lag t
+
+    auto acov = [&](const size_t t) -> fp_t
+    {
+        fp_t acov_val = 0;
+
+        for (size_t m = 0; m < n_chains; ++m) {
+            acov_val += centered_draws.col(m).head(n_draws - t).dot(centered_draws.col(m).tail(n_draws - t));
+        }
+
+        return acov_val / fp_t(n_draws * n_chains);
+    };
+
+    const fp_t acov_0_val = acov(0);
+
+    auto rho = [&](const size_t t) -> fp_t
+    {
+        return fp_t(1) - (acov_0_val * n_draws / fp_t(n_draws - 1) - acov(t)) / var_hat_val;
+    };
+
+    fp_t prev_pair_val = fp_t(1) + rho(1);
+
+    if (prev_pair_val < fp_t(0)) {
+        return n_total;
+    }
+
+    fp_t sum_pair_val = prev_pair_val;
+
+    for (size_t t = 2; t + 1 < n_draws; t += 2) {
+        fp_t pair_val = rho(t) + rho(t + 1);
+
+        if (pair_val < fp_t(0)) {
+            break;
+        }
+
+        pair_val = std::min(pair_val, prev_pair_val); // monotone sequence
+
+        sum_pair_val += pair_val;
+        prev_pair_val = pair_val;
+    }
+
+    const fp_t tau_val = std::max(fp_t(-1) + 2 * sum_pair_val, fp_t(1) / std::log10(n_total));
+
+    return n_total / tau_val;
+}
+
+// empirical quantile of the pooled draws
+
+inline
+fp_t
+pooled_quantile(const Mat_t& draws, const fp_t prob_val)
+{
+    std::vector<fp_t> sorted_draws(draws.data(), draws.data() + draws.size());
+    std::sort(sorted_draws.begin(), sorted_draws.end());
+
+    const fp_t pos_val = prob_val * (sorted_draws.size() - 1);
+    const size_t lower_ind = static_cast<size_t>(std::floor(pos_val));
+    const size_t upper_ind = std::min(lower_ind + 1, sorted_draws.size() - 1);
+
+    return sorted_draws[lower_ind] + (pos_val - lower_ind) * (sorted_draws[upper_ind] - sorted_draws[lower_ind]);
+}
+
+/**
+ * Rank-normalized split R-hat
+ *
+ * @param draws an N x M matrix of draws of one parameter, one column per chain
+ * @return the maximum of the bulk and folded rank-normalized split R-hat values
+ */
+
+inline
+fp_t
+split_rhat(const Mat_t& draws)
+{
+    const Mat_t split_draws = split_chains(draws);
+
+    const fp_t median_val = pooled_quantile(split_draws, fp_t(0.5));
+
+    const fp_t rhat_bulk_val = rhat_basic(rank_normalize(split_draws));
+    const fp_t rhat_tail_val = rhat_basic(rank_normalize( (split_draws.array() - median_val).abs().matrix() ));
+
+    return std::max(rhat_bulk_val, rhat_tail_val);
+}
+
+/**
+ * Bulk effective sample size
+ *
+ * @param draws an N x M matrix of draws of one parameter, one column per chain
+ * @return the ESS of the rank-normalized split chains
+ */
+
+inline
+fp_t
+ess_bulk(const Mat_t& draws)
+{
+    return ess_basic(rank_normalize(split_chains(draws)));
+}
+
+/**
+ * Tail effective sample size
+ *
+ * @param draws an N x M matrix of draws of one parameter, one column per chain
+ * @return the minimum of the ESS values of the 5% and 95% quantile indicators
+ */
+
+inline
+fp_t
+ess_tail(const Mat_t& draws)
+{
+    const Mat_t split_draws = split_chains(draws);
+
+    const fp_t q05_val = pooled_quantile(split_draws, fp_t(0.05));
+    const fp_t q95_val = pooled_quantile(split_draws, fp_t(0.95));
+
+    const Mat_t ind_05 = (split_draws.array() <= q05_val).template cast<fp_t>().matrix();
+    const Mat_t ind_95 = (split_draws.array() <= q95_val).template cast<fp_t>().matrix();
+
+    return std::min(ess_basic(ind_05), ess_basic(ind_95));
+}
+
+/**
+ * Convergence diagnostics for the output of the Gibbs sampler
+ *
+ * @param beta_draws a vector of M matrices (K x N), one per chain
+ * @param sigma_draws an N x M matrix of draws of \f$ \sigma \f$, one column per chain
+ * @return R-hat, bulk-ESS, and tail-ESS for each element of \f$ \beta \f$ and for \f$ \sigma \f$
+ */
+
+inline
+convergence_diagnostics_t
+compute_convergence_diagnostics(
+    const std::vector<Mat_t>& beta_draws,
+    const Mat_t& sigma_draws
+)
+{
+    const size_t n_chains = beta_draws.size();
+
+    if (n_chains == 0) {
+        throw std::invalid_argument("bqreg: no chains were provided to compute_convergence_diagnostics");
+    }
+
+    const size_t K = beta_draws[0].rows();
+    const size_t n_draws = beta_draws[0].cols();
+
+    convergence_diagnostics_t diag_out;
+
+    diag_out.rhat.resize(K + 1);
+    diag_out.ess_bulk.resize(K + 1);
+    diag_out.ess_tail.resize(K + 1);
+
+    Mat_t param_draws(n_draws, n_chains);
+
+    for (size_t k = 0; k < K + 1; ++k) {
+        if (k < K) {
+            for (size_t m = 0; m < n_chains; ++m) {
+                param_draws.col(m) = beta_draws[m].row(k).transpose();
+            }
+        } else {
+            param_draws = sigma_draws;
+        }
+
+        diag_out.rhat(k) = split_rhat(param_draws);
+        diag_out.ess_bulk(k) = ess_bulk(param_draws);
+        diag_out.ess_tail(k) = ess_tail(param_draws);
+    }
+
+    return diag_out;
+}
+
+#endif
@@ -0,0 +1,363 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Draw sinks: receive each kept draw of the Gibbs sampler as it is produced
+ */
+
+#ifndef _bqreg_draw_sink_HPP
+#define _bqreg_draw_sink_HPP
+
+/**
+ * Base class for draw sinks
+ */
+
+class draw_sink_t
+{
+    public:
+        virtual ~draw_sink_t() = default;
+
+        /**
+         * Called once before sampling starts
+         *
+         * @param n the number of observations
+         * @param K the number of features
+         * @param n_keep_draws the number of draws that will be pushed
+         */
+
+        virtual void begin(const size_t n, const size_t K, const size_t n_keep_draws) { (void)(n); (void)(K); (void)(n_keep_draws); }
+
+        /**
+         * Receive one kept draw
+         *
+         * @param draw_ind the index of the kept draw, from 0 to n_keep_draws - 1
+         * @param beta_draw the K x 1 draw of \f$ \beta \f$
+         * @param z_draw the n x 1 draw of \f$ z \f$; empty if \c wants_z returns false
+         * @param sigma_draw the draw of \f$ \sigma \f$
+         */
+
+        virtual void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) = 0;
+
+        /**
+         * Called once after the last draw has been pushed
+         */
+
+        virtual void end() {}
+
+        /**
+         * @return whether the sampler should form the n x 1 draw of \f$ z \f$ for each kept draw
+         */
+
+        virtual bool wants_z() const { return true; }
+
+        /**
+         * Checked after each push; a sink can end the sampler early, e.g., once a target effective sample size is reached
+         *
+         * @return whether the sampler should stop after the current draw
+         */
+
+        virtual bool stop_requested() const { return false; }
+};
+
+/**
+ * Store the draws in (caller-owned) in-memory matrices
+ */
+
+class memory_sink_t : public draw_sink_t
+{
+    public:
+        memory_sink_t(Mat_t& beta_draws_inp, Mat_t& z_draws_inp, ColVec_t& sigma_draws_inp)
+            : beta_draws(beta_draws_inp), z_draws(z_draws_inp), sigma_draws(sigma_draws_inp) {}
+
+        void begin(const size_t n, const size_t K, const size_t n_keep_draws) override
+        {
+            beta_draws.setZero(K, n_keep_draws);
+            z_draws.setZero(n, n_keep_draws);
+            sigma_draws.setZero(n_keep_draws);
+        }
+
+        void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) override
+        {
+            beta_draws.col(draw_ind) = beta_draw;
+            z_draws.col(draw_ind) = z_draw;
+            sigma_draws(draw_ind) = sigma_draw;
+        }
+
+    private:
+        Mat_t& beta_draws;
+        Mat_t& z_draws;
+        ColVec_t& sigma_draws;
+};
+
+/**
+ * Store the draws of \f$ \beta \f$ and \f$ \sigma \f$ in (caller-owned) in-memory matrices; \f$ z \f$ is never formed
+ */
+
+class param_memory_sink_t : public draw_sink_t
+{
+    public:
+        param_memory_sink_t(Mat_t& beta_draws_inp, ColVec_t& sigma_draws_inp)
+            : beta_draws(beta_draws_inp), sigma_draws(sigma_draws_inp) {}
+
+        void begin(const size_t n, const size_t K, const size_t n_keep_draws) override
+        {
+            (void)(n);
+
+            beta_draws.setZero(K, n_keep_draws);
+            sigma_draws.setZero(n_keep_draws);
+        }
+
+        void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) override
+        {
+            (void)(z_draw);
+
+            beta_draws.col(draw_ind) = beta_draw;
+            sigma_draws(draw_ind) = sigma_draw;
+        }
+
+        bool wants_z() const override { return false; }
+
+    private:
+        Mat_t& beta_draws;
+        ColVec_t& sigma_draws;
+};
+
+/**
+ * Drop every draw (e.g., for timing runs, or when only the final state is needed)
+ */
+
+class discard_sink_t : public draw_sink_t
+{
+    public:
+        void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) override
+        {
+            (void)(draw_ind); (void)(beta_draw); (void)(z_draw); (void)(sigma_draw);
+        }
+
+        bool wants_z() const override { return false; }
+};
+
+/**
+ * Bounded single-producer/single-consumer ring buffer, drained by a background writer thread
+ *
+ * The sampler copies each draw into a preallocated slot and returns; the writer callback
+ * (e.g., file or network I/O) runs on its own thread. Memory use is capacity x (n + K + 1)
+ * values, independent of the number of draws. If the ring is full, the sampler waits for
+ * a free slot, or, if \c drop_when_full is set, drops the draw and counts it. The slots are
+ * handed over through atomic head and tail counters, but the ring is not lock-free: after each
+ * push and each freed slot, the other side is signalled through a mutex and a condition
+ * variable, and both sides block on those rather than spinning.
+ *
+ * If the writer callback throws, the writer stops, the sink drops every later draw and asks the
+ * sampler to stop (see stop_requested), and end() rethrows the exception on the sampling thread.
+ */
+
+class ring_buffer_sink_t : public draw_sink_t
+{
+    public:
+        using writer_fn_t = std::function<void(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw)>;
+
+        ring_buffer_sink_t(writer_fn_t writer_fn_inp, const size_t capacity_inp, const bool keep_z_inp = true, const bool drop_when_full_inp = false)
+            : writer_fn(writer_fn_inp), capacity(std::max(capacity_inp, size_t(1))), keep_z(keep_z_inp), drop_when_full(drop_when_full_inp) {}
+
+        ~ring_buffer_sink_t() override
+        {
+            join_writer();
+        }
+
+        ring_buffer_sink_t(const ring_buffer_sink_t&) = delete;
+        ring_buffer_sink_t& operator=(const ring_buffer_sink_t&) = delete;
+
+        void begin(const size_t n, const size_t K, const size_t n_keep_draws) override
+        {
+            (void)(n_keep_draws);
+
+            join_writer();
+            writer_exception = nullptr;
+
+            slots.resize(capacity);
+
+            for (auto& slot : slots) {
+                slot.beta_draw.resize(K);
+                slot.z_draw.resize(keep_z ? n : 0);
+            }
+
+            head.store(0, std::memory_order_relaxed);
+            tail.store(0, std::memory_order_relaxed);
+            n_dropped.store(0, std::memory_order_relaxed);
+            producer_done.store(false, std::memory_order_relaxed);
+            writer_failed.store(false, std::memory_order_relaxed);
+
+            writer_thread = std::thread(&ring_buffer_sink_t::drain, this);
+        }
+
+        void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) override
+        {
+            const size_t head_val = head.load(std::memory_order_relaxed);
+
+            if (writer_failed.load(std::memory_order_acquire)) {
+                return;
+            }
+
+            if (head_val - tail.load(std::memory_order_acquire) >= capacity) {
+                if (drop_when_full) {
+                    n_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+
+                std::unique_lock<std::mutex> lock(ring_mutex);
+                not_full.wait(lock, [&] { return head_val - tail.load(std::memory_order_acquire) < capacity || writer_failed.load(std::memory_order_acquire); });
+
+                if (writer_failed.load(std::memory_order_acquire)) {
+                    return;
+                }
+            }
+
+            slot_t& slot = slots[head_val % capacity];
+
+            slot.draw_ind = draw_ind;
+            slot.beta_draw = beta_draw;
+            slot.sigma_draw = sigma_draw;
+
+            if (keep_z) {
+                slot.z_draw = z_draw;
+            }
+
+            head.store(head_val + 1, std::memory_order_release);
+
+            notify(not_empty);
+        }
+
+        /**
+         * Wait for the writer to drain the ring
+         * @brief Rethrows the exception of the writer callback, if it threw
+         */
+
+        void end() override
+        {
+            stop_writer();
+        }
+
+        bool wants_z() const override { return keep_z; }
+
+        bool stop_requested() const override { return writer_failed.load(std::memory_order_acquire); }
+
+        /**
+         * @return the number of draws dropped because the ring was full
+         */
+
+        size_t get_n_dropped() const { return n_dropped.load(std::memory_order_relaxed); }
+
+    private:
+        struct slot_t
+        {
+            size_t draw_ind = 0;
+            ColVec_t beta_draw;
+            ColVec_t z_draw;
+            fp_t sigma_draw = 0;
+        };
+
+        writer_fn_t writer_fn;
+        size_t capacity;
+        bool keep_z;
+        bool drop_when_full;
+
+        std::vector<slot_t> slots;
+
+        std::atomic<size_t> head{0}; // next slot to be written by the sampler
+        std::atomic<size_t> tail{0}; // next slot to be read by the writer
+        std::atomic<size_t> n_dropped{0};
+        std::atomic<bool> producer_done{false};
+        std::atomic<bool> writer_failed{false};
+
+        std::exception_ptr writer_exception; // set by the writer thread before writer_failed
+
+        // the waits check head, tail, and producer_done under ring_mutex, and each update of those
+        // is followed by locking ring_mutex before notifying, so a wakeup cannot be lost
+
+        std::mutex ring_mutex;
+        std::condition_variable not_empty; // the writer waits on this
+        std::condition_variable not_full;  // the sampler waits on this
+
+        std::thread writer_thread;
+
+        void notify(std::condition_variable& cond_var)
+        {
+            { std::lock_guard<std::mutex> lock(ring_mutex); }
+
+            cond_var.notify_one();
+        }
+
+        void drain()
+        {
+            while (true) {
+                const size_t tail_val = tail.load(std::memory_order_relaxed);
+
+                if (tail_val == head.load(std::memory_order_acquire)) {
+                    std::unique_lock<std::mutex> lock(ring_mutex);
+                    not_empty.wait(lock, [&] { return tail_val != head.load(std::memory_order_acquire) || producer_done.load(std::memory_order_acquire); });
+
+                    if (tail_val == head.load(std::memory_order_acquire)) {
+                        return; // producer_done, and the ring is empty
+                    }
+                }
+
+                const slot_t& slot = slots[tail_val % capacity];
+
+                try {
+                    writer_fn(slot.draw_ind, slot.beta_draw, slot.z_draw, slot.sigma_draw);
+                } catch (...) {
+                    writer_exception = std::current_exception();
+                    writer_failed.store(true, std::memory_order_release);
+
+                    notify(not_full);
+                    return;
+                }
+
+                tail.store(tail_val + 1, std::memory_order_release);
+
+                notify(not_full);
+            }
+        }
+
+        void join_writer()
+        {
+            if (writer_thread.joinable()) {
+                producer_done.store(true, std::memory_order_release);
+                notify(not_empty);
+
+                writer_thread.join();
+            }
+        }
+
+        void stop_writer()
+        {
+            join_writer();
+
+            if (writer_exception) {
+                std::exception_ptr writer_exception_copy = writer_exception;
+                writer_exception = nullptr;
+
+                std::rethrow_exception(writer_exception_copy);
+            }
+        }
+};
+
+#endif
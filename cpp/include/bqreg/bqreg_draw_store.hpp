@@ -0,0 +1,431 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Memory-mapped on-disk draw store
+ *
+ * File layout (native byte order, all integers are uint64):
+ *
+ *   offset   0: magic "BQREGDRW"
+ *   offset   8: version, n, K, n_keep_draws, n_burnin_draws, thinning_factor, seed_value
+ *   offset  64: tau (float64)
+ *   offset  72: n_draws_written, n_blocks
+ *   offset  88: n_blocks block descriptors, each (type_code, n_rows, n_cols, offset)
+ *
+ * followed by the blocks, in the order beta (K x n_keep_draws), sigma (1 x n_keep_draws), and
+ * z (n x n_keep_draws). Each block is stored column-major with one column per kept draw, so a
+ * draw is a contiguous segment, and starts on a page boundary. Type codes: 1 = float32, 2 = float64.
+ */
+
+#ifndef _bqreg_draw_store_HPP
+#define _bqreg_draw_store_HPP
+
+#define BQREG_DRAW_STORE_VERSION 1
+#define BQREG_DRAW_STORE_PAGE_SIZE 4096
+
+enum class draw_store_type_t : uint64_t {
+    float32 = 1,
+    float64 = 2
+};
+
+struct draw_store_block_t
+{
+    uint64_t type_code;
+    uint64_t n_rows;
+    uint64_t n_cols;
+    uint64_t offset;
+};
+
+struct draw_store_header_t
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t n;
+    uint64_t K;
+    uint64_t n_keep_draws;
+    uint64_t n_burnin_draws;
+    uint64_t thinning_factor;
+    uint64_t seed_value;
+    double tau;
+    uint64_t n_draws_written;
+    uint64_t n_blocks;
+    draw_store_block_t blocks[3]; // beta, sigma, z
+};
+
+static_assert(sizeof(draw_store_header_t) == 184, "bqreg: unexpected padding in draw_store_header_t");
+
+enum draw_store_block_ind_t {
+    DRAW_STORE_BETA = 0,
+    DRAW_STORE_SIGMA = 1,
+    DRAW_STORE_Z = 2
+};
+
+/**
+ * Metadata recorded in the header of a draw store
+ */
+
+struct draw_store_meta_t
+{
+    fp_t tau = fp_t(0.5);
+    size_t n_burnin_draws = 0;
+    size_t thinning_factor = 0;
+    size_t seed_value = 0; /*!< key of the counter-based generator of the run (see counter_rng_t) */
+};
+
+/**
+ * Metadata of a new sampler run that draws from \c rand_engine
+ * @brief A new run (not a resume) takes the key of its counter-based generator as the next draw of \c rand_engine; the key is drawn here from a copy of the engine, so the state of \c rand_engine is unchanged.
+ */
+
+inline
+draw_store_meta_t
+make_draw_store_meta(
+    const fp_t tau,
+    const size_t n_burnin_draws,
+    const size_t thinning_factor,
+    const rand_engine_t& rand_engine
+)
+{
+    draw_store_meta_t meta;
+
+    meta.tau = tau;
+    meta.n_burnin_draws = n_burnin_draws;
+    meta.thinning_factor = thinning_factor;
+
+    rand_engine_t key_engine = rand_engine;
+    meta.seed_value = key_engine();
+
+    return meta;
+}
+
+inline
+size_t
+draw_store_type_size(const uint64_t type_code)
+{
+    return (type_code == uint64_t(draw_store_type_t::float32)) ? sizeof(float) : sizeof(double);
+}
+
+inline
+uint64_t
+draw_store_round_up(const uint64_t offset)
+{
+    return ( (offset + BQREG_DRAW_STORE_PAGE_SIZE - 1) / BQREG_DRAW_STORE_PAGE_SIZE ) * BQREG_DRAW_STORE_PAGE_SIZE;
+}
+
+/**
+ * Draw sink that writes each kept draw straight into a memory-mapped file
+ */
+
+class mmap_draw_sink_t : public draw_sink_t
+{
+    public:
+        /**
+         * @param file_path_inp path of the file to create (an existing file is overwritten)
+         * @param meta_inp metadata to record in the header
+         * @param keep_z_inp whether to store the draws of \f$ z \f$
+         * @param z_as_float_inp store the draws of \f$ z \f$ as float32, halving the size of the largest block
+         */
+
+        mmap_draw_sink_t(const std::string& file_path_inp, const draw_store_meta_t& meta_inp, const bool keep_z_inp = true, const bool z_as_float_inp = false)
+            : file_path(file_path_inp), meta(meta_inp), keep_z(keep_z_inp), z_as_float(z_as_float_inp) {}
+
+        ~mmap_draw_sink_t() override
+        {
+            close_map();
+        }
+
+        mmap_draw_sink_t(const mmap_draw_sink_t&) = delete;
+        mmap_draw_sink_t& operator=(const mmap_draw_sink_t&) = delete;
+
+        void begin(const size_t n, const size_t K, const size_t n_keep_draws) override
+        {
+            close_map();
+
+            const uint64_t fp_type_code = (sizeof(fp_t) == sizeof(float)) ? uint64_t(draw_store_type_t::float32) : uint64_t(draw_store_type_t::float64);
+            const uint64_t z_type_code = z_as_float ? uint64_t(draw_store_type_t::float32) : fp_type_code;
+
+            draw_store_header_t header;
+
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, "BQREGDRW", 8);
+
+            header.version = BQREG_DRAW_STORE_VERSION;
+            header.n = n;
+            header.K = K;
+            header.n_keep_draws = n_keep_draws;
+            header.n_burnin_draws = meta.n_burnin_draws;
+            header.thinning_factor = meta.thinning_factor;
+            header.seed_value = meta.seed_value;
+            header.tau = static_cast<double>(meta.tau);
+            header.n_draws_written = 0;
+            header.n_blocks = 3;
+
+            header.blocks[DRAW_STORE_BETA] = {fp_type_code, K, n_keep_draws, 0};
+            header.blocks[DRAW_STORE_SIGMA] = {fp_type_code, 1, n_keep_draws, 0};
+            header.blocks[DRAW_STORE_Z] = {z_type_code, n, keep_z ? n_keep_draws : 0, 0};
+
+            uint64_t offset = draw_store_round_up(sizeof(draw_store_header_t));
+
+            for (uint64_t block_ind = 0; block_ind < header.n_blocks; ++block_ind) {
+                draw_store_block_t& block = header.blocks[block_ind];
+
+                block.offset = offset;
+                offset = draw_store_round_up(offset + block.n_rows * block.n_cols * draw_store_type_size(block.type_code));
+            }
+
+            file_size = offset;
+
+            fd = ::open(file_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+            if (fd < 0) {
+                throw std::runtime_error("bqreg: could not create the draw store file " + file_path);
+            }
+
+            if (::ftruncate(fd, file_size) != 0) {
+                close_map();
+                throw std::runtime_error("bqreg: could not resize the draw store file " + file_path);
+            }
+
+            void* map_ptr = ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (map_ptr == MAP_FAILED) {
+                close_map();
+                throw std::runtime_error("bqreg: could not memory-map the draw store file " + file_path);
+            }
+
+            base_ptr = static_cast<char*>(map_ptr);
+
+            std::memcpy(base_ptr, &header, sizeof(header));
+        }
+
+        void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) override
+        {
+            draw_store_header_t* header = reinterpret_cast<draw_store_header_t*>(base_ptr);
+
+            write_column(header->blocks[DRAW_STORE_BETA], draw_ind, beta_draw.data());
+            write_column(header->blocks[DRAW_STORE_SIGMA], draw_ind, &sigma_draw);
+
+            if (keep_z) {
+                write_column(header->blocks[DRAW_STORE_Z], draw_ind, z_draw.data());
+            }
+
+            header->n_draws_written = draw_ind + 1;
+        }
+
+        void end() override
+        {
+            close_map();
+        }
+
+        bool wants_z() const override { return keep_z; }
+
+    private:
+        std::string file_path;
+        draw_store_meta_t meta;
+        bool keep_z;
+        bool z_as_float;
+
+        int fd = -1;
+        size_t file_size = 0;
+        char* base_ptr = nullptr;
+
+        void write_column(const draw_store_block_t& block, const size_t draw_ind, const fp_t* src_ptr)
+        {
+            char* col_ptr = base_ptr + block.offset + draw_ind * block.n_rows * draw_store_type_size(block.type_code);
+
+            if (block.type_code == uint64_t(draw_store_type_t::float32)) {
+                Eigen::Map<Eigen::VectorXf>(reinterpret_cast<float*>(col_ptr), block.n_rows) = Eigen::Map<const ColVec_t>(src_ptr, block.n_rows).template cast<float>();
+            } else {
+                Eigen::Map<Eigen::VectorXd>(reinterpret_cast<double*>(col_ptr), block.n_rows) = Eigen::Map<const ColVec_t>(src_ptr, block.n_rows).template cast<double>();
+            }
+        }
+
+        void close_map()
+        {
+            if (base_ptr != nullptr) {
+                ::msync(base_ptr, file_size, MS_SYNC);
+                ::munmap(base_ptr, file_size);
+                base_ptr = nullptr;
+            }
+
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+};
+
+/**
+ * Zero-copy reader for a draw store
+ *
+ * The file is mapped read-only; nothing is read from disk until a block is accessed, and
+ * then only the pages that are touched.
+ */
+
+class draw_store_reader_t
+{
+    public:
+        explicit draw_store_reader_t(const std::string& file_path)
+        {
+            fd = ::open(file_path.c_str(), O_RDONLY);
+
+            if (fd < 0) {
+                throw std::runtime_error("bqreg: could not open the draw store file " + file_path);
+            }
+
+            struct stat file_stat;
+
+            if (::fstat(fd, &file_stat) != 0 || size_t(file_stat.st_size) < sizeof(draw_store_header_t)) {
+                close_map();
+                throw std::runtime_error("bqreg: invalid draw store file " + file_path);
+            }
+
+            file_size = file_stat.st_size;
+
+            void* map_ptr = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+
+            if (map_ptr == MAP_FAILED) {
+                close_map();
+                throw std::runtime_error("bqreg: could not memory-map the draw store file " + file_path);
+            }
+
+            base_ptr = static_cast<const char*>(map_ptr);
+
+            if (std::memcmp(header().magic, "BQREGDRW", 8) != 0 || header().version != BQREG_DRAW_STORE_VERSION) {
+                close_map();
+                throw std::runtime_error("bqreg: " + file_path + " is not a draw store file (or has an unsupported version)");
+            }
+
+            // a truncated or corrupt header would otherwise let block() map past the end of the file
+
+            if (!valid_blocks()) {
+                close_map();
+                throw std::runtime_error("bqreg: the block descriptors of the draw store file " + file_path + " do not fit in the file");
+            }
+        }
+
+        ~draw_store_reader_t()
+        {
+            close_map();
+        }
+
+        draw_store_reader_t(const draw_store_reader_t&) = delete;
+        draw_store_reader_t& operator=(const draw_store_reader_t&) = delete;
+
+        /**
+         * @return the file header
+         */
+
+        const draw_store_header_t& header() const
+        {
+            return *reinterpret_cast<const draw_store_header_t*>(base_ptr);
+        }
+
+        /**
+         * Map a block of the file as a matrix, one column per kept draw
+         *
+         * @param block_ind one of DRAW_STORE_BETA, DRAW_STORE_SIGMA, or DRAW_STORE_Z
+         * @return a read-only view of the block; T must match the type code of the block
+         */
+
+        template<typename T>
+        Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>
+        block(const size_t block_ind) const
+        {
+            if (block_ind >= header().n_blocks) {
+                throw std::invalid_argument("bqreg: the draw store has no block with this index");
+            }
+
+            const draw_store_block_t& block_desc = header().blocks[block_ind];
+
+            if (draw_store_type_size(block_desc.type_code) != sizeof(T)) {
+                throw std::invalid_argument("bqreg: the requested type does not match the type of the draw store block");
+            }
+
+            return Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>(reinterpret_cast<const T*>(base_ptr + block_desc.offset), block_desc.n_rows, block_desc.n_cols);
+        }
+
+        /**
+         * @return a K x n_keep_draws view of the draws of \f$ \beta \f$
+         */
+
+        Eigen::Map<const Mat_t> beta_draws() const { return block<fp_t>(DRAW_STORE_BETA); }
+
+        /**
+         * @return a 1 x n_keep_draws view of the draws of \f$ \sigma \f$
+         */
+
+        Eigen::Map<const Mat_t> sigma_draws() const { return block<fp_t>(DRAW_STORE_SIGMA); }
+
+    private:
+        int fd = -1;
+        size_t file_size = 0;
+        const char* base_ptr = nullptr;
+
+        // each block must have a known type, be aligned for it, and lie within the file
+
+        bool valid_blocks() const
+        {
+            const uint64_t n_blocks = header().n_blocks;
+
+            if (n_blocks > sizeof(header().blocks) / sizeof(draw_store_block_t)) {
+                return false;
+            }
+
+            for (uint64_t block_ind = 0; block_ind < n_blocks; ++block_ind) {
+                const draw_store_block_t& block_desc = header().blocks[block_ind];
+
+                if (block_desc.type_code != uint64_t(draw_store_type_t::float32) && block_desc.type_code != uint64_t(draw_store_type_t::float64)) {
+                    return false;
+                }
+
+                const uint64_t type_size = draw_store_type_size(block_desc.type_code);
+
+                if (block_desc.offset < sizeof(draw_store_header_t) || block_desc.offset > file_size || block_desc.offset % type_size != 0) {
+                    return false;
+                }
+
+                // n_rows * n_cols * type_size <= file_size - offset, without overflow
+
+                const uint64_t max_values = (file_size - block_desc.offset) / type_size;
+
+                if (block_desc.n_rows != 0 && block_desc.n_cols > max_values / block_desc.n_rows) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        void close_map()
+        {
+            if (base_ptr != nullptr) {
+                ::munmap(const_cast<char*>(base_ptr), file_size);
+                base_ptr = nullptr;
+            }
+
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+};
+
+#endif
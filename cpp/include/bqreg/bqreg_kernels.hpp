@@ -0,0 +1,899 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Fused data pass kernels
+ *
+ * X is processed in blocks of BQREG_ROW_BLOCK_SIZE rows. For a column-major X, each
+ * column of a row block is a contiguous segment, so the block is read with unit stride.
+ *
+ * The Gram statistics are accumulated without the 1 / (omega^2 * sigma) factor:
+ *
+ *   gram_mat = X' N^{-1} X,   gram_vec = X' N^{-1} (Y - theta * nu),   N = diag(nu)
+ *
+ * so that they can be computed in the same pass as the nu draws, before sigma is updated.
+ *
+ * Y and X may be stored in a lower precision than fp_t (e.g., float with fp_t = double); each
+ * row block is then converted to fp_t once, in cache, and all accumulation is done in fp_t.
+ *
+ * Reductions are deterministic: the row blocks are split into a fixed number of contiguous
+ * reduction slots that depends only on n and K. Each slot is accumulated in row order by a
+ * single thread, and the slots are summed in slot order, so the results are bitwise identical
+ * for any number of threads.
+ */
+
+#ifndef _bqreg_kernels_HPP
+#define _bqreg_kernels_HPP
+
+inline
+size_t
+get_n_row_blocks(const size_t n)
+{
+    return (n + BQREG_ROW_BLOCK_SIZE - 1) / BQREG_ROW_BLOCK_SIZE;
+}
+
+/*
+ * Reduction slots: partial sums for a contiguous range of row blocks, one set per chain
+ * (index slot_ind * n_chains + chain_ind)
+ */
+
+struct reduction_slots_t
+{
+    size_t n_slots = 0;
+    size_t n_chains = 0;
+
+    std::vector<Mat_t> gram_mats;
+    std::vector<ColVec_t> gram_vecs;
+    ColVec_t sum_nu_vals;
+    ColVec_t sum_err_vals;
+};
+
+inline
+size_t
+get_n_reduction_slots(const size_t n_blocks, const size_t K, const size_t n_chains)
+{
+    const size_t slot_bytes = n_chains * (K * K + K + 2) * sizeof(fp_t);
+    const size_t n_slots_mem = std::max(size_t(1), size_t(BQREG_REDUCTION_MAX_BYTES) / slot_bytes);
+
+    return std::max(size_t(1), std::min( std::min(n_blocks, size_t(BQREG_REDUCTION_SLOTS)), n_slots_mem ));
+}
+
+inline
+void
+set_reduction_slots(reduction_slots_t& slots_ws, const size_t n_blocks, const size_t K, const size_t n_chains, sampler_stats_t* stats = nullptr)
+{
+    const size_t n_slots = get_n_reduction_slots(n_blocks, K, n_chains);
+    const size_t n_accum = n_slots * n_chains;
+
+    slots_ws.n_slots = n_slots;
+    slots_ws.n_chains = n_chains;
+
+    // allocated once, then only zeroed
+
+    const bool is_allocated = slots_ws.gram_mats.size() == n_accum && size_t(slots_ws.sum_nu_vals.size()) == n_accum
+                                && (n_accum == 0 || size_t(slots_ws.gram_mats[0].rows()) == K);
+
+    if (!is_allocated) {
+        stats_add_allocs(stats, (K > 0 ? 2 * n_accum : 0) + 2, n_accum * (K * K + K + 2) * sizeof(fp_t));
+    }
+
+    slots_ws.gram_mats.resize(n_accum);
+    slots_ws.gram_vecs.resize(n_accum);
+
+    for (size_t accum_ind = 0; accum_ind < n_accum; ++accum_ind) {
+        slots_ws.gram_mats[accum_ind].setZero(K,K);
+        slots_ws.gram_vecs[accum_ind].setZero(K);
+    }
+
+    slots_ws.sum_nu_vals.setZero(n_accum);
+    slots_ws.sum_err_vals.setZero(n_accum);
+}
+
+inline
+void
+get_slot_block_range(const size_t slot_ind, const size_t n_slots, const size_t n_blocks, size_t& block_begin, size_t& block_end)
+{
+    block_begin = (slot_ind * n_blocks) / n_slots;
+    block_end = ((slot_ind + 1) * n_blocks) / n_slots;
+}
+
+// sum the slots of one chain in slot order
+
+inline
+void
+combine_reduction_slots(
+    const reduction_slots_t& slots_ws,
+    const size_t chain_ind,
+    Mat_t& gram_mat,
+    ColVec_t& gram_vec,
+    fp_t& sum_nu,
+    fp_t& sum_err_val
+)
+{
+    const size_t n_chains = slots_ws.n_chains;
+
+    gram_mat = slots_ws.gram_mats[chain_ind];
+    gram_vec = slots_ws.gram_vecs[chain_ind];
+    sum_nu = slots_ws.sum_nu_vals(chain_ind);
+    sum_err_val = slots_ws.sum_err_vals(chain_ind);
+
+    for (size_t slot_ind = 1; slot_ind < slots_ws.n_slots; ++slot_ind) {
+        const size_t accum_ind = slot_ind * n_chains + chain_ind;
+
+        gram_mat.template triangularView<Eigen::Lower>() += slots_ws.gram_mats[accum_ind];
+        gram_vec += slots_ws.gram_vecs[accum_ind];
+        sum_nu += slots_ws.sum_nu_vals(accum_ind);
+        sum_err_val += slots_ws.sum_err_vals(accum_ind);
+    }
+}
+
+/*
+ * A row block of X in the working precision: a view of X itself when X is stored as Mat_t,
+ * otherwise a converted copy held in the workspace X_block_ws
+ */
+
+inline
+Eigen::Ref<const Mat_t>
+get_row_block(
+    const Mat_t& X,
+    const size_t row_start,
+    const size_t n_rows,
+    Mat_t& X_block_ws
+)
+{
+    (void)(X_block_ws);
+    return X.middleRows(row_start, n_rows);
+}
+
+template<typename DataMat_t>
+inline
+Eigen::Ref<const Mat_t>
+get_row_block(
+    const DataMat_t& X,
+    const size_t row_start,
+    const size_t n_rows,
+    Mat_t& X_block_ws
+)
+{
+    if (size_t(X_block_ws.rows()) < n_rows || X_block_ws.cols() != X.cols()) {
+        X_block_ws.resize(BQREG_ROW_BLOCK_SIZE, X.cols());
+    }
+
+    X_block_ws.topRows(n_rows) = X.middleRows(row_start, n_rows).template cast<fp_t>();
+
+    return X_block_ws.topRows(n_rows);
+}
+
+// a view of column-major data is used in place; a row-major view is copied a block at a time
+
+inline
+Eigen::Ref<const Mat_t>
+get_row_block(
+    const MatView_t& X,
+    const size_t row_start,
+    const size_t n_rows,
+    Mat_t& X_block_ws
+)
+{
+    if (X.innerStride() == 1) {
+        (void)(X_block_ws);
+        return Eigen::Map<const Mat_t, 0, Eigen::OuterStride<>>(X.data() + row_start, n_rows, X.cols(), Eigen::OuterStride<>(X.outerStride()));
+    }
+
+    if (size_t(X_block_ws.rows()) < n_rows || X_block_ws.cols() != X.cols()) {
+        X_block_ws.resize(BQREG_ROW_BLOCK_SIZE, X.cols());
+    }
+
+    X_block_ws.topRows(n_rows) = X.middleRows(row_start, n_rows);
+
+    return X_block_ws.topRows(n_rows);
+}
+
+// a sparse X is scattered into a dense block; used by the kernels without a sparse specialization
+
+inline
+Eigen::Ref<const Mat_t>
+get_row_block(
+    const SpMat_t& X,
+    const size_t row_start,
+    const size_t n_rows,
+    Mat_t& X_block_ws
+)
+{
+    if (size_t(X_block_ws.rows()) < n_rows || X_block_ws.cols() != X.cols()) {
+        X_block_ws.resize(BQREG_ROW_BLOCK_SIZE, X.cols());
+    }
+
+    X_block_ws.topRows(n_rows).setZero();
+
+    for (size_t j = 0; j < n_rows; ++j) {
+        for (SpMat_t::InnerIterator it(X, row_start + j); it; ++it) {
+            X_block_ws(j, it.col()) = it.value();
+        }
+    }
+
+    return X_block_ws.topRows(n_rows);
+}
+
+/*
+ * accumulate the lower triangle of X_b' W X_b and X_b' W y_b for one block, where the
+ * rows of X_b have already been scaled by sqrt(w) (held in Xw_block) and wy_block = sqrt(w) * y
+ */
+
+template<typename BlockMat_t, typename BlockVec_t>
+inline
+void
+qr_gram_block_update(
+    const BlockMat_t& Xw_block,
+    const BlockVec_t& wy_block,
+    Mat_t& gram_mat,
+    ColVec_t& gram_vec
+)
+{
+    gram_mat.template selfadjointView<Eigen::Lower>().rankUpdate(Xw_block.transpose());
+    gram_vec.noalias() += Xw_block.transpose() * wy_block;
+}
+
+inline
+void
+qr_gram_symmetrize(Mat_t& gram_mat)
+{
+    gram_mat.template triangularView<Eigen::StrictlyUpper>() = gram_mat.transpose();
+}
+
+/*
+ * Packed outer-product cache
+ *
+ * Only the weights w_i = 1 / nu_i of the Gram matrix change between iterations, so for small K
+ * the lower triangles of the row outer products x_i x_i' can be stored once, packed column by
+ * column into K(K+1)/2 values per row. The Gram matrix of a row block is then a single weighted
+ * GEMV over a contiguous array,
+ *
+ *   packed(X_b' W_b X_b) = C_b w_b,   column i of C_b = packed(x_i x_i')
+ *
+ * The cache is (K+1)/2 times the size of X, so it pays off only while reading it is cheaper than
+ * the blocked rank update it replaces: for small K, or while it stays in cache.
+ */
+
+struct outer_prod_cache_t
+{
+    Mat_t packed_rows; /*!< K(K+1)/2 x n */
+
+    bool is_built() const
+    {
+        return packed_rows.size() > 0;
+    }
+};
+
+inline
+size_t
+get_n_packed(const size_t K)
+{
+    return K * (K + 1) / 2;
+}
+
+inline
+bool
+use_outer_prod_cache(const size_t n, const size_t K, const size_t max_bytes)
+{
+    return n > 0 && K > 0 && K <= size_t(BQREG_OUTER_CACHE_MAX_K) && n * get_n_packed(K) * sizeof(fp_t) <= max_bytes;
+}
+
+template<typename DataMat_t>
+inline
+void
+build_outer_prod_cache(
+    const DataMat_t& X,
+    const size_t n,
+    const int omp_n_threads,
+    outer_prod_cache_t& outer_cache,
+    sampler_stats_t* stats = nullptr
+)
+{
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    const size_t K = X.cols();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    outer_cache.packed_rows.resize(get_n_packed(K), n);
+
+    stats_add_allocs(stats, 1, outer_cache.packed_rows.size() * sizeof(fp_t));
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel num_threads(omp_n_threads)
+#endif
+    {
+        Mat_t X_block_ws;
+
+#ifdef BQREG_USE_OPENMP
+        #pragma omp for schedule(static)
+#endif
+        for (size_t block_ind = 0; block_ind < n_blocks; ++block_ind) {
+            const size_t row_start = block_ind * BQREG_ROW_BLOCK_SIZE;
+            const size_t n_rows = std::min(size_t(BQREG_ROW_BLOCK_SIZE), n - row_start);
+
+            const Eigen::Ref<const Mat_t> X_block = get_row_block(X, row_start, n_rows, X_block_ws);
+
+            for (size_t j = 0; j < n_rows; ++j) {
+                fp_t* packed_col = outer_cache.packed_rows.col(row_start + j).data();
+
+                for (size_t col_ind = 0; col_ind < K; ++col_ind) {
+                    for (size_t row_ind = col_ind; row_ind < K; ++row_ind) {
+                        *packed_col++ = X_block(j, row_ind) * X_block(j, col_ind);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// add a packed lower triangle to the lower triangle of gram_mat
+
+inline
+void
+qr_gram_unpack_add(const ColVec_t& packed_vec, Mat_t& gram_mat)
+{
+    const size_t K = gram_mat.cols();
+
+    size_t packed_ind = 0;
+
+    for (size_t col_ind = 0; col_ind < K; ++col_ind) {
+        for (size_t row_ind = col_ind; row_ind < K; ++row_ind) {
+            gram_mat(row_ind, col_ind) += packed_vec(packed_ind++);
+        }
+    }
+}
+
+/*
+ * Sum of squared residuals, || Y - X beta ||^2
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+fp_t
+qr_sum_sq_resid(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const ColVec_t& beta_draw
+)
+{
+    const size_t n = Y.size();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    Mat_t X_block_ws;
+    ColVec_t resid_block(BQREG_ROW_BLOCK_SIZE);
+
+    fp_t sum_sq_val = 0;
+
+    for (size_t block_ind = 0; block_ind < n_blocks; ++block_ind) {
+        const size_t row_start = block_ind * BQREG_ROW_BLOCK_SIZE;
+        const size_t n_rows = std::min(size_t(BQREG_ROW_BLOCK_SIZE), n - row_start);
+
+        resid_block.head(n_rows).noalias() = Y.segment(row_start, n_rows).template cast<fp_t>() - get_row_block(X, row_start, n_rows, X_block_ws) * beta_draw;
+
+        sum_sq_val += resid_block.head(n_rows).squaredNorm();
+    }
+
+    return sum_sq_val;
+}
+
+/*
+ * Gram statistics only; used to initialize the sampler
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gram_pass(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const ColVec_t& nu_draw,
+    const fp_t theta_par,
+    const int omp_n_threads,
+    Mat_t& gram_mat,
+    ColVec_t& gram_vec
+)
+{
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    reduction_slots_t slots_ws;
+    set_reduction_slots(slots_ws, n_blocks, K, 1);
+
+    const size_t n_slots = slots_ws.n_slots;
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel num_threads(omp_n_threads)
+#endif
+    {
+        Mat_t X_block_ws;
+        Mat_t Xw_block(BQREG_ROW_BLOCK_SIZE, K);
+        ColVec_t sqrt_w_block(BQREG_ROW_BLOCK_SIZE);
+        ColVec_t wy_block(BQREG_ROW_BLOCK_SIZE);
+
+#ifdef BQREG_USE_OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+            size_t block_begin, block_end;
+            get_slot_block_range(slot_ind, n_slots, n_blocks, block_begin, block_end);
+
+            for (size_t block_ind = block_begin; block_ind < block_end; ++block_ind) {
+                const size_t row_start = block_ind * BQREG_ROW_BLOCK_SIZE;
+                const size_t n_rows = std::min(size_t(BQREG_ROW_BLOCK_SIZE), n - row_start);
+
+                for (size_t j = 0; j < n_rows; ++j) {
+                    const size_t i = row_start + j;
+
+                    sqrt_w_block(j) = fp_t(1) / std::sqrt(nu_draw(i));
+                    wy_block(j) = ( Y(i) - theta_par * nu_draw(i) ) * sqrt_w_block(j);
+                }
+
+                Xw_block.topRows(n_rows).noalias() = sqrt_w_block.head(n_rows).asDiagonal() * get_row_block(X, row_start, n_rows, X_block_ws);
+
+                qr_gram_block_update(Xw_block.topRows(n_rows), wy_block.head(n_rows), slots_ws.gram_mats[slot_ind], slots_ws.gram_vecs[slot_ind]);
+            }
+        }
+    }
+
+    fp_t sum_nu_unused, sum_err_unused;
+    combine_reduction_slots(slots_ws, 0, gram_mat, gram_vec, sum_nu_unused, sum_err_unused);
+
+    qr_gram_symmetrize(gram_mat);
+}
+
+/*
+ * Team reductions: the data pass below is written for a team of threads that stays alive for
+ * the whole run of the sampler. Its loops are orphaned worksharing constructs, so it is called
+ * by every thread of the enclosing parallel region (or, outside of one, runs serially), and the
+ * barriers at the ends of the loops separate the phases of an iteration.
+ */
+
+// per-thread buffers of the data pass, sized by the first pass of the team and then reused
+
+struct data_pass_ws_t
+{
+    Mat_t X_block_ws;
+    Mat_t Xw_block;
+    ColVec_t resid_block;
+    ColVec_t sqrt_w_block;
+    ColVec_t packed_gram; // the Gram sum of a slot, when the rows' outer products are cached
+
+    thread_stats_t thread_stats;
+};
+
+// called by each thread when the team ends
+
+inline
+void
+stats_merge_thread(sampler_stats_t* stats, data_pass_ws_t& pass_ws)
+{
+    stats_count_workspace(pass_ws.thread_stats, pass_ws.X_block_ws, pass_ws.Xw_block, pass_ws.resid_block, pass_ws.sqrt_w_block, pass_ws.packed_gram);
+    stats_merge_thread(stats, pass_ws.thread_stats);
+}
+
+inline
+bool
+is_team_master()
+{
+#ifdef BQREG_USE_OPENMP
+    return omp_get_thread_num() == 0;
+#else
+    return true;
+#endif
+}
+
+/*
+ * Pairwise (tree) sum of the reduction slots of each chain, into slot 0: at each level, slot i
+ * adds slot i + stride for every i that is a multiple of 2 * stride. The pairs depend only on the
+ * number of slots, so the sum is the same for any number of threads, and the sum of one chain
+ * does not depend on the number of chains.
+ */
+
+inline
+void
+tree_reduce_slots(reduction_slots_t& slots_ws)
+{
+    const size_t n_slots = slots_ws.n_slots;
+    const size_t n_chains = slots_ws.n_chains;
+
+    for (size_t stride = 1; stride < n_slots; stride *= 2) {
+        const size_t n_pairs = (n_slots - stride - 1) / (2 * stride) + 1;
+
+#ifdef BQREG_USE_OPENMP
+        #pragma omp for schedule(static)
+#endif
+        for (size_t pair_ind = 0; pair_ind < n_pairs * n_chains; ++pair_ind) {
+            const size_t accum_ind = (pair_ind / n_chains) * 2 * stride * n_chains + pair_ind % n_chains;
+            const size_t other_ind = accum_ind + stride * n_chains;
+
+            slots_ws.gram_mats[accum_ind].template triangularView<Eigen::Lower>() += slots_ws.gram_mats[other_ind];
+            slots_ws.gram_vecs[accum_ind] += slots_ws.gram_vecs[other_ind];
+            slots_ws.sum_nu_vals(accum_ind) += slots_ws.sum_nu_vals(other_ind);
+            slots_ws.sum_err_vals(accum_ind) += slots_ws.sum_err_vals(other_ind);
+        }
+    }
+}
+
+/*
+ * Compile-time variants of the data pass, chosen once per run: for tau = 0.5, theta = 0 and the
+ * theta * nu terms vanish; with sigma held fixed, the sigma statistics are not needed. Each variant
+ * gives the same nu draws and Gram statistics as the general pass.
+ */
+
+enum data_pass_variant_t : int {
+    DATA_PASS_GENERAL      = 0,
+    DATA_PASS_ZERO_THETA   = 1,
+    DATA_PASS_SIGMA_FIXED  = 2  // combined with DATA_PASS_ZERO_THETA as a bit flag
+};
+
+inline
+int
+get_data_pass_variant(const fp_t theta_par, const bool keep_sigma_fixed)
+{
+    return (theta_par == fp_t(0) ? DATA_PASS_ZERO_THETA : 0) | (keep_sigma_fixed ? DATA_PASS_SIGMA_FIXED : 0);
+}
+
+/*
+ * Single pass over the data: compute the residuals once, draw nu, accumulate the
+ * sufficient statistics for sigma, and rebuild the Gram statistics for the next beta draw.
+ *
+ * The slots of slots_ws must be allocated (set_reduction_slots); each slot is zeroed by the
+ * thread that fills it. On return, slot 0 holds the sums (see get_data_pass_sums).
+ *
+ * With outer_cache, the Gram matrix is accumulated from the cached outer products of the rows
+ * instead of a rank update of each row block (see outer_prod_cache_t).
+ *
+ * This is the kernel of one variant; without sigma_stats, the sigma sums are left at zero.
+ */
+
+template<bool zero_theta, bool sigma_stats, typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_data_pass_team_kernel(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const ColVec_t& beta_draw,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const fp_t sigma_draw,
+    const counter_rng_t& rng,
+    reduction_slots_t& slots_ws,
+    data_pass_ws_t& pass_ws,
+    ColVec_t& nu_draw,
+    sampler_stats_t* stats,
+    const outer_prod_cache_t* outer_cache
+)
+{
+    const size_t n = Y.size();
+    const size_t n_blocks = get_n_row_blocks(n);
+    const size_t n_slots = slots_ws.n_slots;
+
+    const fp_t theta_val = zero_theta ? fp_t(0) : theta_par;
+
+    const fp_t gamma_par = std::sqrt( (2 / sigma_draw) + (theta_val * theta_val) / (sigma_draw * omega_sq_par) );
+    const fp_t tmp_scale_val = std::sqrt( sigma_draw * omega_sq_par );
+
+    if (size_t(pass_ws.Xw_block.cols()) != size_t(X.cols())) {
+        pass_ws.Xw_block.resize(BQREG_ROW_BLOCK_SIZE, X.cols());
+        pass_ws.resid_block.resize(BQREG_ROW_BLOCK_SIZE);
+        pass_ws.sqrt_w_block.resize(BQREG_ROW_BLOCK_SIZE);
+    }
+
+    if (outer_cache && size_t(pass_ws.packed_gram.size()) != size_t(outer_cache->packed_rows.rows())) {
+        pass_ws.packed_gram.resize(outer_cache->packed_rows.rows());
+    }
+
+    Mat_t& Xw_block = pass_ws.Xw_block;
+    ColVec_t& resid_block = pass_ws.resid_block;
+    ColVec_t& sqrt_w_block = pass_ws.sqrt_w_block;
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp for schedule(dynamic)
+#endif
+    for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+        size_t block_begin, block_end;
+        get_slot_block_range(slot_ind, n_slots, n_blocks, block_begin, block_end);
+
+        slots_ws.gram_mats[slot_ind].setZero();
+        slots_ws.gram_vecs[slot_ind].setZero();
+
+        if (outer_cache) {
+            pass_ws.packed_gram.setZero();
+        }
+
+        fp_t sum_nu_val = 0;
+        fp_t sum_err_sq_val = 0;
+
+        for (size_t block_ind = block_begin; block_ind < block_end; ++block_ind) {
+            const size_t row_start = block_ind * BQREG_ROW_BLOCK_SIZE;
+            const size_t n_rows = std::min(size_t(BQREG_ROW_BLOCK_SIZE), n - row_start);
+
+            const stats_time_t nu_time = stats_now();
+
+            const Eigen::Ref<const Mat_t> X_block = get_row_block(X, row_start, n_rows, pass_ws.X_block_ws);
+
+            resid_block.head(n_rows).noalias() = Y.segment(row_start, n_rows).template cast<fp_t>() - X_block * beta_draw;
+
+            for (size_t j = 0; j < n_rows; ++j) {
+                const size_t i = row_start + j;
+
+                const fp_t err_val = resid_block(j);
+                const fp_t delta_par = std::abs(err_val) / tmp_scale_val;
+                const fp_t nu_val = counter_rnu(gamma_par, delta_par, rng.block(RNG_STREAM_NU, i));
+
+                nu_draw(i) = nu_val;
+
+                if (sigma_stats) {
+                    const fp_t sigma_err_val = err_val - theta_val * nu_val;
+
+                    sum_nu_val += nu_val;
+                    sum_err_sq_val += (sigma_err_val * sigma_err_val) / (omega_sq_par * nu_val);
+                }
+
+                // the residual block is reused to hold sqrt(w) * (Y - theta * nu); with the cache,
+                // the rows are not scaled, and the weight block holds w itself
+
+                sqrt_w_block(j) = outer_cache ? fp_t(1) / nu_val : fp_t(1) / std::sqrt(nu_val);
+                resid_block(j) = ( Y(i) - theta_val * nu_val ) * sqrt_w_block(j);
+            }
+
+            const stats_time_t gram_time = stats_now();
+            pass_ws.thread_stats.nu_draw_seconds += stats_seconds_since(nu_time);
+
+            if (outer_cache) {
+                pass_ws.packed_gram.noalias() += outer_cache->packed_rows.middleCols(row_start, n_rows) * sqrt_w_block.head(n_rows);
+                slots_ws.gram_vecs[slot_ind].noalias() += X_block.transpose() * resid_block.head(n_rows);
+            } else {
+                Xw_block.topRows(n_rows).noalias() = sqrt_w_block.head(n_rows).asDiagonal() * X_block;
+
+                qr_gram_block_update(Xw_block.topRows(n_rows), resid_block.head(n_rows), slots_ws.gram_mats[slot_ind], slots_ws.gram_vecs[slot_ind]);
+            }
+
+            pass_ws.thread_stats.gram_seconds += stats_seconds_since(gram_time);
+        }
+
+        if (outer_cache) {
+            qr_gram_unpack_add(pass_ws.packed_gram, slots_ws.gram_mats[slot_ind]);
+        }
+
+        slots_ws.sum_nu_vals(slot_ind) = sum_nu_val;
+        slots_ws.sum_err_vals(slot_ind) = sum_err_sq_val;
+    }
+
+    const stats_time_t reduce_time = stats_now();
+
+    tree_reduce_slots(slots_ws);
+
+    if (is_team_master()) {
+        stats_add_time(stats, &sampler_stats_t::reduce_seconds, reduce_time);
+    }
+}
+
+// the data pass, dispatched to the kernel of pass_variant (see get_data_pass_variant)
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_data_pass_team(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const ColVec_t& beta_draw,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const fp_t sigma_draw,
+    const counter_rng_t& rng,
+    reduction_slots_t& slots_ws,
+    data_pass_ws_t& pass_ws,
+    ColVec_t& nu_draw,
+    sampler_stats_t* stats = nullptr,
+    const outer_prod_cache_t* outer_cache = nullptr,
+    const int pass_variant = DATA_PASS_GENERAL
+)
+{
+    switch (pass_variant) {
+        case DATA_PASS_ZERO_THETA:
+            qr_data_pass_team_kernel<true, true>(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, rng, slots_ws, pass_ws, nu_draw, stats, outer_cache);
+            break;
+        case DATA_PASS_SIGMA_FIXED:
+            qr_data_pass_team_kernel<false, false>(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, rng, slots_ws, pass_ws, nu_draw, stats, outer_cache);
+            break;
+        case DATA_PASS_ZERO_THETA | DATA_PASS_SIGMA_FIXED:
+            qr_data_pass_team_kernel<true, false>(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, rng, slots_ws, pass_ws, nu_draw, stats, outer_cache);
+            break;
+        default:
+            qr_data_pass_team_kernel<false, true>(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, rng, slots_ws, pass_ws, nu_draw, stats, outer_cache);
+    }
+}
+
+// the sums of a data pass, from slot 0; called by one thread after the pass
+
+inline
+void
+get_data_pass_sums(
+    const reduction_slots_t& slots_ws,
+    Mat_t& gram_mat,
+    ColVec_t& gram_vec,
+    fp_t& sum_nu,
+    fp_t& sum_err_val
+)
+{
+    gram_mat = slots_ws.gram_mats[0];
+    gram_vec = slots_ws.gram_vecs[0];
+    sum_nu = slots_ws.sum_nu_vals(0);
+    sum_err_val = slots_ws.sum_err_vals(0);
+
+    qr_gram_symmetrize(gram_mat);
+}
+
+// one data pass on its own team of threads, with the kernel the sampler would run (see qr_data_pass_team)
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_data_pass(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const ColVec_t& beta_draw,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const fp_t sigma_draw,
+    const int omp_n_threads,
+    const counter_rng_t& rng,
+    reduction_slots_t& slots_ws,
+    ColVec_t& nu_draw,
+    Mat_t& gram_mat,
+    ColVec_t& gram_vec,
+    fp_t& sum_nu,
+    fp_t& sum_err_val,
+    sampler_stats_t* stats = nullptr,
+    const int pass_variant = DATA_PASS_GENERAL,
+    const outer_prod_cache_t* outer_cache = nullptr
+)
+{
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    const size_t K = X.cols();
+
+    set_reduction_slots(slots_ws, get_n_row_blocks(Y.size()), K, 1, stats);
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel num_threads(omp_n_threads)
+#endif
+    {
+        data_pass_ws_t pass_ws;
+
+        qr_data_pass_team(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, rng, slots_ws, pass_ws, nu_draw, stats, outer_cache, pass_variant);
+
+        stats_merge_thread(stats, pass_ws);
+    }
+
+    get_data_pass_sums(slots_ws, gram_mat, gram_vec, sum_nu, sum_err_val);
+}
+
+
+/*
+ * Pass over the data without the Gram statistics: draw nu and accumulate the sufficient
+ * statistics for sigma; used when beta is drawn without forming X' N^{-1} X
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_nu_pass(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const ColVec_t& beta_draw,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const fp_t sigma_draw,
+    const int omp_n_threads,
+    const counter_rng_t& rng,
+    reduction_slots_t& slots_ws,
+    ColVec_t& nu_draw,
+    fp_t& sum_nu,
+    fp_t& sum_err_val,
+    sampler_stats_t* stats = nullptr
+)
+{
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    const size_t n = Y.size();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    const fp_t gamma_par = std::sqrt( (2 / sigma_draw) + (theta_par * theta_par) / (sigma_draw * omega_sq_par) );
+    const fp_t tmp_scale_val = std::sqrt( sigma_draw * omega_sq_par );
+
+    // no Gram accumulators: the number of slots depends on n only
+
+    set_reduction_slots(slots_ws, n_blocks, 0, 1, stats);
+
+    const size_t n_slots = slots_ws.n_slots;
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel num_threads(omp_n_threads)
+#endif
+    {
+        Mat_t X_block_ws;
+        ColVec_t resid_block(BQREG_ROW_BLOCK_SIZE);
+
+        thread_stats_t thread_stats;
+
+#ifdef BQREG_USE_OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+            size_t block_begin, block_end;
+            get_slot_block_range(slot_ind, n_slots, n_blocks, block_begin, block_end);
+
+            fp_t sum_nu_val = 0;
+            fp_t sum_err_sq_val = 0;
+
+            for (size_t block_ind = block_begin; block_ind < block_end; ++block_ind) {
+                const size_t row_start = block_ind * BQREG_ROW_BLOCK_SIZE;
+                const size_t n_rows = std::min(size_t(BQREG_ROW_BLOCK_SIZE), n - row_start);
+
+                const stats_time_t nu_time = stats_now();
+
+                resid_block.head(n_rows).noalias() = Y.segment(row_start, n_rows).template cast<fp_t>() - get_row_block(X, row_start, n_rows, X_block_ws) * beta_draw;
+
+                for (size_t j = 0; j < n_rows; ++j) {
+                    const size_t i = row_start + j;
+
+                    const fp_t err_val = resid_block(j);
+                    const fp_t delta_par = std::abs(err_val) / tmp_scale_val;
+                    const fp_t nu_val = counter_rnu(gamma_par, delta_par, rng.block(RNG_STREAM_NU, i));
+
+                    nu_draw(i) = nu_val;
+
+                    const fp_t sigma_err_val = err_val - theta_par * nu_val;
+
+                    sum_nu_val += nu_val;
+                    sum_err_sq_val += (sigma_err_val * sigma_err_val) / (omega_sq_par * nu_val);
+                }
+
+                thread_stats.nu_draw_seconds += stats_seconds_since(nu_time);
+            }
+
+            slots_ws.sum_nu_vals(slot_ind) = sum_nu_val;
+            slots_ws.sum_err_vals(slot_ind) = sum_err_sq_val;
+        }
+
+        stats_count_workspace(thread_stats, X_block_ws, resid_block);
+        stats_merge_thread(stats, thread_stats);
+    }
+
+    const stats_time_t reduce_time = stats_now();
+
+    sum_nu = 0;
+    sum_err_val = 0;
+
+    for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+        sum_nu += slots_ws.sum_nu_vals(slot_ind);
+        sum_err_val += slots_ws.sum_err_vals(slot_ind);
+    }
+
+    stats_add_time(stats, &sampler_stats_t::reduce_seconds, reduce_time);
+}
+
+#endif
@@ -0,0 +1,247 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Linear algebra routines for the Gaussian posterior draws
+ */
+
+#ifndef _bqreg_linalg_HPP
+#define _bqreg_linalg_HPP
+
+#ifndef BQREG_JITTER_MAX_TRIES
+    #define BQREG_JITTER_MAX_TRIES 10
+#endif
+
+/*
+ * Draw from N( P^{-1} b, P^{-1} ), given the precision matrix P and the vector b.
+ *
+ * With P = L L', the mean is obtained from two triangular solves and the noise term
+ * from one back-substitution, L' x = e, so that Var(x) = P^{-1}; P is never inverted.
+ *
+ * If P is not numerically positive definite, fall back to an LDLT factorization and,
+ * failing that, add an increasing multiple of the mean diagonal to P.
+ */
+
+inline
+void
+draw_mvnorm_prec(
+    const Mat_t& post_prec,
+    const ColVec_t& post_vec,
+    const ColVec_t& std_norm_vec, // K x 1 vector of N(0,1) draws
+    ColVec_t& draw_out
+)
+{
+    Eigen::LLT<Mat_t> llt_obj(post_prec);
+
+    if (llt_obj.info() == Eigen::Success) {
+        draw_out = llt_obj.solve(post_vec);
+        draw_out += llt_obj.matrixU().solve(std_norm_vec);
+        return;
+    }
+
+    // LDLT fallback: P = T' L D L' T, with T a permutation
+
+    Eigen::LDLT<Mat_t> ldlt_obj(post_prec);
+
+    if (ldlt_obj.info() == Eigen::Success && ldlt_obj.vectorD().minCoeff() > fp_t(0)) {
+        ColVec_t noise_vec = std_norm_vec.cwiseQuotient( ldlt_obj.vectorD().cwiseSqrt() );
+        ldlt_obj.matrixU().solveInPlace(noise_vec);
+
+        noise_vec = ldlt_obj.transpositionsP().transpose() * noise_vec;
+
+        draw_out = ldlt_obj.solve(post_vec) + noise_vec;
+        return;
+    }
+
+    // diagonal jitter
+
+    const size_t K = post_prec.rows();
+    const fp_t diag_mean_val = std::max(post_prec.diagonal().cwiseAbs().mean(), fp_t(1));
+
+    fp_t jitter_val = diag_mean_val * std::sqrt(std::numeric_limits<fp_t>::epsilon());
+
+    for (int try_ind = 0; try_ind < BQREG_JITTER_MAX_TRIES; ++try_ind) {
+        llt_obj.compute(post_prec + jitter_val * Mat_t::Identity(K,K));
+
+        if (llt_obj.info() == Eigen::Success) {
+            draw_out = llt_obj.solve(post_vec);
+            draw_out += llt_obj.matrixU().solve(std_norm_vec);
+            return;
+        }
+
+        jitter_val *= 10;
+    }
+
+    throw std::runtime_error("bqreg: posterior precision matrix of beta is not positive definite");
+}
+
+/*
+ * The same draw with storage that is reused from one draw to the next: P, b, and e are written
+ * into the workspace by the caller, and the factorization is computed in place, so repeated
+ * draws of the same dimension do not allocate. This matters for small K, where the allocations
+ * would otherwise cost about as much as the factorization.
+ */
+
+struct mvnorm_prec_ws_t
+{
+    Mat_t post_prec;
+    ColVec_t post_vec;
+    ColVec_t std_norm_vec;
+
+    Eigen::LLT<Mat_t> llt_obj;
+};
+
+inline
+void
+draw_mvnorm_prec(
+    mvnorm_prec_ws_t& prec_ws,
+    ColVec_t& draw_out
+)
+{
+    prec_ws.llt_obj.compute(prec_ws.post_prec);
+
+    if (prec_ws.llt_obj.info() == Eigen::Success) {
+        draw_out = prec_ws.llt_obj.solve(prec_ws.post_vec);
+
+        prec_ws.llt_obj.matrixU().solveInPlace(prec_ws.std_norm_vec);
+        draw_out += prec_ws.std_norm_vec;
+        return;
+    }
+
+    draw_mvnorm_prec(prec_ws.post_prec, prec_ws.post_vec, prec_ws.std_norm_vec, draw_out);
+}
+
+/*
+ * Sparse version of draw_mvnorm_prec; only the lower triangle of P is referenced.
+ *
+ * The fill-reducing ordering is computed on the first call and reused while the sparsity
+ * pattern of P is unchanged. With T P T' = L L', the noise term is T' L'^{-1} e.
+ * If the sparse factorization fails, the draw falls back to the dense routine.
+ */
+
+inline
+void
+draw_mvnorm_prec(
+    const SpMatCSC_t& post_prec,
+    const ColVec_t& post_vec,
+    const ColVec_t& std_norm_vec, // K x 1 vector of N(0,1) draws
+    Eigen::SimplicialLLT<SpMatCSC_t, Eigen::Lower>& llt_obj,
+    Eigen::Index& llt_pattern_nnz, // nonzeros of the analyzed pattern; 0 before the first call
+    ColVec_t& draw_out
+)
+{
+    if (llt_pattern_nnz != post_prec.nonZeros()) {
+        llt_obj.analyzePattern(post_prec);
+        llt_pattern_nnz = post_prec.nonZeros();
+    }
+
+    llt_obj.factorize(post_prec);
+
+    if (llt_obj.info() == Eigen::Success) {
+        const ColVec_t noise_vec = llt_obj.permutationPinv() * ColVec_t(llt_obj.matrixU().solve(std_norm_vec));
+
+        draw_out = llt_obj.solve(post_vec) + noise_vec;
+        return;
+    }
+
+    const SpMatCSC_t post_prec_full = post_prec.template selfadjointView<Eigen::Lower>();
+
+    draw_mvnorm_prec(Mat_t(post_prec_full), post_vec, std_norm_vec, draw_out);
+}
+
+/*
+ * Draw from the posterior N( P^{-1} b, P^{-1} ), P = X' W X + V^{-1}, b = X' W y + V^{-1} m,
+ * working in the n-dimensional space (Bhattacharya, Chakraborty, and Mallick, 2016):
+ *
+ *   u ~ N(0, V),  d ~ N(0, I_n),  v = W^{1/2} X u + d
+ *   solve (W^{1/2} X V X' W^{1/2} + I_n) r = W^{1/2} (y - X m) - v
+ *   beta = m + u + V X' W^{1/2} r
+ *
+ * X L (with V = L L'), X V, and X V X' do not depend on W and are computed once, so each
+ * draw costs O(n^3 + n K + K^2) rather than the O(K^3) of factorizing P.
+ */
+
+inline
+void
+draw_mvnorm_woodbury(
+    const Mat_t& XL,   // n x K, X L
+    const Mat_t& XV,   // n x K, X V
+    const Mat_t& XVXt, // n x n, X V X'
+    const ColVec_t& Xm, // n x 1, X m
+    const Mat_t& prior_var_chol, // L, lower triangular
+    const ColVec_t& prior_mean,
+    const ColVec_t& sqrt_w_vec, // diagonal of W^{1/2}
+    const ColVec_t& wy_vec,     // W^{1/2} y
+    const ColVec_t& std_norm_vec, // (K + n) x 1 vector of N(0,1) draws
+    ColVec_t& draw_out
+)
+{
+    const size_t n = XL.rows();
+    const size_t K = XL.cols();
+
+    const ColVec_t u_vec = prior_var_chol.template triangularView<Eigen::Lower>() * std_norm_vec.head(K);
+
+    const ColVec_t rhs_vec = wy_vec - sqrt_w_vec.cwiseProduct(Xm + XL * std_norm_vec.head(K)) - std_norm_vec.tail(n);
+
+    Mat_t woodbury_mat = sqrt_w_vec.asDiagonal() * XVXt * sqrt_w_vec.asDiagonal();
+    woodbury_mat.diagonal().array() += fp_t(1);
+
+    // I + (PSD) is positive definite; LDLT only guards against rounding
+
+    ColVec_t r_vec;
+
+    Eigen::LLT<Mat_t> llt_obj(woodbury_mat);
+
+    if (llt_obj.info() == Eigen::Success) {
+        r_vec = llt_obj.solve(rhs_vec);
+    } else {
+        r_vec = woodbury_mat.ldlt().solve(rhs_vec);
+    }
+
+    draw_out = prior_mean + u_vec;
+    draw_out.noalias() += XV.transpose() * sqrt_w_vec.cwiseProduct(r_vec);
+}
+
+/*
+ * Inverse of a symmetric positive definite matrix via its Cholesky factor
+ */
+
+inline
+Mat_t
+inv_sympd(const Mat_t& X)
+{
+    const size_t K = X.rows();
+
+    Eigen::LLT<Mat_t> llt_obj(X);
+
+    if (llt_obj.info() == Eigen::Success) {
+        return llt_obj.solve(Mat_t::Identity(K,K));
+    }
+
+    Eigen::LDLT<Mat_t> ldlt_obj(X);
+
+    if (ldlt_obj.info() == Eigen::Success && ldlt_obj.vectorD().minCoeff() > fp_t(0)) {
+        return ldlt_obj.solve(Mat_t::Identity(K,K));
+    }
+
+    throw std::runtime_error("bqreg: prior variance matrix of beta is not positive definite");
+}
+
+#endif
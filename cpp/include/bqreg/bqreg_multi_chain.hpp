@@ -0,0 +1,151 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Multiple independent chains
+ */
+
+#ifndef _bqreg_multi_chain_HPP
+#define _bqreg_multi_chain_HPP
+
+// below this many rows per thread, the data pass does not amortize the OpenMP overhead
+
+#ifndef BQREG_MIN_ROWS_PER_THREAD
+    #define BQREG_MIN_ROWS_PER_THREAD 20000
+#endif
+
+/*
+ * Split the available threads between chains (across-chain) and rows (within-chain).
+ * Chains are run in parallel, one thread each, when there are at least as many chains as
+ * threads or when the data are too small to keep several threads busy within a chain;
+ * otherwise the chains are run one after another, each using all of the threads.
+ */
+
+inline
+void
+set_chain_threading(
+    const size_t n,
+    const size_t n_chains,
+    const int omp_n_threads,
+    int& n_outer_threads,
+    int& n_inner_threads
+)
+{
+    const bool across_chains = (n_chains > 1) && ( n_chains >= size_t(omp_n_threads) || n < size_t(BQREG_MIN_ROWS_PER_THREAD) * omp_n_threads );
+
+    if (across_chains) {
+        n_outer_threads = std::min(static_cast<int>(n_chains), omp_n_threads);
+        n_inner_threads = 1;
+    } else {
+        n_outer_threads = 1;
+        n_inner_threads = omp_n_threads;
+    }
+}
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs_multi_chain(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const fp_t tau,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_chains,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    int omp_n_threads,
+    std::vector<Mat_t>& beta_draws_storage,
+    std::vector<Mat_t>& z_draws_storage,
+    Mat_t& sigma_draws_storage,
+    rand_engine_t& rand_engine
+)
+{
+#ifdef BQREG_USE_OPENMP
+    if (omp_n_threads < 0) {
+        omp_n_threads = std::max(1, static_cast<int>(omp_get_max_threads()) / 2);
+    }
+
+    if (omp_n_threads == 0) {
+        omp_n_threads = 1;
+    }
+#else
+    omp_n_threads = 1;
+#endif
+
+    if (n_chains == 0) {
+        throw std::invalid_argument("bqreg: the number of chains must be positive");
+    }
+
+    int n_outer_threads = 1;
+    int n_inner_threads = 1;
+
+    set_chain_threading(Y.size(), n_chains, omp_n_threads, n_outer_threads, n_inner_threads);
+
+    (void)(n_outer_threads); // for !BQREG_USE_OPENMP case
+
+    // every chain uses the same key; the chain index is part of the counter
+
+    const uint64_t seed_val = rand_engine();
+
+    beta_draws_storage.resize(n_chains);
+    z_draws_storage.resize(n_chains);
+    sigma_draws_storage.setZero(n_keep_draws, n_chains);
+
+    std::vector<ColVec_t> sigma_draws_vec(n_chains);
+
+    // exceptions cannot leave an OpenMP region, so they are passed out by hand
+
+    std::vector<std::exception_ptr> chain_exceptions(n_chains);
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel for num_threads(n_outer_threads) schedule(dynamic)
+#endif
+    for (size_t m = 0; m < n_chains; ++m) {
+        try {
+            counter_rng_t rng(seed_val, static_cast<uint32_t>(m));
+            memory_sink_t draw_sink(beta_draws_storage[m], z_draws_storage[m], sigma_draws_vec[m]);
+
+            qr_gibbs(Y, X, tau, beta_initial_draw, prior_beta_mean, prior_beta_var, prior_sigma_shape, prior_sigma_scale,
+                     n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed, n_inner_threads,
+                     draw_sink, rng, nullptr, nullptr, 0, SAMPLER_SCHEME_STANDARD,
+                     BQREG_OUTER_CACHE_MAX_BYTES / n_outer_threads); // the concurrent runs share the cache budget
+        } catch (...) {
+            chain_exceptions[m] = std::current_exception();
+        }
+    }
+
+    for (size_t m = 0; m < n_chains; ++m) {
+        if (chain_exceptions[m]) {
+            std::rethrow_exception(chain_exceptions[m]);
+        }
+    }
+
+    for (size_t m = 0; m < n_chains; ++m) {
+        sigma_draws_storage.col(m) = sigma_draws_vec[m];
+    }
+}
+
+#endif
@@ -0,0 +1,437 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Gibbs sampler for a grid of quantiles
+ *
+ * One chain per value of tau; the chains are advanced in lockstep so that each row block
+ * of X is read once per iteration and shared by all of the chains.
+ */
+
+#ifndef _bqreg_multi_tau_HPP
+#define _bqreg_multi_tau_HPP
+
+// number of single-chain iterations used to warm-start each tau from its neighbor
+
+#ifndef BQREG_WARM_START_DRAWS
+    #define BQREG_WARM_START_DRAWS 25
+#endif
+
+/*
+ * Data pass for T chains: column t of beta_draws, nu_draws, and gram_vecs belongs to chain t
+ *
+ * Each chain gets the nu draws and Gram statistics of a single-chain pass (qr_data_pass) with its
+ * own generator, as long as the number of reduction slots is not cut by BQREG_REDUCTION_MAX_BYTES
+ * (see get_n_reduction_slots).
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_data_pass_multi(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const Mat_t& beta_draws,
+    const ColVec_t& theta_vec,
+    const ColVec_t& omega_sq_vec,
+    const ColVec_t& sigma_vec,
+    const int omp_n_threads,
+    const std::vector<counter_rng_t>& rng_vec,
+    reduction_slots_t& slots_ws,
+    Mat_t& nu_draws,
+    std::vector<Mat_t>& gram_mats,
+    Mat_t& gram_vecs,
+    ColVec_t& sum_nu_vec,
+    ColVec_t& sum_err_vec
+)
+{
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+    const size_t n_tau = beta_draws.cols();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    const ColVec_t gamma_vec = ( (2 / sigma_vec.array()) + theta_vec.array().square() / (sigma_vec.array() * omega_sq_vec.array()) ).sqrt();
+    const ColVec_t tmp_scale_vec = ( sigma_vec.array() * omega_sq_vec.array() ).sqrt();
+
+    set_reduction_slots(slots_ws, n_blocks, K, n_tau);
+
+    const size_t n_slots = slots_ws.n_slots;
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel num_threads(omp_n_threads)
+#endif
+    {
+        Mat_t X_block_ws;
+        Mat_t Xw_block(BQREG_ROW_BLOCK_SIZE, K);
+        Mat_t resid_block(BQREG_ROW_BLOCK_SIZE, n_tau);
+        ColVec_t sqrt_w_block(BQREG_ROW_BLOCK_SIZE);
+
+#ifdef BQREG_USE_OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+            size_t block_begin, block_end;
+            get_slot_block_range(slot_ind, n_slots, n_blocks, block_begin, block_end);
+
+            for (size_t block_ind = block_begin; block_ind < block_end; ++block_ind) {
+                const size_t row_start = block_ind * BQREG_ROW_BLOCK_SIZE;
+                const size_t n_rows = std::min(size_t(BQREG_ROW_BLOCK_SIZE), n - row_start);
+
+                const Eigen::Ref<const Mat_t> X_block = get_row_block(X, row_start, n_rows, X_block_ws);
+
+                // residuals for every chain from one read of the block; column by column, with the
+                // arithmetic of the single-chain pass (qr_data_pass_team_kernel)
+
+                for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+                    resid_block.col(tau_ind).head(n_rows).noalias() = Y.segment(row_start, n_rows).template cast<fp_t>() - X_block * beta_draws.col(tau_ind);
+                }
+
+                for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+                    const size_t accum_ind = slot_ind * n_tau + tau_ind;
+
+                    const fp_t theta_par = theta_vec(tau_ind);
+                    const fp_t omega_sq_par = omega_sq_vec(tau_ind);
+
+                    for (size_t j = 0; j < n_rows; ++j) {
+                        const size_t i = row_start + j;
+
+                        const fp_t err_val = resid_block(j, tau_ind);
+                        const fp_t delta_par = std::abs(err_val) / tmp_scale_vec(tau_ind);
+                        const fp_t nu_val = counter_rnu(gamma_vec(tau_ind), delta_par, rng_vec[tau_ind].block(RNG_STREAM_NU, i));
+
+                        nu_draws(i, tau_ind) = nu_val;
+
+                        const fp_t sigma_err_val = err_val - theta_par * nu_val;
+
+                        slots_ws.sum_nu_vals(accum_ind) += nu_val;
+                        slots_ws.sum_err_vals(accum_ind) += (sigma_err_val * sigma_err_val) / (omega_sq_par * nu_val);
+
+                        sqrt_w_block(j) = fp_t(1) / std::sqrt(nu_val);
+                        resid_block(j, tau_ind) = ( Y(i) - theta_par * nu_val ) * sqrt_w_block(j);
+                    }
+
+                    Xw_block.topRows(n_rows).noalias() = sqrt_w_block.head(n_rows).asDiagonal() * X_block;
+
+                    qr_gram_block_update(Xw_block.topRows(n_rows), resid_block.col(tau_ind).head(n_rows), slots_ws.gram_mats[accum_ind], slots_ws.gram_vecs[accum_ind]);
+                }
+            }
+        }
+
+        // the slots of each chain are summed in the order of the single-chain pass
+
+        tree_reduce_slots(slots_ws);
+    }
+
+    for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+        gram_mats[tau_ind] = slots_ws.gram_mats[tau_ind];
+        qr_gram_symmetrize(gram_mats[tau_ind]);
+
+        gram_vecs.col(tau_ind) = slots_ws.gram_vecs[tau_ind];
+        sum_nu_vec(tau_ind) = slots_ws.sum_nu_vals(tau_ind);
+        sum_err_vec(tau_ind) = slots_ws.sum_err_vals(tau_ind);
+    }
+}
+
+/*
+ * Gibbs sampler for a vector of quantiles
+ *
+ * Chains are warm-started outward from the tau closest to the median: each chain starts
+ * from the state of its neighbor (on the sorted grid) after BQREG_WARM_START_DRAWS
+ * single-chain iterations. The warm-start draws are in addition to n_burnin_draws.
+ *
+ * The kept draws of chain t are pushed to draw_sinks[t]; the sampler stops early once
+ * every sink has requested a stop.
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs_multi_tau(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const ColVec_t& tau_vec,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    int omp_n_threads,
+    const std::vector<draw_sink_t*>& draw_sinks,
+    rand_engine_t& rand_engine
+)
+{
+#ifdef BQREG_USE_OPENMP
+    if (omp_n_threads < 0) {
+        omp_n_threads = std::max(1, static_cast<int>(omp_get_max_threads()) / 2);
+    }
+
+    if (omp_n_threads == 0) {
+        omp_n_threads = 1;
+    }
+#else
+    omp_n_threads = 1;
+#endif
+
+    const size_t n_tau = tau_vec.size();
+
+    if (n_tau == 0) {
+        throw std::invalid_argument("bqreg: the vector of quantile values is empty");
+    }
+
+    if (draw_sinks.size() != n_tau) {
+        throw std::invalid_argument("bqreg: the number of draw sinks must match the number of quantile values");
+    }
+
+    const size_t n_total_draws = n_burnin_draws + (thinning_factor + 1) * n_keep_draws;
+
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    const ColVec_t theta_vec = (1 - 2 * tau_vec.array()) / (tau_vec.array() * (1 - tau_vec.array()));
+    const ColVec_t omega_sq_vec = 2 / (tau_vec.array() * (1 - tau_vec.array()));
+
+    const Mat_t prior_beta_var_inv = inv_sympd(prior_beta_var);
+    const ColVec_t prior_beta_mu = prior_beta_var_inv * prior_beta_mean;
+
+    //
+
+    // one chain index per tau under a common key
+
+    const uint64_t seed_val = rand_engine();
+
+    std::vector<counter_rng_t> rng_vec;
+
+    for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+        rng_vec.push_back(counter_rng_t(seed_val, static_cast<uint32_t>(tau_ind)));
+    }
+
+    reduction_slots_t slots_ws;
+    mvnorm_prec_ws_t prec_ws;
+
+    for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+        draw_sinks[tau_ind]->begin(n, K, n_keep_draws);
+    }
+
+    // warm start: walk outward from the tau closest to the median of the distribution
+
+    std::vector<size_t> sort_ind(n_tau);
+    std::iota(sort_ind.begin(), sort_ind.end(), size_t(0));
+    std::sort(sort_ind.begin(), sort_ind.end(), [&](const size_t a, const size_t b) { return tau_vec(a) < tau_vec(b); });
+
+    size_t center_ind = 0;
+
+    for (size_t j = 1; j < n_tau; ++j) {
+        if (std::abs(tau_vec(sort_ind[j]) - fp_t(0.5)) < std::abs(tau_vec(sort_ind[center_ind]) - fp_t(0.5))) {
+            center_ind = j;
+        }
+    }
+
+    Mat_t beta_draws(K, n_tau);
+    Mat_t nu_draws(n, n_tau);
+    ColVec_t sigma_vec(n_tau);
+
+    std::vector<Mat_t> gram_mats(n_tau);
+    Mat_t gram_vecs(K, n_tau);
+
+    auto warm_start = [&](const size_t tau_ind, const ColVec_t& beta_start, const ColVec_t& nu_start, const fp_t sigma_start)
+    {
+        ColVec_t beta_draw = beta_start;
+        ColVec_t nu_draw = nu_start;
+        fp_t sigma_draw = sigma_start;
+
+        ColVec_t gram_vec;
+
+        qr_gram_pass(Y, X, nu_draw, theta_vec(tau_ind), omp_n_threads, gram_mats[tau_ind], gram_vec);
+
+        // the warm-start draws take the first BQREG_WARM_START_DRAWS iteration counters of the chain
+
+        for (size_t draw_ind = 0; draw_ind < BQREG_WARM_START_DRAWS; ++draw_ind) {
+            rng_vec[tau_ind].iter_ind = static_cast<uint32_t>(draw_ind);
+
+            qr_gibbs_iteration(Y, X, prior_beta_mu, prior_beta_var_inv, prior_sigma_shape, prior_sigma_scale,
+                               theta_vec(tau_ind), omega_sq_vec(tau_ind), keep_sigma_fixed, omp_n_threads,
+                               gram_mats[tau_ind], gram_vec, beta_draw, nu_draw, sigma_draw, rng_vec[tau_ind], slots_ws, prec_ws);
+        }
+
+        beta_draws.col(tau_ind) = beta_draw;
+        nu_draws.col(tau_ind) = nu_draw;
+        sigma_vec(tau_ind) = sigma_draw;
+        gram_vecs.col(tau_ind) = gram_vec;
+    };
+
+    {
+        fp_t sigma_initial_draw = qr_sum_sq_resid(Y, X, beta_initial_draw) / fp_t(n);
+        const ColVec_t nu_initial_draw = ColVec_t::Constant(n, sigma_initial_draw);
+
+        if (keep_sigma_fixed) {
+            sigma_initial_draw = fp_t(1);
+        }
+
+        warm_start(sort_ind[center_ind], beta_initial_draw, nu_initial_draw, sigma_initial_draw);
+    }
+
+    for (size_t j = center_ind + 1; j < n_tau; ++j) {
+        const size_t nbr_ind = sort_ind[j-1];
+        warm_start(sort_ind[j], beta_draws.col(nbr_ind), nu_draws.col(nbr_ind), sigma_vec(nbr_ind));
+    }
+
+    for (size_t j = center_ind; j-- > 0; ) {
+        const size_t nbr_ind = sort_ind[j+1];
+        warm_start(sort_ind[j], beta_draws.col(nbr_ind), nu_draws.col(nbr_ind), sigma_vec(nbr_ind));
+    }
+
+    // main loop
+
+    ColVec_t sum_nu_vec(n_tau);
+    ColVec_t sum_err_vec(n_tau);
+
+    ColVec_t beta_draw, gram_vec, z_draw;
+
+    size_t mcmc_save_ind = 0;
+
+    for (size_t mcmc_ind = 0; mcmc_ind < n_total_draws; ++mcmc_ind) {
+
+        for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+            rng_vec[tau_ind].iter_ind = static_cast<uint32_t>(BQREG_WARM_START_DRAWS + mcmc_ind);
+        }
+
+        // draw beta for each chain
+
+        for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+            gram_vec = gram_vecs.col(tau_ind);
+
+            qr_draw_beta(prior_beta_mu, prior_beta_var_inv, omega_sq_vec(tau_ind), sigma_vec(tau_ind), gram_mats[tau_ind], gram_vec,
+                         rng_vec[tau_ind], prec_ws, beta_draw);
+
+            beta_draws.col(tau_ind) = beta_draw;
+        }
+
+        // draw nu for every chain in one pass over X
+
+        qr_data_pass_multi(Y, X, beta_draws, theta_vec, omega_sq_vec, sigma_vec, omp_n_threads, rng_vec, slots_ws, nu_draws, gram_mats, gram_vecs, sum_nu_vec, sum_err_vec);
+
+        // draw sigma for each chain
+
+        if (!keep_sigma_fixed) {
+            const fp_t post_sigma_shape_par = prior_sigma_shape + (3 * n / fp_t(2));
+
+            for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+                const fp_t post_sigma_scale_par = (2 * prior_sigma_scale + 2 * sum_nu_vec(tau_ind) + sum_err_vec(tau_ind) ) / 2;
+
+                sigma_vec(tau_ind) = fp_t(1) / rng_vec[tau_ind].rgamma(RNG_STREAM_SIGMA, post_sigma_shape_par, 1 / post_sigma_scale_par);
+            }
+        }
+
+        // save draws
+
+        if (mcmc_ind >= n_burnin_draws && (mcmc_ind - n_burnin_draws) % (thinning_factor + 1) == 0 ) {
+            for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+                if (draw_sinks[tau_ind]->wants_z()) {
+                    z_draw.noalias() = nu_draws.col(tau_ind) / sigma_vec(tau_ind);
+                } else {
+                    z_draw.resize(0);
+                }
+
+                beta_draw = beta_draws.col(tau_ind);
+
+                draw_sinks[tau_ind]->push(mcmc_save_ind, beta_draw, z_draw, sigma_vec(tau_ind));
+            }
+
+            ++mcmc_save_ind;
+        }
+
+        bool stop_flag = true;
+
+        for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+            stop_flag = stop_flag && draw_sinks[tau_ind]->stop_requested();
+        }
+
+        if (stop_flag) {
+            break;
+        }
+    }
+
+    for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+        draw_sinks[tau_ind]->end();
+    }
+}
+
+/*
+ * Gibbs sampler for a vector of quantiles, with the draws of chain t stored in
+ * beta_draws_storage[t], z_draws_storage[t], and column t of sigma_draws_storage
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs_multi_tau(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const ColVec_t& tau_vec,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    int omp_n_threads,
+    std::vector<Mat_t>& beta_draws_storage,
+    std::vector<Mat_t>& z_draws_storage,
+    Mat_t& sigma_draws_storage,
+    rand_engine_t& rand_engine
+)
+{
+    const size_t n_tau = tau_vec.size();
+
+    beta_draws_storage.resize(n_tau);
+    z_draws_storage.resize(n_tau);
+
+    std::vector<ColVec_t> sigma_draws_vec(n_tau);
+
+    std::vector<memory_sink_t> memory_sinks;
+    std::vector<draw_sink_t*> draw_sinks;
+
+    memory_sinks.reserve(n_tau);
+
+    for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+        memory_sinks.emplace_back(beta_draws_storage[tau_ind], z_draws_storage[tau_ind], sigma_draws_vec[tau_ind]);
+        draw_sinks.push_back(&memory_sinks[tau_ind]);
+    }
+
+    qr_gibbs_multi_tau(Y, X, tau_vec, beta_initial_draw, prior_beta_mean, prior_beta_var, prior_sigma_shape, prior_sigma_scale,
+                       n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed, omp_n_threads, draw_sinks, rand_engine);
+
+    sigma_draws_storage.setZero(n_keep_draws, n_tau);
+
+    for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+        sigma_draws_storage.col(tau_ind) = sigma_draws_vec[tau_ind];
+    }
+}
+
+#endif
@@ -21,8 +21,33 @@
 #ifndef _bqreg_options_HPP
 #define _bqreg_options_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <numeric>
 #include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// POSIX; used by the memory-mapped draw store
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // version
 
@@ -70,6 +95,54 @@
     #define BQREG_FPN_TYPE double
 #endif
 
+// per-phase timing, thread load balance, and workspace allocation counts from the sampler
+// (see sampler_stats_t) are compiled in only if BQREG_ENABLE_SAMPLER_STATS is defined
+
+// number of rows of X processed per block in the data pass kernels
+
+#ifndef BQREG_ROW_BLOCK_SIZE
+    #define BQREG_ROW_BLOCK_SIZE 256
+#endif
+
+// number of partial sums used by the (thread-count independent) reductions in the data pass
+// kernels, and a cap on their total memory
+
+#ifndef BQREG_REDUCTION_SLOTS
+    #define BQREG_REDUCTION_SLOTS 64
+#endif
+
+#ifndef BQREG_REDUCTION_MAX_BYTES
+    #define BQREG_REDUCTION_MAX_BYTES (size_t(256) << 20)
+#endif
+
+// Gibbs sweeps over the shard indices per combined draw of the consensus kernel combiner, and
+// the scale of its bandwidth in shard standard deviations (see consensus_kernel_combine)
+
+#ifndef BQREG_KERNEL_COMBINE_SWEEPS
+    #define BQREG_KERNEL_COMBINE_SWEEPS 5
+#endif
+
+#ifndef BQREG_KERNEL_COMBINE_BANDWIDTH_SCALE
+    #define BQREG_KERNEL_COMBINE_BANDWIDTH_SCALE 4
+#endif
+
+// the packed outer-product cache of the dense data pass (see outer_prod_cache_t): built when
+// K is at most BQREG_OUTER_CACHE_MAX_K and its n * K(K+1)/2 values fit in the byte budget
+
+#ifndef BQREG_OUTER_CACHE_MAX_K
+    #define BQREG_OUTER_CACHE_MAX_K 6
+#endif
+
+#ifndef BQREG_OUTER_CACHE_MAX_BYTES
+    #define BQREG_OUTER_CACHE_MAX_BYTES (size_t(256) << 20)
+#endif
+
+// the beta step uses a fixed-size Cholesky factorization for K = 1, ..., BQREG_FIXED_K_MAX (0 turns this off)
+
+#ifndef BQREG_FIXED_K_MAX
+    #define BQREG_FIXED_K_MAX 16
+#endif
+
 //
 
 #ifndef EIGEN_PERMANENTLY_DISABLE_STUPID_WARNINGS
@@ -80,6 +153,7 @@
     #include <RcppEigen.h>
 #else
     #include <Eigen/Dense>
+    #include <Eigen/Sparse>
 #endif
 
 #ifndef STATS_ENABLE_EIGEN_WRAPPERS
@@ -95,6 +169,25 @@ namespace bqreg
 
     using ColVec_t = Eigen::Matrix<fp_t, Eigen::Dynamic, 1>;
     using Mat_t = Eigen::Matrix<fp_t, Eigen::Dynamic, Eigen::Dynamic>;
+
+    // single precision storage for the data; computations are carried out in fp_t
+
+    using ColVecF_t = Eigen::Matrix<float, Eigen::Dynamic, 1>;
+    using MatF_t = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>;
+
+    // sparse features are stored by row (CSR); Gram and precision matrices by column (CSC)
+
+    using SpMat_t = Eigen::SparseMatrix<fp_t, Eigen::RowMajor>;
+    using SpMatCSC_t = Eigen::SparseMatrix<fp_t, Eigen::ColMajor>;
+
+    // read-only views of data held elsewhere (e.g., a numpy array), in either storage order
+
+    using DataStride_t = Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>;
+
+    using ColVecView_t = Eigen::Map<const ColVec_t, 0, Eigen::InnerStride<>>;
+    using MatView_t = Eigen::Map<const Mat_t, 0, DataStride_t>;
+    using ColVecFView_t = Eigen::Map<const ColVecF_t, 0, Eigen::InnerStride<>>;
+    using MatFView_t = Eigen::Map<const MatF_t, 0, DataStride_t>;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,200 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Posterior predictive summaries
+ *
+ * For new rows X_new (m x K) and S draws of beta (K x S), the posterior of x_i' beta is
+ * summarized by its mean and by quantiles of the S values x_i' beta_s. The m x S product is
+ * never formed: the rows are processed in blocks sized so that a block of the product fits
+ * in BQREG_PREDICT_BLOCK_BYTES, one block per thread at a time, and each quantile is found
+ * with a selection (O(S)) rather than a sort. Every row is written by one thread, so the
+ * output does not depend on the number of threads.
+ *
+ * The quantiles interpolate linearly between order statistics (as pooled_quantile, and the
+ * default of R's quantile and numpy.quantile).
+ */
+
+#ifndef _bqreg_predict_HPP
+#define _bqreg_predict_HPP
+
+// memory for one block of X_new * beta_draws, per thread
+
+#ifndef BQREG_PREDICT_BLOCK_BYTES
+    #define BQREG_PREDICT_BLOCK_BYTES (size_t(8) << 20)
+#endif
+
+inline
+size_t
+get_predict_block_rows(const size_t n_draws)
+{
+    const size_t max_rows = BQREG_PREDICT_BLOCK_BYTES / ( sizeof(fp_t) * std::max(n_draws, size_t(1)) );
+
+    return std::max(size_t(1), std::min(size_t(BQREG_ROW_BLOCK_SIZE), max_rows));
+}
+
+/*
+ * quantiles of the values in [vals_begin, vals_end), reordered in place; probs must be sorted,
+ * so that each selection only searches the part of the range above the previous one
+ */
+
+inline
+void
+select_quantiles(fp_t* vals_begin, fp_t* vals_end, const ColVec_t& probs, fp_t* quantile_out, const size_t out_stride)
+{
+    const size_t n_vals = vals_end - vals_begin;
+
+    size_t search_begin = 0;
+
+    for (size_t p = 0; p < size_t(probs.size()); ++p) {
+        const fp_t pos_val = probs(p) * (n_vals - 1);
+        const size_t lower_ind = std::min(static_cast<size_t>(std::floor(pos_val)), n_vals - 1);
+
+        std::nth_element(vals_begin + search_begin, vals_begin + lower_ind, vals_end);
+
+        fp_t quantile_val = vals_begin[lower_ind];
+
+        if (lower_ind + 1 < n_vals && pos_val > lower_ind) {
+            const fp_t upper_val = *std::min_element(vals_begin + lower_ind + 1, vals_end);
+            quantile_val += (pos_val - lower_ind) * (upper_val - quantile_val);
+        }
+
+        quantile_out[p * out_stride] = quantile_val;
+
+        search_begin = lower_ind;
+    }
+}
+
+/**
+ * Posterior predictive mean and quantiles of the linear predictor
+ *
+ * @param X_new an m x K matrix of features (dense, single precision, or sparse)
+ * @param beta_draws a K x S matrix of draws of \f$ \beta \f$, one column per draw, e.g., a view of a draw store
+ * @param probs a vector of P probabilities in [0,1], e.g., (0.05, 0.5, 0.95) for the median and a 90% credible interval
+ * @param omp_n_threads the number of OpenMP threads; a negative value selects half of the available threads
+ * @param pred_mean a writable vector to store the m posterior means
+ * @param pred_quantiles a writable m x P matrix to store the quantiles, in the order of \c probs
+ */
+
+template<typename DataMat_t>
+inline
+void
+qr_predict(
+    const DataMat_t& X_new,
+    const Eigen::Ref<const Mat_t>& beta_draws,
+    const ColVec_t& probs,
+    int omp_n_threads,
+    ColVec_t& pred_mean,
+    Mat_t& pred_quantiles
+)
+{
+    const size_t m = X_new.rows();
+    const size_t K = X_new.cols();
+    const size_t n_draws = beta_draws.cols();
+    const size_t n_probs = probs.size();
+
+    if (size_t(beta_draws.rows()) != K) {
+        throw std::invalid_argument("bqreg: the number of features does not match the draws of beta");
+    }
+
+    if (n_draws == 0 && n_probs > 0) {
+        throw std::invalid_argument("bqreg: there are no draws to compute quantiles from");
+    }
+
+    if (n_probs > 0 && (probs.minCoeff() < 0 || probs.maxCoeff() > 1)) {
+        throw std::invalid_argument("bqreg: the probabilities of the predictive quantiles must be in [0,1]");
+    }
+
+#ifdef BQREG_USE_OPENMP
+    if (omp_n_threads < 0) {
+        omp_n_threads = std::max(1, static_cast<int>(omp_get_max_threads()) / 2);
+    }
+
+    if (omp_n_threads == 0) {
+        omp_n_threads = 1;
+    }
+#else
+    omp_n_threads = 1;
+#endif
+
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    // the mean is linear in beta; the quantiles are found for the probabilities in increasing order
+
+    const ColVec_t beta_mean = (n_draws > 0) ? ColVec_t(beta_draws.rowwise().mean()) : ColVec_t(ColVec_t::Zero(K));
+
+    std::vector<size_t> prob_order(n_probs);
+    std::iota(prob_order.begin(), prob_order.end(), size_t(0));
+    std::sort(prob_order.begin(), prob_order.end(), [&](const size_t a, const size_t b) { return probs(a) < probs(b); });
+
+    ColVec_t sorted_probs(n_probs);
+
+    for (size_t p = 0; p < n_probs; ++p) {
+        sorted_probs(p) = probs(prob_order[p]);
+    }
+
+    pred_mean.resize(m);
+    pred_quantiles.resize(m, n_probs);
+
+    const size_t block_rows = get_predict_block_rows(n_draws);
+    const size_t n_blocks = (m + block_rows - 1) / block_rows;
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel num_threads(omp_n_threads)
+#endif
+    {
+        Mat_t X_block_ws;
+        Mat_t pred_block; // S x block_rows: the draws of each new row are a contiguous column
+        Mat_t quantile_block(block_rows, n_probs);
+
+        if (n_probs > 0) {
+            pred_block.resize(n_draws, block_rows);
+        }
+
+#ifdef BQREG_USE_OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for (size_t block_ind = 0; block_ind < n_blocks; ++block_ind) {
+            const size_t row_start = block_ind * block_rows;
+            const size_t n_rows = std::min(block_rows, m - row_start);
+
+            const Eigen::Ref<const Mat_t> X_block = get_row_block(X_new, row_start, n_rows, X_block_ws);
+
+            pred_mean.segment(row_start, n_rows).noalias() = X_block * beta_mean;
+
+            if (n_probs == 0) {
+                continue;
+            }
+
+            pred_block.leftCols(n_rows).noalias() = beta_draws.transpose() * X_block.transpose();
+
+            for (size_t j = 0; j < n_rows; ++j) {
+                fp_t* vals_ptr = pred_block.col(j).data();
+                select_quantiles(vals_ptr, vals_ptr + n_draws, sorted_probs, quantile_block.data() + j, quantile_block.rows());
+            }
+
+            for (size_t p = 0; p < n_probs; ++p) {
+                pred_quantiles.col(prob_order[p]).segment(row_start, n_rows) = quantile_block.col(p).head(n_rows);
+            }
+        }
+    }
+}
+
+#endif
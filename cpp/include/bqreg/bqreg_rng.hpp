@@ -0,0 +1,305 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Counter-based random number generation
+ *
+ * Every random quantity used by the sampler is a pure function of
+ *
+ *   (seed, chain, iteration, stream, index)
+ *
+ * through the Philox4x32-10 bijection (Salmon et al., 2011). The draw for observation i at
+ * iteration t does not depend on which thread computes it or on what was drawn before it,
+ * so the output of the sampler does not depend on the number of threads or on the OpenMP
+ * schedule. There is no generator state to carry between iterations other than the counter.
+ */
+
+#ifndef _bqreg_rng_HPP
+#define _bqreg_rng_HPP
+
+// streams: one per use, so that the draws for different parts of an iteration never overlap
+
+enum : uint32_t {
+    RNG_STREAM_NU          = 0,
+    RNG_STREAM_BETA        = 1,
+    RNG_STREAM_SIGMA       = 2,
+    RNG_STREAM_COMBINE     = 3, // consensus combiner
+    RNG_STREAM_SIGMA_SLICE = 4  // slice sampler of the collapsed and interweaved sigma steps
+};
+
+struct philox_block_t
+{
+    uint32_t v[4];
+};
+
+inline
+void
+philox4x32_round(uint32_t* ctr, const uint32_t* key)
+{
+    const uint64_t prod_0 = uint64_t(0xD2511F53U) * ctr[0];
+    const uint64_t prod_1 = uint64_t(0xCD9E8D57U) * ctr[2];
+
+    const uint32_t hi_0 = static_cast<uint32_t>(prod_0 >> 32);
+    const uint32_t lo_0 = static_cast<uint32_t>(prod_0);
+    const uint32_t hi_1 = static_cast<uint32_t>(prod_1 >> 32);
+    const uint32_t lo_1 = static_cast<uint32_t>(prod_1);
+
+    const uint32_t ctr_1 = ctr[1];
+    const uint32_t ctr_3 = ctr[3];
+
+    ctr[0] = hi_1 ^ ctr_1 ^ key[0];
+    ctr[1] = lo_1;
+    ctr[2] = hi_0 ^ ctr_3 ^ key[1];
+    ctr[3] = lo_0;
+}
+
+inline
+philox_block_t
+philox4x32_10(const philox_block_t& ctr_inp, const uint32_t key_0, const uint32_t key_1)
+{
+    philox_block_t ctr = ctr_inp;
+    uint32_t key[2] = { key_0, key_1 };
+
+    for (int round_ind = 0; round_ind < 10; ++round_ind) {
+        if (round_ind > 0) {
+            key[0] += 0x9E3779B9U;
+            key[1] += 0xBB67AE85U;
+        }
+
+        philox4x32_round(ctr.v, key);
+    }
+
+    return ctr;
+}
+
+// uniform draws on the open interval (0,1)
+
+inline
+double
+u01_from_u64(const uint64_t x)
+{
+    return ( double(x >> 11) + 0.5 ) * (1.0 / 9007199254740992.0); // 2^-53
+}
+
+inline
+double
+u01_from_u32(const uint32_t x)
+{
+    return ( double(x) + 0.5 ) * (1.0 / 4294967296.0); // 2^-32
+}
+
+/*
+ * Transforms of one Philox block. Each block holds 128 random bits: 64 bits for the radius
+ * of a Box-Muller pair and 32 bits each for the angle and for an accept/reject uniform.
+ */
+
+inline
+void
+counter_rnorm_pair(const philox_block_t& rand_block, double& norm_val_0, double& norm_val_1)
+{
+    const double u_val = u01_from_u64( (uint64_t(rand_block.v[1]) << 32) | rand_block.v[0] );
+    const double angle_val = 6.283185307179586476925 * u01_from_u32(rand_block.v[2]);
+
+    const double radius_val = std::sqrt( - 2 * std::log(u_val) );
+
+    norm_val_0 = radius_val * std::cos(angle_val);
+    norm_val_1 = radius_val * std::sin(angle_val);
+}
+
+/*
+ * inverse Gaussian with mean mu_par and shape lambda_par (Michael, Schucany, and Haas, 1976);
+ * the latent nu draws go through counter_rnu, which maps (gamma, delta) to these parameters
+ */
+
+inline
+fp_t
+counter_rinvgauss(const fp_t mu_par, const fp_t lambda_par, const philox_block_t& rand_block)
+{
+    const double u_val = u01_from_u64( (uint64_t(rand_block.v[1]) << 32) | rand_block.v[0] );
+    const double angle_val = 6.283185307179586476925 * u01_from_u32(rand_block.v[2]);
+
+    const double norm_val = std::sqrt( - 2 * std::log(u_val) ) * std::cos(angle_val);
+
+    const double mu_val = mu_par;
+    const double lambda_val = lambda_par;
+
+    // smaller root of the quadratic, x = mu + mu^2 y / (2 lambda) - mu / (2 lambda) sqrt(4 mu lambda y + mu^2 y^2),
+    // written without the subtraction: the direct form cancels catastrophically when mu y / lambda is large
+    // (a residual near zero), and can return x <= 0
+
+    const double q_val = mu_val * norm_val * norm_val;
+
+    if (q_val == 0) {
+        return static_cast<fp_t>(mu_val);
+    }
+
+    const double root_denom_val = q_val + std::sqrt( q_val * (q_val + 4 * lambda_val) );
+    const double x_val = mu_val * (4 * lambda_val * q_val) / (root_denom_val * root_denom_val);
+
+    if (u01_from_u32(rand_block.v[3]) <= mu_val / (mu_val + x_val)) {
+        return static_cast<fp_t>(x_val);
+    } else {
+        return static_cast<fp_t>(mu_val * mu_val / x_val);
+    }
+}
+
+/*
+ * the latent nu_i given beta and sigma: GIG(1/2, delta^2, gamma^2), whose reciprocal is inverse
+ * Gaussian with mean gamma / delta and shape gamma^2 (delta = |residual| / sqrt(omega^2 sigma),
+ * gamma^2 = 2 / sigma + theta^2 / (omega^2 sigma)); a zero residual leaves Gamma(1/2, rate gamma^2 / 2)
+ */
+
+inline
+fp_t
+counter_rnu(const fp_t gamma_par, const fp_t delta_par, const philox_block_t& rand_block)
+{
+    if (delta_par == 0) {
+        double norm_val, norm_val_unused;
+        counter_rnorm_pair(rand_block, norm_val, norm_val_unused);
+
+        return static_cast<fp_t>( norm_val * norm_val / ( double(gamma_par) * gamma_par ) );
+    }
+
+    return fp_t(1) / counter_rinvgauss(gamma_par / delta_par, gamma_par * gamma_par, rand_block);
+}
+
+/**
+ * Counter-based generator for one chain
+ *
+ * The key is the 64-bit seed; the 128-bit counter is (index, iteration, chain and stream).
+ * The caller sets \c iter_ind before each iteration of the sampler.
+ */
+
+class counter_rng_t
+{
+    public:
+        uint64_t seed_val = 0;
+        uint32_t chain_ind = 0; /*!< up to 2^24 chains */
+        uint32_t iter_ind = 0;
+
+        counter_rng_t() = default;
+
+        counter_rng_t(const uint64_t seed_val_inp, const uint32_t chain_ind_inp)
+            : seed_val(seed_val_inp), chain_ind(chain_ind_inp) {}
+
+        /**
+         * @param stream_ind one of the \c RNG_STREAM_* values
+         * @param index the position within the stream, e.g., the observation index
+         * @return 128 random bits
+         */
+
+        philox_block_t block(const uint32_t stream_ind, const uint64_t index) const
+        {
+            philox_block_t ctr;
+
+            ctr.v[0] = static_cast<uint32_t>(index);
+            ctr.v[1] = static_cast<uint32_t>(index >> 32);
+            ctr.v[2] = iter_ind;
+            ctr.v[3] = (chain_ind << 8) | (stream_ind & 0xFFU);
+
+            return philox4x32_10(ctr, static_cast<uint32_t>(seed_val), static_cast<uint32_t>(seed_val >> 32));
+        }
+
+        /**
+         * @param stream_ind one of the \c RNG_STREAM_* values
+         * @param n_vals the number of draws
+         * @return a vector of independent standard normal draws
+         */
+
+        ColVec_t rnorm_vec(const uint32_t stream_ind, const size_t n_vals) const
+        {
+            ColVec_t norm_vec(n_vals);
+
+            rnorm_fill(stream_ind, norm_vec);
+
+            return norm_vec;
+        }
+
+        /**
+         * @param stream_ind one of the \c RNG_STREAM_* values
+         * @param norm_vec a vector to fill with independent standard normal draws; the same values as \c rnorm_vec of the same size
+         */
+
+        void rnorm_fill(const uint32_t stream_ind, ColVec_t& norm_vec) const
+        {
+            const size_t n_vals = norm_vec.size();
+
+            for (size_t j = 0; j < n_vals; j += 2) {
+                double norm_val_0, norm_val_1;
+                counter_rnorm_pair(block(stream_ind, j / 2), norm_val_0, norm_val_1);
+
+                norm_vec(j) = static_cast<fp_t>(norm_val_0);
+
+                if (j + 1 < n_vals) {
+                    norm_vec(j + 1) = static_cast<fp_t>(norm_val_1);
+                }
+            }
+        }
+
+        /**
+         * Gamma draw (Marsaglia and Tsang, 2000); the rejection loop reads consecutive blocks of the stream
+         *
+         * @param stream_ind one of the \c RNG_STREAM_* values
+         * @param shape_par the shape parameter
+         * @param scale_par the scale parameter
+         * @return a draw from the gamma distribution
+         */
+
+        fp_t rgamma(const uint32_t stream_ind, const fp_t shape_par, const fp_t scale_par) const
+        {
+            // for shape < 1, draw with shape + 1 and scale by u^(1/shape), using the first block for u
+
+            const bool boost_shape = (shape_par < 1);
+            const double shape_val = boost_shape ? double(shape_par) + 1 : double(shape_par);
+
+            const double d_val = shape_val - 1.0 / 3.0;
+            const double c_val = 1.0 / std::sqrt(9 * d_val);
+
+            uint64_t index = boost_shape ? 1 : 0;
+
+            while (true) {
+                const philox_block_t rand_block = block(stream_ind, index++);
+
+                double norm_val, norm_val_unused;
+                counter_rnorm_pair(rand_block, norm_val, norm_val_unused);
+
+                const double v_base = 1 + c_val * norm_val;
+
+                if (v_base <= 0) {
+                    continue;
+                }
+
+                const double v_val = v_base * v_base * v_base;
+                const double u_val = u01_from_u32(rand_block.v[3]);
+
+                if (std::log(u_val) < 0.5 * norm_val * norm_val + d_val - d_val * v_val + d_val * std::log(v_val)) {
+                    double gamma_val = d_val * v_val;
+
+                    if (boost_shape) {
+                        gamma_val *= std::pow(u01_from_u32(block(stream_ind, 0).v[3]), 1 / double(shape_par));
+                    }
+
+                    return static_cast<fp_t>(gamma_val * scale_par);
+                }
+            }
+        }
+};
+
+#endif
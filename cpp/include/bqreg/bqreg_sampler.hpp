@@ -25,26 +25,195 @@
 #ifndef _bqreg_sampler_HPP
 #define _bqreg_sampler_HPP
 
-#ifdef BQREG_USE_OPENMP
-    #pragma omp declare reduction (+: ColVec_t: omp_out=omp_out+omp_in) \
-        initializer(omp_priv = ColVec_t::Zero(omp_orig.size()))
+/*
+ * The beta step for K fixed at compile time: the Cholesky factor of the posterior precision is
+ * formed with plain loops over fixed-size storage on the stack, and the mean and noise solves are
+ * merged into one back substitution, beta = U^{-1} (U^{-T} b + z) with U = L'. For small K this is
+ * several times faster than the dynamic-size routines, and, unlike Eigen's fixed-size LLT, cheap
+ * to compile. Returns false if the factorization breaks down, in which case the caller uses the
+ * dynamic-size routine and its LDLT and jitter fallbacks.
+ */
 
-    #pragma omp declare reduction (+: Mat_t: omp_out=omp_out+omp_in) \
-        initializer(omp_priv = Mat_t::Zero(omp_orig.cols(),omp_orig.cols()))
-#endif
+template<int K_fixed>
+inline
+bool
+qr_draw_beta_fixed(
+    const ColVec_t& prior_beta_mu,
+    const Mat_t& prior_beta_var_inv,
+    const fp_t gram_scale_val,
+    const Mat_t& gram_mat,
+    const ColVec_t& gram_vec,
+    const ColVec_t& std_norm_vec,
+    ColVec_t& beta_draw
+)
+{
+    // lower triangle of the posterior precision, overwritten by its Cholesky factor
+
+    Eigen::Matrix<fp_t, K_fixed, K_fixed> chol_mat;
+    Eigen::Matrix<fp_t, K_fixed, 1> work_vec;
+
+    for (int j = 0; j < K_fixed; ++j) {
+        for (int i = j; i < K_fixed; ++i) {
+            chol_mat(i,j) = gram_scale_val * gram_mat(i,j) + prior_beta_var_inv(i,j);
+        }
+    }
+
+    for (int j = 0; j < K_fixed; ++j) {
+        fp_t diag_val = chol_mat(j,j);
+
+        for (int k = 0; k < j; ++k) {
+            diag_val -= chol_mat(j,k) * chol_mat(j,k);
+        }
+
+        if (!(diag_val > fp_t(0))) {
+            return false;
+        }
+
+        diag_val = std::sqrt(diag_val);
+        chol_mat(j,j) = diag_val;
+
+        for (int i = j + 1; i < K_fixed; ++i) {
+            fp_t val = chol_mat(i,j);
+
+            for (int k = 0; k < j; ++k) {
+                val -= chol_mat(i,k) * chol_mat(j,k);
+            }
+
+            chol_mat(i,j) = val / diag_val;
+        }
+    }
+
+    // forward substitution L y = b, then y + z
+
+    for (int i = 0; i < K_fixed; ++i) {
+        fp_t val = gram_scale_val * gram_vec(i) + prior_beta_mu(i);
+
+        for (int k = 0; k < i; ++k) {
+            val -= chol_mat(i,k) * work_vec(k);
+        }
+
+        work_vec(i) = val / chol_mat(i,i);
+    }
+
+    for (int i = 0; i < K_fixed; ++i) {
+        work_vec(i) += std_norm_vec(i);
+    }
+
+    // back substitution L' beta = y + z
+
+    beta_draw.resize(K_fixed);
+
+    for (int i = K_fixed - 1; i >= 0; --i) {
+        fp_t val = work_vec(i);
+
+        for (int k = i + 1; k < K_fixed; ++k) {
+            val -= chol_mat(k,i) * beta_draw(k);
+        }
+
+        beta_draw(i) = val / chol_mat(i,i);
+    }
+
+    return true;
+}
+
+// tries K_fixed, K_fixed - 1, ..., 1; returns false if K is not one of them or the factorization fails
+
+template<int K_fixed>
+struct fixed_k_beta_step_t
+{
+    static bool run(
+        const ColVec_t& prior_beta_mu,
+        const Mat_t& prior_beta_var_inv,
+        const fp_t gram_scale_val,
+        const Mat_t& gram_mat,
+        const ColVec_t& gram_vec,
+        const ColVec_t& std_norm_vec,
+        ColVec_t& beta_draw
+    )
+    {
+        if (size_t(gram_vec.size()) == size_t(K_fixed)) {
+            return qr_draw_beta_fixed<K_fixed>(prior_beta_mu, prior_beta_var_inv, gram_scale_val, gram_mat, gram_vec, std_norm_vec, beta_draw);
+        }
+
+        return fixed_k_beta_step_t<K_fixed - 1>::run(prior_beta_mu, prior_beta_var_inv, gram_scale_val, gram_mat, gram_vec, std_norm_vec, beta_draw);
+    }
+};
+
+template<>
+struct fixed_k_beta_step_t<0>
+{
+    static bool run(const ColVec_t&, const Mat_t&, const fp_t, const Mat_t&, const ColVec_t&, const ColVec_t&, ColVec_t&)
+    {
+        return false;
+    }
+};
+
+// the beta and sigma steps of an iteration, given the statistics of the current nu draw
 
 inline
-size_t
-generate_seed_value(const int ind_inp, const int n_threads, rand_engine_t& rand_engine)
+void
+qr_draw_beta(
+    const ColVec_t& prior_beta_mu,
+    const Mat_t& prior_beta_var_inv,
+    const fp_t omega_sq_par,
+    const fp_t sigma_draw,
+    const Mat_t& gram_mat,
+    const ColVec_t& gram_vec,
+    const counter_rng_t& rng,
+    mvnorm_prec_ws_t& prec_ws,
+    ColVec_t& beta_draw,
+    sampler_stats_t* stats = nullptr
+)
 {
-    return static_cast<size_t>( (stats::runif(fp_t(0), fp_t(1), rand_engine) + ind_inp + n_threads) * 1000 );
+    const stats_time_t beta_time = stats_now();
+
+    const fp_t gram_scale_val = fp_t(1) / ( omega_sq_par * sigma_draw );
+
+    prec_ws.std_norm_vec.resize(gram_vec.size());
+    rng.rnorm_fill(RNG_STREAM_BETA, prec_ws.std_norm_vec);
+
+    if (!fixed_k_beta_step_t<BQREG_FIXED_K_MAX>::run(prior_beta_mu, prior_beta_var_inv, gram_scale_val, gram_mat, gram_vec, prec_ws.std_norm_vec, beta_draw)) {
+        prec_ws.post_prec = gram_scale_val * gram_mat + prior_beta_var_inv;
+        prec_ws.post_vec = gram_scale_val * gram_vec + prior_beta_mu;
+
+        draw_mvnorm_prec(prec_ws, beta_draw);
+    }
+
+    stats_add_time(stats, &sampler_stats_t::beta_draw_seconds, beta_time);
 }
 
+inline
+void
+qr_draw_sigma(
+    const size_t n,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const bool keep_sigma_fixed,
+    const fp_t sum_nu,
+    const fp_t sum_err_val,
+    const counter_rng_t& rng,
+    fp_t& sigma_draw,
+    sampler_stats_t* stats = nullptr
+)
+{
+    const stats_time_t sigma_time = stats_now();
+
+    if (!keep_sigma_fixed) {
+        const fp_t post_sigma_shape_par = prior_sigma_shape + (3 * n / fp_t(2));
+        const fp_t post_sigma_scale_par = (2 * prior_sigma_scale + 2 * sum_nu + sum_err_val ) / 2;
+
+        sigma_draw = fp_t(1) / rng.rgamma(RNG_STREAM_SIGMA, post_sigma_shape_par, 1 / post_sigma_scale_par);
+    }
+
+    stats_add_time(stats, &sampler_stats_t::sigma_draw_seconds, sigma_time);
+}
+
+template<typename DataVec_t, typename DataMat_t>
 inline
 void
 qr_gibbs_iteration(
-    const ColVec_t& Y,
-    const Mat_t& X,
+    const DataVec_t& Y,
+    const DataMat_t& X,
     const ColVec_t& prior_beta_mu, //  prior_beta_var_inv * prior_beta_mean
     const Mat_t& prior_beta_var_inv,
     const fp_t prior_sigma_shape,
@@ -53,90 +222,280 @@ qr_gibbs_iteration(
     const fp_t omega_sq_par,
     const bool keep_sigma_fixed, // keep sigma^2 value fixed for sampling
     const int omp_n_threads,
+    Mat_t& gram_mat,   // X' N^{-1} X for the current nu; updated for the new nu draw
+    ColVec_t& gram_vec, // X' N^{-1} (Y - theta * nu) for the current nu; updated for the new nu draw
     ColVec_t& beta_draw,
     ColVec_t& nu_draw,
     fp_t& sigma_draw,
-    std::vector<rand_engine_t>& rand_engines_vec
+    const counter_rng_t& rng, // iter_ind set by the caller
+    reduction_slots_t& slots_ws,
+    mvnorm_prec_ws_t& prec_ws,
+    sampler_stats_t* stats = nullptr
 )
 {
-    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+    qr_draw_beta(prior_beta_mu, prior_beta_var_inv, omega_sq_par, sigma_draw, gram_mat, gram_vec, rng, prec_ws, beta_draw, stats);
 
-    const size_t n = Y.size();
-    const size_t K = X.cols();
+    // draw nu; the same pass over X accumulates the sigma statistics and the Gram statistics for the next beta draw
 
-    // draw beta
+    const stats_time_t data_pass_time = stats_now();
 
-    Mat_t var_mat_sum = Mat_t::Zero(K,K);
+    fp_t sum_nu = 0;
+    fp_t sum_err_val = 0;
 
-#ifdef BQREG_USE_OPENMP
-    #pragma omp parallel for num_threads(omp_n_threads) reduction(+:var_mat_sum)
-#endif
-    for (size_t i = 0; i < n; ++i) {
-        var_mat_sum += X.row(i).transpose() * X.row(i) / ( omega_sq_par * sigma_draw * nu_draw(i) );
+    qr_data_pass(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, omp_n_threads, rng, slots_ws, nu_draw, gram_mat, gram_vec, sum_nu, sum_err_val, stats,
+                 get_data_pass_variant(theta_par, keep_sigma_fixed));
+
+    stats_add_time(stats, &sampler_stats_t::data_pass_seconds, data_pass_time);
+
+    qr_draw_sigma(Y.size(), prior_sigma_shape, prior_sigma_scale, keep_sigma_fixed, sum_nu, sum_err_val, rng, sigma_draw, stats);
+}
+
+/*
+ * Sampler for n < K: beta is drawn in the n-dimensional space (see draw_mvnorm_woodbury),
+ * so the K x K Gram matrix is never formed and the data pass only draws nu
+ */
+
+struct woodbury_factors_t
+{
+    Mat_t prior_var_chol; // L, with V = L L'
+    Mat_t XL;
+    Mat_t XV;
+    Mat_t XVXt;
+    ColVec_t Xm;
+};
+
+template<typename DataMat_t>
+inline
+void
+set_woodbury_factors(
+    const DataMat_t& X,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    woodbury_factors_t& factors
+)
+{
+    const size_t n = X.rows();
+    const size_t K = X.cols();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    Eigen::LLT<Mat_t> llt_obj(prior_beta_var);
+
+    if (llt_obj.info() != Eigen::Success) {
+        throw std::runtime_error("bqreg: prior variance matrix of beta is not positive definite");
     }
 
-    const Mat_t post_beta_var = ( var_mat_sum + prior_beta_var_inv ).inverse();
+    factors.prior_var_chol = llt_obj.matrixL();
 
-    //
+    factors.XL.resize(n, K);
+    factors.Xm.resize(n);
 
-    ColVec_t sum_vec = ColVec_t::Zero(K);
+    Mat_t X_block_ws;
 
-#ifdef BQREG_USE_OPENMP
-    #pragma omp parallel for num_threads(omp_n_threads) reduction(+:sum_vec)
-#endif
-    for (size_t i = 0; i < n; ++i) {
-        sum_vec += X.row(i) * ( Y(i) - theta_par * nu_draw(i) ) / ( omega_sq_par * sigma_draw * nu_draw(i) );
+    for (size_t block_ind = 0; block_ind < n_blocks; ++block_ind) {
+        const size_t row_start = block_ind * BQREG_ROW_BLOCK_SIZE;
+        const size_t n_rows = std::min(size_t(BQREG_ROW_BLOCK_SIZE), n - row_start);
+
+        const Eigen::Ref<const Mat_t> X_block = get_row_block(X, row_start, n_rows, X_block_ws);
+
+        factors.XL.middleRows(row_start, n_rows).noalias() = X_block * factors.prior_var_chol.template triangularView<Eigen::Lower>();
+        factors.Xm.segment(row_start, n_rows).noalias() = X_block * prior_beta_mean;
     }
 
-    const ColVec_t post_beta_mean = post_beta_var * (sum_vec + prior_beta_mu);
+    factors.XV.noalias() = factors.XL * factors.prior_var_chol.transpose().template triangularView<Eigen::Upper>();
+
+    factors.XVXt.setZero(n, n);
+    factors.XVXt.template selfadjointView<Eigen::Lower>().rankUpdate(factors.XL);
+    factors.XVXt.template triangularView<Eigen::StrictlyUpper>() = factors.XVXt.transpose();
+}
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs_iteration_woodbury(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const ColVec_t& prior_beta_mean,
+    const woodbury_factors_t& factors,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const bool keep_sigma_fixed, // keep sigma^2 value fixed for sampling
+    const int omp_n_threads,
+    ColVec_t& beta_draw,
+    ColVec_t& nu_draw,
+    fp_t& sigma_draw,
+    const counter_rng_t& rng, // iter_ind set by the caller
+    reduction_slots_t& slots_ws,
+    sampler_stats_t* stats = nullptr
+)
+{
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    // draw beta; W = (omega^2 sigma N)^{-1}
+
+    const stats_time_t beta_time = stats_now();
+
+    const ColVec_t sqrt_w_vec = ( omega_sq_par * sigma_draw * nu_draw.array() ).rsqrt().matrix();
+    const ColVec_t wy_vec = sqrt_w_vec.cwiseProduct( Y.template cast<fp_t>() - theta_par * nu_draw );
+
+    draw_mvnorm_woodbury(factors.XL, factors.XV, factors.XVXt, factors.Xm, factors.prior_var_chol, prior_beta_mean,
+                         sqrt_w_vec, wy_vec, rng.rnorm_vec(RNG_STREAM_BETA, K + n), beta_draw);
 
-    beta_draw = post_beta_mean + post_beta_var.llt().matrixL() * stats::rnorm<ColVec_t>(K, 1, fp_t(0), fp_t(1), rand_engines_vec[0]);
+    stats_add_time(stats, &sampler_stats_t::beta_draw_seconds, beta_time);
 
     // draw nu
 
-    const fp_t gamma_par = std::sqrt( (2 / sigma_draw) + (theta_par * theta_par) / (sigma_draw * omega_sq_par) );
-    const fp_t tmp_scale_val = std::sqrt( sigma_draw * omega_sq_par );
+    const stats_time_t data_pass_time = stats_now();
 
-#ifdef BQREG_USE_OPENMP
-    #pragma omp parallel for num_threads(omp_n_threads)
-#endif
-    for (size_t i = 0; i < n; ++i) {
-        size_t thread_num = 0;
+    fp_t sum_nu = 0;
+    fp_t sum_err_val = 0;
 
-#ifdef BQREG_USE_OPENMP
-        thread_num = omp_get_thread_num();
-#endif
+    qr_nu_pass(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, omp_n_threads, rng, slots_ws, nu_draw, sum_nu, sum_err_val, stats);
 
-        const fp_t err_val = Y(i) - X.row(i).dot(beta_draw);
-        const fp_t delta_par = std::abs(err_val) / tmp_scale_val;
-        nu_draw(i) = fp_t(1) / stats::rinvgauss(gamma_par, delta_par, rand_engines_vec[thread_num]);
-    }
+    stats_add_time(stats, &sampler_stats_t::data_pass_seconds, data_pass_time);
 
     // draw sigma
 
+    const stats_time_t sigma_time = stats_now();
+
     if (!keep_sigma_fixed) {
-        fp_t sum_err_val = 0;
+        const fp_t post_sigma_shape_par = prior_sigma_shape + (3 * n / fp_t(2));
+        const fp_t post_sigma_scale_par = (2 * prior_sigma_scale + 2 * sum_nu + sum_err_val ) / 2;
+
+        sigma_draw = fp_t(1) / rng.rgamma(RNG_STREAM_SIGMA, post_sigma_shape_par, 1 / post_sigma_scale_par);
+    }
+
+    stats_add_time(stats, &sampler_stats_t::sigma_draw_seconds, sigma_time);
+}
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs_woodbury(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const fp_t tau,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    const int omp_n_threads,
+    draw_sink_t& draw_sink,
+    counter_rng_t& rng,
+    sampler_stats_t* stats = nullptr,
+    sampler_checkpoint_t* checkpoint = nullptr
+)
+{
+    const size_t n_total_draws = n_burnin_draws + (thinning_factor + 1) * n_keep_draws;
+
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    const fp_t theta_par = (1 - 2 * tau) / (tau * (1 - tau));
+    const fp_t omega_sq_par = 2 / (tau * (1 - tau));
+
+    const bool resume = (checkpoint && checkpoint->resume);
+    const bool warm_start = (checkpoint && checkpoint->warm_start);
+
+    if (checkpoint) {
+        checkpoint->begin_run(rng, n, K, tau, n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed);
+    }
+
+    const stats_time_t setup_time = stats_now();
+
+    woodbury_factors_t factors;
+    set_woodbury_factors(X, prior_beta_mean, prior_beta_var, factors);
+
+    stats_add_time(stats, &sampler_stats_t::setup_seconds, setup_time);
+
+    // a resumed run pushes only the draws after the checkpoint, indexed from zero
 
-    #ifdef BQREG_USE_OPENMP
-        #pragma omp parallel for num_threads(omp_n_threads) reduction(+:sum_err_val)
-    #endif
-        for (size_t i = 0; i < n; ++i) {
-            const fp_t err_val = Y(i) - X.row(i).dot(beta_draw) - theta_par * nu_draw(i);
-            sum_err_val += (err_val * err_val) / (omega_sq_par * nu_draw(i));
+    const size_t mcmc_start_ind = resume ? checkpoint->state.n_iterations : 0;
+    const size_t save_start_ind = resume ? checkpoint->state.n_saved : 0;
+
+    draw_sink.begin(n, K, n_keep_draws - save_start_ind);
+
+    ColVec_t z_draw;
+
+    // set initial values for the draws
+
+    ColVec_t beta_draw, nu_draw;
+    fp_t sigma_draw;
+
+    if (resume || warm_start) {
+        beta_draw = checkpoint->state.beta_draw;
+        nu_draw = checkpoint->state.nu_draw;
+        sigma_draw = checkpoint->state.sigma_draw;
+    } else {
+        beta_draw = beta_initial_draw;
+
+        sigma_draw = qr_sum_sq_resid(Y, X, beta_draw) / fp_t(n);
+
+        nu_draw = ColVec_t::Constant(n, sigma_draw);
+
+        if (keep_sigma_fixed) {
+            sigma_draw = fp_t(1);
         }
+    }
 
-        const fp_t post_sigma_shape_par = prior_sigma_shape + (3 * n / fp_t(2));
-        const fp_t post_sigma_scale_par = (2 * prior_sigma_scale + 2 * nu_draw.array().sum() + sum_err_val ) / 2;
+    reduction_slots_t slots_ws;
+
+    // main loop
+
+    size_t mcmc_save_ind = save_start_ind;
+
+    for (size_t mcmc_ind = mcmc_start_ind; mcmc_ind < n_total_draws; ++mcmc_ind) {
+        rng.iter_ind = static_cast<uint32_t>(mcmc_ind);
+
+        qr_gibbs_iteration_woodbury(Y, X, prior_beta_mean, factors, prior_sigma_shape, prior_sigma_scale,
+                                    theta_par, omega_sq_par, keep_sigma_fixed, omp_n_threads,
+                                    beta_draw, nu_draw, sigma_draw, rng, slots_ws, stats);
+
+        if (mcmc_ind >= n_burnin_draws && (mcmc_ind - n_burnin_draws) % (thinning_factor + 1) == 0 ) {
+            const stats_time_t store_time = stats_now();
+
+            if (draw_sink.wants_z()) {
+                z_draw.noalias() = nu_draw / sigma_draw;
+            }
+
+            draw_sink.push(mcmc_save_ind - save_start_ind, beta_draw, z_draw, sigma_draw);
+
+            ++mcmc_save_ind;
+
+            stats_add_time(stats, &sampler_stats_t::store_seconds, store_time);
+        }
+
+        const bool stop_flag = draw_sink.stop_requested();
+
+        if (checkpoint) {
+            checkpoint->update(mcmc_ind + 1, mcmc_save_ind, beta_draw, nu_draw, sigma_draw, stop_flag || mcmc_ind + 1 == n_total_draws);
+        }
 
-        sigma_draw = fp_t(1) / stats::rgamma(post_sigma_shape_par, 1 / post_sigma_scale_par, rand_engines_vec[0]);
+        if (stop_flag) {
+            if (stats) {
+                stats->n_iterations = mcmc_ind + 1 - mcmc_start_ind;
+            }
+
+            break;
+        }
     }
+
+    draw_sink.end();
 }
 
+template<typename DataVec_t, typename DataMat_t>
 inline
 void
 qr_gibbs(
-    const ColVec_t& Y,
-    const Mat_t& X,
+    const DataVec_t& Y,
+    const DataMat_t& X,
     const fp_t tau,
     const ColVec_t& beta_initial_draw,
     const ColVec_t& prior_beta_mean,
@@ -148,12 +507,17 @@ qr_gibbs(
     const size_t thinning_factor,
     const bool keep_sigma_fixed,
     int omp_n_threads,
-    Mat_t& beta_draws_storage,
-    Mat_t& z_draws_storage,
-    ColVec_t& sigma_draws_storage,
-    rand_engine_t& rand_engine
+    draw_sink_t& draw_sink,
+    counter_rng_t& rng,
+    sampler_stats_t* stats = nullptr,
+    sampler_checkpoint_t* checkpoint = nullptr,
+    const int setup_n_threads = 0, // threads for the one-off passes of the setup; 0 uses omp_n_threads
+    const sampler_scheme_t sampler_scheme = SAMPLER_SCHEME_STANDARD, // see bqreg_schemes.hpp; the n < K sampler always uses the standard scheme
+    const size_t outer_cache_max_bytes = BQREG_OUTER_CACHE_MAX_BYTES // byte budget of the packed outer-product cache (see outer_prod_cache_t); 0 turns it off
 )
 {
+    const stats_time_t total_time = stats_now();
+
 #ifdef BQREG_USE_OPENMP
     if (omp_n_threads < 0) {
         omp_n_threads = std::max(1, static_cast<int>(omp_get_max_threads()) / 2); // OpenMP often detects the number of virtual/logical cores, not physical cores
@@ -166,82 +530,325 @@ qr_gibbs(
     omp_n_threads = 1;
 #endif
 
-    //
+    const int setup_omp_n_threads = (setup_n_threads > 0) ? setup_n_threads : omp_n_threads;
+
+    const size_t n_total_draws = n_burnin_draws + (thinning_factor + 1) * n_keep_draws;
+
+    const size_t n = Y.size();
+    const size_t K = X.cols();
 
-    std::vector<rand_engine_t> rand_engines_vec;
+    const bool resume = (checkpoint && checkpoint->resume);
+    const bool warm_start = (checkpoint && checkpoint->warm_start);
 
-    for (int i = 0; i < omp_n_threads; ++i) {
-        size_t seed_val = generate_seed_value(i, omp_n_threads, rand_engine);
-        rand_engines_vec.push_back(rand_engine_t(seed_val));
+    if (stats) {
+        stats->reset(omp_n_threads);
+        stats->n_iterations = n_total_draws - (resume ? std::min(checkpoint->state.n_iterations, n_total_draws) : 0);
     }
 
-    //
+    // wide data: draw beta in the n-dimensional space
 
-    const size_t n_total_draws = n_burnin_draws + (thinning_factor + 1) * n_keep_draws;
+    if (n < K) {
+        qr_gibbs_woodbury(Y, X, tau, beta_initial_draw, prior_beta_mean, prior_beta_var, prior_sigma_shape, prior_sigma_scale,
+                          n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed, omp_n_threads, draw_sink, rng, stats, checkpoint);
 
-    const size_t n = Y.size();
-    const size_t K = X.cols();
+        stats_add_time(stats, &sampler_stats_t::total_seconds, total_time);
+        return;
+    }
+
+    if (checkpoint) {
+        checkpoint->begin_run(rng, n, K, tau, n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed);
+    }
 
     const fp_t theta_par = (1 - 2 * tau) / (tau * (1 - tau));
     const fp_t omega_sq_par = 2 / (tau * (1 - tau));
 
-    const Mat_t prior_beta_var_inv = prior_beta_var.inverse();
-    const Mat_t prior_beta_mu = prior_beta_var_inv * prior_beta_mean;
+    const stats_time_t setup_time = stats_now();
+
+    const Mat_t prior_beta_var_inv = inv_sympd(prior_beta_var);
+    const ColVec_t prior_beta_mu = prior_beta_var_inv * prior_beta_mean;
+
+    // set storage containers; a resumed run pushes only the draws after the checkpoint, indexed from zero
+
+    const size_t mcmc_start_ind = resume ? checkpoint->state.n_iterations : 0;
+    const size_t save_start_ind = resume ? checkpoint->state.n_saved : 0;
 
-    // set storage containers
+    draw_sink.begin(n, K, n_keep_draws - save_start_ind);
 
-    beta_draws_storage.setZero(K, n_keep_draws);
-    z_draws_storage.setZero(n, n_keep_draws);
-    sigma_draws_storage.setZero(n_keep_draws);
+    ColVec_t z_draw;
 
     // set initial values for the draws
 
-    ColVec_t beta_draw = beta_initial_draw;
+    ColVec_t beta_draw, nu_draw;
+    fp_t sigma_draw;
 
-    fp_t sigma_draw = (Y - X * beta_draw).array().pow(2).sum() / fp_t(n);
+    Mat_t gram_mat;
+    ColVec_t gram_vec;
 
-    ColVec_t nu_draw = ColVec_t::Constant(n, sigma_draw);
+    if (resume || warm_start) {
+        beta_draw = checkpoint->state.beta_draw;
+        nu_draw = checkpoint->state.nu_draw;
+        sigma_draw = checkpoint->state.sigma_draw;
 
-    if (keep_sigma_fixed) {
-        sigma_draw = fp_t(1);
+        if (!get_state_gram(checkpoint->state, gram_mat, gram_vec)) {
+            qr_gram_pass(Y, X, nu_draw, theta_par, setup_omp_n_threads, gram_mat, gram_vec);
+        }
+    } else {
+        beta_draw = beta_initial_draw;
+
+        sigma_draw = qr_sum_sq_resid(Y, X, beta_draw) / fp_t(n);
+
+        nu_draw = ColVec_t::Constant(n, sigma_draw);
+
+        if (keep_sigma_fixed) {
+            sigma_draw = fp_t(1);
+        }
+
+        qr_gram_pass(Y, X, nu_draw, theta_par, setup_omp_n_threads, gram_mat, gram_vec);
     }
 
-    // main loop
+    reduction_slots_t slots_ws;
+    set_reduction_slots(slots_ws, get_n_row_blocks(n), K, 1, stats);
 
-    size_t mcmc_save_ind = 0;
-
-    for (size_t mcmc_ind = 0; mcmc_ind < n_total_draws; ++mcmc_ind) {
-        
-        // one iteration of gibbs sampling
-
-        qr_gibbs_iteration(Y, 
-                           X, 
-                           prior_beta_mu, 
-                           prior_beta_var_inv,
-                           prior_sigma_shape,
-                           prior_sigma_scale,
-                           theta_par,
-                           omega_sq_par,
-                           keep_sigma_fixed,
-                           omp_n_threads,
-                           beta_draw,
-                           nu_draw,
-                           sigma_draw,
-                           rand_engines_vec);
-        
-        // save draws
+    const sampler_scheme_t run_scheme = keep_sigma_fixed ? SAMPLER_SCHEME_STANDARD : sampler_scheme;
 
-        if (mcmc_ind >= n_burnin_draws && (mcmc_ind - n_burnin_draws) % (thinning_factor + 1) == 0 ) {
-            // note: (mcmc_ind - n_burnin_draws) could underflow but...
-            // the second condition will not be checked if the first condition does not pass
+    fp_t sum_Y = 0;
+    ColVec_t X_col_sums;
 
-            beta_draws_storage.col(mcmc_save_ind) = beta_draw;
-            z_draws_storage.col(mcmc_save_ind) = nu_draw / sigma_draw;
-            sigma_draws_storage(mcmc_save_ind) = sigma_draw;
+    if (run_scheme == SAMPLER_SCHEME_INTERWEAVED) {
+        qr_sum_cols(Y, X, sum_Y, X_col_sums);
+    }
 
-            ++mcmc_save_ind;
+    // for small K, the outer products of the rows are packed once, if they fit in the budget
+
+    outer_prod_cache_t outer_cache;
+
+    if (mcmc_start_ind < n_total_draws && use_outer_prod_cache(n, K, outer_cache_max_bytes)) {
+        build_outer_prod_cache(X, n, setup_omp_n_threads, outer_cache, stats);
+
+        if (stats && stats->enabled) {
+            stats->outer_cache_bytes = outer_cache.packed_rows.size() * sizeof(fp_t);
         }
     }
+
+    const outer_prod_cache_t* outer_cache_ptr = outer_cache.is_built() ? &outer_cache : nullptr;
+
+    // the data pass kernel for tau = 0.5 and for a fixed sigma (see get_data_pass_variant)
+
+    const int pass_variant = get_data_pass_variant(theta_par, keep_sigma_fixed);
+
+    stats_add_time(stats, &sampler_stats_t::setup_seconds, setup_time);
+
+    // main loop: one team of threads for the whole run. Each iteration is the data pass (whose
+    // worksharing loops end in barriers) followed by the master thread drawing sigma, storing the
+    // draws, and drawing beta for the next iteration, while the rest of the team waits at a barrier.
+    // The sinks and the checkpoint are only touched by the thread that called the sampler.
+
+    size_t mcmc_save_ind = save_start_ind;
+
+    bool stop_flag = (mcmc_start_ind >= n_total_draws);
+    std::exception_ptr loop_exception;
+
+    mvnorm_prec_ws_t prec_ws;
+
+    stats_time_t data_pass_time = stats_now();
+
+    if (!stop_flag) {
+        rng.iter_ind = static_cast<uint32_t>(mcmc_start_ind);
+
+        qr_draw_beta(prior_beta_mu, prior_beta_var_inv, omega_sq_par, sigma_draw, gram_mat, gram_vec, rng, prec_ws, beta_draw, stats);
+
+        data_pass_time = stats_now();
+    }
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel num_threads(omp_n_threads) if(!stop_flag)
+#endif
+    {
+        data_pass_ws_t pass_ws;
+
+        for (size_t mcmc_ind = mcmc_start_ind; !stop_flag; ++mcmc_ind) {
+
+            // draw nu; the same pass over X accumulates the sigma statistics and the Gram statistics for the next beta draw
+
+            qr_data_pass_team(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, rng, slots_ws, pass_ws, nu_draw, stats, outer_cache_ptr, pass_variant);
+
+#ifdef BQREG_USE_OPENMP
+            #pragma omp master
+#endif
+            {
+                try {
+                    stats_add_time(stats, &sampler_stats_t::data_pass_seconds, data_pass_time);
+
+                    fp_t sum_nu = 0;
+                    fp_t sum_err_val = 0;
+
+                    get_data_pass_sums(slots_ws, gram_mat, gram_vec, sum_nu, sum_err_val);
+
+                    // the collapsed draw of sigma is completed by the next beta draw, so the draws saved
+                    // with this beta are those of the sigma that nu was drawn with
+
+                    const fp_t sigma_pass_draw = sigma_draw;
+
+                    if (run_scheme == SAMPLER_SCHEME_COLLAPSED) {
+                        qr_draw_sigma_collapsed(n, prior_sigma_shape, prior_sigma_scale, omega_sq_par, prior_beta_mu, prior_beta_var_inv, beta_draw,
+                                                gram_mat, gram_vec, sum_nu, sum_err_val, rng, prec_ws, sigma_draw, stats);
+                    } else {
+                        qr_draw_sigma(n, prior_sigma_shape, prior_sigma_scale, keep_sigma_fixed, sum_nu, sum_err_val, rng, sigma_draw, stats);
+                    }
+
+                    if (run_scheme == SAMPLER_SCHEME_INTERWEAVED) {
+                        const fp_t nu_scale = qr_interweave_sigma(n, prior_sigma_shape, prior_sigma_scale, theta_par, omega_sq_par, sum_Y, X_col_sums, beta_draw,
+                                                                  sum_err_val, rng, gram_mat, gram_vec, sum_nu, sigma_draw, stats);
+
+                        // nu is read only by the checkpoint and through z; the next pass draws it afresh
+
+                        if (checkpoint || draw_sink.wants_z()) {
+                            nu_draw *= nu_scale;
+                        }
+                    }
+
+                    // save draws
+
+                    if (mcmc_ind >= n_burnin_draws && (mcmc_ind - n_burnin_draws) % (thinning_factor + 1) == 0 ) {
+                        // note: (mcmc_ind - n_burnin_draws) could underflow but...
+                        // the second condition will not be checked if the first condition does not pass
+
+                        const stats_time_t store_time = stats_now();
+
+                        const fp_t sigma_save_draw = (run_scheme == SAMPLER_SCHEME_COLLAPSED) ? sigma_pass_draw : sigma_draw;
+
+                        if (draw_sink.wants_z()) {
+                            z_draw.noalias() = nu_draw / sigma_save_draw;
+                        }
+
+                        draw_sink.push(mcmc_save_ind - save_start_ind, beta_draw, z_draw, sigma_save_draw);
+
+                        ++mcmc_save_ind;
+
+                        stats_add_time(stats, &sampler_stats_t::store_seconds, store_time);
+                    }
+
+                    const bool stop_requested = draw_sink.stop_requested();
+
+                    stop_flag = stop_requested || mcmc_ind + 1 == n_total_draws;
+
+                    if (checkpoint) {
+                        checkpoint->update(mcmc_ind + 1, mcmc_save_ind, beta_draw, nu_draw, sigma_draw, gram_mat, gram_vec, stop_flag);
+                    }
+
+                    if (stop_requested && stats) {
+                        stats->n_iterations = mcmc_ind + 1 - mcmc_start_ind;
+                    }
+
+                    // draw beta for the next iteration
+
+                    if (!stop_flag) {
+                        rng.iter_ind = static_cast<uint32_t>(mcmc_ind + 1);
+
+                        qr_draw_beta(prior_beta_mu, prior_beta_var_inv, omega_sq_par, sigma_draw, gram_mat, gram_vec, rng, prec_ws, beta_draw, stats);
+                    }
+
+                    data_pass_time = stats_now();
+                } catch (...) {
+                    loop_exception = std::current_exception();
+                    stop_flag = true;
+                }
+            }
+
+#ifdef BQREG_USE_OPENMP
+            #pragma omp barrier
+#endif
+        }
+
+        stats_merge_thread(stats, pass_ws);
+    }
+
+    if (loop_exception) {
+        std::rethrow_exception(loop_exception);
+    }
+
+    draw_sink.end();
+
+    stats_add_time(stats, &sampler_stats_t::total_seconds, total_time);
+}
+
+// the counter-based generator is keyed by a 64-bit seed drawn from rand_engine (or, on resume, read from the checkpoint)
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const fp_t tau,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    int omp_n_threads,
+    draw_sink_t& draw_sink,
+    rand_engine_t& rand_engine,
+    sampler_stats_t* stats = nullptr,
+    sampler_checkpoint_t* checkpoint = nullptr,
+    const int setup_n_threads = 0,
+    const sampler_scheme_t sampler_scheme = SAMPLER_SCHEME_STANDARD,
+    const size_t outer_cache_max_bytes = BQREG_OUTER_CACHE_MAX_BYTES
+)
+{
+    counter_rng_t rng;
+
+    if (checkpoint && checkpoint->resume) {
+        // the seed comes from the checkpoint; leave the engine as it was after the seed draw of the original run
+
+        if (!checkpoint->state.rand_engine_state.empty()) {
+            rand_engine_from_string(checkpoint->state.rand_engine_state, rand_engine);
+        }
+    } else {
+        rng = counter_rng_t(rand_engine(), 0);
+
+        if (checkpoint) {
+            checkpoint->state.rand_engine_state = rand_engine_to_string(rand_engine);
+        }
+    }
+
+    qr_gibbs(Y, X, tau, beta_initial_draw, prior_beta_mean, prior_beta_var, prior_sigma_shape, prior_sigma_scale,
+             n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed, omp_n_threads, draw_sink, rng, stats, checkpoint, setup_n_threads, sampler_scheme, outer_cache_max_bytes);
+}
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_gibbs(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const fp_t tau,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    int omp_n_threads,
+    Mat_t& beta_draws_storage,
+    Mat_t& z_draws_storage,
+    ColVec_t& sigma_draws_storage,
+    rand_engine_t& rand_engine,
+    sampler_stats_t* stats = nullptr,
+    sampler_checkpoint_t* checkpoint = nullptr
+)
+{
+    memory_sink_t draw_sink(beta_draws_storage, z_draws_storage, sigma_draws_storage);
+
+    qr_gibbs(Y, X, tau, beta_initial_draw, prior_beta_mean, prior_beta_var, prior_sigma_shape, prior_sigma_scale,
+             n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed, omp_n_threads, draw_sink, rand_engine, stats, checkpoint);
 }
 
 #endif
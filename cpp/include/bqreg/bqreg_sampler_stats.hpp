@@ -0,0 +1,232 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Sampler statistics: per-phase wall time, load balance across threads in the data pass,
+ * and workspace allocations
+ *
+ * The instrumentation is compiled in only when BQREG_ENABLE_SAMPLER_STATS is defined. Otherwise
+ * the timers below are empty, and a sampler_stats_t passed to the sampler stays zero, with
+ * enabled = false.
+ */
+
+#ifndef _bqreg_sampler_stats_HPP
+#define _bqreg_sampler_stats_HPP
+
+/**
+ * Statistics for one run of the sampler
+ *
+ * Phase times are wall-clock seconds summed over iterations. The data pass is split further by
+ * thread: the time spent on residuals and nu draws and on the Gram accumulation is summed over
+ * threads, and \c thread_busy_seconds holds the total for each thread.
+ *
+ * The allocation counts cover the heap buffers of the data pass (per-thread row-block buffers
+ * and reduction slots); temporaries inside Eigen's K x K algebra are not counted.
+ */
+
+struct sampler_stats_t
+{
+    bool enabled = false; /*!< whether the instrumentation was compiled in */
+
+    size_t n_iterations = 0;
+    int n_threads = 0;
+
+    double total_seconds = 0;
+    double setup_seconds = 0;      /*!< prior precision, initial Gram statistics, and factors computed once */
+    double beta_draw_seconds = 0;  /*!< forming and factorizing the posterior precision, and the beta draw */
+    double data_pass_seconds = 0;  /*!< the pass over X: residuals, nu draws, and Gram accumulation */
+    double reduce_seconds = 0;     /*!< summing the reduction slots; part of data_pass_seconds */
+    double sigma_draw_seconds = 0;
+    double store_seconds = 0;      /*!< forming z and pushing the kept draws to the sink */
+
+    double nu_draw_thread_seconds = 0; /*!< residuals and nu draws, summed over threads */
+    double gram_thread_seconds = 0;    /*!< Gram accumulation, summed over threads */
+
+    std::vector<double> thread_busy_seconds; /*!< time each thread spent on row blocks */
+
+    size_t n_workspace_allocs = 0;
+    size_t workspace_alloc_bytes = 0;
+
+    size_t outer_cache_bytes = 0; /*!< size of the packed outer-product cache; zero when the data pass does not use one */
+
+    void reset(const int n_threads_inp)
+    {
+        *this = sampler_stats_t();
+
+#ifdef BQREG_ENABLE_SAMPLER_STATS
+        enabled = true;
+#endif
+        n_threads = n_threads_inp;
+        thread_busy_seconds.assign(std::max(n_threads_inp, 1), 0.0);
+    }
+
+    /**
+     * @return the busiest thread's time over the mean time per thread; 1 when the data pass is balanced
+     */
+
+    double load_imbalance() const
+    {
+        if (thread_busy_seconds.empty()) {
+            return 0;
+        }
+
+        const double sum_val = std::accumulate(thread_busy_seconds.begin(), thread_busy_seconds.end(), 0.0);
+        const double max_val = *std::max_element(thread_busy_seconds.begin(), thread_busy_seconds.end());
+
+        return sum_val > 0 ? max_val * thread_busy_seconds.size() / sum_val : 0;
+    }
+};
+
+// accumulated by each thread of a data pass, then merged into sampler_stats_t
+
+struct thread_stats_t
+{
+    double nu_draw_seconds = 0;
+    double gram_seconds = 0;
+
+    size_t n_workspace_allocs = 0;
+    size_t workspace_alloc_bytes = 0;
+};
+
+#ifdef BQREG_ENABLE_SAMPLER_STATS
+    using stats_time_t = std::chrono::steady_clock::time_point;
+
+    inline
+    stats_time_t
+    stats_now()
+    {
+        return std::chrono::steady_clock::now();
+    }
+
+    inline
+    double
+    stats_seconds_since(const stats_time_t& start_time)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    }
+#else
+    using stats_time_t = int;
+
+    inline
+    stats_time_t
+    stats_now()
+    {
+        return 0;
+    }
+
+    inline
+    double
+    stats_seconds_since(const stats_time_t start_time)
+    {
+        (void)(start_time);
+        return 0;
+    }
+#endif
+
+// add the time since start_time to one of the phase fields, e.g., &sampler_stats_t::sigma_draw_seconds
+
+inline
+void
+stats_add_time(sampler_stats_t* stats, double sampler_stats_t::* field, const stats_time_t& start_time)
+{
+#ifdef BQREG_ENABLE_SAMPLER_STATS
+    if (stats) {
+        stats->*field += stats_seconds_since(start_time);
+    }
+#else
+    (void)(stats); (void)(field); (void)(start_time);
+#endif
+}
+
+inline
+void
+stats_add_allocs(sampler_stats_t* stats, const size_t n_allocs, const size_t n_bytes)
+{
+#ifdef BQREG_ENABLE_SAMPLER_STATS
+    if (stats) {
+        stats->n_workspace_allocs += n_allocs;
+        stats->workspace_alloc_bytes += n_bytes;
+    }
+#else
+    (void)(stats); (void)(n_allocs); (void)(n_bytes);
+#endif
+}
+
+// count the (nonempty) workspace buffers of one thread
+
+inline
+void
+stats_count_workspace(thread_stats_t& thread_stats)
+{
+    (void)(thread_stats);
+}
+
+template<typename Derived, typename... Rest>
+inline
+void
+stats_count_workspace(thread_stats_t& thread_stats, const Eigen::DenseBase<Derived>& buffer, const Rest&... rest)
+{
+#ifdef BQREG_ENABLE_SAMPLER_STATS
+    if (buffer.size() > 0) {
+        thread_stats.n_workspace_allocs += 1;
+        thread_stats.workspace_alloc_bytes += buffer.size() * sizeof(typename Derived::Scalar);
+    }
+#else
+    (void)(buffer);
+#endif
+
+    stats_count_workspace(thread_stats, rest...);
+}
+
+// called once by each thread at the end of a data pass
+
+inline
+void
+stats_merge_thread(sampler_stats_t* stats, const thread_stats_t& thread_stats)
+{
+#ifdef BQREG_ENABLE_SAMPLER_STATS
+    if (!stats) {
+        return;
+    }
+
+#ifdef BQREG_USE_OPENMP
+    const size_t thread_ind = omp_get_thread_num();
+    #pragma omp critical (bqreg_sampler_stats)
+#else
+    const size_t thread_ind = 0;
+#endif
+    {
+        if (stats->thread_busy_seconds.size() <= thread_ind) {
+            stats->thread_busy_seconds.resize(thread_ind + 1, 0.0);
+        }
+
+        stats->thread_busy_seconds[thread_ind] += thread_stats.nu_draw_seconds + thread_stats.gram_seconds;
+
+        stats->nu_draw_thread_seconds += thread_stats.nu_draw_seconds;
+        stats->gram_thread_seconds += thread_stats.gram_seconds;
+        stats->n_workspace_allocs += thread_stats.n_workspace_allocs;
+        stats->workspace_alloc_bytes += thread_stats.workspace_alloc_bytes;
+    }
+#else
+    (void)(stats); (void)(thread_stats);
+#endif
+}
+
+#endif
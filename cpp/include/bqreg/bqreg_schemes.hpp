@@ -0,0 +1,313 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Update schemes for sigma
+ *
+ * The standard scheme draws beta | nu, sigma, then nu | beta, sigma, then sigma | beta, nu. As
+ * nu_i ~ Exp(sigma), sigma and nu move together only slowly, and the chain needs many more
+ * iterations for extreme tau (where theta^2 / omega^2 is large) or collinear X. Two alternatives
+ * replace the sigma step; both use only the sums of the data pass, so the pass is unchanged.
+ *
+ *   collapsed:    sigma | nu with beta integrated out, so that (sigma, beta) is drawn as one
+ *                 block given nu; the conditional is not conjugate, and is slice sampled.
+ *
+ *   interweaved:  the standard sigma draw is followed by a second draw of sigma given
+ *                 xi = nu / sigma instead of nu, the ancillary form of the augmentation
+ *                 (ancillarity-sufficiency interweaving; Yu and Meng, 2011), after which
+ *                 nu = sigma xi. The rescaling of nu is also applied to the Gram statistics.
+ *
+ * Each step costs a few evaluations of a one-dimensional density: for the collapsed draw a
+ * K x K Cholesky factorization per evaluation, for the interweaved draw O(1).
+ */
+
+#ifndef _bqreg_schemes_HPP
+#define _bqreg_schemes_HPP
+
+// the number of steps the slice sampler may take on each side of the current value
+
+#ifndef BQREG_SLICE_MAX_STEPS
+    #define BQREG_SLICE_MAX_STEPS 16
+#endif
+
+enum sampler_scheme_t {
+    SAMPLER_SCHEME_STANDARD = 0,
+    SAMPLER_SCHEME_COLLAPSED = 1,
+    SAMPLER_SCHEME_INTERWEAVED = 2
+};
+
+inline
+sampler_scheme_t
+sampler_scheme_from_string(const std::string& scheme_str)
+{
+    if (scheme_str == "standard") {
+        return SAMPLER_SCHEME_STANDARD;
+    } else if (scheme_str == "collapsed") {
+        return SAMPLER_SCHEME_COLLAPSED;
+    } else if (scheme_str == "interweaved") {
+        return SAMPLER_SCHEME_INTERWEAVED;
+    }
+
+    throw std::invalid_argument("bqreg: unknown sampler scheme '" + scheme_str + "'; use 'standard', 'collapsed', or 'interweaved'");
+}
+
+inline
+std::string
+sampler_scheme_to_string(const sampler_scheme_t scheme)
+{
+    switch (scheme) {
+        case SAMPLER_SCHEME_COLLAPSED:
+            return "collapsed";
+        case SAMPLER_SCHEME_INTERWEAVED:
+            return "interweaved";
+        default:
+            return "standard";
+    }
+}
+
+/*
+ * Univariate slice sampler with stepping out and shrinkage (Neal, 2003); log_dens returns the
+ * log density up to a constant, and -infinity outside the support. The uniforms are read from
+ * consecutive blocks of one stream, as in counter_rng_t::rgamma.
+ */
+
+template<typename LogDens_t>
+inline
+double
+slice_sample(
+    const LogDens_t& log_dens,
+    const double x_initial,
+    const double width,
+    const counter_rng_t& rng,
+    const uint32_t stream_ind
+)
+{
+    uint64_t index = 0;
+
+    philox_block_t rand_block = rng.block(stream_ind, index++);
+
+    const double log_level = log_dens(x_initial) + std::log(u01_from_u32(rand_block.v[0]));
+
+    // step out from a randomly placed interval, at most BQREG_SLICE_MAX_STEPS in total
+
+    double x_lower = x_initial - width * u01_from_u32(rand_block.v[1]);
+    double x_upper = x_lower + width;
+
+    int n_lower_steps = static_cast<int>(BQREG_SLICE_MAX_STEPS * u01_from_u32(rand_block.v[2]));
+    int n_upper_steps = BQREG_SLICE_MAX_STEPS - 1 - n_lower_steps;
+
+    while (n_lower_steps > 0 && log_dens(x_lower) > log_level) {
+        x_lower -= width;
+        --n_lower_steps;
+    }
+
+    while (n_upper_steps > 0 && log_dens(x_upper) > log_level) {
+        x_upper += width;
+        --n_upper_steps;
+    }
+
+    // shrink towards x_initial until a point inside the slice is found
+
+    while (true) {
+        rand_block = rng.block(stream_ind, index++);
+
+        const double x_val = x_lower + (x_upper - x_lower) * u01_from_u64( (uint64_t(rand_block.v[1]) << 32) | rand_block.v[0] );
+
+        if (log_dens(x_val) > log_level || x_val == x_initial) {
+            return x_val;
+        }
+
+        if (x_val < x_initial) {
+            x_lower = x_val;
+        } else {
+            x_upper = x_val;
+        }
+    }
+}
+
+/*
+ * Sigma given nu, with beta integrated out. With G = X' N^{-1} X, g = X' N^{-1} (Y - theta nu),
+ * and S = (Y - theta nu)' N^{-1} (Y - theta nu), the log density of t = log(sigma) is
+ *
+ *   - (a + 3n/2) t - (b + sum(nu) + S / (2 omega^2)) / sigma - log|P| / 2 + m' P^{-1} m / 2,
+ *
+ * where P = G / (omega^2 sigma) + V^{-1} and m = g / (omega^2 sigma) + V^{-1} mu. S is recovered
+ * from the sums of the data pass at the beta_draw of the pass: S = omega^2 sum_err + 2 beta' g - beta' G beta.
+ */
+
+inline
+void
+qr_draw_sigma_collapsed(
+    const size_t n,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const fp_t omega_sq_par,
+    const ColVec_t& prior_beta_mu,
+    const Mat_t& prior_beta_var_inv,
+    const ColVec_t& beta_draw,
+    const Mat_t& gram_mat,
+    const ColVec_t& gram_vec,
+    const fp_t sum_nu,
+    const fp_t sum_err_val,
+    const counter_rng_t& rng,
+    mvnorm_prec_ws_t& prec_ws,
+    fp_t& sigma_draw,
+    sampler_stats_t* stats = nullptr
+)
+{
+    const stats_time_t sigma_time = stats_now();
+
+    const double sum_sq_val = double(omega_sq_par) * sum_err_val + double( beta_draw.dot(2 * gram_vec - gram_mat * beta_draw) );
+
+    const double shape_val = double(prior_sigma_shape) + 1.5 * double(n);
+    const double scale_val = double(prior_sigma_scale) + double(sum_nu) + std::max(sum_sq_val, 0.0) / (2 * double(omega_sq_par));
+
+    auto log_dens = [&](const double t_val) -> double {
+        const fp_t gram_scale_val = static_cast<fp_t>( std::exp(-t_val) / omega_sq_par );
+
+        prec_ws.post_prec = gram_scale_val * gram_mat + prior_beta_var_inv;
+        prec_ws.post_vec = gram_scale_val * gram_vec + prior_beta_mu;
+
+        prec_ws.llt_obj.compute(prec_ws.post_prec);
+
+        if (prec_ws.llt_obj.info() != Eigen::Success) {
+            return - std::numeric_limits<double>::infinity();
+        }
+
+        prec_ws.llt_obj.matrixL().solveInPlace(prec_ws.post_vec);
+
+        const double log_det_val = 2 * prec_ws.llt_obj.matrixLLT().diagonal().array().log().sum();
+
+        return - shape_val * t_val - scale_val * std::exp(-t_val) - log_det_val / 2 + double(prec_ws.post_vec.squaredNorm()) / 2;
+    };
+
+    // the conditional of log(sigma) has a standard deviation of about 1 / sqrt(shape)
+
+    const double t_val = slice_sample(log_dens, std::log(double(sigma_draw)), 2 / std::sqrt(shape_val), rng, RNG_STREAM_SIGMA_SLICE);
+
+    sigma_draw = static_cast<fp_t>( std::exp(t_val) );
+
+    stats_add_time(stats, &sampler_stats_t::sigma_draw_seconds, sigma_time);
+}
+
+/*
+ * Sigma given xi = nu / sigma (after the usual draw of sigma given nu). With r = Y - X beta, the
+ * log density of s = 1 / sigma is
+ *
+ *   (a + n - 1) log(s) - b s - (A s^2 - 2 B s) / (2 omega^2),   A = sum(r^2 / xi), B = theta sum(r),
+ *
+ * which is log-concave. sum(r) = sum(Y) - (X' 1)' beta, and sum(r^2 / nu) comes from the sums of
+ * the data pass. Returns the factor by which nu is rescaled; gram_mat, gram_vec, and sum_nu are
+ * updated to the rescaled nu, but nu_draw itself is left for the caller.
+ */
+
+inline
+fp_t
+qr_interweave_sigma(
+    const size_t n,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const fp_t sum_Y,
+    const ColVec_t& X_col_sums,
+    const ColVec_t& beta_draw,
+    const fp_t sum_err_val,
+    const counter_rng_t& rng,
+    Mat_t& gram_mat,
+    ColVec_t& gram_vec,
+    fp_t& sum_nu,
+    fp_t& sigma_draw,
+    sampler_stats_t* stats = nullptr
+)
+{
+    const stats_time_t sigma_time = stats_now();
+
+    const double sigma_val = sigma_draw;
+    const double theta_val = theta_par;
+    const double omega_sq_val = omega_sq_par;
+
+    const double sum_resid_val = double(sum_Y) - double(X_col_sums.dot(beta_draw));
+    const double sum_resid_sq_w_val = omega_sq_val * sum_err_val + 2 * theta_val * sum_resid_val - theta_val * theta_val * sum_nu; // sum(r^2 / nu)
+
+    const double quad_val = sigma_val * std::max(sum_resid_sq_w_val, 0.0) / omega_sq_val; // A / omega^2
+    const double lin_val = theta_val * sum_resid_val / omega_sq_val - double(prior_sigma_scale); // B / omega^2 - b
+    const double power_val = double(prior_sigma_shape) + double(n) - 1;
+
+    auto log_dens = [&](const double s_val) -> double {
+        if (s_val <= 0) {
+            return - std::numeric_limits<double>::infinity();
+        }
+
+        return power_val * std::log(s_val) - quad_val * s_val * s_val / 2 + lin_val * s_val;
+    };
+
+    // width from the curvature at the current value
+
+    const double s_initial = 1 / sigma_val;
+    const double width_val = 2 / std::sqrt( power_val / (s_initial * s_initial) + quad_val );
+
+    const double s_val = slice_sample(log_dens, s_initial, width_val, rng, RNG_STREAM_SIGMA_SLICE);
+
+    sigma_draw = static_cast<fp_t>(1 / s_val);
+
+    // nu = sigma xi: N^{-1} scales by 1 / nu_scale, and X' N^{-1} theta nu = theta X' 1 is unchanged
+
+    const fp_t nu_scale = static_cast<fp_t>( (1 / s_val) / sigma_val );
+
+    gram_mat /= nu_scale;
+    gram_vec = (gram_vec + theta_par * X_col_sums) / nu_scale - theta_par * X_col_sums;
+    sum_nu *= nu_scale;
+
+    stats_add_time(stats, &sampler_stats_t::sigma_draw_seconds, sigma_time);
+
+    return nu_scale;
+}
+
+// sum(Y) and X' 1, for the interweaved scheme
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+qr_sum_cols(
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    fp_t& sum_Y,
+    ColVec_t& X_col_sums
+)
+{
+    const size_t n = Y.size();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    Mat_t X_block_ws;
+
+    sum_Y = 0;
+    X_col_sums.setZero(X.cols());
+
+    for (size_t block_ind = 0; block_ind < n_blocks; ++block_ind) {
+        const size_t row_start = block_ind * BQREG_ROW_BLOCK_SIZE;
+        const size_t n_rows = std::min(size_t(BQREG_ROW_BLOCK_SIZE), n - row_start);
+
+        sum_Y += Y.segment(row_start, n_rows).template cast<fp_t>().sum();
+        X_col_sums.noalias() += get_row_block(X, row_start, n_rows, X_block_ws).colwise().sum().transpose();
+    }
+}
+
+#endif
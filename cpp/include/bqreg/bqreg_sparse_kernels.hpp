@@ -0,0 +1,530 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Data pass kernels for a sparse (CSR) design matrix
+ *
+ * Residuals are sparse row dot products and each row adds w_i x_i x_i' to the Gram
+ * statistics through its nonzeros only, so a pass costs O(sum_i nnz_i^2) rather than
+ * O(n K^2). Two forms of the Gram statistics are provided:
+ *
+ *  - dense K x K (the kernels in this file), used when X'X is well filled in or K is small;
+ *  - sparse lower-triangular CSC, used with a sparse Cholesky factorization of the posterior
+ *    precision (see bqreg_sparse_sampler.hpp).
+ *
+ * The reductions use the same fixed reduction slots as the dense kernels.
+ */
+
+#ifndef _bqreg_sparse_kernels_HPP
+#define _bqreg_sparse_kernels_HPP
+
+// r_i = y_i - x_i' beta
+
+inline
+fp_t
+sp_row_resid(const SpMat_t& X, const size_t row_ind, const fp_t y_val, const ColVec_t& beta_draw)
+{
+    fp_t resid_val = y_val;
+
+    for (SpMat_t::InnerIterator it(X, row_ind); it; ++it) {
+        resid_val -= it.value() * beta_draw(it.col());
+    }
+
+    return resid_val;
+}
+
+// lower triangle of w x_i x_i', and w x_i y_tilde; the column indices of a row are sorted
+
+inline
+void
+sp_row_gram_update(const SpMat_t& X, const size_t row_ind, const fp_t w_val, const fp_t y_tilde_val, Mat_t& gram_mat, ColVec_t& gram_vec)
+{
+    for (SpMat_t::InnerIterator it_a(X, row_ind); it_a; ++it_a) {
+        const fp_t wx_val = w_val * it_a.value();
+
+        gram_vec(it_a.col()) += wx_val * y_tilde_val;
+
+        for (SpMat_t::InnerIterator it_b(X, row_ind); it_b && it_b.col() <= it_a.col(); ++it_b) {
+            gram_mat(it_a.col(), it_b.col()) += wx_val * it_b.value();
+        }
+    }
+}
+
+template<typename DataVec_t>
+inline
+fp_t
+qr_sum_sq_resid(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const ColVec_t& beta_draw
+)
+{
+    const size_t n = Y.size();
+
+    fp_t sum_sq_val = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        const fp_t resid_val = sp_row_resid(X, i, Y(i), beta_draw);
+        sum_sq_val += resid_val * resid_val;
+    }
+
+    return sum_sq_val;
+}
+
+template<typename DataVec_t>
+inline
+void
+qr_gram_pass(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const ColVec_t& nu_draw,
+    const fp_t theta_par,
+    const int omp_n_threads,
+    Mat_t& gram_mat,
+    ColVec_t& gram_vec
+)
+{
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    reduction_slots_t slots_ws;
+    set_reduction_slots(slots_ws, n_blocks, K, 1);
+
+    const size_t n_slots = slots_ws.n_slots;
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel for num_threads(omp_n_threads) schedule(dynamic)
+#endif
+    for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+        size_t block_begin, block_end;
+        get_slot_block_range(slot_ind, n_slots, n_blocks, block_begin, block_end);
+
+        const size_t row_begin = block_begin * BQREG_ROW_BLOCK_SIZE;
+        const size_t row_end = std::min(block_end * BQREG_ROW_BLOCK_SIZE, n);
+
+        for (size_t i = row_begin; i < row_end; ++i) {
+            const fp_t w_val = fp_t(1) / nu_draw(i);
+            sp_row_gram_update(X, i, w_val, Y(i) - theta_par * nu_draw(i), slots_ws.gram_mats[slot_ind], slots_ws.gram_vecs[slot_ind]);
+        }
+    }
+
+    fp_t sum_nu_unused, sum_err_unused;
+    combine_reduction_slots(slots_ws, 0, gram_mat, gram_vec, sum_nu_unused, sum_err_unused);
+
+    qr_gram_symmetrize(gram_mat);
+}
+
+// the sparse form of qr_data_pass_team: called by every thread of the team
+
+template<typename DataVec_t>
+inline
+void
+qr_data_pass_team(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const ColVec_t& beta_draw,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const fp_t sigma_draw,
+    const counter_rng_t& rng,
+    reduction_slots_t& slots_ws,
+    data_pass_ws_t& pass_ws,
+    ColVec_t& nu_draw,
+    sampler_stats_t* stats = nullptr,
+    const outer_prod_cache_t* outer_cache = nullptr, // unused: the sampler builds no cache for sparse rows
+    const int pass_variant = DATA_PASS_GENERAL // unused: the sparse pass has a single kernel
+)
+{
+    (void)(outer_cache); (void)(pass_variant);
+
+    const size_t n = Y.size();
+    const size_t n_blocks = get_n_row_blocks(n);
+    const size_t n_slots = slots_ws.n_slots;
+
+    const fp_t gamma_par = std::sqrt( (2 / sigma_draw) + (theta_par * theta_par) / (sigma_draw * omega_sq_par) );
+    const fp_t tmp_scale_val = std::sqrt( sigma_draw * omega_sq_par );
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp for schedule(dynamic)
+#endif
+    for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+        size_t block_begin, block_end;
+        get_slot_block_range(slot_ind, n_slots, n_blocks, block_begin, block_end);
+
+        const size_t row_begin = block_begin * BQREG_ROW_BLOCK_SIZE;
+        const size_t row_end = std::min(block_end * BQREG_ROW_BLOCK_SIZE, n);
+
+        slots_ws.gram_mats[slot_ind].setZero();
+        slots_ws.gram_vecs[slot_ind].setZero();
+
+        fp_t sum_nu_val = 0;
+        fp_t sum_err_sq_val = 0;
+
+        // the nu draws and the Gram updates are interleaved by row; the time is counted under the nu draws
+
+        const stats_time_t nu_time = stats_now();
+
+        for (size_t i = row_begin; i < row_end; ++i) {
+            const fp_t err_val = sp_row_resid(X, i, Y(i), beta_draw);
+            const fp_t delta_par = std::abs(err_val) / tmp_scale_val;
+            const fp_t nu_val = counter_rnu(gamma_par, delta_par, rng.block(RNG_STREAM_NU, i));
+
+            nu_draw(i) = nu_val;
+
+            const fp_t sigma_err_val = err_val - theta_par * nu_val;
+
+            sum_nu_val += nu_val;
+            sum_err_sq_val += (sigma_err_val * sigma_err_val) / (omega_sq_par * nu_val);
+
+            sp_row_gram_update(X, i, fp_t(1) / nu_val, Y(i) - theta_par * nu_val, slots_ws.gram_mats[slot_ind], slots_ws.gram_vecs[slot_ind]);
+        }
+
+        pass_ws.thread_stats.nu_draw_seconds += stats_seconds_since(nu_time);
+
+        slots_ws.sum_nu_vals(slot_ind) = sum_nu_val;
+        slots_ws.sum_err_vals(slot_ind) = sum_err_sq_val;
+    }
+
+    const stats_time_t reduce_time = stats_now();
+
+    tree_reduce_slots(slots_ws);
+
+    if (is_team_master()) {
+        stats_add_time(stats, &sampler_stats_t::reduce_seconds, reduce_time);
+    }
+}
+
+template<typename DataVec_t>
+inline
+void
+qr_data_pass(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const ColVec_t& beta_draw,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const fp_t sigma_draw,
+    const int omp_n_threads,
+    const counter_rng_t& rng,
+    reduction_slots_t& slots_ws,
+    ColVec_t& nu_draw,
+    Mat_t& gram_mat,
+    ColVec_t& gram_vec,
+    fp_t& sum_nu,
+    fp_t& sum_err_val,
+    sampler_stats_t* stats = nullptr
+)
+{
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    set_reduction_slots(slots_ws, get_n_row_blocks(Y.size()), X.cols(), 1, stats);
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel num_threads(omp_n_threads)
+#endif
+    {
+        data_pass_ws_t pass_ws;
+
+        qr_data_pass_team(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, rng, slots_ws, pass_ws, nu_draw, stats);
+
+        stats_merge_thread(stats, pass_ws);
+    }
+
+    get_data_pass_sums(slots_ws, gram_mat, gram_vec, sum_nu, sum_err_val);
+}
+
+/*
+ * Sparse Gram statistics
+ *
+ * The pattern of the lower triangle of X'X is fixed, so it is found once, at setup. Each
+ * reduction slot keeps a value array aligned with that pattern, and each row adds the lower
+ * triangle of w x_i x_i' in place, locating entry (a, b) in column b of the pattern by
+ * binary search. No sparse matrix is built during a pass.
+ */
+
+struct sparse_reduction_slots_t
+{
+    size_t n_slots = 0;
+
+    SpMatCSC_t gram_pattern; // lower triangle of X'X; only its pattern is used
+
+    std::vector<ColVec_t> gram_vals; // one value array per slot, aligned with gram_pattern
+    std::vector<ColVec_t> gram_vecs;
+    ColVec_t sum_nu_vals;
+    ColVec_t sum_err_vals;
+};
+
+// the lower triangle of |X|'|X|, which has the structural pattern of X'X, with no entries lost to cancellation
+
+inline
+SpMatCSC_t
+sparse_gram_pattern(const SpMat_t& X)
+{
+    const SpMatCSC_t X_abs_csc = SpMatCSC_t(X).cwiseAbs();
+
+    SpMatCSC_t gram_pattern = SpMatCSC_t( SpMatCSC_t(X_abs_csc.transpose()) * X_abs_csc ).template triangularView<Eigen::Lower>();
+    gram_pattern.makeCompressed();
+
+    return gram_pattern;
+}
+
+// the pattern is formed here unless gram_pattern was already set to that of X (see use_sparse_precision)
+
+inline
+void
+set_sparse_reduction_slots(sparse_reduction_slots_t& slots_ws, const SpMat_t& X, sampler_stats_t* stats = nullptr)
+{
+    const size_t n = X.rows();
+    const size_t K = X.cols();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    if (slots_ws.n_slots > 0) {
+        return;
+    }
+
+    const size_t n_slots = std::max(size_t(1), std::min(n_blocks, size_t(BQREG_REDUCTION_SLOTS)));
+
+    slots_ws.n_slots = n_slots;
+
+    if (size_t(slots_ws.gram_pattern.cols()) != K || !slots_ws.gram_pattern.isCompressed()) {
+        slots_ws.gram_pattern = sparse_gram_pattern(X);
+    }
+
+    const size_t n_gram_vals = slots_ws.gram_pattern.nonZeros();
+
+    slots_ws.gram_vals.resize(n_slots);
+    slots_ws.gram_vecs.resize(n_slots);
+
+    for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+        slots_ws.gram_vals[slot_ind].setZero(n_gram_vals);
+        slots_ws.gram_vecs[slot_ind].setZero(K);
+    }
+
+    slots_ws.sum_nu_vals.setZero(n_slots);
+    slots_ws.sum_err_vals.setZero(n_slots);
+
+    // the pattern (values, inner indices, and outer indices), the slot arrays, and the sums
+
+    stats_add_allocs(stats, 3 + 2 * n_slots + 2, n_gram_vals * (sizeof(fp_t) + sizeof(SpMatCSC_t::StorageIndex)) + (K + 1) * sizeof(SpMatCSC_t::StorageIndex)
+                                                  + n_slots * (n_gram_vals + K + 2) * sizeof(fp_t));
+}
+
+// add the lower triangle of w x_i x_i' to the values of a slot, and w x_i y_tilde to its gram_vec
+
+inline
+void
+sp_slot_gram_add_row(const SpMat_t& X, const size_t row_ind, const fp_t w_val, const fp_t y_tilde_val, const SpMatCSC_t& gram_pattern, ColVec_t& gram_vals, ColVec_t& gram_vec)
+{
+    const SpMatCSC_t::StorageIndex* outer_ptr = gram_pattern.outerIndexPtr();
+    const SpMatCSC_t::StorageIndex* inner_ptr = gram_pattern.innerIndexPtr();
+
+    for (SpMat_t::InnerIterator it_b(X, row_ind); it_b; ++it_b) {
+        const fp_t wx_val = w_val * it_b.value();
+
+        gram_vec(it_b.col()) += wx_val * y_tilde_val;
+
+        // the column indices of a row are sorted, so the search in column b resumes where it left off
+
+        const SpMatCSC_t::StorageIndex* col_end = inner_ptr + outer_ptr[it_b.col() + 1];
+        const SpMatCSC_t::StorageIndex* pos_ptr = inner_ptr + outer_ptr[it_b.col()];
+
+        for (SpMat_t::InnerIterator it_a = it_b; it_a; ++it_a) {
+            pos_ptr = std::lower_bound(pos_ptr, col_end, static_cast<SpMatCSC_t::StorageIndex>(it_a.col()));
+            gram_vals(pos_ptr - inner_ptr) += wx_val * it_a.value();
+        }
+    }
+}
+
+inline
+void
+combine_sparse_reduction_slots(
+    const sparse_reduction_slots_t& slots_ws,
+    SpMatCSC_t& gram_mat,
+    ColVec_t& gram_vec,
+    fp_t& sum_nu,
+    fp_t& sum_err_val
+)
+{
+    const SpMatCSC_t& gram_pattern = slots_ws.gram_pattern;
+    const Eigen::Index n_gram_vals = gram_pattern.nonZeros();
+
+    // the structure of gram_mat is set on the first pass (or if it came from elsewhere, e.g., a checkpoint); later passes only write values
+
+    const bool same_pattern = gram_mat.isCompressed() && gram_mat.rows() == gram_pattern.rows() && gram_mat.cols() == gram_pattern.cols()
+                              && gram_mat.nonZeros() == n_gram_vals
+                              && std::equal(gram_pattern.outerIndexPtr(), gram_pattern.outerIndexPtr() + gram_pattern.cols() + 1, gram_mat.outerIndexPtr())
+                              && std::equal(gram_pattern.innerIndexPtr(), gram_pattern.innerIndexPtr() + n_gram_vals, gram_mat.innerIndexPtr());
+
+    if (!same_pattern) {
+        gram_mat = gram_pattern;
+    }
+
+    Eigen::Map<ColVec_t> gram_mat_vals(gram_mat.valuePtr(), n_gram_vals);
+
+    gram_mat_vals = slots_ws.gram_vals[0];
+    gram_vec = slots_ws.gram_vecs[0];
+    sum_nu = slots_ws.sum_nu_vals(0);
+    sum_err_val = slots_ws.sum_err_vals(0);
+
+    for (size_t slot_ind = 1; slot_ind < slots_ws.n_slots; ++slot_ind) {
+        gram_mat_vals += slots_ws.gram_vals[slot_ind];
+        gram_vec += slots_ws.gram_vecs[slot_ind];
+        sum_nu += slots_ws.sum_nu_vals(slot_ind);
+        sum_err_val += slots_ws.sum_err_vals(slot_ind);
+    }
+}
+
+template<typename DataVec_t>
+inline
+void
+qr_gram_pass(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const ColVec_t& nu_draw,
+    const fp_t theta_par,
+    const int omp_n_threads,
+    sparse_reduction_slots_t& slots_ws,
+    SpMatCSC_t& gram_mat,
+    ColVec_t& gram_vec
+)
+{
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    const size_t n = Y.size();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    set_sparse_reduction_slots(slots_ws, X);
+
+    const size_t n_slots = slots_ws.n_slots;
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel for num_threads(omp_n_threads) schedule(dynamic)
+#endif
+    for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+        size_t block_begin, block_end;
+        get_slot_block_range(slot_ind, n_slots, n_blocks, block_begin, block_end);
+
+        const size_t row_begin = block_begin * BQREG_ROW_BLOCK_SIZE;
+        const size_t row_end = std::min(block_end * BQREG_ROW_BLOCK_SIZE, n);
+
+        slots_ws.gram_vals[slot_ind].setZero();
+        slots_ws.gram_vecs[slot_ind].setZero();
+
+        for (size_t i = row_begin; i < row_end; ++i) {
+            sp_slot_gram_add_row(X, i, fp_t(1) / nu_draw(i), Y(i) - theta_par * nu_draw(i), slots_ws.gram_pattern, slots_ws.gram_vals[slot_ind], slots_ws.gram_vecs[slot_ind]);
+        }
+
+        slots_ws.sum_nu_vals(slot_ind) = 0;
+        slots_ws.sum_err_vals(slot_ind) = 0;
+    }
+
+    fp_t sum_nu_unused, sum_err_unused;
+    combine_sparse_reduction_slots(slots_ws, gram_mat, gram_vec, sum_nu_unused, sum_err_unused);
+}
+
+template<typename DataVec_t>
+inline
+void
+qr_data_pass(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const ColVec_t& beta_draw,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const fp_t sigma_draw,
+    const int omp_n_threads,
+    const counter_rng_t& rng,
+    sparse_reduction_slots_t& slots_ws,
+    ColVec_t& nu_draw,
+    SpMatCSC_t& gram_mat,
+    ColVec_t& gram_vec,
+    fp_t& sum_nu,
+    fp_t& sum_err_val,
+    sampler_stats_t* stats = nullptr
+)
+{
+    (void)(omp_n_threads); // for !BQREG_USE_OPENMP case
+
+    const size_t n = Y.size();
+    const size_t n_blocks = get_n_row_blocks(n);
+
+    const fp_t gamma_par = std::sqrt( (2 / sigma_draw) + (theta_par * theta_par) / (sigma_draw * omega_sq_par) );
+    const fp_t tmp_scale_val = std::sqrt( sigma_draw * omega_sq_par );
+
+    set_sparse_reduction_slots(slots_ws, X, stats);
+
+    const size_t n_slots = slots_ws.n_slots;
+
+#ifdef BQREG_USE_OPENMP
+    #pragma omp parallel for num_threads(omp_n_threads) schedule(dynamic)
+#endif
+    for (size_t slot_ind = 0; slot_ind < n_slots; ++slot_ind) {
+        size_t block_begin, block_end;
+        get_slot_block_range(slot_ind, n_slots, n_blocks, block_begin, block_end);
+
+        const size_t row_begin = block_begin * BQREG_ROW_BLOCK_SIZE;
+        const size_t row_end = std::min(block_end * BQREG_ROW_BLOCK_SIZE, n);
+
+        slots_ws.gram_vals[slot_ind].setZero();
+        slots_ws.gram_vecs[slot_ind].setZero();
+
+        fp_t sum_nu_val = 0;
+        fp_t sum_err_sq_val = 0;
+
+        // the nu draws and the Gram updates are interleaved by row; the time is counted under the nu draws
+
+        const stats_time_t nu_time = stats_now();
+
+        for (size_t i = row_begin; i < row_end; ++i) {
+            const fp_t err_val = sp_row_resid(X, i, Y(i), beta_draw);
+            const fp_t delta_par = std::abs(err_val) / tmp_scale_val;
+            const fp_t nu_val = counter_rnu(gamma_par, delta_par, rng.block(RNG_STREAM_NU, i));
+
+            nu_draw(i) = nu_val;
+
+            const fp_t sigma_err_val = err_val - theta_par * nu_val;
+
+            sum_nu_val += nu_val;
+            sum_err_sq_val += (sigma_err_val * sigma_err_val) / (omega_sq_par * nu_val);
+
+            sp_slot_gram_add_row(X, i, fp_t(1) / nu_val, Y(i) - theta_par * nu_val, slots_ws.gram_pattern, slots_ws.gram_vals[slot_ind], slots_ws.gram_vecs[slot_ind]);
+        }
+
+        thread_stats_t thread_stats;
+
+        thread_stats.nu_draw_seconds = stats_seconds_since(nu_time);
+
+        stats_merge_thread(stats, thread_stats);
+
+        slots_ws.sum_nu_vals(slot_ind) = sum_nu_val;
+        slots_ws.sum_err_vals(slot_ind) = sum_err_sq_val;
+    }
+
+    const stats_time_t reduce_time = stats_now();
+
+    combine_sparse_reduction_slots(slots_ws, gram_mat, gram_vec, sum_nu, sum_err_val);
+
+    stats_add_time(stats, &sampler_stats_t::reduce_seconds, reduce_time);
+}
+
+#endif
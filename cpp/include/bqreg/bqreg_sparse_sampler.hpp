@@ -0,0 +1,387 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Gibbs sampler for a sparse design matrix
+ *
+ * When X'X (together with the prior precision) is sparse enough, the posterior precision
+ * of beta is kept in sparse form and factorized with a sparse Cholesky decomposition;
+ * otherwise the dense sampler is used with the sparse data pass kernels.
+ */
+
+#ifndef _bqreg_sparse_sampler_HPP
+#define _bqreg_sparse_sampler_HPP
+
+// the sparse posterior precision is used only for K at least this large...
+
+#ifndef BQREG_SPARSE_PREC_MIN_K
+    #define BQREG_SPARSE_PREC_MIN_K 100
+#endif
+
+// ... and when at most this fraction of the lower triangle is nonzero
+
+#ifndef BQREG_SPARSE_PREC_MAX_FILL
+    #define BQREG_SPARSE_PREC_MAX_FILL 0.1
+#endif
+
+// gram_pattern, if given, receives the pattern of X'X formed for the decision (see sparse_gram_pattern),
+// so that the sampler does not form it again; it is left empty if K is too small
+
+inline
+bool
+use_sparse_precision(const SpMat_t& X, const SpMatCSC_t& prior_beta_prec_lower, SpMatCSC_t* gram_pattern = nullptr)
+{
+    const size_t K = X.cols();
+
+    if (K < size_t(BQREG_SPARSE_PREC_MIN_K)) {
+        return false;
+    }
+
+    SpMatCSC_t XtX_lower = sparse_gram_pattern(X);
+    const SpMatCSC_t post_prec_pattern = XtX_lower + prior_beta_prec_lower;
+
+    if (gram_pattern) {
+        *gram_pattern = std::move(XtX_lower);
+    }
+
+    const double fill_val = double(post_prec_pattern.nonZeros()) / ( double(K) * double(K + 1) / 2 );
+
+    return fill_val <= BQREG_SPARSE_PREC_MAX_FILL;
+}
+
+template<typename DataVec_t>
+inline
+void
+qr_gibbs_iteration(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const ColVec_t& prior_beta_mu, //  prior_beta_var_inv * prior_beta_mean
+    const SpMatCSC_t& prior_beta_prec_lower,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const fp_t theta_par,
+    const fp_t omega_sq_par,
+    const bool keep_sigma_fixed, // keep sigma^2 value fixed for sampling
+    const int omp_n_threads,
+    SpMatCSC_t& gram_mat,   // lower triangle of X' N^{-1} X
+    ColVec_t& gram_vec,
+    ColVec_t& beta_draw,
+    ColVec_t& nu_draw,
+    fp_t& sigma_draw,
+    const counter_rng_t& rng, // iter_ind set by the caller
+    sparse_reduction_slots_t& slots_ws,
+    Eigen::SimplicialLLT<SpMatCSC_t, Eigen::Lower>& llt_obj,
+    Eigen::Index& llt_pattern_nnz,
+    sampler_stats_t* stats = nullptr
+)
+{
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    // draw beta
+
+    const stats_time_t beta_time = stats_now();
+
+    const fp_t gram_scale_val = fp_t(1) / ( omega_sq_par * sigma_draw );
+
+    const SpMatCSC_t post_beta_prec = gram_scale_val * gram_mat + prior_beta_prec_lower;
+    const ColVec_t post_beta_vec = gram_scale_val * gram_vec + prior_beta_mu;
+
+    draw_mvnorm_prec(post_beta_prec, post_beta_vec, rng.rnorm_vec(RNG_STREAM_BETA, K), llt_obj, llt_pattern_nnz, beta_draw);
+
+    stats_add_time(stats, &sampler_stats_t::beta_draw_seconds, beta_time);
+
+    // draw nu, with the sigma and Gram statistics from the same pass
+
+    const stats_time_t data_pass_time = stats_now();
+
+    fp_t sum_nu = 0;
+    fp_t sum_err_val = 0;
+
+    qr_data_pass(Y, X, beta_draw, theta_par, omega_sq_par, sigma_draw, omp_n_threads, rng, slots_ws, nu_draw, gram_mat, gram_vec, sum_nu, sum_err_val, stats);
+
+    stats_add_time(stats, &sampler_stats_t::data_pass_seconds, data_pass_time);
+
+    // draw sigma
+
+    const stats_time_t sigma_time = stats_now();
+
+    if (!keep_sigma_fixed) {
+        const fp_t post_sigma_shape_par = prior_sigma_shape + (3 * n / fp_t(2));
+        const fp_t post_sigma_scale_par = (2 * prior_sigma_scale + 2 * sum_nu + sum_err_val ) / 2;
+
+        sigma_draw = fp_t(1) / rng.rgamma(RNG_STREAM_SIGMA, post_sigma_shape_par, 1 / post_sigma_scale_par);
+    }
+
+    stats_add_time(stats, &sampler_stats_t::sigma_draw_seconds, sigma_time);
+}
+
+template<typename DataVec_t>
+inline
+void
+qr_gibbs_sparse_prec(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const fp_t tau,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mu,
+    const SpMatCSC_t& prior_beta_prec_lower,
+    SpMatCSC_t gram_pattern, // from use_sparse_precision
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    const int omp_n_threads,
+    draw_sink_t& draw_sink,
+    counter_rng_t& rng,
+    sampler_stats_t* stats = nullptr,
+    sampler_checkpoint_t* checkpoint = nullptr,
+    const int setup_n_threads = 0
+)
+{
+    const int setup_omp_n_threads = (setup_n_threads > 0) ? setup_n_threads : omp_n_threads;
+
+    const size_t n_total_draws = n_burnin_draws + (thinning_factor + 1) * n_keep_draws;
+
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    const fp_t theta_par = (1 - 2 * tau) / (tau * (1 - tau));
+    const fp_t omega_sq_par = 2 / (tau * (1 - tau));
+
+    const bool resume = (checkpoint && checkpoint->resume);
+    const bool warm_start = (checkpoint && checkpoint->warm_start);
+
+    if (checkpoint) {
+        checkpoint->begin_run(rng, n, K, tau, n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed);
+    }
+
+    const stats_time_t setup_time = stats_now();
+
+    // a resumed run pushes only the draws after the checkpoint, indexed from zero
+
+    const size_t mcmc_start_ind = resume ? checkpoint->state.n_iterations : 0;
+    const size_t save_start_ind = resume ? checkpoint->state.n_saved : 0;
+
+    draw_sink.begin(n, K, n_keep_draws - save_start_ind);
+
+    ColVec_t z_draw;
+
+    // set initial values for the draws
+
+    ColVec_t beta_draw, nu_draw;
+    fp_t sigma_draw;
+
+    sparse_reduction_slots_t slots_ws;
+    slots_ws.gram_pattern = std::move(gram_pattern);
+
+    SpMatCSC_t gram_mat;
+    ColVec_t gram_vec;
+
+    if (resume || warm_start) {
+        beta_draw = checkpoint->state.beta_draw;
+        nu_draw = checkpoint->state.nu_draw;
+        sigma_draw = checkpoint->state.sigma_draw;
+
+        if (!get_state_gram(checkpoint->state, gram_mat, gram_vec)) {
+            qr_gram_pass(Y, X, nu_draw, theta_par, setup_omp_n_threads, slots_ws, gram_mat, gram_vec);
+        }
+    } else {
+        beta_draw = beta_initial_draw;
+
+        sigma_draw = qr_sum_sq_resid(Y, X, beta_draw) / fp_t(n);
+
+        nu_draw = ColVec_t::Constant(n, sigma_draw);
+
+        if (keep_sigma_fixed) {
+            sigma_draw = fp_t(1);
+        }
+
+        qr_gram_pass(Y, X, nu_draw, theta_par, setup_omp_n_threads, slots_ws, gram_mat, gram_vec);
+    }
+
+    Eigen::SimplicialLLT<SpMatCSC_t, Eigen::Lower> llt_obj;
+    Eigen::Index llt_pattern_nnz = 0;
+
+    stats_add_time(stats, &sampler_stats_t::setup_seconds, setup_time);
+
+    // main loop
+
+    size_t mcmc_save_ind = save_start_ind;
+
+    for (size_t mcmc_ind = mcmc_start_ind; mcmc_ind < n_total_draws; ++mcmc_ind) {
+        rng.iter_ind = static_cast<uint32_t>(mcmc_ind);
+
+        qr_gibbs_iteration(Y, X, prior_beta_mu, prior_beta_prec_lower, prior_sigma_shape, prior_sigma_scale,
+                           theta_par, omega_sq_par, keep_sigma_fixed, omp_n_threads,
+                           gram_mat, gram_vec, beta_draw, nu_draw, sigma_draw, rng, slots_ws, llt_obj, llt_pattern_nnz, stats);
+
+        if (mcmc_ind >= n_burnin_draws && (mcmc_ind - n_burnin_draws) % (thinning_factor + 1) == 0 ) {
+            const stats_time_t store_time = stats_now();
+
+            if (draw_sink.wants_z()) {
+                z_draw.noalias() = nu_draw / sigma_draw;
+            }
+
+            draw_sink.push(mcmc_save_ind - save_start_ind, beta_draw, z_draw, sigma_draw);
+
+            ++mcmc_save_ind;
+
+            stats_add_time(stats, &sampler_stats_t::store_seconds, store_time);
+        }
+
+        const bool stop_flag = draw_sink.stop_requested();
+
+        if (checkpoint) {
+            checkpoint->update(mcmc_ind + 1, mcmc_save_ind, beta_draw, nu_draw, sigma_draw, gram_mat, gram_vec, stop_flag || mcmc_ind + 1 == n_total_draws);
+        }
+
+        if (stop_flag) {
+            if (stats) {
+                stats->n_iterations = mcmc_ind + 1 - mcmc_start_ind;
+            }
+
+            break;
+        }
+    }
+
+    draw_sink.end();
+}
+
+/*
+ * Entry point for a sparse X: choose between the sparse and dense posterior precision. The
+ * sparse posterior precision path implements only the standard scheme; other schemes are
+ * rejected there.
+ */
+
+template<typename DataVec_t>
+inline
+void
+qr_gibbs(
+    const DataVec_t& Y,
+    const SpMat_t& X,
+    const fp_t tau,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    int omp_n_threads,
+    draw_sink_t& draw_sink,
+    counter_rng_t& rng,
+    sampler_stats_t* stats = nullptr,
+    sampler_checkpoint_t* checkpoint = nullptr,
+    const int setup_n_threads = 0,
+    const sampler_scheme_t sampler_scheme = SAMPLER_SCHEME_STANDARD, // only the standard scheme on the sparse posterior precision path
+    const size_t outer_cache_max_bytes = 0 // unused: sparse rows are not cached
+)
+{
+    (void)(outer_cache_max_bytes);
+
+    const stats_time_t total_time = stats_now();
+
+    const Mat_t prior_beta_var_inv = inv_sympd(prior_beta_var);
+    const SpMatCSC_t prior_beta_prec_lower = Mat_t(prior_beta_var_inv.template triangularView<Eigen::Lower>()).sparseView();
+
+    SpMatCSC_t gram_pattern;
+
+    if (!use_sparse_precision(X, prior_beta_prec_lower, &gram_pattern)) {
+        // the general sampler, which picks up the sparse data pass kernels (without the outer-product cache)
+
+        qr_gibbs<DataVec_t, SpMat_t>(Y, X, tau, beta_initial_draw, prior_beta_mean, prior_beta_var, prior_sigma_shape, prior_sigma_scale,
+                                     n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed, omp_n_threads, draw_sink, rng, stats, checkpoint, setup_n_threads, sampler_scheme, 0);
+        return;
+    }
+
+    if (sampler_scheme != SAMPLER_SCHEME_STANDARD) {
+        throw std::invalid_argument("bqreg: the sparse posterior precision sampler supports only the standard scheme");
+    }
+
+#ifdef BQREG_USE_OPENMP
+    if (omp_n_threads < 0) {
+        omp_n_threads = std::max(1, static_cast<int>(omp_get_max_threads()) / 2);
+    }
+
+    if (omp_n_threads == 0) {
+        omp_n_threads = 1;
+    }
+#else
+    omp_n_threads = 1;
+#endif
+
+    const ColVec_t prior_beta_mu = prior_beta_var_inv * prior_beta_mean;
+
+    if (stats) {
+        const size_t n_total_draws = n_burnin_draws + (thinning_factor + 1) * n_keep_draws;
+
+        stats->reset(omp_n_threads);
+        stats->n_iterations = n_total_draws - ((checkpoint && checkpoint->resume) ? std::min(checkpoint->state.n_iterations, n_total_draws) : 0);
+    }
+
+    qr_gibbs_sparse_prec(Y, X, tau, beta_initial_draw, prior_beta_mu, prior_beta_prec_lower, std::move(gram_pattern), prior_sigma_shape, prior_sigma_scale,
+                         n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed, omp_n_threads, draw_sink, rng, stats, checkpoint, setup_n_threads);
+
+    stats_add_time(stats, &sampler_stats_t::total_seconds, total_time);
+}
+
+// a column-major (CSC) X is converted to CSR once
+
+template<typename DataVec_t>
+inline
+void
+qr_gibbs(
+    const DataVec_t& Y,
+    const SpMatCSC_t& X,
+    const fp_t tau,
+    const ColVec_t& beta_initial_draw,
+    const ColVec_t& prior_beta_mean,
+    const Mat_t& prior_beta_var,
+    const fp_t prior_sigma_shape,
+    const fp_t prior_sigma_scale,
+    const size_t n_burnin_draws,
+    const size_t n_keep_draws,
+    const size_t thinning_factor,
+    const bool keep_sigma_fixed,
+    int omp_n_threads,
+    draw_sink_t& draw_sink,
+    counter_rng_t& rng,
+    sampler_stats_t* stats = nullptr,
+    sampler_checkpoint_t* checkpoint = nullptr,
+    const int setup_n_threads = 0,
+    const sampler_scheme_t sampler_scheme = SAMPLER_SCHEME_STANDARD,
+    const size_t outer_cache_max_bytes = 0
+)
+{
+    (void)(outer_cache_max_bytes);
+
+    SpMat_t X_csr = X;
+    X_csr.makeCompressed();
+
+    qr_gibbs(Y, X_csr, tau, beta_initial_draw, prior_beta_mean, prior_beta_var, prior_sigma_shape, prior_sigma_scale,
+             n_burnin_draws, n_keep_draws, thinning_factor, keep_sigma_fixed, omp_n_threads, draw_sink, rng, stats, checkpoint, setup_n_threads, sampler_scheme);
+}
+
+#endif
@@ -0,0 +1,390 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Rolling windows of rows
+ *
+ * A model refit on a sliding window (append the newest rows, retire the oldest) can start
+ * from the state of the chain on the previous window instead of the initial values: beta and
+ * sigma carry over, as do the nu draws of the retained rows, and each appended row starts at
+ * nu = sigma, the prior mean of nu given sigma. The data-pass products X' N^{-1} X and
+ * X' N^{-1} (Y - theta nu) held in the chain state are downdated for the retired rows and
+ * updated for the appended ones, so moving the window by m rows costs O(m K^2) rather than
+ * a pass over the whole window.
+ *
+ * The rows of the window are held in the slots of the data matrices as a ring: appended rows
+ * are written into the slots freed by retired rows, so a window that slides by as many rows
+ * as it gains is never shifted or copied. The rows are therefore in slot order, not time
+ * order (the posterior does not depend on the order of the rows); see row_window_t::get_slots.
+ * When more rows are appended than there are free slots, or when free slots remain at the
+ * start of a run, the window is compacted into time order.
+ */
+
+#ifndef _bqreg_window_HPP
+#define _bqreg_window_HPP
+
+// whether the chain state belongs to data with n_slots rows and K features
+
+inline
+bool
+window_has_state(const sampler_state_t& state, const size_t n_slots, const size_t K)
+{
+    return size_t(state.beta_draw.size()) == K && size_t(state.nu_draw.size()) == n_slots && n_slots > 0;
+}
+
+/*
+ * add (sign_val = 1) or remove (sign_val = -1) the contribution of the given rows to the
+ * data-pass products of the state; the sparse form of X' N^{-1} X is not updated in place,
+ * but dropped, and rebuilt by the sampler at the start of the next run
+ */
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+window_gram_update(
+    sampler_state_t& state,
+    const DataVec_t& Y,
+    const DataMat_t& X,
+    const std::vector<size_t>& slots,
+    const fp_t sign_val
+)
+{
+    const size_t K = X.cols();
+    const size_t n_rows = slots.size();
+
+    if (size_t(state.gram_vec.size()) != K || n_rows == 0) {
+        return; // nothing to update, e.g., for the n-dimensional draw of beta
+    }
+
+    if (size_t(state.gram_mat.cols()) != K) {
+        state.gram_mat_sp.resize(0,0);
+        state.gram_vec.resize(0);
+        return;
+    }
+
+    const fp_t theta_par = (1 - 2 * state.tau) / (state.tau * (1 - state.tau));
+
+    Mat_t X_block_ws;
+    Mat_t Xw_block(n_rows, K);
+    ColVec_t wy_block(n_rows);
+
+    for (size_t j = 0; j < n_rows; ++j) {
+        const size_t i = slots[j];
+        const fp_t sqrt_w_val = fp_t(1) / std::sqrt(state.nu_draw(i));
+
+        wy_block(j) = ( Y(i) - theta_par * state.nu_draw(i) ) * sqrt_w_val;
+        Xw_block.row(j).noalias() = sqrt_w_val * get_row_block(X, i, 1, X_block_ws);
+    }
+
+    state.gram_mat.template selfadjointView<Eigen::Lower>().rankUpdate(Xw_block.transpose(), sign_val);
+    qr_gram_symmetrize(state.gram_mat);
+
+    state.gram_vec.noalias() += sign_val * (Xw_block.transpose() * wy_block);
+}
+
+//
+// write one row into a slot; only dense data can be written in place
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+bool
+window_set_row(DataVec_t& Y, DataMat_t& X, const size_t slot_ind, const DataVec_t& Y_new, const DataMat_t& X_new, const size_t row_ind)
+{
+    Y(slot_ind) = Y_new(row_ind);
+    X.row(slot_ind) = X_new.row(row_ind);
+
+    return true;
+}
+
+template<typename DataVec_t>
+inline
+bool
+window_set_row(DataVec_t& Y, SpMat_t& X, const size_t slot_ind, const DataVec_t& Y_new, const SpMat_t& X_new, const size_t row_ind)
+{
+    (void)(Y); (void)(X); (void)(slot_ind); (void)(Y_new); (void)(X_new); (void)(row_ind);
+
+    return false;
+}
+
+//
+// rebuild the data from the given slots, in order, followed by the new rows
+
+template<typename DataVec_t, typename DataMat_t>
+inline
+void
+window_rebuild(DataVec_t& Y, DataMat_t& X, const std::vector<size_t>& slots, const DataVec_t& Y_new, const DataMat_t& X_new)
+{
+    const size_t n_kept = slots.size();
+    const size_t n_new = Y_new.size();
+    const size_t K = X.cols();
+
+    DataVec_t Y_out(n_kept + n_new);
+    DataMat_t X_out(n_kept + n_new, K);
+
+    for (size_t j = 0; j < n_kept; ++j) {
+        Y_out(j) = Y(slots[j]);
+    }
+
+    for (size_t k = 0; k < K; ++k) {
+        for (size_t j = 0; j < n_kept; ++j) {
+            X_out(j, k) = X(slots[j], k);
+        }
+    }
+
+    if (n_new > 0) {
+        Y_out.tail(n_new) = Y_new;
+        X_out.bottomRows(n_new) = X_new;
+    }
+
+    Y.swap(Y_out);
+    X.swap(X_out);
+}
+
+template<typename DataVec_t>
+inline
+void
+window_rebuild(DataVec_t& Y, SpMat_t& X, const std::vector<size_t>& slots, const DataVec_t& Y_new, const SpMat_t& X_new)
+{
+    const size_t n_kept = slots.size();
+    const size_t n_new = Y_new.size();
+
+    DataVec_t Y_out(n_kept + n_new);
+    SpMat_t X_out(n_kept + n_new, X.cols());
+
+    Eigen::VectorXi row_nnz(n_kept + n_new);
+
+    for (size_t j = 0; j < n_kept; ++j) {
+        Y_out(j) = Y(slots[j]);
+        row_nnz(j) = X.outerIndexPtr()[slots[j] + 1] - X.outerIndexPtr()[slots[j]];
+    }
+
+    for (size_t j = 0; j < n_new; ++j) {
+        Y_out(n_kept + j) = Y_new(j);
+        row_nnz(n_kept + j) = X_new.outerIndexPtr()[j + 1] - X_new.outerIndexPtr()[j];
+    }
+
+    X_out.reserve(row_nnz);
+
+    for (size_t j = 0; j < n_kept; ++j) {
+        for (SpMat_t::InnerIterator it(X, slots[j]); it; ++it) {
+            X_out.insert(j, it.col()) = it.value();
+        }
+    }
+
+    for (size_t j = 0; j < n_new; ++j) {
+        for (SpMat_t::InnerIterator it(X_new, j); it; ++it) {
+            X_out.insert(n_kept + j, it.col()) = it.value();
+        }
+    }
+
+    X_out.makeCompressed();
+
+    Y.swap(Y_out);
+    X.swap(X_out);
+}
+
+/**
+ * Slot bookkeeping of a rolling window of rows
+ *
+ * The live rows occupy the slots \c head, \c head + 1, ... (mod the number of slots), oldest
+ * first; the slots of retired rows not yet refilled are the \c n_free slots just before \c head.
+ * The chain state passed to each method is kept in step with the rows: its \c nu_draw is
+ * indexed by slot, like the data. A state that does not belong to the data is cleared.
+ */
+
+class row_window_t
+{
+    public:
+        size_t head = 0;   /*!< Slot of the oldest row */
+        size_t n_free = 0; /*!< Number of retired rows whose slots have not been refilled */
+
+        /**
+         * Forget the window, e.g., when new data are loaded
+         */
+
+        void reset()
+        {
+            head = 0;
+            n_free = 0;
+        }
+
+        /**
+         * @param n_slots the number of rows of the data matrices
+         * @return the slot of each row of the window, oldest first
+         */
+
+        std::vector<size_t> get_slots(const size_t n_slots) const
+        {
+            std::vector<size_t> slots(n_slots - n_free);
+
+            for (size_t j = 0; j < slots.size(); ++j) {
+                slots[j] = (head + j) % n_slots;
+            }
+
+            return slots;
+        }
+
+        /**
+         * Retire the oldest rows
+         *
+         * @param n_retire the number of rows to retire
+         * @param Y the target variable, one entry per slot
+         * @param X the features, one row per slot
+         * @param state the chain state; the retired rows are removed from its data-pass products
+         */
+
+        template<typename DataVec_t, typename DataMat_t>
+        void retire(const size_t n_retire, const DataVec_t& Y, const DataMat_t& X, sampler_state_t& state)
+        {
+            const size_t n_slots = Y.size();
+
+            if (n_retire > n_slots - n_free) {
+                throw std::invalid_argument("bqreg: cannot retire more rows than the window holds");
+            }
+
+            if (n_retire == 0) {
+                return;
+            }
+
+            std::vector<size_t> retired_slots(n_retire);
+
+            for (size_t j = 0; j < n_retire; ++j) {
+                retired_slots[j] = (head + j) % n_slots;
+            }
+
+            if (window_has_state(state, n_slots, X.cols())) {
+                window_gram_update(state, Y, X, retired_slots, fp_t(-1));
+            } else {
+                state.nu_draw.resize(0);
+            }
+
+            head = (head + n_retire) % n_slots;
+            n_free += n_retire;
+        }
+
+        /**
+         * Append rows as the newest rows of the window
+         * @brief The rows are written into free slots; if there are too few, the window is compacted and grown
+         *
+         * @param Y the target variable, one entry per slot
+         * @param X the features, one row per slot
+         * @param Y_new the target variable of the new rows
+         * @param X_new the features of the new rows, in the storage format of \c X
+         * @param state the chain state; the new rows start at \f$ \nu = \sigma \f$ and are added to its data-pass products
+         */
+
+        template<typename DataVec_t, typename DataMat_t>
+        void append(DataVec_t& Y, DataMat_t& X, const DataVec_t& Y_new, const DataMat_t& X_new, sampler_state_t& state)
+        {
+            const size_t n_new = Y_new.size();
+
+            if (size_t(X_new.rows()) != n_new || X_new.cols() != X.cols()) {
+                throw std::invalid_argument("bqreg: the dimensions of the appended rows do not match the data");
+            }
+
+            if (n_new == 0) {
+                return;
+            }
+
+            const size_t n_slots = Y.size();
+            const bool has_state = window_has_state(state, n_slots, X.cols());
+
+            std::vector<size_t> new_slots(n_new);
+
+            bool in_place = (n_new <= n_free);
+
+            for (size_t j = 0; j < n_new && in_place; ++j) {
+                new_slots[j] = (head + n_slots - n_free + j) % n_slots;
+                in_place = window_set_row(Y, X, new_slots[j], Y_new, X_new, j);
+            }
+
+            if (in_place) {
+                n_free -= n_new;
+            } else {
+                // too few free slots (or sparse data): rebuild in time order with the new rows at the end
+
+                const std::vector<size_t> kept_slots = get_slots(n_slots);
+                const size_t n_kept = kept_slots.size();
+
+                window_rebuild(Y, X, kept_slots, Y_new, X_new);
+
+                if (has_state) {
+                    ColVec_t nu_draw(n_kept + n_new);
+
+                    for (size_t j = 0; j < n_kept; ++j) {
+                        nu_draw(j) = state.nu_draw(kept_slots[j]);
+                    }
+
+                    state.nu_draw.swap(nu_draw);
+                }
+
+                for (size_t j = 0; j < n_new; ++j) {
+                    new_slots[j] = n_kept + j;
+                }
+
+                head = 0;
+                n_free = 0;
+            }
+
+            if (has_state) {
+                for (size_t j = 0; j < n_new; ++j) {
+                    state.nu_draw(new_slots[j]) = state.sigma_draw;
+                }
+
+                window_gram_update(state, Y, X, new_slots, fp_t(1));
+            } else {
+                state.nu_draw.resize(0);
+            }
+        }
+
+        /**
+         * Drop the free slots, putting the rows in time order; called before each run of the sampler
+         */
+
+        template<typename DataVec_t, typename DataMat_t>
+        void compact(DataVec_t& Y, DataMat_t& X, sampler_state_t& state)
+        {
+            if (n_free == 0) {
+                return; // the rows may wrap around the ring; their order does not matter to the sampler
+            }
+
+            const size_t n_slots = Y.size();
+            const std::vector<size_t> kept_slots = get_slots(n_slots);
+
+            if (window_has_state(state, n_slots, X.cols())) {
+                ColVec_t nu_draw(kept_slots.size());
+
+                for (size_t j = 0; j < kept_slots.size(); ++j) {
+                    nu_draw(j) = state.nu_draw(kept_slots[j]);
+                }
+
+                state.nu_draw.swap(nu_draw);
+            } else {
+                state.nu_draw.resize(0);
+            }
+
+            window_rebuild(Y, X, kept_slots, DataVec_t(), DataMat_t(0, X.cols()));
+
+            head = 0;
+            n_free = 0;
+        }
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Adaptive burn-in and stopping rule: the run should stop well before the cap once the ESS
+ * target is met, and the kept draws should agree with a long fixed-length run
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+int main()
+{
+    rand_engine_t rand_engine(1212);
+
+    const size_t n = 2000;
+    const size_t K = 4;
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+    const ColVec_t beta_true = ColVec_t::LinSpaced(K, fp_t(-1), fp_t(1));
+    const ColVec_t Y = X * beta_true + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+    bqreg_t bqreg_obj(Y, X);
+
+    bqreg_obj.set_prior_params(ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+    bqreg_obj.set_quantile_target(fp_t(0.5));
+    bqreg_obj.set_seed_value(1313);
+
+    // 1. stop once every ESS reaches the target
+
+    adaptive_settings_t settings;
+    settings.target_ess = 300;
+    settings.max_draws = 20000;
+
+    Mat_t beta_draws, z_draws;
+    ColVec_t sigma_draws;
+
+    const adaptive_result_t result = bqreg_obj.gibbs(settings, beta_draws, z_draws, sigma_draws);
+
+    std::cout << "burn-in draws = " << result.n_burnin_draws << " (converged = " << result.burnin_converged << ")"
+              << ", kept draws = " << result.n_keep_draws << " (targets met = " << result.targets_met << ")"
+              << ", min ESS = " << result.ess.minCoeff() << ", max MCSE = " << result.mcse.maxCoeff() << std::endl;
+
+    if (!result.burnin_converged || !result.targets_met) {
+        return 1;
+    }
+
+    if (result.ess.minCoeff() < settings.target_ess || result.n_burnin_draws + result.n_keep_draws >= settings.max_draws / 2) {
+        return 1;
+    }
+
+    if (size_t(beta_draws.cols()) != result.n_keep_draws || size_t(z_draws.cols()) != result.n_keep_draws || size_t(sigma_draws.size()) != result.n_keep_draws) {
+        return 1;
+    }
+
+    // 2. the posterior means agree with a long fixed-length run, within a few Monte Carlo standard errors
+
+    Mat_t beta_draws_fixed, z_draws_fixed;
+    ColVec_t sigma_draws_fixed;
+
+    bqreg_obj.gibbs(2000, 10000, 0, beta_draws_fixed, z_draws_fixed, sigma_draws_fixed);
+
+    const ColVec_t mean_diff = beta_draws.rowwise().mean() - beta_draws_fixed.rowwise().mean();
+    const fp_t max_z_val = (mean_diff.array() / result.mcse.head(K).array()).abs().maxCoeff();
+
+    std::cout << "max |adaptive mean - fixed mean| / MCSE = " << max_z_val << std::endl;
+
+    if (!(max_z_val < fp_t(5))) {
+        return 1;
+    }
+
+    // 3. an unreachable target runs to the cap
+
+    settings.target_ess = 0;
+    settings.target_mcse = fp_t(1e-12);
+    settings.max_burnin_draws = 500;
+    settings.max_draws = 1500;
+
+    const adaptive_result_t result_cap = bqreg_obj.gibbs(settings, beta_draws, z_draws, sigma_draws, false);
+
+    std::cout << "capped run: burn-in draws = " << result_cap.n_burnin_draws << ", kept draws = " << result_cap.n_keep_draws << std::endl;
+
+    if (result_cap.targets_met || result_cap.n_burnin_draws + result_cap.n_keep_draws != settings.max_draws || z_draws.size() != 0) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Autotuning: the thread counts are chosen once per data shape and kernel and then read from the cache
+ * (in memory, and from the cache file in a new process), and do not change the draws
+ */
+
+#include <cstdio>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+int main()
+{
+    const size_t n = 4000;
+    const size_t K = 8;
+
+    const std::string cache_path = "autotune_cache.txt";
+    std::remove(cache_path.c_str());
+
+    rand_engine_t data_engine(1234);
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), data_engine);
+    const ColVec_t Y = X * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+    // reference: a fixed number of threads
+
+    Mat_t beta_draws_ref, z_draws_ref;
+    ColVec_t sigma_draws_ref;
+
+    bqreg_t obj_ref(Y, X);
+    obj_ref.set_prior_params(ColVec_t::Zero(K), fp_t(100) * Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+    obj_ref.set_quantile_target(fp_t(0.3));
+    obj_ref.set_seed_value(42);
+    obj_ref.set_omp_n_threads(1);
+    obj_ref.gibbs(50, 100, 0, beta_draws_ref, z_draws_ref, sigma_draws_ref);
+
+    // the first autotuned fit calibrates (if more than one thread is available), the second reads the cache
+
+    for (int fit_ind = 0; fit_ind < 3; ++fit_ind) {
+        if (fit_ind == 2) {
+            get_tuning_cache().clear(); // as in a new process: the choice comes from the file
+        }
+
+        Mat_t beta_draws, z_draws;
+        ColVec_t sigma_draws;
+
+        bqreg_t obj(Y, X);
+        obj.set_prior_params(ColVec_t::Zero(K), fp_t(100) * Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+        obj.set_quantile_target(fp_t(0.3));
+        obj.set_seed_value(42);
+        obj.set_omp_n_threads(4);
+        obj.set_autotune(true, cache_path);
+        obj.gibbs(50, 100, 0, beta_draws, z_draws, sigma_draws);
+
+        const sampler_tuning_t& tuning = obj.get_sampler_tuning();
+
+        std::cout << "fit " << fit_ind << ": setup threads = " << tuning.setup_n_threads << ", data pass threads = " << tuning.data_pass_n_threads
+                  << ", from cache = " << tuning.from_cache << ", calibration (s) = " << tuning.calibration_seconds << std::endl;
+
+#ifdef BQREG_USE_OPENMP
+        if (fit_ind > 0 && !tuning.from_cache) {
+            std::cout << "the tuning was not read from the cache" << std::endl;
+            return 1;
+        }
+#endif
+
+        if (tuning.data_pass_n_threads < 1 || tuning.data_pass_n_threads > 4 || tuning.setup_n_threads < 1 || tuning.setup_n_threads > 4) {
+            std::cout << "thread counts out of range" << std::endl;
+            return 1;
+        }
+
+        const bool is_equal = (beta_draws.array() == beta_draws_ref.array()).all() && (z_draws.array() == z_draws_ref.array()).all()
+                                && (sigma_draws.array() == sigma_draws_ref.array()).all();
+
+        if (!is_equal) {
+            std::cout << "autotuned draws differ from the reference" << std::endl;
+            return 1;
+        }
+    }
+
+#ifdef BQREG_USE_OPENMP
+    // the kernel is part of the key: the zero-theta, fixed-sigma data pass is calibrated on its own
+
+    const sampler_tuning_t other_tuning = tune_sampler_threads(Y, X, 4, cache_path, fp_t(0.5), true);
+
+    if (other_tuning.from_cache) {
+        std::cout << "the tuning of another data pass kernel was read from the cache" << std::endl;
+        return 1;
+    }
+#endif
+
+    std::remove(cache_path.c_str());
+
+    std::cout << "autotuned fits match the reference" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Batches of small problems: each problem gives the draws of its own chain, whatever the number
+ * of threads, and the draws land in the right part of the arena
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+int main()
+{
+    const size_t n_problems = 60;
+    const size_t n_burnin_draws = 50;
+    const size_t n_keep_draws = 100;
+    const uint64_t seed_val = 2024;
+
+    rand_engine_t data_engine(1234);
+
+    std::vector<ColVec_t> Y_vec(n_problems);
+    std::vector<Mat_t> X_vec(n_problems);
+    std::vector<batch_problem_t<ColVec_t,Mat_t>> problems(n_problems);
+
+    for (size_t p = 0; p < n_problems; ++p) {
+        const size_t n = 200 + 40 * (p % 7);
+        const size_t K = 2 + p % 5;
+
+        X_vec[p] = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), data_engine);
+        Y_vec[p] = X_vec[p] * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+        problems[p].Y = &Y_vec[p];
+        problems[p].X = &X_vec[p];
+        problems[p].tau = fp_t(0.1) + fp_t(0.8) * (p % 3) / 2;
+
+        if (p % 2 == 0) {
+            problems[p].prior_beta_var = fp_t(10) * Mat_t::Identity(K,K);
+        }
+    }
+
+    batch_result_t result_ref;
+
+    for (int n_threads : {1, 3}) {
+        batch_result_t result;
+        qr_gibbs_batch(problems, n_burnin_draws, n_keep_draws, 0, n_threads, seed_val, result);
+
+        if (n_threads == 1) {
+            result_ref = result;
+            continue;
+        }
+
+        const bool is_equal = (result.arena.array() == result_ref.arena.array()).all();
+
+        std::cout << "threads = " << n_threads << ": " << (is_equal ? "identical" : "DIFFERENT") << std::endl;
+
+        if (!is_equal) {
+            return 1;
+        }
+    }
+
+    // each problem matches a chain run on its own
+
+    for (size_t p = 0; p < n_problems; p += 7) {
+        const size_t K = X_vec[p].cols();
+
+        Mat_t beta_draws;
+        ColVec_t sigma_draws;
+        param_memory_sink_t draw_sink(beta_draws, sigma_draws);
+
+        counter_rng_t rng(seed_val, static_cast<uint32_t>(p));
+
+        const Mat_t prior_beta_var = (p % 2 == 0) ? Mat_t(fp_t(10) * Mat_t::Identity(K,K)) : Mat_t(Mat_t::Identity(K,K));
+
+        qr_gibbs(Y_vec[p], X_vec[p], problems[p].tau, ColVec_t::Zero(K), ColVec_t::Zero(K), prior_beta_var, fp_t(3), fp_t(3),
+                 n_burnin_draws, n_keep_draws, 0, false, 1, draw_sink, rng);
+
+        if (!(result_ref.beta_draws(p).array() == beta_draws.array()).all() || !(result_ref.sigma_draws(p).array() == sigma_draws.array()).all()) {
+            std::cout << "problem " << p << ": the batch draws differ from a single run" << std::endl;
+            return 1;
+        }
+    }
+
+    // a malformed problem is reported before any sampling
+
+    problems[5].prior_beta_mean = ColVec_t::Zero(1 + X_vec[5].cols());
+
+    try {
+        batch_result_t result;
+        qr_gibbs_batch(problems, n_burnin_draws, n_keep_draws, 0, 1, seed_val, result);
+
+        std::cout << "a malformed problem was not reported" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument& ex) {
+        std::cout << ex.what() << std::endl;
+    }
+
+    std::cout << "batch draws match single runs" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Beta draw benchmark: explicit inverse + Cholesky of the inverse vs a single Cholesky of the precision
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+inline
+ColVec_t
+beta_draw_inverse(const Mat_t& post_prec, const ColVec_t& post_vec, const ColVec_t& std_norm_vec)
+{
+    const Mat_t post_beta_var = post_prec.inverse();
+    const ColVec_t post_beta_mean = post_beta_var * post_vec;
+
+    return post_beta_mean + post_beta_var.llt().matrixL() * std_norm_vec;
+}
+
+inline
+ColVec_t
+beta_draw_cholesky(const Mat_t& post_prec, const ColVec_t& post_vec, const ColVec_t& std_norm_vec)
+{
+    ColVec_t beta_draw;
+    draw_mvnorm_prec(post_prec, post_vec, std_norm_vec, beta_draw);
+
+    return beta_draw;
+}
+
+template<typename DrawFn_t>
+double
+time_per_draw(DrawFn_t draw_fn, const Mat_t& post_prec, const ColVec_t& post_vec, const ColVec_t& std_norm_vec, const int n_reps, fp_t& check_val)
+{
+    auto start_time = std::chrono::steady_clock::now();
+
+    for (int rep_ind = 0; rep_ind < n_reps; ++rep_ind) {
+        check_val += draw_fn(post_prec, post_vec, std_norm_vec)(0);
+    }
+
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    return elapsed.count() / n_reps;
+}
+
+int main()
+{
+    rand_engine_t rand_engine(1111);
+
+    std::cout << std::setw(6) << "K" << std::setw(16) << "inverse (us)" << std::setw(16) << "cholesky (us)"
+              << std::setw(10) << "speedup" << std::setw(16) << "max abs diff" << std::endl;
+
+    for (int K : {10, 25, 50, 100, 200, 400, 800}) {
+        const int n_reps = std::max(5, 2000000 / (K * K * K / 10 + 1));
+
+        // a precision matrix shaped like X' W X / (omega^2 sigma) + V^{-1}
+
+        const Mat_t X = stats::rnorm<Mat_t>(4 * K, K, fp_t(0), fp_t(1), rand_engine);
+        const Mat_t post_prec = X.transpose() * X + fp_t(0.001) * Mat_t::Identity(K,K);
+        const ColVec_t post_vec = stats::rnorm<ColVec_t>(K, 1, fp_t(0), fp_t(1), rand_engine);
+        const ColVec_t std_norm_vec = stats::rnorm<ColVec_t>(K, 1, fp_t(0), fp_t(1), rand_engine);
+
+        fp_t check_val = 0;
+
+        const double inv_time = time_per_draw(beta_draw_inverse, post_prec, post_vec, std_norm_vec, n_reps, check_val);
+        const double chol_time = time_per_draw(beta_draw_cholesky, post_prec, post_vec, std_norm_vec, n_reps, check_val);
+
+        // the two draws have the same distribution but use different square roots of the covariance, so compare the means
+
+        const ColVec_t zero_vec = ColVec_t::Zero(K);
+        const fp_t max_diff_val = ( beta_draw_inverse(post_prec, post_vec, zero_vec) - beta_draw_cholesky(post_prec, post_vec, zero_vec) ).cwiseAbs().maxCoeff();
+
+        std::cout << std::setw(6) << K << std::setw(16) << inv_time << std::setw(16) << chol_time
+                  << std::setw(10) << std::setprecision(3) << inv_time / chol_time
+                  << std::setw(16) << max_diff_val << std::setprecision(6) << std::endl;
+
+        if (!std::isfinite(check_val)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Checkpoint and resume: a run interrupted after a checkpoint and resumed from the file, and
+ * a finished run extended from its final state, match uninterrupted runs bit for bit; corrupt
+ * or truncated checkpoint files are rejected
+ */
+
+#include <cstdio>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+// simulates preemption: throws after a number of draws
+
+class interrupt_sink_t : public draw_sink_t
+{
+    public:
+        explicit interrupt_sink_t(const size_t n_draws_inp) : n_draws(n_draws_inp) {}
+
+        void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) override
+        {
+            (void)(beta_draw); (void)(z_draw); (void)(sigma_draw);
+
+            if (draw_ind + 1 == n_draws) {
+                throw std::runtime_error("interrupted");
+            }
+        }
+
+        bool wants_z() const override { return false; }
+
+    private:
+        size_t n_draws;
+};
+
+bool
+same_draws(const Mat_t& beta_a, const Mat_t& z_a, const ColVec_t& sigma_a, const Mat_t& beta_b, const Mat_t& z_b, const ColVec_t& sigma_b)
+{
+    return beta_a.cols() == beta_b.cols() && (beta_a.array() == beta_b.array()).all()
+        && z_a.cols() == z_b.cols() && (z_a.array() == z_b.array()).all()
+        && sigma_a.size() == sigma_b.size() && (sigma_a.array() == sigma_b.array()).all();
+}
+
+int
+run_case(const size_t n, const size_t K, rand_engine_t& rand_engine)
+{
+    const std::string file_path = "checkpoint_resume.ckpt";
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+    const ColVec_t Y = X.leftCols(2) * ColVec_t::Ones(2) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+    const size_t n_burnin_draws = 150;
+    const size_t n_keep_draws = 200;
+    const size_t thinning_factor = 1;
+
+    auto make_obj = [&]()
+    {
+        bqreg_t bqreg_obj(Y, X);
+
+        bqreg_obj.set_prior_params(ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+        bqreg_obj.set_quantile_target(fp_t(0.25));
+        bqreg_obj.set_seed_value(2024);
+
+        return bqreg_obj;
+    };
+
+    // 1. uninterrupted runs of the planned length and of the extended length
+
+    Mat_t beta_full, z_full, beta_long, z_long;
+    ColVec_t sigma_full, sigma_long;
+
+    bqreg_t obj_full = make_obj();
+    obj_full.gibbs(n_burnin_draws, n_keep_draws, thinning_factor, beta_full, z_full, sigma_full);
+
+    bqreg_t obj_long = make_obj();
+    obj_long.gibbs(n_burnin_draws, n_keep_draws + 100, thinning_factor, beta_long, z_long, sigma_long);
+
+    // 2. interrupted at the 150th kept draw (iteration 448); the last checkpoint is at iteration 400
+
+    bqreg_t obj_interrupted = make_obj();
+    obj_interrupted.set_checkpoint(file_path, 100);
+
+    interrupt_sink_t interrupt_sink(150);
+
+    try {
+        obj_interrupted.gibbs(n_burnin_draws, n_keep_draws, thinning_factor, interrupt_sink);
+        return 1;
+    } catch (const std::runtime_error&) {}
+
+    const sampler_state_t state = load_sampler_state(file_path);
+    std::remove(file_path.c_str());
+
+    std::cout << "n = " << n << ", K = " << K << ": checkpoint at iteration " << state.n_iterations << " with " << state.n_saved << " kept draws" << std::endl;
+
+    if (state.n_iterations != 400 || state.n_saved != (400 - n_burnin_draws) / (thinning_factor + 1)) {
+        return 1;
+    }
+
+    // 3. resume in a fresh object
+
+    Mat_t beta_rest, z_rest;
+    ColVec_t sigma_rest;
+
+    bqreg_t obj_resumed(Y, X);
+    obj_resumed.set_prior_params(ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+    obj_resumed.gibbs_resume(state, 0, beta_rest, z_rest, sigma_rest);
+
+    const size_t n_rest = n_keep_draws - state.n_saved;
+
+    if (!same_draws(beta_rest, z_rest, sigma_rest, beta_full.rightCols(n_rest), z_full.rightCols(n_rest), sigma_full.tail(n_rest))) {
+        std::cout << "resumed draws differ from the uninterrupted run" << std::endl;
+        return 1;
+    }
+
+    if (obj_resumed.get_sampler_state().rand_engine_state != obj_full.get_sampler_state().rand_engine_state) {
+        return 1;
+    }
+
+    // 4. extend the finished run by 100 kept draws
+
+    Mat_t beta_extra, z_extra;
+    ColVec_t sigma_extra;
+
+    obj_full.gibbs_resume(obj_full.get_sampler_state(), 100, beta_extra, z_extra, sigma_extra);
+
+    if (!same_draws(beta_extra, z_extra, sigma_extra, beta_long.rightCols(100), z_long.rightCols(100), sigma_long.tail(100))) {
+        std::cout << "extended draws differ from the longer run" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// a copy of the bytes of a file with one field overwritten
+
+template<typename T>
+std::vector<char>
+with_value(const std::vector<char>& file_bytes, const size_t offset, const T val)
+{
+    std::vector<char> bytes = file_bytes;
+    std::memcpy(bytes.data() + offset, &val, sizeof(val));
+
+    return bytes;
+}
+
+// each corruption of a small checkpoint, with a sparse Gram matrix, must make load_sampler_state throw
+
+int
+corrupt_cases()
+{
+    const std::string file_path = "checkpoint_corrupt.ckpt";
+
+    const size_t n = 4;
+    const size_t K = 3;
+
+    sampler_state_t state;
+
+    state.beta_draw = ColVec_t::Zero(K);
+    state.nu_draw = ColVec_t::Ones(n);
+
+    Mat_t gram_mat = Mat_t::Identity(K, K);
+    set_state_gram(state, SpMatCSC_t(gram_mat.sparseView()), ColVec_t::Zero(K));
+
+    save_sampler_state(file_path, state);
+
+    std::ifstream in_file(file_path, std::ios::binary);
+    const std::vector<char> file_bytes( (std::istreambuf_iterator<char>(in_file)), std::istreambuf_iterator<char>() );
+    in_file.close();
+
+    // offsets of the fields written by save_sampler_state
+
+    using index_t = SpMatCSC_t::StorageIndex;
+
+    const size_t beta_size_offset = 8 + 11 * 8 + sizeof(fp_t);
+    const size_t gram_rows_offset = beta_size_offset + 3 * 8 + (2 * K + n) * sizeof(fp_t);
+    const size_t nnz_offset = gram_rows_offset + 2 * 8 + 2 * 8;
+    const size_t outer_offset = nnz_offset + 8;
+    const size_t inner_offset = outer_offset + (K + 1) * sizeof(index_t);
+
+    int n_failures = 0;
+
+    auto check_rejected = [&](const char* label, const std::vector<char>& bytes) {
+        {
+            std::ofstream out_file(file_path, std::ios::binary | std::ios::trunc);
+            out_file.write(bytes.data(), bytes.size());
+        }
+
+        try {
+            load_sampler_state(file_path);
+        } catch (const std::runtime_error&) {
+            return;
+        }
+
+        std::cout << "a checkpoint with " << label << " was not rejected" << std::endl;
+        ++n_failures;
+    };
+
+    check_rejected("a truncated end", std::vector<char>(file_bytes.begin(), file_bytes.end() - 4));
+    check_rejected("a truncated sparse block", std::vector<char>(file_bytes.begin(), file_bytes.begin() + inner_offset));
+    check_rejected("a huge vector length", with_value(file_bytes, beta_size_offset, uint64_t(1) << 60));
+    check_rejected("a Gram matrix of the wrong dimension", with_value(file_bytes, gram_rows_offset, uint64_t(K + 1)));
+    check_rejected("too many sparse nonzeros", with_value(file_bytes, nnz_offset, uint64_t(K * K + 1)));
+    check_rejected("an outer index that does not end at nnz", with_value(file_bytes, outer_offset + K * sizeof(index_t), index_t(K - 1)));
+    check_rejected("a decreasing outer index", with_value(file_bytes, outer_offset + sizeof(index_t), index_t(K)));
+    check_rejected("an inner index past the last row", with_value(file_bytes, inner_offset, index_t(K)));
+
+    // the file as written still loads
+
+    {
+        std::ofstream out_file(file_path, std::ios::binary | std::ios::trunc);
+        out_file.write(file_bytes.data(), file_bytes.size());
+    }
+
+    const sampler_state_t loaded_state = load_sampler_state(file_path);
+    std::remove(file_path.c_str());
+
+    if (Mat_t(loaded_state.gram_mat_sp) != gram_mat) {
+        std::cout << "the sparse Gram matrix did not survive a round trip" << std::endl;
+        ++n_failures;
+    }
+
+    return n_failures;
+}
+
+int main()
+{
+    if (corrupt_cases() != 0) {
+        return 1;
+    }
+
+    rand_engine_t rand_engine(3131);
+
+    // dense precision, then the n-dimensional draw of beta (n < K)
+
+    if (run_case(500, 5, rand_engine) != 0 || run_case(30, 60, rand_engine) != 0) {
+        return 1;
+    }
+
+    std::cout << "resumed and extended chains match the uninterrupted runs" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Divide-and-conquer sampling: consensus (weighted) and kernel-combined draws vs a single chain on all rows,
+ * and the rejection of a prior on sigma that would leave the shard priors improper
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+int main()
+{
+    const size_t n = 40000;
+    const size_t K = 4;
+
+    const size_t n_burnin_draws = 100;
+    const size_t n_keep_draws = 500;
+
+    rand_engine_t rand_engine(3333);
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+    const ColVec_t beta_true = ColVec_t::LinSpaced(K, fp_t(-1), fp_t(1));
+    const ColVec_t Y = X * beta_true + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+    const ColVec_t prior_beta_mean = ColVec_t::Zero(K);
+    const Mat_t prior_beta_var = Mat_t::Identity(K,K);
+
+    // reference: one chain on all of the rows
+
+    Mat_t beta_draws_full;
+    ColVec_t sigma_draws_full;
+
+    {
+        rand_engine_t sampler_engine(1111);
+        param_memory_sink_t draw_sink(beta_draws_full, sigma_draws_full);
+
+        auto start_time = std::chrono::steady_clock::now();
+
+        qr_gibbs(Y, X, fp_t(0.5), ColVec_t::Zero(K), prior_beta_mean, prior_beta_var, fp_t(3), fp_t(3),
+                 n_burnin_draws, n_keep_draws, 0, false, -1, draw_sink, sampler_engine);
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+        std::cout << "full chain: " << elapsed.count() << "s" << std::endl;
+    }
+
+    const ColVec_t beta_mean_full = beta_draws_full.rowwise().mean();
+    const ColVec_t beta_sd_full = ( (beta_draws_full.colwise() - beta_mean_full).rowwise().squaredNorm() / fp_t(n_keep_draws - 1) ).cwiseSqrt();
+    const fp_t sigma_mean_full = sigma_draws_full.mean();
+
+    std::cout << std::setw(8) << "shards" << std::setw(12) << "combiner" << std::setw(12) << "time (s)"
+              << std::setw(16) << "max |diff|/sd" << std::setw(14) << "sd ratio" << std::setw(14) << "sigma ratio" << std::endl;
+
+    for (size_t n_shards : {4, 8}) {
+        for (bool use_kernel_combiner : {false, true}) {
+            Mat_t beta_draws;
+            ColVec_t sigma_draws;
+
+            rand_engine_t sampler_engine(1111);
+
+            auto start_time = std::chrono::steady_clock::now();
+
+            qr_gibbs_consensus(Y, X, fp_t(0.5), ColVec_t::Zero(K), prior_beta_mean, prior_beta_var, fp_t(3), fp_t(3),
+                               n_shards, n_burnin_draws, n_keep_draws, 0, false, use_kernel_combiner, -1,
+                               beta_draws, sigma_draws, sampler_engine);
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+            const ColVec_t beta_mean = beta_draws.rowwise().mean();
+            const ColVec_t beta_sd = ( (beta_draws.colwise() - beta_mean).rowwise().squaredNorm() / fp_t(n_keep_draws - 1) ).cwiseSqrt();
+
+            const fp_t max_diff_val = ( (beta_mean - beta_mean_full).array() / beta_sd_full.array() ).abs().maxCoeff();
+            const fp_t sd_ratio_val = (beta_sd.array() / beta_sd_full.array()).mean();
+            const fp_t sigma_ratio_val = sigma_draws.mean() / sigma_mean_full;
+
+            std::cout << std::setw(8) << n_shards << std::setw(12) << (use_kernel_combiner ? "kernel" : "weighted")
+                      << std::setw(12) << std::setprecision(3) << elapsed.count() << std::setw(16) << max_diff_val
+                      << std::setw(14) << sd_ratio_val << std::setw(14) << sigma_ratio_val << std::setprecision(6) << std::endl;
+
+            // the combined posterior mean of beta should match the full posterior mean to within a fraction of a posterior sd
+
+            if (!(max_diff_val < fp_t(0.75))) {
+                return 1;
+            }
+        }
+    }
+
+    // a prior shape of sigma of -1 or less would leave the shard priors improper
+
+    try {
+        Mat_t beta_draws;
+        ColVec_t sigma_draws;
+
+        rand_engine_t sampler_engine(1111);
+
+        qr_gibbs_consensus(Y, X, fp_t(0.5), ColVec_t::Zero(K), prior_beta_mean, prior_beta_var, fp_t(-1), fp_t(3),
+                           4, n_burnin_draws, n_keep_draws, 0, false, true, -1,
+                           beta_draws, sigma_draws, sampler_engine);
+
+        std::cout << "a prior shape of -1 was not rejected" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument&) {}
+
+    return 0;
+}
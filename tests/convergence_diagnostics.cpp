@@ -0,0 +1,133 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Convergence diagnostics on chains with known behavior: for stationary AR(1) chains, R-hat is
+ * close to one and the ESS is close to N M (1 - phi) / (1 + phi); for chains with shifted means,
+ * R-hat is well above one
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+// M chains of a stationary AR(1) process with coefficient phi, each shifted by shift_val times its index
+
+Mat_t
+ar1_chains(const size_t n_draws, const size_t n_chains, const fp_t phi, const fp_t shift_val, rand_engine_t& rand_engine)
+{
+    const Mat_t innov = stats::rnorm<Mat_t>(n_draws, n_chains, fp_t(0), fp_t(1), rand_engine);
+
+    Mat_t draws(n_draws, n_chains);
+
+    for (size_t m = 0; m < n_chains; ++m) {
+        fp_t state_val = innov(0, m) / std::sqrt(1 - phi * phi);
+
+        for (size_t i = 0; i < n_draws; ++i) {
+            if (i > 0) {
+                state_val = phi * state_val + innov(i, m);
+            }
+
+            draws(i, m) = state_val + shift_val * m;
+        }
+    }
+
+    return draws;
+}
+
+int main()
+{
+    const size_t n_draws = 2000;
+    const size_t n_chains = 4;
+    const fp_t phi = fp_t(0.5);
+
+    rand_engine_t rand_engine(1234);
+
+    bool is_ok = true;
+
+    // 1. stationary chains
+
+    const Mat_t draws = ar1_chains(n_draws, n_chains, phi, fp_t(0), rand_engine);
+
+    const fp_t ess_theory = n_draws * n_chains * (1 - phi) / (1 + phi);
+
+    const fp_t rhat_val = split_rhat(draws);
+    const fp_t ess_bulk_val = ess_bulk(draws);
+    const fp_t ess_tail_val = ess_tail(draws);
+
+    std::cout << "AR(1), phi = " << phi << ": R-hat = " << rhat_val << ", bulk-ESS = " << ess_bulk_val
+              << ", tail-ESS = " << ess_tail_val << ", theoretical ESS = " << ess_theory << std::endl;
+
+    if (!(rhat_val < fp_t(1.01))) {
+        std::cout << "R-hat of stationary chains is not close to one" << std::endl;
+        is_ok = false;
+    }
+
+    if (!(ess_bulk_val > fp_t(0.75) * ess_theory && ess_bulk_val < fp_t(1.25) * ess_theory)) {
+        std::cout << "bulk-ESS is out of range" << std::endl;
+        is_ok = false;
+    }
+
+    // the tail indicators are less autocorrelated than the draws themselves
+
+    if (!(ess_tail_val > fp_t(0.5) * ess_theory && ess_tail_val <= fp_t(n_draws * n_chains))) {
+        std::cout << "tail-ESS is out of range" << std::endl;
+        is_ok = false;
+    }
+
+    // 2. shifted means
+
+    const Mat_t shifted_draws = ar1_chains(n_draws, n_chains, phi, fp_t(2), rand_engine);
+
+    const fp_t shifted_rhat_val = split_rhat(shifted_draws);
+
+    std::cout << "shifted means: R-hat = " << shifted_rhat_val << std::endl;
+
+    if (!(shifted_rhat_val > fp_t(1.5))) {
+        std::cout << "R-hat of chains with shifted means is not well above one" << std::endl;
+        is_ok = false;
+    }
+
+    // 3. the same values through compute_convergence_diagnostics, with the chains of two parameters as beta draws
+
+    std::vector<Mat_t> beta_draws(n_chains);
+
+    for (size_t m = 0; m < n_chains; ++m) {
+        beta_draws[m].resize(2, n_draws);
+        beta_draws[m].row(0) = draws.col(m).transpose();
+        beta_draws[m].row(1) = shifted_draws.col(m).transpose();
+    }
+
+    const convergence_diagnostics_t diag = compute_convergence_diagnostics(beta_draws, draws);
+
+    if (diag.rhat.size() != 3 || diag.rhat(0) != rhat_val || diag.rhat(1) != shifted_rhat_val || diag.rhat(2) != rhat_val
+        || diag.ess_bulk(0) != ess_bulk_val || diag.ess_tail(0) != ess_tail_val) {
+        std::cout << "compute_convergence_diagnostics does not match the single-parameter diagnostics" << std::endl;
+        is_ok = false;
+    }
+
+    if (is_ok) {
+        std::cout << "convergence diagnostics passed" << std::endl;
+    }
+
+    return is_ok ? 0 : 1;
+}
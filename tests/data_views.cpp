@@ -0,0 +1,137 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Data views: sampling from a view of data held elsewhere, in column-major or row-major order,
+ * gives the same draws as sampling from a copy of the data
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+using RowMat_t = Eigen::Matrix<fp_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+struct draws_t
+{
+    Mat_t beta_draws;
+    Mat_t z_draws;
+    ColVec_t sigma_draws;
+};
+
+template<typename DataVec_t, typename DataMat_t>
+draws_t
+run_sampler(const DataVec_t& Y, const DataMat_t& X)
+{
+    const size_t K = X.cols();
+
+    draws_t draws;
+    rand_engine_t rand_engine(42);
+
+    qr_gibbs(Y, X, fp_t(0.3), ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+             50, 100, 1, false, 2, draws.beta_draws, draws.z_draws, draws.sigma_draws, rand_engine);
+
+    return draws;
+}
+
+bool
+draws_match(const draws_t& draws_a, const draws_t& draws_b)
+{
+    return (draws_a.beta_draws - draws_b.beta_draws).cwiseAbs().maxCoeff() < 1e-10 
+            && (draws_a.z_draws - draws_b.z_draws).cwiseAbs().maxCoeff() < 1e-10 
+            && (draws_a.sigma_draws - draws_b.sigma_draws).cwiseAbs().maxCoeff() < 1e-10;
+}
+
+int main()
+{
+    rand_engine_t data_engine(1234);
+
+    for (size_t n : {3000, 20}) {
+        const size_t K = (n > 100) ? 6 : 40; // the second case is sampled with the Woodbury identity
+
+        const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), data_engine);
+        const ColVec_t Y = X * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+        const draws_t draws_ref = run_sampler(Y, X);
+
+        // column-major (Fortran order), with every other element of Y
+
+        ColVec_t Y_strided = ColVec_t::Zero(2 * n);
+
+        for (size_t i = 0; i < n; ++i) {
+            Y_strided(2 * i) = Y(i);
+        }
+
+        const ColVecView_t Y_view(Y_strided.data(), n, Eigen::InnerStride<>(2));
+        const MatView_t X_col_view(X.data(), n, K, DataStride_t(n, 1));
+
+        if (!draws_match(draws_ref, run_sampler(Y_view, X_col_view))) {
+            std::cout << "n = " << n << ": the draws from a column-major view differ" << std::endl;
+            return 1;
+        }
+
+        // row-major (C order)
+
+        const RowMat_t X_row = X;
+        const MatView_t X_row_view(X_row.data(), n, K, DataStride_t(1, K));
+
+        if (!draws_match(draws_ref, run_sampler(Y_view, X_row_view))) {
+            std::cout << "n = " << n << ": the draws from a row-major view differ" << std::endl;
+            return 1;
+        }
+
+        // single precision
+
+        const ColVecF_t Y_f = Y.cast<float>();
+        const MatF_t X_f = X.cast<float>();
+        const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> X_f_row = X_f;
+
+        const ColVecFView_t Y_f_view(Y_f.data(), n, Eigen::InnerStride<>(1));
+        const MatFView_t X_f_view(X_f_row.data(), n, K, DataStride_t(1, K));
+
+        if (!draws_match(run_sampler(Y_f, X_f), run_sampler(Y_f_view, X_f_view))) {
+            std::cout << "n = " << n << ": the draws from a single-precision view differ" << std::endl;
+            return 1;
+        }
+
+        // shards of a view are copied into owned storage
+
+        Mat_t beta_ref, beta_view;
+        ColVec_t sigma_ref, sigma_view;
+
+        rand_engine_t engine_ref(7), engine_view(7);
+
+        qr_gibbs_consensus(Y, X, fp_t(0.5), ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+                           2, 20, 50, 0, false, false, 1, beta_ref, sigma_ref, engine_ref);
+        qr_gibbs_consensus(Y_view, X_row_view, fp_t(0.5), ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+                           2, 20, 50, 0, false, false, 1, beta_view, sigma_view, engine_view);
+
+        if ((beta_ref - beta_view).cwiseAbs().maxCoeff() > 1e-10) {
+            std::cout << "n = " << n << ": the consensus draws from a view differ" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "draws from views match the draws from copies" << std::endl;
+
+    return 0;
+}
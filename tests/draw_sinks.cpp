@@ -0,0 +1,161 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Draw sinks: the memory sink matches the storage overload of gibbs bit for bit, the discard
+ * sink leaves the chain unchanged, a ring buffer that drops draws accounts for every draw, and
+ * the exception of a failing ring buffer writer reaches the caller of gibbs
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+int main()
+{
+    const size_t n = 200;
+    const size_t K = 3;
+    const size_t n_burnin_draws = 50;
+    const size_t n_keep_draws = 400;
+
+    rand_engine_t rand_engine(1);
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+    const ColVec_t Y = X * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+    auto make_obj = [&]()
+    {
+        bqreg_t bqreg_obj(Y, X);
+
+        bqreg_obj.set_prior_params(ColVec_t::Zero(K), 1000 * Mat_t::Identity(K, K), fp_t(3), fp_t(3));
+        bqreg_obj.set_quantile_target(fp_t(0.5));
+        bqreg_obj.set_seed_value(2222);
+
+        return bqreg_obj;
+    };
+
+    bool is_ok = true;
+
+    // 1. memory sink vs storage overload
+
+    Mat_t beta_draws, z_draws;
+    ColVec_t sigma_draws;
+
+    bqreg_t ref_obj = make_obj();
+    ref_obj.gibbs(n_burnin_draws, n_keep_draws, 0, beta_draws, z_draws, sigma_draws);
+
+    {
+        Mat_t beta_sink(K, n_keep_draws), z_sink(n, n_keep_draws);
+        ColVec_t sigma_sink(n_keep_draws);
+
+        memory_sink_t draw_sink(beta_sink, z_sink, sigma_sink);
+
+        bqreg_t bqreg_obj = make_obj();
+        bqreg_obj.gibbs(n_burnin_draws, n_keep_draws, 0, draw_sink);
+
+        if (beta_sink != beta_draws || z_sink != z_draws || sigma_sink != sigma_draws) {
+            std::cout << "the memory sink does not match the storage overload" << std::endl;
+            is_ok = false;
+        }
+    }
+
+    // 2. discard sink: same final state as the stored run
+
+    {
+        discard_sink_t draw_sink;
+
+        bqreg_t bqreg_obj = make_obj();
+        bqreg_obj.gibbs(n_burnin_draws, n_keep_draws, 0, draw_sink);
+
+        const sampler_state_t& state = bqreg_obj.get_sampler_state();
+
+        if (state.n_saved != n_keep_draws || state.beta_draw != ref_obj.get_sampler_state().beta_draw || state.sigma_draw != sigma_draws(n_keep_draws - 1)) {
+            std::cout << "the discard sink changed the chain" << std::endl;
+            is_ok = false;
+        }
+    }
+
+    // 3. ring buffer that drops draws, with a slow writer
+
+    {
+        size_t n_written = 0;
+
+        auto slow_writer = [&](const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) {
+            (void)(draw_ind); (void)(beta_draw); (void)(z_draw); (void)(sigma_draw);
+
+            ++n_written;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        };
+
+        ring_buffer_sink_t draw_sink(slow_writer, 4, false, true);
+
+        bqreg_t bqreg_obj = make_obj();
+        bqreg_obj.gibbs(n_burnin_draws, n_keep_draws, 0, draw_sink);
+
+        if (n_written + draw_sink.get_n_dropped() != n_keep_draws || draw_sink.get_n_dropped() == 0) {
+            std::cout << "ring buffer: " << n_written << " written + " << draw_sink.get_n_dropped() << " dropped != " << n_keep_draws << " draws" << std::endl;
+            is_ok = false;
+        }
+    }
+
+    // 4. ring buffer with a writer that throws: end() rethrows on the sampling thread, and the
+    //    sampler stops early
+
+    {
+        const size_t fail_ind = 5;
+        size_t n_calls = 0;
+
+        auto failing_writer = [&](const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) {
+            (void)(beta_draw); (void)(z_draw); (void)(sigma_draw);
+
+            ++n_calls;
+
+            if (draw_ind == fail_ind) {
+                throw std::runtime_error("writer failed");
+            }
+        };
+
+        ring_buffer_sink_t draw_sink(failing_writer, 2);
+
+        bqreg_t bqreg_obj = make_obj();
+
+        bool caught = false;
+
+        try {
+            bqreg_obj.gibbs(n_burnin_draws, n_keep_draws, 0, draw_sink);
+        } catch (const std::runtime_error& err) {
+            caught = (std::string(err.what()) == "writer failed");
+        }
+
+        if (!caught || n_calls != fail_ind + 1 || bqreg_obj.get_sampler_state().n_saved >= n_keep_draws) {
+            std::cout << "ring buffer: the exception of the writer was not passed on (caught = " << caught << ", "
+                      << n_calls << " writer calls, " << bqreg_obj.get_sampler_state().n_saved << " draws saved)" << std::endl;
+            is_ok = false;
+        }
+    }
+
+    if (is_ok) {
+        std::cout << "draw sink tests passed" << std::endl;
+    }
+
+    return is_ok ? 0 : 1;
+}
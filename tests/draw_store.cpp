@@ -0,0 +1,188 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Draw store: a round trip through the memory-mapped file, rejection of files whose block
+ * descriptors do not fit (truncated, or with a corrupt header), and the generator key
+ * recorded by gibbs_to_file
+ */
+
+#include <cstdio>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+// read or write a whole file
+
+std::vector<char>
+read_file(const std::string& file_path)
+{
+    std::ifstream in_file(file_path, std::ios::binary);
+
+    return std::vector<char>( (std::istreambuf_iterator<char>(in_file)), std::istreambuf_iterator<char>() );
+}
+
+void
+write_file(const std::string& file_path, const std::vector<char>& bytes)
+{
+    std::ofstream out_file(file_path, std::ios::binary | std::ios::trunc);
+
+    out_file.write(bytes.data(), bytes.size());
+}
+
+// true if opening the file throws a runtime_error
+
+bool
+open_fails(const std::string& file_path)
+{
+    try {
+        draw_store_reader_t draw_store(file_path);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+
+    return false;
+}
+
+int main()
+{
+    const size_t n = 50;
+    const size_t K = 3;
+    const size_t n_keep_draws = 40;
+
+    const std::string file_path = "draw_store_draws.bin";
+    const std::string bad_file_path = "draw_store_bad.bin";
+
+    // 1. round trip
+
+    Mat_t beta_draws = Mat_t::Random(K, n_keep_draws);
+    Mat_t z_draws = Mat_t::Random(n, n_keep_draws).cwiseAbs();
+    ColVec_t sigma_draws = ColVec_t::Random(n_keep_draws).cwiseAbs();
+
+    {
+        mmap_draw_sink_t draw_sink(file_path, draw_store_meta_t());
+
+        draw_sink.begin(n, K, n_keep_draws);
+
+        for (size_t draw_ind = 0; draw_ind < n_keep_draws; ++draw_ind) {
+            draw_sink.push(draw_ind, beta_draws.col(draw_ind), z_draws.col(draw_ind), sigma_draws(draw_ind));
+        }
+
+        draw_sink.end();
+    }
+
+    {
+        draw_store_reader_t draw_store(file_path);
+
+        if (draw_store.header().n_draws_written != n_keep_draws || draw_store.beta_draws() != beta_draws
+            || draw_store.sigma_draws().transpose() != sigma_draws || draw_store.block<fp_t>(DRAW_STORE_Z) != z_draws) {
+            std::cout << "the draws read back do not match those written" << std::endl;
+            return 1;
+        }
+    }
+
+    // 2. corrupt files
+
+    const std::vector<char> file_bytes = read_file(file_path);
+
+    const size_t n_blocks_offset = offsetof(draw_store_header_t, n_blocks);
+    const size_t z_desc_offset = offsetof(draw_store_header_t, blocks) + DRAW_STORE_Z * sizeof(draw_store_block_t);
+
+    bool is_ok = true;
+
+    auto check_rejected = [&](const char* label, const std::vector<char>& bytes) {
+        write_file(bad_file_path, bytes);
+
+        if (!open_fails(bad_file_path)) {
+            std::cout << "a draw store with " << label << " was not rejected" << std::endl;
+            is_ok = false;
+        }
+    };
+
+    {
+        // truncated: the z block runs past the end of the file
+
+        std::vector<char> bytes(file_bytes.begin(), file_bytes.end() - BQREG_DRAW_STORE_PAGE_SIZE);
+        check_rejected("a truncated z block", bytes);
+    }
+
+    {
+        std::vector<char> bytes = file_bytes;
+        const uint64_t n_blocks = 1000;
+        std::memcpy(bytes.data() + n_blocks_offset, &n_blocks, sizeof(n_blocks));
+        check_rejected("too many blocks", bytes);
+    }
+
+    {
+        // n_rows * n_cols * type_size overflows to a small value
+
+        std::vector<char> bytes = file_bytes;
+        const uint64_t n_cols = (uint64_t(1) << 61) + 1;
+        std::memcpy(bytes.data() + z_desc_offset + offsetof(draw_store_block_t, n_cols), &n_cols, sizeof(n_cols));
+        check_rejected("an overflowing block size", bytes);
+    }
+
+    {
+        std::vector<char> bytes = file_bytes;
+        const uint64_t offset = file_bytes.size() + BQREG_DRAW_STORE_PAGE_SIZE;
+        std::memcpy(bytes.data() + z_desc_offset + offsetof(draw_store_block_t, offset), &offset, sizeof(offset));
+        check_rejected("a block offset past the end of the file", bytes);
+    }
+
+    {
+        std::vector<char> bytes = file_bytes;
+        const uint64_t type_code = 7;
+        std::memcpy(bytes.data() + z_desc_offset + offsetof(draw_store_block_t, type_code), &type_code, sizeof(type_code));
+        check_rejected("an unknown type code", bytes);
+    }
+
+    // 3. the header of a sampler run records the key of its counter-based generator
+
+    Mat_t X = Mat_t::Random(n, K);
+    X.col(0).setOnes();
+
+    ColVec_t Y = X.rowwise().sum() + ColVec_t::Random(n);
+
+    bqreg_t bqreg_obj(Y, X);
+
+    bqreg_obj.set_prior_params(ColVec_t::Zero(K), 1000 * Mat_t::Identity(K, K), 3, 3);
+    bqreg_obj.set_seed_value(1111);
+    bqreg_obj.gibbs_to_file(file_path, 100, n_keep_draws, 0, false);
+
+    {
+        draw_store_reader_t draw_store(file_path);
+
+        if (draw_store.header().seed_value != bqreg_obj.get_sampler_state().seed_val) {
+            std::cout << "the draw store does not record the key of the generator of the run" << std::endl;
+            is_ok = false;
+        }
+    }
+
+    std::remove(file_path.c_str());
+    std::remove(bad_file_path.c_str());
+
+    if (is_ok) {
+        std::cout << "draw store round trip and validation passed" << std::endl;
+    }
+
+    return is_ok ? 0 : 1;
+}
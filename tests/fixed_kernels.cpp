@@ -0,0 +1,135 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Specialized kernels: the data pass variants for tau = 0.5 and a fixed sigma against the general
+ * pass, and the fixed-size beta step against the dynamic-size draw for K = 1, ..., 17
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+bool
+check_pass_variant(const ColVec_t& Y, const Mat_t& X, const fp_t tau, const bool keep_sigma_fixed)
+{
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    const fp_t theta_par = (1 - 2 * tau) / (tau * (1 - tau));
+    const fp_t omega_sq_par = 2 / (tau * (1 - tau));
+
+    const int pass_variant = get_data_pass_variant(theta_par, keep_sigma_fixed);
+
+    const ColVec_t beta_draw = ColVec_t::LinSpaced(K, fp_t(1), fp_t(-1));
+
+    counter_rng_t rng(99, 2);
+    rng.iter_ind = 5;
+
+    Mat_t gram_mats[2];
+    ColVec_t gram_vecs[2], nu_draws[2];
+    fp_t sum_nu[2], sum_err[2];
+
+    for (int use_variant = 0; use_variant < 2; ++use_variant) {
+        reduction_slots_t slots_ws;
+        nu_draws[use_variant].resize(n);
+
+        qr_data_pass(Y, X, beta_draw, theta_par, omega_sq_par, fp_t(1.3), 1, rng, slots_ws, nu_draws[use_variant],
+                     gram_mats[use_variant], gram_vecs[use_variant], sum_nu[use_variant], sum_err[use_variant], nullptr,
+                     use_variant ? pass_variant : int(DATA_PASS_GENERAL));
+    }
+
+    // identical draws and Gram statistics; the sigma sums only when they are used
+
+    bool is_ok = (nu_draws[1].array() == nu_draws[0].array()).all() && (gram_mats[1].array() == gram_mats[0].array()).all()
+                    && (gram_vecs[1].array() == gram_vecs[0].array()).all();
+
+    if (keep_sigma_fixed) {
+        is_ok = is_ok && sum_nu[1] == 0 && sum_err[1] == 0;
+    } else {
+        is_ok = is_ok && sum_nu[1] == sum_nu[0] && sum_err[1] == sum_err[0];
+    }
+
+    std::cout << "pass variant " << pass_variant << " (tau = " << tau << ", sigma fixed = " << keep_sigma_fixed << "): "
+              << (is_ok ? "identical" : "DIFFERENT") << std::endl;
+
+    return is_ok;
+}
+
+int main()
+{
+    rand_engine_t data_engine(2468);
+
+    const size_t n = 1500;
+    const size_t K = 4;
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), data_engine);
+    const ColVec_t Y = X * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+    bool is_ok = true;
+
+    for (const fp_t tau : {fp_t(0.5), fp_t(0.25)}) {
+        for (const bool keep_sigma_fixed : {false, true}) {
+            is_ok = check_pass_variant(Y, X, tau, keep_sigma_fixed) && is_ok;
+        }
+    }
+
+    // the fixed-size beta step, including K = 17, which is drawn by the dynamic-size routine
+
+    fp_t max_rel_diff = 0;
+
+    for (size_t K_draw = 1; K_draw <= 17; ++K_draw) {
+        const Mat_t A = stats::rnorm<Mat_t>(3 * K_draw, K_draw, fp_t(0), fp_t(1), data_engine);
+        const Mat_t gram_mat = A.transpose() * A;
+        const ColVec_t gram_vec = stats::rnorm<ColVec_t>(K_draw, 1, fp_t(0), fp_t(1), data_engine);
+
+        const Mat_t prior_beta_var_inv = Mat_t::Identity(K_draw, K_draw) / fp_t(4);
+        const ColVec_t prior_beta_mu = ColVec_t::Constant(K_draw, fp_t(0.1));
+
+        counter_rng_t rng(7, 0);
+        rng.iter_ind = static_cast<uint32_t>(K_draw);
+
+        mvnorm_prec_ws_t prec_ws;
+        ColVec_t beta_draw;
+
+        qr_draw_beta(prior_beta_mu, prior_beta_var_inv, fp_t(2), fp_t(0.5), gram_mat, gram_vec, rng, prec_ws, beta_draw);
+
+        // the same draw through the dynamic-size routine
+
+        mvnorm_prec_ws_t prec_ws_ref;
+        ColVec_t beta_draw_ref;
+
+        prec_ws_ref.post_prec = gram_mat + prior_beta_var_inv;
+        prec_ws_ref.post_vec = gram_vec + prior_beta_mu;
+        prec_ws_ref.std_norm_vec = rng.rnorm_vec(RNG_STREAM_BETA, K_draw);
+
+        draw_mvnorm_prec(prec_ws_ref, beta_draw_ref);
+
+        max_rel_diff = std::max(max_rel_diff, (beta_draw - beta_draw_ref).cwiseAbs().maxCoeff() / beta_draw_ref.cwiseAbs().maxCoeff());
+    }
+
+    std::cout << "beta step, K = 1, ..., 17: max. rel. diff. = " << max_rel_diff << std::endl;
+
+    is_ok = is_ok && max_rel_diff < 1e-10;
+
+    return is_ok ? 0 : 1;
+}
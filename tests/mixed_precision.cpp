@@ -0,0 +1,134 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Mixed precision: float storage of X and Y (double accumulation) vs the all-double path
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+// keep running moments of the beta draws only
+
+class moments_sink_t : public draw_sink_t
+{
+    public:
+        ColVec_t beta_mean;
+        ColVec_t beta_sq_mean;
+
+        void begin(const size_t n, const size_t K, const size_t n_keep_draws) override
+        {
+            (void)(n);
+            beta_mean.setZero(K);
+            beta_sq_mean.setZero(K);
+            n_draws = n_keep_draws;
+        }
+
+        void push(const size_t draw_ind, const ColVec_t& beta_draw, const ColVec_t& z_draw, const fp_t sigma_draw) override
+        {
+            (void)(draw_ind); (void)(z_draw); (void)(sigma_draw);
+            beta_mean += beta_draw / fp_t(n_draws);
+            beta_sq_mean += beta_draw.cwiseAbs2() / fp_t(n_draws);
+        }
+
+        bool wants_z() const override { return false; }
+
+    private:
+        size_t n_draws = 1;
+};
+
+template<typename DataVec_t, typename DataMat_t>
+double
+time_sampler(const DataVec_t& Y, const DataMat_t& X, const size_t n_burnin_draws, const size_t n_keep_draws, moments_sink_t& draw_sink)
+{
+    const size_t K = X.cols();
+
+    rand_engine_t rand_engine(1111);
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    qr_gibbs(Y, X, fp_t(0.5), ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+             n_burnin_draws, n_keep_draws, 0, false, -1, draw_sink, rand_engine);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    return elapsed.count();
+}
+
+int main()
+{
+    const size_t n_burnin_draws = 200;
+    const size_t n_keep_draws = 1000;
+
+    rand_engine_t rand_engine(2222);
+
+    std::cout << std::setw(10) << "n" << std::setw(6) << "K" << std::setw(14) << "double (s)" << std::setw(14) << "float (s)"
+              << std::setw(10) << "speedup" << std::setw(16) << "gram rel diff" << std::setw(16) << "max |diff|/sd" << std::endl;
+
+    for (size_t K : {5, 20, 50}) {
+        const size_t n = 100000;
+
+        const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+        const ColVec_t beta_true = ColVec_t::LinSpaced(K, fp_t(-1), fp_t(1));
+        const ColVec_t Y = X * beta_true + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+        const MatF_t X_f = X.cast<float>();
+        const ColVecF_t Y_f = Y.cast<float>();
+
+        // Gram statistics for the same nu: differences come from rounding the data only
+
+        const ColVec_t nu_draw = stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine).array().abs() + fp_t(0.1);
+
+        Mat_t gram_mat, gram_mat_f;
+        ColVec_t gram_vec, gram_vec_f;
+
+        qr_gram_pass(Y, X, nu_draw, fp_t(0), 1, gram_mat, gram_vec);
+        qr_gram_pass(Y_f, X_f, nu_draw, fp_t(0), 1, gram_mat_f, gram_vec_f);
+
+        const fp_t gram_diff_val = (gram_mat - gram_mat_f).norm() / gram_mat.norm();
+
+        // full sampler
+
+        moments_sink_t sink_d, sink_f;
+
+        const double time_d = time_sampler(Y, X, n_burnin_draws, n_keep_draws, sink_d);
+        const double time_f = time_sampler(Y_f, X_f, n_burnin_draws, n_keep_draws, sink_f);
+
+        const ColVec_t beta_sd = (sink_d.beta_sq_mean - sink_d.beta_mean.cwiseAbs2()).cwiseMax(fp_t(0)).cwiseSqrt();
+        const fp_t max_diff_val = ( (sink_d.beta_mean - sink_f.beta_mean).array() / beta_sd.array() ).abs().maxCoeff();
+
+        std::cout << std::setw(10) << n << std::setw(6) << K << std::setw(14) << time_d << std::setw(14) << time_f
+                  << std::setw(10) << std::setprecision(3) << time_d / time_f
+                  << std::setw(16) << gram_diff_val << std::setw(16) << max_diff_val << std::setprecision(6) << std::endl;
+
+        // the posterior means should agree to well within Monte Carlo error
+
+        if (!(gram_diff_val < fp_t(1e-5)) || !(max_diff_val < fp_t(0.5))) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
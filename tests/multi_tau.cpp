@@ -0,0 +1,171 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Multi-tau sampling: the chains that share each pass over X give the same draws as independent
+ * single-chain runs of each tau with the same keys, started from the same warm-start states
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+// the state of one chain between iterations
+
+struct chain_state_t
+{
+    ColVec_t beta_draw;
+    ColVec_t nu_draw;
+    fp_t sigma_draw;
+
+    Mat_t gram_mat;
+    ColVec_t gram_vec;
+};
+
+int main()
+{
+    const size_t n = 3000;
+    const size_t K = 4;
+
+    const size_t n_burnin_draws = 20;
+    const size_t n_keep_draws = 40;
+    const size_t thinning_factor = 1;
+    const int n_threads = 2;
+
+    rand_engine_t data_engine(1234);
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), data_engine);
+    const ColVec_t Y = X * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+    ColVec_t tau_vec(4);
+    tau_vec << fp_t(0.5), fp_t(0.9), fp_t(0.25), fp_t(0.75);
+
+    const size_t n_tau = tau_vec.size();
+
+    const ColVec_t beta_initial_draw = ColVec_t::Zero(K);
+    const ColVec_t prior_beta_mean = ColVec_t::Zero(K);
+    const Mat_t prior_beta_var = fp_t(100) * Mat_t::Identity(K,K);
+    const fp_t prior_sigma_shape = 3;
+    const fp_t prior_sigma_scale = 3;
+
+    // multi-tau run
+
+    std::vector<Mat_t> beta_draws_multi, z_draws_multi;
+    Mat_t sigma_draws_multi;
+
+    rand_engine_t rand_engine(42);
+
+    qr_gibbs_multi_tau(Y, X, tau_vec, beta_initial_draw, prior_beta_mean, prior_beta_var, prior_sigma_shape, prior_sigma_scale,
+                       n_burnin_draws, n_keep_draws, thinning_factor, false, n_threads, beta_draws_multi, z_draws_multi, sigma_draws_multi, rand_engine);
+
+    // independent runs: chain t of the multi-tau sampler uses the key of the run with chain index t
+
+    rand_engine_t ref_engine(42);
+    const uint64_t seed_val = ref_engine();
+
+    const Mat_t prior_beta_var_inv = inv_sympd(prior_beta_var);
+    const ColVec_t prior_beta_mu = prior_beta_var_inv * prior_beta_mean;
+
+    reduction_slots_t slots_ws;
+    mvnorm_prec_ws_t prec_ws;
+
+    auto run_iterations = [&](const size_t tau_ind, const size_t iter_begin, const size_t iter_end, chain_state_t& state, std::vector<chain_state_t>* kept_states) {
+        const fp_t tau = tau_vec(tau_ind);
+        const fp_t theta_par = (1 - 2 * tau) / (tau * (1 - tau));
+        const fp_t omega_sq_par = 2 / (tau * (1 - tau));
+
+        counter_rng_t rng(seed_val, static_cast<uint32_t>(tau_ind));
+
+        for (size_t iter_ind = iter_begin; iter_ind < iter_end; ++iter_ind) {
+            rng.iter_ind = static_cast<uint32_t>(iter_ind);
+
+            qr_gibbs_iteration(Y, X, prior_beta_mu, prior_beta_var_inv, prior_sigma_shape, prior_sigma_scale, theta_par, omega_sq_par, false, n_threads,
+                               state.gram_mat, state.gram_vec, state.beta_draw, state.nu_draw, state.sigma_draw, rng, slots_ws, prec_ws);
+
+            const size_t mcmc_ind = iter_ind - BQREG_WARM_START_DRAWS;
+
+            if (kept_states && mcmc_ind >= n_burnin_draws && (mcmc_ind - n_burnin_draws) % (thinning_factor + 1) == 0) {
+                kept_states->push_back(state);
+            }
+        }
+    };
+
+    // warm starts, outward from the median (here, the first tau): each chain starts from its neighbor on the sorted grid
+
+    std::vector<chain_state_t> warm_states(n_tau);
+
+    {
+        chain_state_t& state = warm_states[0];
+
+        state.beta_draw = beta_initial_draw;
+        state.sigma_draw = qr_sum_sq_resid(Y, X, beta_initial_draw) / fp_t(n);
+        state.nu_draw = ColVec_t::Constant(n, state.sigma_draw);
+    }
+
+    const size_t warm_order[4] = { 0, 3, 1, 2 };
+    const size_t warm_nbr[4] = { 0, 0, 3, 0 };
+
+    for (size_t j = 0; j < n_tau; ++j) {
+        const size_t tau_ind = warm_order[j];
+        chain_state_t& state = warm_states[tau_ind];
+
+        if (j > 0) {
+            state = warm_states[warm_nbr[j]];
+        }
+
+        qr_gram_pass(Y, X, state.nu_draw, (1 - 2 * tau_vec(tau_ind)) / (tau_vec(tau_ind) * (1 - tau_vec(tau_ind))), n_threads, state.gram_mat, state.gram_vec);
+
+        run_iterations(tau_ind, 0, BQREG_WARM_START_DRAWS, state, nullptr);
+    }
+
+    bool is_ok = true;
+
+    for (size_t tau_ind = 0; tau_ind < n_tau; ++tau_ind) {
+        chain_state_t state = warm_states[tau_ind];
+        std::vector<chain_state_t> kept_states;
+
+        run_iterations(tau_ind, BQREG_WARM_START_DRAWS, BQREG_WARM_START_DRAWS + n_burnin_draws + (thinning_factor + 1) * n_keep_draws, state, &kept_states);
+
+        bool is_equal = kept_states.size() == n_keep_draws && size_t(beta_draws_multi[tau_ind].cols()) == n_keep_draws;
+
+        for (size_t draw_ind = 0; is_equal && draw_ind < n_keep_draws; ++draw_ind) {
+            const chain_state_t& kept_state = kept_states[draw_ind];
+
+            is_equal = (beta_draws_multi[tau_ind].col(draw_ind).array() == kept_state.beta_draw.array()).all()
+                        && (z_draws_multi[tau_ind].col(draw_ind).array() == (kept_state.nu_draw / kept_state.sigma_draw).array()).all()
+                        && sigma_draws_multi(draw_ind, tau_ind) == kept_state.sigma_draw;
+        }
+
+        std::cout << "tau = " << tau_vec(tau_ind) << ": " << (is_equal ? "identical" : "differ") << std::endl;
+
+        is_ok = is_ok && is_equal;
+    }
+
+    if (!is_ok) {
+        std::cout << "the multi-tau draws differ from the single-tau runs" << std::endl;
+        return 1;
+    }
+
+    std::cout << "multi-tau draws match the single-tau runs" << std::endl;
+
+    return 0;
+}
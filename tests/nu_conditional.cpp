@@ -0,0 +1,126 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+/*
+ * The latent nu conditional: moments of counter_rnu against those of GIG(1/2, delta^2, gamma^2),
+ *
+ *   E[nu] = (delta / gamma) (1 + 1/z),  Var[nu] = (delta / gamma)^2 (1/z + 2/z^2),  z = gamma delta,
+ *
+ * and, for delta > 0, of its reciprocal, inverse Gaussian with mean gamma / delta and shape gamma^2:
+ *
+ *   E[1/nu] = gamma / delta,  Var[1/nu] = gamma / delta^3
+ */
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+// sample mean and variance, with standard errors from the sample moments
+
+struct moment_check_t
+{
+    double mean_val = 0;
+    double var_val = 0;
+    double mean_se = 0;
+    double var_se = 0;
+};
+
+moment_check_t
+get_moments(const std::vector<double>& draws)
+{
+    const double n_draws = double(draws.size());
+
+    moment_check_t out;
+
+    for (const double x : draws) {
+        out.mean_val += x / n_draws;
+    }
+
+    double m4_val = 0;
+
+    for (const double x : draws) {
+        const double dev_sq = (x - out.mean_val) * (x - out.mean_val);
+
+        out.var_val += dev_sq / n_draws;
+        m4_val += dev_sq * dev_sq / n_draws;
+    }
+
+    out.mean_se = std::sqrt(out.var_val / n_draws);
+    out.var_se = std::sqrt( std::max(m4_val - out.var_val * out.var_val, 0.0) / n_draws );
+
+    return out;
+}
+
+bool
+check_moments(const char* label, const moment_check_t& sample, const double mean_val, const double var_val)
+{
+    const double mean_z = (sample.mean_val - mean_val) / sample.mean_se;
+    const double var_z = (sample.var_val - var_val) / sample.var_se;
+
+    std::cout << "    " << label << ": mean " << std::setw(12) << sample.mean_val << " (" << std::setw(12) << mean_val << ", z = " << std::setw(6) << std::setprecision(2) << mean_z << std::setprecision(6) << ")"
+              << "  var " << std::setw(12) << sample.var_val << " (" << std::setw(12) << var_val << ", z = " << std::setw(6) << std::setprecision(2) << var_z << std::setprecision(6) << ")" << std::endl;
+
+    return std::abs(mean_z) < 5 && std::abs(var_z) < 5;
+}
+
+int main()
+{
+    const size_t n_draws = 1000000;
+
+    // (gamma, delta): moderate, large and small residuals, a residual near zero, and a zero residual
+
+    const double par_vals[5][2] = { {1.0, 1.0}, {2.0, 0.5}, {0.7, 3.0}, {1.5, 1e-3}, {1.2, 0.0} };
+
+    counter_rng_t rng(20231, 0);
+
+    bool is_ok = true;
+
+    for (uint32_t case_ind = 0; case_ind < 5; ++case_ind) {
+        const double gamma_val = par_vals[case_ind][0];
+        const double delta_val = par_vals[case_ind][1];
+
+        rng.iter_ind = case_ind;
+
+        std::vector<double> nu_draws(n_draws), nu_inv_draws(n_draws);
+
+        for (size_t i = 0; i < n_draws; ++i) {
+            nu_draws[i] = counter_rnu(fp_t(gamma_val), fp_t(delta_val), rng.block(RNG_STREAM_NU, i));
+            nu_inv_draws[i] = 1 / nu_draws[i];
+        }
+
+        std::cout << "gamma = " << gamma_val << ", delta = " << delta_val << std::endl;
+
+        // E[nu] and Var[nu] in a form that stays finite as delta -> 0: 1 / gamma^2 and 2 / gamma^4 at delta = 0
+
+        const double nu_mean = delta_val / gamma_val + 1 / (gamma_val * gamma_val);
+        const double nu_var = delta_val / (gamma_val * gamma_val * gamma_val) + 2 / (gamma_val * gamma_val * gamma_val * gamma_val);
+
+        is_ok = check_moments("nu  ", get_moments(nu_draws), nu_mean, nu_var) && is_ok;
+
+        if (delta_val > 0) {
+            is_ok = check_moments("1/nu", get_moments(nu_inv_draws), gamma_val / delta_val, gamma_val / (delta_val * delta_val * delta_val)) && is_ok;
+        }
+    }
+
+    return is_ok ? 0 : 1;
+}
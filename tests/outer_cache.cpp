@@ -0,0 +1,144 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Packed outer-product cache: the same data pass with and without the cache, for double and float
+ * storage, and the sampler with the cache on 1 and 3 threads
+ *
+ * The draws of the sampler with and without the cache are not compared one by one: the Gram sums
+ * differ in the last bits, and the accept/reject branch of the nu draw can amplify that.
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+template<typename DataVec_t, typename DataMat_t>
+bool
+check_data_pass(const DataVec_t& Y, const DataMat_t& X, const char* label)
+{
+    const size_t n = Y.size();
+    const size_t K = X.cols();
+
+    const fp_t tau = fp_t(0.2);
+    const fp_t theta_par = (1 - 2 * tau) / (tau * (1 - tau));
+    const fp_t omega_sq_par = 2 / (tau * (1 - tau));
+
+    const ColVec_t beta_draw = ColVec_t::LinSpaced(K, fp_t(-1), fp_t(1));
+
+    counter_rng_t rng(77, 0);
+    rng.iter_ind = 3;
+
+    outer_prod_cache_t outer_cache;
+    build_outer_prod_cache(X, n, 2, outer_cache);
+
+    Mat_t gram_mats[2];
+    ColVec_t gram_vecs[2], nu_draws[2];
+    fp_t sum_nu[2], sum_err[2];
+
+    for (int use_cache = 0; use_cache < 2; ++use_cache) {
+        reduction_slots_t slots_ws;
+        set_reduction_slots(slots_ws, get_n_row_blocks(n), K, 1);
+
+        data_pass_ws_t pass_ws;
+        nu_draws[use_cache].resize(n);
+
+        qr_data_pass_team(Y, X, beta_draw, theta_par, omega_sq_par, fp_t(0.8), rng, slots_ws, pass_ws, nu_draws[use_cache], nullptr,
+                          use_cache ? &outer_cache : nullptr);
+
+        get_data_pass_sums(slots_ws, gram_mats[use_cache], gram_vecs[use_cache], sum_nu[use_cache], sum_err[use_cache]);
+    }
+
+    const fp_t gram_err = (gram_mats[1] - gram_mats[0]).cwiseAbs().maxCoeff() / gram_mats[0].cwiseAbs().maxCoeff();
+    const fp_t vec_err = (gram_vecs[1] - gram_vecs[0]).cwiseAbs().maxCoeff() / gram_vecs[0].cwiseAbs().maxCoeff();
+
+    const bool is_ok = (nu_draws[1].array() == nu_draws[0].array()).all() && sum_nu[1] == sum_nu[0] && sum_err[1] == sum_err[0]
+                        && gram_err < 1e-12 && vec_err < 1e-12;
+
+    std::cout << label << ": Gram matrix rel. diff = " << gram_err << ", Gram vector rel. diff = " << vec_err
+              << (is_ok ? "" : "  FAILED") << std::endl;
+
+    return is_ok;
+}
+
+int main()
+{
+    const size_t n = 3001; // a partial last row block
+    const size_t K = 5;
+
+    rand_engine_t data_engine(4321);
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), data_engine);
+    const ColVec_t Y = X * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+    if (!use_outer_prod_cache(n, K, BQREG_OUTER_CACHE_MAX_BYTES) || use_outer_prod_cache(n, K, 0)
+        || use_outer_prod_cache(n, BQREG_OUTER_CACHE_MAX_K + 1, BQREG_OUTER_CACHE_MAX_BYTES)) {
+        std::cout << "use_outer_prod_cache: unexpected choice" << std::endl;
+        return 1;
+    }
+
+    bool is_ok = check_data_pass(Y, X, "double");
+    is_ok = check_data_pass(ColVecF_t(Y.template cast<float>()), MatF_t(X.template cast<float>()), "float") && is_ok;
+
+    // the sampler with the cache: identical draws for any number of threads, and the same posterior means as without it
+
+    Mat_t beta_draws_ref;
+    ColVec_t sigma_draws_ref;
+
+    for (int n_threads : {1, 3, 0}) { // 0: one thread without the cache
+        const size_t outer_cache_max_bytes = (n_threads > 0) ? size_t(BQREG_OUTER_CACHE_MAX_BYTES) : 0;
+
+        Mat_t beta_draws, z_draws;
+        ColVec_t sigma_draws;
+        memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+        rand_engine_t rand_engine(42);
+
+        qr_gibbs(Y, X, fp_t(0.3), ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+                 100, 1000, 0, false, std::max(n_threads, 1), draw_sink, rand_engine, nullptr, nullptr, 0, SAMPLER_SCHEME_STANDARD, outer_cache_max_bytes);
+
+        if (n_threads == 1) {
+            beta_draws_ref = beta_draws;
+            sigma_draws_ref = sigma_draws;
+            continue;
+        }
+
+        if (n_threads > 1) {
+            const bool is_equal = (beta_draws.array() == beta_draws_ref.array()).all() && (sigma_draws.array() == sigma_draws_ref.array()).all();
+
+            std::cout << "cache, threads = " << n_threads << ": " << (is_equal ? "identical" : "DIFFERENT") << std::endl;
+
+            is_ok = is_ok && is_equal;
+        } else {
+            const ColVec_t beta_mean_ref = beta_draws_ref.rowwise().mean();
+            const ColVec_t beta_sd_ref = ( (beta_draws_ref.colwise() - beta_mean_ref).array().square().rowwise().sum() / fp_t(beta_draws_ref.cols() - 1) ).sqrt();
+
+            const fp_t max_diff = ( (beta_draws.rowwise().mean() - beta_mean_ref).array() / beta_sd_ref.array() ).abs().maxCoeff();
+
+            std::cout << "no cache: max. diff. of the posterior means of beta = " << max_diff << " sd" << std::endl;
+
+            is_ok = is_ok && max_diff < 0.25;
+        }
+    }
+
+    return is_ok ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Posterior predictive summaries: the blocked computation matches the full product of the
+ * new rows and the draws, for dense and sparse features, draws in memory and in a draw store,
+ * and any number of threads
+ */
+
+// small blocks, so that the rows are split across many blocks
+
+#define BQREG_PREDICT_BLOCK_BYTES (size_t(64) << 10)
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+// the full m x S product, sorted row by row
+
+void
+naive_predict(const Mat_t& X_new, const Mat_t& beta_draws, const ColVec_t& probs, ColVec_t& pred_mean, Mat_t& pred_quantiles)
+{
+    const Mat_t pred_draws = X_new * beta_draws;
+    const size_t n_draws = beta_draws.cols();
+
+    pred_mean = pred_draws.rowwise().mean();
+    pred_quantiles.resize(X_new.rows(), probs.size());
+
+    for (size_t i = 0; i < size_t(X_new.rows()); ++i) {
+        std::vector<fp_t> vals(n_draws);
+
+        for (size_t s = 0; s < n_draws; ++s) {
+            vals[s] = pred_draws(i,s);
+        }
+
+        std::sort(vals.begin(), vals.end());
+
+        for (size_t p = 0; p < size_t(probs.size()); ++p) {
+            const fp_t pos_val = probs(p) * (n_draws - 1);
+            const size_t lower_ind = static_cast<size_t>(pos_val);
+            const size_t upper_ind = std::min(lower_ind + 1, n_draws - 1);
+
+            pred_quantiles(i,p) = vals[lower_ind] + (pos_val - lower_ind) * (vals[upper_ind] - vals[lower_ind]);
+        }
+    }
+}
+
+bool
+summaries_match(const ColVec_t& mean_a, const Mat_t& quantiles_a, const ColVec_t& mean_b, const Mat_t& quantiles_b)
+{
+    if (mean_a.size() != mean_b.size() || quantiles_a.rows() != quantiles_b.rows() || quantiles_a.cols() != quantiles_b.cols()) {
+        return false;
+    }
+
+    return (mean_a - mean_b).cwiseAbs().maxCoeff() < 1e-10 && (quantiles_a - quantiles_b).cwiseAbs().maxCoeff() < 1e-10;
+}
+
+int main()
+{
+    rand_engine_t rand_engine(1234);
+
+    const size_t n = 400;
+    const size_t m = 300;
+    const size_t K = 5;
+
+    Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+    X.col(0).setOnes();
+
+    const ColVec_t Y = X * ColVec_t::LinSpaced(K, 1, 2) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+    Mat_t X_new = stats::rnorm<Mat_t>(m, K, fp_t(0), fp_t(1), rand_engine);
+    X_new.col(0).setOnes();
+
+    bqreg_t bqreg_obj(Y, X);
+
+    bqreg_obj.set_prior_params(ColVec_t::Zero(K), fp_t(100) * Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+    bqreg_obj.set_quantile_target(fp_t(0.5));
+    bqreg_obj.set_seed_value(99);
+
+    Mat_t beta_draws, z_draws;
+    ColVec_t sigma_draws;
+
+    bqreg_obj.gibbs(500, 1000, 0, beta_draws, z_draws, sigma_draws);
+
+    // unsorted, with the end points
+
+    ColVec_t probs(5);
+    probs << fp_t(0.95), fp_t(0.05), fp_t(0.5), fp_t(0), fp_t(1);
+
+    ColVec_t mean_ref, mean_out;
+    Mat_t quantiles_ref, quantiles_out;
+
+    naive_predict(X_new, beta_draws, probs, mean_ref, quantiles_ref);
+
+    // 1. dense features, on one and several threads
+
+    for (int n_threads : {1, 3}) {
+        bqreg_obj.set_omp_n_threads(n_threads);
+        bqreg_obj.predict(X_new, beta_draws, probs, mean_out, quantiles_out);
+
+        if (!summaries_match(mean_ref, quantiles_ref, mean_out, quantiles_out)) {
+            std::cout << "dense predictions do not match the full product (" << n_threads << " threads)" << std::endl;
+            return 1;
+        }
+    }
+
+    // 2. sparse features
+
+    Mat_t X_new_sparse = X_new;
+    X_new_sparse.rightCols(K - 1) = (X_new.rightCols(K - 1).array().abs() > 1).select(X_new.rightCols(K - 1), fp_t(0));
+
+    naive_predict(X_new_sparse, beta_draws, probs, mean_ref, quantiles_ref);
+
+    bqreg_obj.predict(SpMat_t(X_new_sparse.sparseView()), beta_draws, probs, mean_out, quantiles_out);
+
+    if (!summaries_match(mean_ref, quantiles_ref, mean_out, quantiles_out)) {
+        std::cout << "sparse predictions do not match the full product" << std::endl;
+        return 1;
+    }
+
+    // 3. draws read from a draw store
+
+    const std::string file_path = "predict_draws.bin";
+
+    bqreg_obj.gibbs_to_file(file_path, 500, 1000, 0, true);
+
+    {
+        draw_store_reader_t draw_store(file_path);
+        naive_predict(X_new, draw_store.beta_draws(), probs, mean_ref, quantiles_ref);
+    }
+
+    bqreg_obj.predict(X_new, file_path, probs, mean_out, quantiles_out);
+
+    std::remove(file_path.c_str());
+
+    if (!summaries_match(mean_ref, quantiles_ref, mean_out, quantiles_out)) {
+        std::cout << "predictions from the draw store do not match the full product" << std::endl;
+        return 1;
+    }
+
+    std::cout << "blocked predictions match the full product" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Rolling windows: after rows are retired and appended, the data-pass products carried in the
+ * chain state match a fresh pass over the window, and a warm-started refit with a short
+ * burn-in agrees with a cold fit on the same rows
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+// the products of the state against a fresh pass over the rows of the window
+
+bool
+state_gram_matches(const bqreg_t& bqreg_obj, const fp_t tau)
+{
+    const sampler_state_t& state = bqreg_obj.get_sampler_state();
+    const std::vector<size_t> slots = bqreg_obj.get_window_slots();
+
+    const size_t K = bqreg_obj.X.cols();
+    const fp_t theta_par = (1 - 2 * tau) / (tau * (1 - tau));
+
+    Mat_t gram_mat = Mat_t::Zero(K, K);
+    ColVec_t gram_vec = ColVec_t::Zero(K);
+
+    for (size_t i : slots) {
+        const fp_t w_val = fp_t(1) / state.nu_draw(i);
+
+        gram_mat.noalias() += w_val * bqreg_obj.X.row(i).transpose() * bqreg_obj.X.row(i);
+        gram_vec.noalias() += w_val * ( bqreg_obj.Y(i) - theta_par * state.nu_draw(i) ) * bqreg_obj.X.row(i).transpose();
+    }
+
+    const fp_t err_val = (state.gram_mat - gram_mat).norm() / gram_mat.norm() + (state.gram_vec - gram_vec).norm() / gram_vec.norm();
+
+    return err_val < 1e-8;
+}
+
+// posterior means of a warm-started fit and a cold fit on the same rows
+
+bool
+warm_fit_matches(bqreg_t& bqreg_obj, const ColVec_t& Y_window, const Mat_t& X_window)
+{
+    const size_t K = X_window.cols();
+
+    Mat_t beta_warm, z_warm, beta_cold, z_cold;
+    ColVec_t sigma_warm, sigma_cold;
+
+    bqreg_obj.gibbs_warm(50, 1000, 0, beta_warm, z_warm, sigma_warm);
+
+    bqreg_t obj_cold(Y_window, X_window);
+    obj_cold.set_prior_params(ColVec_t::Zero(K), fp_t(100) * Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+    obj_cold.set_quantile_target(bqreg_obj.tau);
+    obj_cold.set_seed_value(17);
+    obj_cold.gibbs(1000, 1000, 0, beta_cold, z_cold, sigma_cold);
+
+    // the difference in posterior means, in units of the posterior standard deviation
+
+    const ColVec_t mean_cold = beta_cold.rowwise().mean();
+    const ColVec_t sd_cold = ( (beta_cold.colwise() - mean_cold).array().square().rowwise().mean() ).sqrt().matrix();
+
+    const fp_t diff_val = ( (beta_warm.rowwise().mean() - mean_cold).array().abs() / sd_cold.array() ).maxCoeff();
+
+    std::cout << "  window of " << X_window.rows() << " rows: max |warm - cold| / sd of the posterior means of beta = " << diff_val << std::endl;
+
+    return diff_val < 0.5 && size_t(z_warm.rows()) == size_t(X_window.rows());
+}
+
+int main()
+{
+    rand_engine_t rand_engine(4242);
+
+    const size_t n_stream = 1200;
+    const size_t n = 600;
+    const size_t K = 4;
+    const fp_t tau = fp_t(0.5);
+
+    Mat_t X_stream = stats::rnorm<Mat_t>(n_stream, K, fp_t(0), fp_t(1), rand_engine);
+    X_stream.col(0).setOnes();
+
+    const ColVec_t Y_stream = X_stream * ColVec_t::LinSpaced(K, 1, 2) + stats::rnorm<ColVec_t>(n_stream, 1, fp_t(0), fp_t(1), rand_engine);
+
+    bqreg_t bqreg_obj(Y_stream.head(n), X_stream.topRows(n));
+
+    bqreg_obj.set_prior_params(ColVec_t::Zero(K), fp_t(100) * Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+    bqreg_obj.set_quantile_target(tau);
+    bqreg_obj.set_seed_value(2024);
+
+    Mat_t beta_draws, z_draws;
+    ColVec_t sigma_draws;
+
+    bqreg_obj.gibbs(1000, 200, 0, beta_draws, z_draws, sigma_draws);
+
+    const ColVec_t nu_prev = bqreg_obj.get_sampler_state().nu_draw;
+
+    // 1. slide by 100 rows: the new rows take the freed slots, and the retained rows keep their nu draws
+
+    bqreg_obj.retire_rows(100);
+    bqreg_obj.append_rows(Y_stream.segment(n, 100), X_stream.middleRows(n, 100));
+
+    const std::vector<size_t> slots = bqreg_obj.get_window_slots();
+
+    if (size_t(bqreg_obj.X.rows()) != n || slots.front() != 100 || slots.back() != 99) {
+        return 1;
+    }
+
+    if (!(bqreg_obj.get_sampler_state().nu_draw.tail(n - 100).array() == nu_prev.tail(n - 100).array()).all()) {
+        return 1;
+    }
+
+    if (!state_gram_matches(bqreg_obj, tau)) {
+        std::cout << "the data-pass products were not updated with the window" << std::endl;
+        return 1;
+    }
+
+    // the rows in time order, for the cold fits
+
+    auto window_rows = [&](const size_t row_start, const size_t n_rows, ColVec_t& Y_window, Mat_t& X_window)
+    {
+        Y_window = Y_stream.segment(row_start, n_rows);
+        X_window = X_stream.middleRows(row_start, n_rows);
+    };
+
+    ColVec_t Y_window;
+    Mat_t X_window;
+
+    window_rows(100, n, Y_window, X_window);
+
+    if (!warm_fit_matches(bqreg_obj, Y_window, X_window)) {
+        return 1;
+    }
+
+    // 2. shrink (free slots left over, compacted before the run), then grow past the free slots
+
+    bqreg_obj.retire_rows(150);
+    bqreg_obj.append_rows(Y_stream.segment(n + 100, 50), X_stream.middleRows(n + 100, 50));
+
+    if (!state_gram_matches(bqreg_obj, tau)) {
+        return 1;
+    }
+
+    window_rows(250, n - 100, Y_window, X_window);
+
+    if (!warm_fit_matches(bqreg_obj, Y_window, X_window)) {
+        return 1;
+    }
+
+    bqreg_obj.append_rows(Y_stream.segment(n + 150, 200), X_stream.middleRows(n + 150, 200));
+
+    if (!state_gram_matches(bqreg_obj, tau) || bqreg_obj.get_window_slots().front() != 0) {
+        return 1;
+    }
+
+    window_rows(250, n + 100, Y_window, X_window);
+
+    if (!warm_fit_matches(bqreg_obj, Y_window, X_window)) {
+        return 1;
+    }
+
+    // 3. sparse storage, where appended rows rebuild the matrix
+
+    bqreg_t obj_sparse(Y_stream.head(n), X_stream.topRows(n));
+
+    obj_sparse.load_data(Y_stream.head(n), SpMat_t(X_stream.topRows(n).sparseView()));
+    obj_sparse.set_prior_params(ColVec_t::Zero(K), fp_t(100) * Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+    obj_sparse.set_quantile_target(tau);
+    obj_sparse.set_seed_value(2025);
+    obj_sparse.gibbs(1000, 200, 0, beta_draws, z_draws, sigma_draws);
+
+    obj_sparse.retire_rows(100);
+    obj_sparse.append_rows(Y_stream.segment(n, 100), SpMat_t(X_stream.middleRows(n, 100).sparseView()));
+
+    window_rows(100, n, Y_window, X_window);
+
+    if (!warm_fit_matches(obj_sparse, Y_window, X_window)) {
+        return 1;
+    }
+
+    std::cout << "warm-started refits on the moved windows match cold fits" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Sampler benchmark: one configuration per process, reported as a single line of JSON
+ *
+ *   ./sampler_bench.test n=100000 K=20 threads=4 errors=t3 design=collinear storage=float
+ *
+ * Arguments (all optional):
+ *   n, K                  data size (default 10000 x 10)
+ *   threads               omp_n_threads passed to the sampler (default -1)
+ *   errors                gaussian | t3 (default gaussian)
+ *   design                dense | collinear (default dense)
+ *   storage               double | float: storage precision of X and Y (default double); always float when fp_t is float
+ *   tau                   the target quantile (default 0.5)
+ *   scheme                standard | collapsed | interweaved: the update scheme of the sampler (default standard)
+ *   outer_cache           byte budget of the packed outer-product cache; 0 turns it off (default BQREG_OUTER_CACHE_MAX_BYTES)
+ *   burnin, keep          numbers of draws (default 200, 1000)
+ *   seed                  seed for the data and the sampler (default 1111)
+ *   dump                  write the generated data to this file, for timing the Python and R bindings
+ *
+ * The fp_t used for all computations is set at compile time with BQREG_FPN_TYPE. Efficiency is reported
+ * as effective draws (the smallest bulk ESS over beta and sigma) per second of wall time and per
+ * second of CPU time, the latter summed over the threads.
+ */
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include <sys/resource.h>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+// synthetic data
+
+inline
+Mat_t
+bench_design(const size_t n, const size_t K, const std::string& design, rand_engine_t& rand_engine)
+{
+    Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+
+    if (design == "collinear") {
+        // neighboring columns have correlation 0.99
+
+        const fp_t rho_val = fp_t(0.99);
+
+        for (size_t k = 1; k < K; ++k) {
+            X.col(k) = rho_val * X.col(k-1) + std::sqrt(1 - rho_val * rho_val) * X.col(k);
+        }
+    } else if (design != "dense") {
+        throw std::invalid_argument("sampler_bench: unknown design '" + design + "'");
+    }
+
+    X.col(0).setOnes();
+
+    return X;
+}
+
+inline
+ColVec_t
+bench_errors(const size_t n, const std::string& errors, rand_engine_t& rand_engine)
+{
+    ColVec_t err_vec = stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+    if (errors == "t3") {
+        // Student's t with 3 degrees of freedom: z / sqrt(chi^2_3 / 3)
+
+        for (size_t i = 0; i < n; ++i) {
+            err_vec(i) /= std::sqrt( stats::rgamma(fp_t(1.5), fp_t(2), rand_engine) / fp_t(3) );
+        }
+    } else if (errors != "gaussian") {
+        throw std::invalid_argument("sampler_bench: unknown error distribution '" + errors + "'");
+    }
+
+    return err_vec;
+}
+
+// header: n and K as uint64, then Y and X (column-major) as float64
+
+inline
+void
+bench_dump_data(const std::string& file_path, const ColVec_t& Y, const Mat_t& X)
+{
+    std::ofstream out_file(file_path, std::ios::binary);
+
+    if (!out_file) {
+        throw std::runtime_error("sampler_bench: could not open '" + file_path + "' for writing");
+    }
+
+    const uint64_t dims[2] = { uint64_t(X.rows()), uint64_t(X.cols()) };
+    out_file.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+
+    const Eigen::VectorXd Y_d = Y.template cast<double>();
+    const Eigen::MatrixXd X_d = X.template cast<double>();
+
+    out_file.write(reinterpret_cast<const char*>(Y_d.data()), Y_d.size() * sizeof(double));
+    out_file.write(reinterpret_cast<const char*>(X_d.data()), X_d.size() * sizeof(double));
+}
+
+inline
+double
+cpu_seconds()
+{
+    struct rusage usage_obj;
+    getrusage(RUSAGE_SELF, &usage_obj);
+
+    return double(usage_obj.ru_utime.tv_sec + usage_obj.ru_stime.tv_sec) + 1e-6 * double(usage_obj.ru_utime.tv_usec + usage_obj.ru_stime.tv_usec);
+}
+
+inline
+long
+peak_rss_kb()
+{
+    struct rusage usage_obj;
+    getrusage(RUSAGE_SELF, &usage_obj);
+
+    return usage_obj.ru_maxrss; // kilobytes on Linux
+}
+
+int main(int argc, char** argv)
+{
+    std::map<std::string, std::string> args = {
+        {"n", "10000"}, {"K", "10"}, {"threads", "-1"}, {"errors", "gaussian"}, {"design", "dense"},
+        {"storage", "double"}, {"tau", "0.5"}, {"scheme", "standard"},
+        {"outer_cache", std::to_string(size_t(BQREG_OUTER_CACHE_MAX_BYTES))}, {"burnin", "200"}, {"keep", "1000"}, {"seed", "1111"}, {"dump", ""}
+    };
+
+    for (int arg_ind = 1; arg_ind < argc; ++arg_ind) {
+        const std::string arg_str = argv[arg_ind];
+        const size_t eq_pos = arg_str.find('=');
+
+        if (eq_pos == std::string::npos || args.count(arg_str.substr(0, eq_pos)) == 0) {
+            std::cerr << "sampler_bench: unknown argument '" << arg_str << "'" << std::endl;
+            return 1;
+        }
+
+        args[arg_str.substr(0, eq_pos)] = arg_str.substr(eq_pos + 1);
+    }
+
+    const size_t n = std::stoul(args["n"]);
+    const size_t K = std::stoul(args["K"]);
+    const int omp_n_threads = std::stoi(args["threads"]);
+    const size_t n_burnin_draws = std::stoul(args["burnin"]);
+    const size_t n_keep_draws = std::stoul(args["keep"]);
+    const size_t seed_val = std::stoul(args["seed"]);
+    const fp_t tau = static_cast<fp_t>(std::stod(args["tau"]));
+    const sampler_scheme_t sampler_scheme = sampler_scheme_from_string(args["scheme"]);
+    const size_t outer_cache_max_bytes = std::stoul(args["outer_cache"]);
+
+    // data
+
+    rand_engine_t rand_engine(seed_val);
+
+    const Mat_t X = bench_design(n, K, args["design"], rand_engine);
+    const ColVec_t beta_true = ColVec_t::LinSpaced(K, fp_t(-1), fp_t(1));
+    const ColVec_t Y = X * beta_true + bench_errors(n, args["errors"], rand_engine);
+
+    if (!args["dump"].empty()) {
+        bench_dump_data(args["dump"], Y, X);
+    }
+
+    // sampler, with the same settings as the Python and R wrappers
+
+    bqreg_t bqreg_obj(Y, X);
+
+    if (args["storage"] == "float") {
+        bqreg_obj.load_data(ColVecF_t(Y.template cast<float>()), MatF_t(X.template cast<float>()));
+    } else if (args["storage"] != "double") {
+        std::cerr << "sampler_bench: unknown storage '" << args["storage"] << "'" << std::endl;
+        return 1;
+    }
+
+    bqreg_obj.set_prior_params(ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+    bqreg_obj.set_quantile_target(tau);
+    bqreg_obj.set_initial_beta_draw(ColVec_t::Zero(K));
+    bqreg_obj.set_omp_n_threads(omp_n_threads);
+    bqreg_obj.set_seed_value(seed_val);
+    bqreg_obj.set_sampler_scheme(sampler_scheme);
+    bqreg_obj.set_outer_cache_budget(outer_cache_max_bytes);
+
+    Mat_t beta_draws, z_draws;
+    ColVec_t sigma_draws;
+
+    auto start_time = std::chrono::steady_clock::now();
+    const double start_cpu_time = cpu_seconds();
+
+    bqreg_obj.gibbs(n_burnin_draws, n_keep_draws, 0, beta_draws, z_draws, sigma_draws);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    const double time_val = elapsed.count();
+    const double cpu_time_val = cpu_seconds() - start_cpu_time;
+
+    // ESS of each element of beta, from the single chain, and of sigma
+
+    ColVec_t ess_vec(K);
+
+    for (size_t k = 0; k < K; ++k) {
+        ess_vec(k) = ess_bulk(Mat_t(beta_draws.row(k).transpose()));
+    }
+
+    const fp_t ess_sigma_val = ess_bulk(Mat_t(sigma_draws));
+    const double ess_min_val = std::min(double(ess_vec.minCoeff()), double(ess_sigma_val));
+
+    std::ostringstream json_out;
+
+    json_out << "{"
+             << "\"n\": " << n << ", \"K\": " << K << ", \"threads\": " << omp_n_threads
+             << ", \"errors\": \"" << args["errors"] << "\", \"design\": \"" << args["design"] << "\""
+             << ", \"fp_type\": \"" << (sizeof(fp_t) == sizeof(float) ? "float" : "double") << "\""
+             << ", \"storage\": \"" << (sizeof(fp_t) == sizeof(float) ? "float" : args["storage"]) << "\""
+             << ", \"tau\": " << tau << ", \"scheme\": \"" << sampler_scheme_to_string(sampler_scheme) << "\""
+             << ", \"outer_cache\": " << (use_outer_prod_cache(n, K, outer_cache_max_bytes) ? "true" : "false")
+             << ", \"n_burnin_draws\": " << n_burnin_draws << ", \"n_keep_draws\": " << n_keep_draws
+             << ", \"seed\": " << seed_val
+             << ", \"sampler_seconds\": " << time_val
+             << ", \"iter_per_sec\": " << (n_burnin_draws + n_keep_draws) / time_val
+             << ", \"ess_per_sec_min\": " << ess_vec.minCoeff() / time_val
+             << ", \"ess_per_sec_mean\": " << ess_vec.mean() / time_val
+             << ", \"cpu_seconds\": " << cpu_time_val
+             << ", \"ess_sigma\": " << ess_sigma_val
+             << ", \"ess_per_sec_all_min\": " << ess_min_val / time_val
+             << ", \"ess_per_cpu_sec_all_min\": " << ess_min_val / cpu_time_val
+             << ", \"peak_rss_kb\": " << peak_rss_kb()
+             << ", \"beta_finite\": " << (beta_draws.allFinite() ? "true" : "false")
+             << "}";
+
+    std::cout << json_out.str() << std::endl;
+
+    return beta_draws.allFinite() ? 0 : 1;
+}
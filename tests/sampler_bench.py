@@ -0,0 +1,201 @@
+################################################################################
+##
+##   Copyright (C) 2021-2023 Keith O'Hara
+##
+##   This file is part of the BayesianQuantileRegression library.
+##
+##   Licensed under the Apache License, Version 2.0 (the "License");
+##   you may not use this file except in compliance with the License.
+##   You may obtain a copy of the License at
+##
+##       http://www.apache.org/licenses/LICENSE-2.0
+##
+##   Unless required by applicable law or agreed to in writing, software
+##   distributed under the License is distributed on an "AS IS" BASIS,
+##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+##   See the License for the specific language governing permissions and
+##   limitations under the License.
+##
+################################################################################
+
+'''
+Sweep driver for sampler_bench.test and sampler_bench_float.test
+
+    python3 sampler_bench.py --out bench.json
+    python3 sampler_bench.py --n 1000 10000 --K 10 --threads 1 4 --out bench.json
+    python3 sampler_bench.py --n 10000 --K 10 --threads 1 --tau 0.01 0.5 0.99 --scheme standard collapsed interweaved
+
+Each configuration is run in its own process, so that peak RSS is per configuration.
+The Python and R bindings, when installed, are timed on the same data with the same seed and
+number of threads; the overhead is the wall time of the binding call less the sampler time
+reported by the C++ benchmark. The output is a JSON array with one object per configuration.
+When more than one scheme is given, the scheme with the most effective draws per CPU second is
+listed for each of the other settings.
+'''
+
+import argparse
+import itertools
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+def run_cpp(binary, config, dump_path=None):
+    args = [binary] + ["{}={}".format(key, val) for key, val in config.items()]
+
+    if dump_path is not None:
+        args.append("dump={}".format(dump_path))
+
+    out = subprocess.run(args, check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+
+    return json.loads(out.strip().splitlines()[-1])
+
+def read_dump(dump_path):
+    import numpy as np
+
+    with open(dump_path, "rb") as f:
+        n, K = np.fromfile(f, dtype=np.uint64, count=2)
+        Y = np.fromfile(f, dtype=np.float64, count=int(n))
+        X = np.fromfile(f, dtype=np.float64, count=int(n * K)).reshape((int(n), int(K)), order="F")
+
+    return Y, X
+
+def time_python(dump_path, config):
+    try:
+        import numpy as np
+        from pybqreg import BayesianQuantileRegression
+    except ImportError:
+        return None
+
+    Y, X = read_dump(dump_path)
+
+    if config["storage"] == "float":
+        X = X.astype(np.float32)
+
+    start_time = time.perf_counter()
+
+    bqreg_obj = BayesianQuantileRegression(Y, X)
+    bqreg_obj.set_seed_value(config["seed"])
+    bqreg_obj.set_omp_n_threads(config["threads"])
+    bqreg_obj.set_sampler_scheme(config["scheme"])
+    bqreg_obj.fit(config["tau"], config["burnin"], config["keep"], 0)
+
+    return time.perf_counter() - start_time
+
+R_BENCH_SCRIPT = '''
+suppressMessages(library(BQReg.Rcpp))
+con <- file("{dump_path}", "rb")
+dims <- readBin(con, "integer", n = 4, size = 4)
+n <- dims[1]; K <- dims[3]
+Y <- readBin(con, "double", n = n)
+X <- matrix(readBin(con, "double", n = n * K), n, K)
+close(con)
+start_time <- proc.time()[["elapsed"]]
+obj <- new(bqreg)
+obj$load_data(Y, X)
+obj$set_prior_params(rep(0, K), diag(K), 3, 3)
+obj$set_initial_beta_draw(rep(0, K))
+obj$set_quantile_target({tau})
+obj$set_seed_value({seed})
+obj$set_omp_n_threads({threads})
+obj$set_sampler_scheme("{scheme}")
+draws <- obj$gibbs({burnin}, {keep}, 0)
+cat(proc.time()[["elapsed"]] - start_time, "\\n")
+'''
+
+def time_r(dump_path, config):
+    if shutil.which("Rscript") is None:
+        return None
+
+    script = R_BENCH_SCRIPT.format(dump_path=dump_path, **config)
+
+    res = subprocess.run(["Rscript", "-e", script], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True)
+
+    if res.returncode != 0:
+        return None # BQReg.Rcpp is not installed
+
+    return float(res.stdout.strip().split()[-1])
+
+def print_best_schemes(results):
+    best = {}
+
+    for res in results:
+        key = tuple(res[name] for name in ("n", "K", "threads", "errors", "design", "fp_type", "storage", "tau"))
+
+        if key not in best or res["ess_per_cpu_sec_all_min"] > best[key]["ess_per_cpu_sec_all_min"]:
+            best[key] = res
+
+    print("\nmost effective draws per CPU second:")
+
+    for res in best.values():
+        print("  n={n} K={K} threads={threads} errors={errors} design={design} fp_type={fp_type} storage={storage} tau={tau}: "
+              "{scheme} ({ess_per_cpu_sec_all_min:.1f})".format(**res))
+
+def main():
+    parser = argparse.ArgumentParser(description="BQReg sampler benchmark sweep")
+    parser.add_argument("--n", type=int, nargs="+", default=[1000, 10000, 100000])
+    parser.add_argument("--K", type=int, nargs="+", default=[10, 50])
+    parser.add_argument("--threads", type=int, nargs="+", default=[1, os.cpu_count()])
+    parser.add_argument("--errors", nargs="+", default=["gaussian", "t3"])
+    parser.add_argument("--design", nargs="+", default=["dense", "collinear"])
+    parser.add_argument("--storage", nargs="+", default=["double", "float"])
+    parser.add_argument("--tau", type=float, nargs="+", default=[0.5])
+    parser.add_argument("--scheme", nargs="+", default=["standard"], choices=["standard", "collapsed", "interweaved"])
+    parser.add_argument("--burnin", type=int, default=200)
+    parser.add_argument("--keep", type=int, default=1000)
+    parser.add_argument("--seed", type=int, default=1111)
+    parser.add_argument("--no-bindings", action="store_true", help="do not time the Python and R bindings")
+    parser.add_argument("--bin-dir", default=os.path.dirname(os.path.abspath(__file__)))
+    parser.add_argument("--out", default="bench_output.json")
+    opts = parser.parse_args()
+
+    # BQREG_FPN_TYPE is fixed at compile time, so each value has its own binary
+
+    binaries = [("double", os.path.join(opts.bin_dir, "sampler_bench.test")),
+                ("float", os.path.join(opts.bin_dir, "sampler_bench_float.test"))]
+
+    binaries = [(fp_type, path) for fp_type, path in binaries if os.path.exists(path)]
+
+    if not binaries:
+        sys.exit("sampler_bench.py: build the benchmark first, with 'make bench_build'")
+
+    results = []
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        dump_path = os.path.join(tmp_dir, "bench_data.bin")
+
+        for n, K, threads, errors, design, storage, tau, scheme in itertools.product(opts.n, opts.K, list(dict.fromkeys(opts.threads)), opts.errors, opts.design,
+                                                                                      opts.storage, opts.tau, opts.scheme):
+            config = {"n": n, "K": K, "threads": threads, "errors": errors, "design": design, "storage": storage,
+                      "tau": tau, "scheme": scheme, "burnin": opts.burnin, "keep": opts.keep, "seed": opts.seed}
+
+            for fp_type, binary in binaries:
+                if fp_type == "float" and storage == "float":
+                    continue # same as storage=double with fp_t = float
+
+                time_bindings = (not opts.no_bindings) and fp_type == "double" # the bindings are built with fp_t = double
+
+                res = run_cpp(binary, config, dump_path if time_bindings else None)
+
+                if time_bindings:
+                    for binding, time_fn in (("python", time_python), ("r", time_r)):
+                        binding_time = time_fn(dump_path, config)
+
+                        if binding_time is not None:
+                            res[binding + "_seconds"] = binding_time
+                            res[binding + "_overhead_seconds"] = binding_time - res["sampler_seconds"]
+
+                print(json.dumps(res), flush=True)
+                results.append(res)
+
+    with open(opts.out, "w") as f:
+        json.dump(results, f, indent=2)
+
+    if len(opts.scheme) > 1:
+        print_best_schemes(results)
+
+if __name__ == "__main__":
+    main()
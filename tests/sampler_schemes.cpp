@@ -0,0 +1,112 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Sampler schemes: the collapsed and interweaved sigma steps target the same posterior as the
+ * standard scheme, and keep the draws independent of the number of threads
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+void
+run_scheme(const ColVec_t& Y, const Mat_t& X, const fp_t tau, const sampler_scheme_t scheme, const size_t n_keep_draws, const int n_threads,
+           Mat_t& beta_draws, ColVec_t& sigma_draws)
+{
+    const size_t K = X.cols();
+
+    Mat_t z_draws;
+    memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+
+    counter_rng_t rng(2024, 0);
+
+    qr_gibbs(Y, X, tau, ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+             500, n_keep_draws, 0, false, n_threads, draw_sink, rng, nullptr, nullptr, 0, scheme);
+}
+
+// the two sets of draws agree on the posterior mean, within Monte Carlo error
+
+bool
+check_mean(const std::string& name, const Mat_t& draws, const Mat_t& draws_ref)
+{
+    const fp_t mean_val = draws.mean();
+    const fp_t mean_ref_val = draws_ref.mean();
+
+    const fp_t var_val = (draws.array() - mean_val).square().mean();
+
+    const fp_t mcse_val = std::sqrt( var_val / ess_bulk(draws) + var_val / ess_bulk(draws_ref) );
+
+    std::cout << "  " << name << ": " << mean_val << " vs. " << mean_ref_val << " (mcse " << mcse_val << ", ess " << ess_bulk(draws) << " vs. " << ess_bulk(draws_ref) << ")" << std::endl;
+
+    return std::abs(mean_val - mean_ref_val) < 5 * mcse_val;
+}
+
+int main()
+{
+    const size_t n = 2000;
+    const size_t K = 4;
+
+    rand_engine_t data_engine(1234);
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), data_engine);
+    const ColVec_t Y = X * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+    bool success = true;
+
+    for (fp_t tau : {fp_t(0.05), fp_t(0.5)}) {
+        Mat_t beta_draws_ref;
+        ColVec_t sigma_draws_ref;
+
+        run_scheme(Y, X, tau, SAMPLER_SCHEME_STANDARD, 4000, 1, beta_draws_ref, sigma_draws_ref);
+
+        for (sampler_scheme_t scheme : {SAMPLER_SCHEME_COLLAPSED, SAMPLER_SCHEME_INTERWEAVED}) {
+            std::cout << "tau = " << tau << ", " << sampler_scheme_to_string(scheme) << ":" << std::endl;
+
+            Mat_t beta_draws;
+            ColVec_t sigma_draws;
+
+            run_scheme(Y, X, tau, scheme, 4000, 1, beta_draws, sigma_draws);
+
+            for (size_t k = 0; k < K; ++k) {
+                success &= check_mean("beta_" + std::to_string(k), beta_draws.row(k).transpose(), beta_draws_ref.row(k).transpose());
+            }
+
+            success &= check_mean("sigma", sigma_draws, sigma_draws_ref);
+
+            // thread invariance
+
+            Mat_t beta_draws_threads;
+            ColVec_t sigma_draws_threads;
+
+            run_scheme(Y, X, tau, scheme, 200, 3, beta_draws_threads, sigma_draws_threads);
+
+            const bool is_equal = (beta_draws_threads.array() == beta_draws.leftCols(200).array()).all() && (sigma_draws_threads.array() == sigma_draws.head(200).array()).all();
+
+            std::cout << "  threads = 3: " << (is_equal ? "identical" : "DIFFERENT") << std::endl;
+
+            success &= is_equal;
+        }
+    }
+
+    return success ? 0 : 1;
+}
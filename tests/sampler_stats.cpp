@@ -0,0 +1,108 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Sampler statistics: with BQREG_ENABLE_SAMPLER_STATS (see the sampler_stats target of the
+ * Makefile), the phase times are filled in and add up to the wall time of the run; without it,
+ * the statistics stay zero
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+int main()
+{
+    const size_t n = 20000;
+    const size_t K = 10;
+    const int n_threads = 2;
+
+    rand_engine_t data_engine(1234);
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), data_engine);
+    const ColVec_t Y = X * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+    bqreg_t obj(Y, X);
+    obj.set_prior_params(ColVec_t::Zero(K), fp_t(100) * Mat_t::Identity(K,K), fp_t(3), fp_t(3));
+    obj.set_quantile_target(fp_t(0.3));
+    obj.set_seed_value(42);
+    obj.set_omp_n_threads(n_threads);
+
+    Mat_t beta_draws, z_draws;
+    ColVec_t sigma_draws;
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    obj.gibbs(100, 200, 0, beta_draws, z_draws, sigma_draws);
+
+    const double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    const sampler_stats_t& stats = obj.get_sampler_stats();
+
+    const double phase_seconds = stats.setup_seconds + stats.beta_draw_seconds + stats.data_pass_seconds
+                                    + stats.sigma_draw_seconds + stats.store_seconds;
+
+    std::cout << "wall (s) = " << wall_seconds << ", total (s) = " << stats.total_seconds << ", sum of phases (s) = " << phase_seconds
+              << ", load imbalance = " << stats.load_imbalance() << std::endl;
+
+#ifdef BQREG_ENABLE_SAMPLER_STATS
+    if (!stats.enabled) {
+        std::cout << "the statistics are not marked as enabled" << std::endl;
+        return 1;
+    }
+
+    if (stats.n_iterations != 300) {
+        std::cout << "wrong number of iterations: " << stats.n_iterations << std::endl;
+        return 1;
+    }
+
+    if (!(stats.setup_seconds > 0 && stats.beta_draw_seconds > 0 && stats.data_pass_seconds > 0
+          && stats.sigma_draw_seconds > 0 && stats.store_seconds > 0)) {
+        std::cout << "a phase time is zero" << std::endl;
+        return 1;
+    }
+
+    // the phases cover the run, up to the untimed bookkeeping between them
+
+    if (stats.total_seconds > wall_seconds || phase_seconds > stats.total_seconds || phase_seconds < 0.8 * stats.total_seconds) {
+        std::cout << "the phase times do not add up to the wall time" << std::endl;
+        return 1;
+    }
+
+    if (stats.thread_busy_seconds.size() != size_t(n_threads) || !(stats.load_imbalance() >= 1)) {
+        std::cout << "the load imbalance is not at least one" << std::endl;
+        return 1;
+    }
+
+    std::cout << "sampler statistics passed" << std::endl;
+#else
+    if (stats.enabled || stats.total_seconds != 0 || phase_seconds != 0 || stats.n_workspace_allocs != 0) {
+        std::cout << "statistics were collected without BQREG_ENABLE_SAMPLER_STATS" << std::endl;
+        return 1;
+    }
+
+    std::cout << "sampler statistics are off without BQREG_ENABLE_SAMPLER_STATS" << std::endl;
+#endif
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Sparse design matrix: one-hot encoded categoricals, sparse vs dense storage of X
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+template<typename DataMat_t>
+double
+run_sampler(const ColVec_t& Y, const DataMat_t& X, Mat_t& beta_draws)
+{
+    const size_t K = X.cols();
+
+    Mat_t z_draws;
+    ColVec_t sigma_draws;
+
+    rand_engine_t rand_engine(1111);
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    qr_gibbs(Y, X, fp_t(0.5), ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+             50, 100, 0, false, -1, beta_draws, z_draws, sigma_draws, rand_engine);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    return elapsed.count();
+}
+
+int main()
+{
+    const size_t n = 10000;
+
+    rand_engine_t rand_engine(2222);
+
+    std::cout << std::setw(6) << "K" << std::setw(12) << "density" << std::setw(14) << "dense (s)" << std::setw(14) << "sparse (s)"
+              << std::setw(10) << "speedup" << std::setw(16) << "max |diff|/sd" << std::endl;
+
+    // 3 categoricals with K / 3 levels each
+
+    for (size_t K : {30, 240}) {
+        const size_t n_levels = K / 3;
+
+        std::vector<Eigen::Triplet<fp_t>> triplets;
+
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < 3; ++j) {
+                const size_t level_ind = static_cast<size_t>(stats::runif(fp_t(0), fp_t(1), rand_engine) * n_levels) % n_levels;
+                triplets.push_back(Eigen::Triplet<fp_t>(i, j * n_levels + level_ind, fp_t(1)));
+            }
+        }
+
+        SpMat_t X_sp(n, K);
+        X_sp.setFromTriplets(triplets.begin(), triplets.end());
+        X_sp.makeCompressed();
+
+        const Mat_t X = Mat_t(X_sp);
+        const ColVec_t beta_true = ColVec_t::LinSpaced(K, fp_t(-1), fp_t(1));
+        const ColVec_t Y = X * beta_true + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+        Mat_t beta_draws_dense, beta_draws_sparse;
+
+        const double time_dense = run_sampler(Y, X, beta_draws_dense);
+        const double time_sparse = run_sampler(Y, X_sp, beta_draws_sparse);
+
+        const ColVec_t beta_mean_dense = beta_draws_dense.rowwise().mean();
+        const ColVec_t beta_mean_sparse = beta_draws_sparse.rowwise().mean();
+        const ColVec_t beta_sd = ( beta_draws_dense.colwise() - beta_mean_dense ).rowwise().norm() / std::sqrt(fp_t(beta_draws_dense.cols()));
+
+        const fp_t max_diff_val = ( (beta_mean_dense - beta_mean_sparse).array() / beta_sd.array() ).abs().maxCoeff();
+
+        std::cout << std::setw(6) << K << std::setw(12) << fp_t(X_sp.nonZeros()) / fp_t(n * K)
+                  << std::setw(14) << time_dense << std::setw(14) << time_sparse
+                  << std::setw(10) << std::setprecision(3) << time_dense / time_sparse
+                  << std::setw(16) << max_diff_val << std::setprecision(6) << std::endl;
+
+        if (!(max_diff_val < fp_t(0.5))) {
+            return 1;
+        }
+    }
+
+    // the sparse posterior precision path (here, one categorical, so X'X is diagonal) runs only the
+    // standard scheme, and rejects the others
+
+    {
+        const size_t K = 240;
+
+        std::vector<Eigen::Triplet<fp_t>> triplets;
+
+        for (size_t i = 0; i < n; ++i) {
+            triplets.push_back(Eigen::Triplet<fp_t>(i, i % K, fp_t(1)));
+        }
+
+        SpMat_t X_sp(n, K);
+        X_sp.setFromTriplets(triplets.begin(), triplets.end());
+        X_sp.makeCompressed();
+
+        const ColVec_t Y = stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+        SpMatCSC_t prior_prec_lower(K,K);
+        prior_prec_lower.setIdentity();
+
+        if (!use_sparse_precision(X_sp, prior_prec_lower)) {
+            return 1;
+        }
+
+        discard_sink_t draw_sink;
+        counter_rng_t rng(1111, 0);
+
+        try {
+            qr_gibbs(Y, X_sp, fp_t(0.5), ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+                     50, 100, 0, false, -1, draw_sink, rng, nullptr, nullptr, 0, SAMPLER_SCHEME_COLLAPSED);
+
+            std::cout << "the collapsed scheme was not rejected on the sparse posterior precision path" << std::endl;
+            return 1;
+        } catch (const std::invalid_argument&) {}
+    }
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Reproducibility: Philox known-answer tests, and bitwise-identical draws for any number of threads,
+ * for a dense design and for a sparse design on the sparse posterior precision path
+ */
+
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+bool
+check_philox(const uint32_t ctr_val, const uint32_t key_val, const uint32_t* expected)
+{
+    philox_block_t ctr = {{ ctr_val, ctr_val, ctr_val, ctr_val }};
+    const philox_block_t out = philox4x32_10(ctr, key_val, key_val);
+
+    for (int j = 0; j < 4; ++j) {
+        if (out.v[j] != expected[j]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main()
+{
+    // Random123 known-answer vectors for Philox4x32-10
+
+    const uint32_t kat_zero[4] = { 0x6627e8d5U, 0xe169c58dU, 0xbc57ac4cU, 0x9b00dbd8U };
+    const uint32_t kat_ones[4] = { 0x408f276dU, 0x41c83b0eU, 0xa20bc7c6U, 0x6d5451fdU };
+
+    if (!check_philox(0, 0, kat_zero) || !check_philox(0xffffffffU, 0xffffffffU, kat_ones)) {
+        std::cout << "philox: known-answer test failed" << std::endl;
+        return 1;
+    }
+
+    // the same seed on 1, 2, 3, and 8 threads
+
+    const size_t n = 5000;
+    const size_t K = 6;
+
+    rand_engine_t data_engine(1234);
+
+    const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), data_engine);
+    const ColVec_t Y = X * ColVec_t::Ones(K) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+    Mat_t beta_draws_ref, z_draws_ref;
+    ColVec_t sigma_draws_ref;
+
+    for (int n_threads : {1, 2, 3, 8}) {
+        Mat_t beta_draws, z_draws;
+        ColVec_t sigma_draws;
+
+        rand_engine_t rand_engine(42);
+
+        qr_gibbs(Y, X, fp_t(0.3), ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+                 50, 100, 1, false, n_threads, beta_draws, z_draws, sigma_draws, rand_engine);
+
+        if (n_threads == 1) {
+            beta_draws_ref = beta_draws;
+            z_draws_ref = z_draws;
+            sigma_draws_ref = sigma_draws;
+            continue;
+        }
+
+        const bool is_equal = (beta_draws.array() == beta_draws_ref.array()).all() && (z_draws.array() == z_draws_ref.array()).all()
+                                && (sigma_draws.array() == sigma_draws_ref.array()).all();
+
+        std::cout << "threads = " << n_threads << ": " << (is_equal ? "identical" : "DIFFERENT") << std::endl;
+
+        if (!is_equal) {
+            return 1;
+        }
+    }
+
+    // a sparse (CSR) design on the sparse posterior precision path: one categorical with 120 levels,
+    // so X'X is diagonal apart from the row of a continuous covariate
+
+    const size_t n_levels = 120;
+    const size_t K_sp = n_levels + 1;
+
+    std::vector<Eigen::Triplet<fp_t>> triplets;
+
+    const ColVec_t x_cont = stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+    for (size_t i = 0; i < n; ++i) {
+        triplets.push_back(Eigen::Triplet<fp_t>(i, i % n_levels, fp_t(1)));
+        triplets.push_back(Eigen::Triplet<fp_t>(i, n_levels, x_cont(i)));
+    }
+
+    SpMat_t X_sp(n, K_sp);
+    X_sp.setFromTriplets(triplets.begin(), triplets.end());
+    X_sp.makeCompressed();
+
+    const ColVec_t Y_sp = X_sp * ColVec_t::Ones(K_sp) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), data_engine);
+
+    SpMatCSC_t prior_prec_lower(K_sp, K_sp);
+    prior_prec_lower.setIdentity();
+
+    if (!use_sparse_precision(X_sp, prior_prec_lower)) {
+        std::cout << "the sparse design does not take the sparse posterior precision path" << std::endl;
+        return 1;
+    }
+
+    for (int n_threads : {1, 2, 3}) {
+        Mat_t beta_draws, z_draws;
+        ColVec_t sigma_draws;
+
+        memory_sink_t draw_sink(beta_draws, z_draws, sigma_draws);
+        counter_rng_t rng(42, 0);
+
+        qr_gibbs(Y_sp, X_sp, fp_t(0.3), ColVec_t::Zero(K_sp), ColVec_t::Zero(K_sp), Mat_t::Identity(K_sp,K_sp), fp_t(3), fp_t(3),
+                 30, 60, 0, false, n_threads, draw_sink, rng);
+
+        if (n_threads == 1) {
+            beta_draws_ref = beta_draws;
+            z_draws_ref = z_draws;
+            sigma_draws_ref = sigma_draws;
+            continue;
+        }
+
+        const bool is_equal = (beta_draws.array() == beta_draws_ref.array()).all() && (z_draws.array() == z_draws_ref.array()).all()
+                                && (sigma_draws.array() == sigma_draws_ref.array()).all();
+
+        std::cout << "sparse, threads = " << n_threads << ": " << (is_equal ? "identical" : "DIFFERENT") << std::endl;
+
+        if (!is_equal) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
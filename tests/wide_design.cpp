@@ -0,0 +1,183 @@
+/*################################################################################
+  ##
+  ##   Copyright (C) 2021-2023 Keith O'Hara
+  ##
+  ##   This file is part of the BayesianQuantileRegression library.
+  ##
+  ##   Licensed under the Apache License, Version 2.0 (the "License");
+  ##   you may not use this file except in compliance with the License.
+  ##   You may obtain a copy of the License at
+  ##
+  ##       http://www.apache.org/licenses/LICENSE-2.0
+  ##
+  ##   Unless required by applicable law or agreed to in writing, software
+  ##   distributed under the License is distributed on an "AS IS" BASIS,
+  ##   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  ##   See the License for the specific language governing permissions and
+  ##   limitations under the License.
+  ##
+  ################################################################################*/
+
+/*
+ * Wide data (n < K): the n-dimensional (Woodbury) draw of beta vs the K x K Cholesky draw
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "bqreg.hpp"
+
+using namespace bqreg;
+
+int main()
+{
+    rand_engine_t rand_engine(4444);
+
+    // 1. both routines draw from the same Gaussian: compare the moments with the exact ones
+
+    {
+        const size_t n = 40;
+        const size_t K = 100;
+        const size_t n_draws = 4000;
+
+        const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+        const ColVec_t y = stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+        const ColVec_t w_vec = stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine).array().abs() + fp_t(0.2);
+        const ColVec_t prior_mean = ColVec_t::LinSpaced(K, fp_t(-0.5), fp_t(0.5));
+
+        // AR(1) prior correlation, so that V is not diagonal
+
+        Mat_t prior_var(K, K);
+
+        for (size_t i = 0; i < K; ++i) {
+            for (size_t j = 0; j < K; ++j) {
+                prior_var(i,j) = fp_t(2) * std::pow(fp_t(0.5), std::abs(int(i) - int(j)));
+            }
+        }
+
+        const Mat_t prior_prec = inv_sympd(prior_var);
+
+        const Mat_t post_prec = X.transpose() * w_vec.asDiagonal() * X + prior_prec;
+        const ColVec_t post_vec = X.transpose() * w_vec.cwiseProduct(y) + prior_prec * prior_mean;
+
+        const Mat_t post_var = inv_sympd(post_prec);
+        const ColVec_t post_mean = post_var * post_vec;
+
+        woodbury_factors_t factors;
+        set_woodbury_factors(X, prior_mean, prior_var, factors);
+
+        const ColVec_t sqrt_w_vec = w_vec.cwiseSqrt();
+        const ColVec_t wy_vec = sqrt_w_vec.cwiseProduct(y);
+
+        Mat_t draws_chol(K, n_draws), draws_woodbury(K, n_draws);
+        ColVec_t draw_vec;
+
+        counter_rng_t rng(5555, 0);
+
+        for (size_t g = 0; g < n_draws; ++g) {
+            rng.iter_ind = static_cast<uint32_t>(g);
+
+            draw_mvnorm_prec(post_prec, post_vec, rng.rnorm_vec(RNG_STREAM_BETA, K), draw_vec);
+            draws_chol.col(g) = draw_vec;
+
+            draw_mvnorm_woodbury(factors.XL, factors.XV, factors.XVXt, factors.Xm, factors.prior_var_chol, prior_mean,
+                                 sqrt_w_vec, wy_vec, rng.rnorm_vec(RNG_STREAM_SIGMA, K + n), draw_vec);
+            draws_woodbury.col(g) = draw_vec;
+        }
+
+        const ColVec_t post_sd = post_var.diagonal().cwiseSqrt();
+
+        for (const Mat_t* draws : {&draws_chol, &draws_woodbury}) {
+            const ColVec_t mean_vec = draws->rowwise().mean();
+            const ColVec_t var_vec = (draws->colwise() - mean_vec).rowwise().squaredNorm() / fp_t(n_draws - 1);
+
+            const fp_t mean_z_val = ( (mean_vec - post_mean).array() / (post_sd.array() / std::sqrt(fp_t(n_draws))) ).abs().maxCoeff();
+            const fp_t var_ratio_val = ( var_vec.array() / post_var.diagonal().array() - 1 ).abs().maxCoeff();
+
+            std::cout << (draws == &draws_chol ? "cholesky: " : "woodbury: ") << "max |mean z| = " << mean_z_val
+                      << ", max |var ratio - 1| = " << var_ratio_val << std::endl;
+
+            if (!(mean_z_val < fp_t(5)) || !(var_ratio_val < fp_t(0.15))) {
+                return 1;
+            }
+        }
+    }
+
+    // 2. cost of one beta draw, including the formation of the K x K precision
+
+    const size_t n = 200;
+
+    std::cout << std::setw(6) << "n" << std::setw(8) << "K" << std::setw(16) << "cholesky (ms)" << std::setw(16) << "woodbury (ms)" << std::setw(10) << "speedup" << std::endl;
+
+    for (size_t K : {400, 1000, 2000}) {
+        const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+        const ColVec_t y = stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+        const ColVec_t w_vec = stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine).array().abs() + fp_t(0.2);
+
+        const ColVec_t prior_mean = ColVec_t::Zero(K);
+        const Mat_t prior_var = Mat_t::Identity(K,K);
+        const Mat_t prior_prec = Mat_t::Identity(K,K);
+
+        woodbury_factors_t factors;
+        set_woodbury_factors(X, prior_mean, prior_var, factors);
+
+        const ColVec_t sqrt_w_vec = w_vec.cwiseSqrt();
+        const ColVec_t wy_vec = sqrt_w_vec.cwiseProduct(y);
+
+        counter_rng_t rng(6666, 0);
+        ColVec_t draw_vec;
+
+        const int n_reps = 3;
+
+        auto start_time = std::chrono::steady_clock::now();
+
+        for (int rep = 0; rep < n_reps; ++rep) {
+            const Mat_t Xw = sqrt_w_vec.asDiagonal() * X;
+
+            Mat_t post_prec = prior_prec;
+            post_prec.selfadjointView<Eigen::Lower>().rankUpdate(Xw.transpose());
+            post_prec.triangularView<Eigen::StrictlyUpper>() = post_prec.transpose();
+
+            draw_mvnorm_prec(post_prec, ColVec_t(Xw.transpose() * wy_vec), rng.rnorm_vec(RNG_STREAM_BETA, K), draw_vec);
+        }
+
+        std::chrono::duration<double> elapsed_chol = std::chrono::steady_clock::now() - start_time;
+
+        start_time = std::chrono::steady_clock::now();
+
+        for (int rep = 0; rep < n_reps; ++rep) {
+            draw_mvnorm_woodbury(factors.XL, factors.XV, factors.XVXt, factors.Xm, factors.prior_var_chol, prior_mean,
+                                 sqrt_w_vec, wy_vec, rng.rnorm_vec(RNG_STREAM_BETA, K + n), draw_vec);
+        }
+
+        std::chrono::duration<double> elapsed_woodbury = std::chrono::steady_clock::now() - start_time;
+
+        const double time_chol = 1000 * elapsed_chol.count() / n_reps;
+        const double time_woodbury = 1000 * elapsed_woodbury.count() / n_reps;
+
+        std::cout << std::setw(6) << n << std::setw(8) << K << std::setw(16) << time_chol << std::setw(16) << time_woodbury
+                  << std::setw(10) << std::setprecision(3) << time_chol / time_woodbury << std::setprecision(6) << std::endl;
+    }
+
+    // 3. qr_gibbs picks the n-dimensional draw for n < K
+
+    {
+        const size_t K = 300;
+
+        const Mat_t X = stats::rnorm<Mat_t>(n, K, fp_t(0), fp_t(1), rand_engine);
+        const ColVec_t Y = X.leftCols(3) * ColVec_t::Ones(3) + stats::rnorm<ColVec_t>(n, 1, fp_t(0), fp_t(1), rand_engine);
+
+        Mat_t beta_draws, z_draws;
+        ColVec_t sigma_draws;
+
+        qr_gibbs(Y, X, fp_t(0.5), ColVec_t::Zero(K), ColVec_t::Zero(K), Mat_t::Identity(K,K), fp_t(3), fp_t(3),
+                 50, 100, 0, false, -1, beta_draws, z_draws, sigma_draws, rand_engine);
+
+        if (!beta_draws.allFinite() || !sigma_draws.allFinite()) {
+            return 1;
+        }
+    }
+
+    return 0;
+}